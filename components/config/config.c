@@ -14,6 +14,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
 #include "esp_system.h"
 #include "esp_log.h"
 #include "esp_console.h"
@@ -28,12 +29,20 @@
 #include "cJSON.h"
 #include "freertos/timers.h"
 #include "freertos/event_groups.h"
+#include "esp_timer.h"
 
 
 #define CONFIG_COMMIT_DELAY 1000
 #define LOCK_MAX_WAIT 20*CONFIG_COMMIT_DELAY
 static const char * TAG = "config";
 static cJSON * nvs_json=NULL;
+/* @brief revision of each key that changed since boot (deleted keys are kept), and cached serialization of nvs_json */
+static cJSON * nvs_revs=NULL;
+/* @brief keys waiting to be committed to nvs */
+static cJSON * nvs_dirty=NULL;
+static uint32_t config_epoch, config_revision;
+static char * json_cache=NULL;
+static uint32_t json_cache_revision;
 static TimerHandle_t timer;
 static SemaphoreHandle_t config_mutex = NULL;
 static EventGroupHandle_t config_group;
@@ -50,6 +59,8 @@ bool config_set_group_bit(int bit_num,bool flag);
 cJSON * config_set_value_safe(nvs_type_t nvs_type, const char *key, void * value);
 static void vCallbackFunction( TimerHandle_t xTimer );
 void config_set_entry_changed_flag(cJSON * entry, cJSON_bool flag);
+static void config_touch(const char *key);
+static void config_mark_dirty(cJSON * entry, const char *key);
 #define IMPLEMENT_SET_DEFAULT(t,nt) void config_set_default_## t (const char *key, t  value){\
 	void * pval = malloc(sizeof(value));\
 	*((t *) pval) = value;\
@@ -104,6 +115,15 @@ void config_init(){
 		cJSON_Delete(nvs_json);
 	}
 	nvs_json = cJSON_CreateObject();
+	if(nvs_revs !=NULL){
+		cJSON_Delete(nvs_revs);
+	}
+	nvs_revs = cJSON_CreateObject();
+	if(nvs_dirty !=NULL){
+		cJSON_Delete(nvs_dirty);
+	}
+	nvs_dirty = cJSON_CreateObject();
+	config_epoch = esp_random();
 
 	config_set_group_bit(CONFIG_LOAD_BIT,true);
 	nvs_load_config();
@@ -209,6 +229,8 @@ cJSON * config_set_value_safe(nvs_type_t nvs_type, const char *key, void * value
 			config_set_entry_changed_flag(entry,true);
 			ESP_LOGI(TAG, "Updating config [%s]", key);
 			cJSON_ReplaceItemInObject(nvs_json,key, entry);
+			config_touch(key);
+			config_mark_dirty(entry, key);
 			entry_str = cJSON_PrintUnformatted(entry);
 			if(entry_str!=NULL){
 				ESP_LOGD(TAG,"New config: %s", entry_str );
@@ -228,6 +250,8 @@ cJSON * config_set_value_safe(nvs_type_t nvs_type, const char *key, void * value
 		// This is a new entry.
 		config_set_entry_changed_flag(entry,true);
 		cJSON_AddItemToObject(nvs_json, key, entry);
+		config_touch(key);
+		config_mark_dirty(entry, key);
 	}
 
 	return entry;
@@ -388,65 +412,83 @@ void * config_safe_alloc_get_entry_value(nvs_type_t nvs_type, cJSON * entry){
 }
 
 void config_commit_to_nvs(){
+	nvs_handle nvs;
+	int count = 0;
+	int64_t start = esp_timer_get_time();
 	ESP_LOGI(TAG,"Committing configuration to nvs. Locking config object.");
-	ESP_LOGV(TAG,"config_commit_to_nvs. Locking config object.");
 	if(!config_lock(LOCK_MAX_WAIT/portTICK_PERIOD_MS)){
 		ESP_LOGE(TAG, "config_commit_to_nvs: Unable to lock config for commit ");
 		return ;
 	}
-	if(nvs_json==NULL){
+	if(nvs_json==NULL || nvs_dirty==NULL){
 		ESP_LOGE(TAG, ": cJSON nvs cache object not set.");
+		config_unlock();
+		return;
+	}
+	// all changed entries go in a single nvs session
+	esp_err_t err = nvs_open_from_partition(settings_partition, current_namespace, NVS_READWRITE, &nvs);
+	if(err != ESP_OK){
+		ESP_LOGE(TAG, "Error opening nvs: %s. Will retry commit later.", esp_err_to_name(err));
+		config_unlock();
 		return;
 	}
 	ESP_LOGV(TAG,"config_commit_to_nvs. Config Locked!");
-	cJSON * entry=nvs_json->child;
-	while(entry!= NULL){
-		char * entry_str = cJSON_PrintUnformatted(entry);
-		if(entry_str!=NULL){
-			ESP_LOGV(TAG,"config_commit_to_nvs processing item %s",entry_str);
-			free(entry_str);
+	// written entries are flagged false, they only leave nvs_dirty once nvs_commit succeeded
+	cJSON * dirty = nvs_dirty->child;
+	while(dirty != NULL){
+		cJSON * next = dirty->next;
+		cJSON * entry = cJSON_GetObjectItemCaseSensitive(nvs_json, dirty->string);
+		// entry might have been deleted since it was changed
+		if(entry==NULL || !config_is_entry_changed(entry)){
+			cJSON_Delete(cJSON_DetachItemViaPointer(nvs_dirty, dirty));
+			dirty = next;
+			continue;
 		}
-
-		if(config_is_entry_changed(entry)){
-			ESP_LOGD(TAG, "Committing entry %s value to nvs.",(entry->string==NULL)?"UNKNOWN":entry->string);
-			nvs_type_t type = config_get_entry_type(entry);
-			void * value = config_safe_alloc_get_entry_value(type, entry);
-			if(value!=NULL){
-				esp_err_t err = store_nvs_value(type,entry->string,value);
-				free(value);
-				if(err!=ESP_OK){
-					char * entry_str = cJSON_PrintUnformatted(entry);
-					if(entry_str!=NULL){
-						ESP_LOGE(TAG, "Error comitting value to nvs for key %s, Object: \n%s",entry->string,entry_str);
-						free(entry_str);
-					}
-					else {
-						ESP_LOGE(TAG, "Error comitting value to nvs for key %s",entry->string);
-					}
-				}
-				else {
-					config_set_entry_changed_flag(entry, false);
-				}
+		ESP_LOGD(TAG, "Committing entry %s value to nvs.",entry->string);
+		nvs_type_t type = config_get_entry_type(entry);
+		void * value = config_safe_alloc_get_entry_value(type, entry);
+		err = value!=NULL ? set_nvs_value_len(nvs, type, entry->string, value, 0) : ESP_FAIL;
+		free(value);
+		if(err!=ESP_OK){
+			char * entry_str = cJSON_PrintUnformatted(entry);
+			if(entry_str!=NULL){
+				ESP_LOGE(TAG, "Error comitting value to nvs for key %s (%s), will retry. Object: \n%s",entry->string,esp_err_to_name(err),entry_str);
+				free(entry_str);
 			}
 			else {
-				char * entry_str = cJSON_PrintUnformatted(entry);
-				if(entry_str!=NULL){
-					ESP_LOGE(TAG, "Unable to retrieve value. Error comitting value to nvs for key %s, Object: \n%s",entry->string,entry_str);
-					free(entry_str);
-				}
-				else {
-					ESP_LOGE(TAG, "Unable to retrieve value. Error comitting value to nvs for key %s",entry->string);
-				}
+				ESP_LOGE(TAG, "Error comitting value to nvs for key %s (%s), will retry.",entry->string,esp_err_to_name(err));
 			}
 		}
 		else {
-			ESP_LOGV(TAG,"config_commit_to_nvs. Item already committed.  Ignoring.");
+			dirty->type = cJSON_False;
+		}
+		dirty = next;
+	}
+	err = nvs_commit(nvs);
+	nvs_close(nvs);
+	if(err != ESP_OK){
+		ESP_LOGE(TAG, "Unable to commit nvs. %s. Will retry commit later.", esp_err_to_name(err));
+	}
+	dirty = nvs_dirty->child;
+	while(dirty != NULL){
+		cJSON * next = dirty->next;
+		if(cJSON_IsFalse(dirty)){
+			if(err == ESP_OK){
+				cJSON * entry = cJSON_GetObjectItemCaseSensitive(nvs_json, dirty->string);
+				config_set_entry_changed_flag(entry, false);
+				config_touch(dirty->string);
+				cJSON_Delete(cJSON_DetachItemViaPointer(nvs_dirty, dirty));
+				count++;
+			}
+			else {
+				dirty->type = cJSON_True;
+			}
 		}
-		taskYIELD();  /* allows the freeRTOS scheduler to take over if needed. */
-		entry = entry->next;
+		dirty = next;
 	}
-	ESP_LOGV(TAG,"config_commit_to_nvs. Resetting the global commit flag.");
-	config_raise_change(false);
+	ESP_LOGI(TAG,"Committed %d entries in %d ms, %d pending", count, (int) ((esp_timer_get_time() - start) / 1000), cJSON_GetArraySize(nvs_dirty));
+	ESP_LOGV(TAG,"config_commit_to_nvs. Updating the global commit flag.");
+	config_raise_change(nvs_dirty->child != NULL);
 	ESP_LOGV(TAG,"config_commit_to_nvs. Releasing the lock object.");
 	config_unlock();
 }
@@ -600,6 +642,7 @@ void config_delete_key(const char *key){
 	if(entry !=NULL){
 		ESP_LOGI(TAG, "Removing config key [%s]", entry->string);
 		cJSON_Delete(entry);
+		config_touch(key);
 		struc_str = cJSON_PrintUnformatted(nvs_json);
 		if(struc_str!=NULL){
 			ESP_LOGV(TAG, "Structure after delete \n%s", struc_str);
@@ -669,6 +712,75 @@ void * config_alloc_get_default(nvs_type_t nvs_type, const char *key, void * def
 	config_unlock();
 	return value;
 }
+/* @brief bump revision and remember which key it applies to (must be called with config locked) */
+static void config_touch(const char *key){
+	if(key==NULL || nvs_revs==NULL) return;
+	config_revision++;
+	cJSON * rev = cJSON_GetObjectItemCaseSensitive(nvs_revs, key);
+	if(rev!=NULL){
+		cJSON_SetNumberValue(rev, config_revision);
+	}
+	else {
+		cJSON_AddNumberToObject(nvs_revs, key, config_revision);
+	}
+}
+/* @brief queue a changed entry for next commit (must be called with config locked) */
+static void config_mark_dirty(cJSON * entry, const char *key){
+	if(nvs_dirty==NULL || !config_is_entry_changed(entry)) return;
+	if(cJSON_GetObjectItemCaseSensitive(nvs_dirty, key)==NULL){
+		cJSON_AddTrueToObject(nvs_dirty, key);
+	}
+}
+/* @brief serialized nvs_json, only re-printed when revision has moved (must be called with config locked) */
+static const char * config_get_json_cache(){
+	if(json_cache==NULL || json_cache_revision != config_revision){
+		free(json_cache);
+		json_cache = cJSON_PrintUnformatted(nvs_json);
+		json_cache_revision = config_revision;
+		ESP_LOGD(TAG, "Config json cache updated to revision %" PRIu32, config_revision);
+	}
+	return json_cache;
+}
+void config_get_etag(char * etag, size_t size){
+	if(!config_lock(LOCK_MAX_WAIT/portTICK_PERIOD_MS)){
+		ESP_LOGE(TAG, "Unable to lock config after %d ms",LOCK_MAX_WAIT);
+		*etag = '\0';
+		return;
+	}
+	snprintf(etag, size, "\"%08" PRIx32 "-%" PRIu32 "\"", config_epoch, config_revision);
+	config_unlock();
+}
+/* @brief keys changed after <since> when it is a usable base (<is_delta> is then set), otherwise full document */
+char * config_alloc_get_json_since(const char * since, char * etag, size_t size, bool * is_delta){
+	char * json_buffer = NULL;
+	uint32_t epoch, revision;
+	*is_delta = false;
+	if(!config_lock(LOCK_MAX_WAIT/portTICK_PERIOD_MS)){
+		ESP_LOGE(TAG, "Unable to lock config after %d ms",LOCK_MAX_WAIT);
+		return strdup("{\"error\":\"Unable to lock configuration object.\"}");
+	}
+	snprintf(etag, size, "\"%08" PRIx32 "-%" PRIu32 "\"", config_epoch, config_revision);
+	// a revision from another boot or from the future can't be used as a base
+	if(since!=NULL && *since=='"') since++;
+	if(since!=NULL && sscanf(since, "%" SCNx32 "-%" SCNu32, &epoch, &revision) == 2 && epoch == config_epoch && revision <= config_revision){
+		cJSON * delta = cJSON_CreateObject();
+		cJSON * rev = NULL;
+		cJSON_ArrayForEach(rev, nvs_revs){
+			if(rev->valuedouble <= revision) continue;
+			cJSON * entry = cJSON_GetObjectItemCaseSensitive(nvs_json, rev->string);
+			cJSON_AddItemToObject(delta, rev->string, entry ? cJSON_Duplicate(entry, true) : cJSON_CreateNull());
+		}
+		json_buffer = cJSON_PrintUnformatted(delta);
+		cJSON_Delete(delta);
+		*is_delta = true;
+	}
+	else {
+		const char * cache = config_get_json_cache();
+		json_buffer = cache ? strdup(cache) : NULL;
+	}
+	config_unlock();
+	return json_buffer;
+}
 char * config_alloc_get_json(bool bFormatted){
 	char * json_buffer = NULL;
 	if(!config_lock(LOCK_MAX_WAIT/portTICK_PERIOD_MS)){
@@ -679,7 +791,8 @@ char * config_alloc_get_json(bool bFormatted){
 		json_buffer= cJSON_Print(nvs_json);
 	}
 	else {
-		json_buffer= cJSON_PrintUnformatted(nvs_json);
+		const char * cache = config_get_json_cache();
+		json_buffer = cache ? strdup(cache) : NULL;
 	}
 	config_unlock();
 	return json_buffer;
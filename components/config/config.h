@@ -37,5 +37,7 @@ void * config_alloc_get(nvs_type_t nvs_type, const char *key) ;
 void * config_alloc_get_str(const char *key, char *lead, char *fallback);
 bool wait_for_commit();
 char * config_alloc_get_json(bool bFormatted);
+void config_get_etag(char * etag, size_t size);
+char * config_alloc_get_json_since(const char * since, char * etag, size_t size, bool * is_delta);
 esp_err_t config_set_value(nvs_type_t nvs_type, const char *key, void * value);
 
@@ -155,6 +155,20 @@ esp_err_t store_nvs_value_len(nvs_type_t type, const char *key, void * data,
 		return err;
 	}
 
+	err = set_nvs_value_len(nvs, type, key, data, data_len);
+	if (err == ESP_OK) {
+		err = nvs_commit(nvs);
+		if (err == ESP_OK) {
+			ESP_LOGI(TAG,   "Value stored under key '%s'", key);
+		}
+	}
+	nvs_close(nvs);
+	return err;
+}
+esp_err_t set_nvs_value_len(nvs_handle nvs, nvs_type_t type, const char *key, void * data,
+		size_t data_len) {
+	esp_err_t err = ESP_ERR_NVS_TYPE_MISMATCH;
+
 	if (type == NVS_TYPE_I8) {
 		err = nvs_set_i8(nvs, key, *(int8_t *) data);
 	} else if (type == NVS_TYPE_U8) {
@@ -176,13 +190,6 @@ esp_err_t store_nvs_value_len(nvs_type_t type, const char *key, void * data,
 	} else if (type == NVS_TYPE_BLOB) {
 		err = nvs_set_blob(nvs, key, (void *) data, data_len);
 	}
-	if (err == ESP_OK) {
-		err = nvs_commit(nvs);
-		if (err == ESP_OK) {
-			ESP_LOGI(TAG,   "Value stored under key '%s'", key);
-		}
-	}
-	nvs_close(nvs);
 	return err;
 }
 void * get_nvs_value_alloc(nvs_type_t type, const char *key) {
@@ -44,6 +44,49 @@ __attribute__( ( always_inline ) ) static inline void SwapInt( int* a, int* b )
     *a = Temp;
 }
 
+/****************************************************************************************
+ * Transpose a 8x8 bits matrix, MSB first (Hacker's Delight). Input bytes are Stride apart
+ */
+static inline void Transpose8x8( uint8_t *In, int Stride, uint8_t *Out ) {
+	uint32_t x, y, t;
+
+	x = ((uint32_t) In[0] << 24) | ((uint32_t) In[Stride] << 16) | ((uint32_t) In[2*Stride] << 8) | In[3*Stride];
+	In += 4*Stride;
+	y = ((uint32_t) In[0] << 24) | ((uint32_t) In[Stride] << 16) | ((uint32_t) In[2*Stride] << 8) | In[3*Stride];
+
+	t = (x ^ (x >> 7)) & 0x00AA00AA; x = x ^ t ^ (t << 7);
+	t = (y ^ (y >> 7)) & 0x00AA00AA; y = y ^ t ^ (t << 7);
+	t = (x ^ (x >> 14)) & 0x0000CCCC; x = x ^ t ^ (t << 14);
+	t = (y ^ (y >> 14)) & 0x0000CCCC; y = y ^ t ^ (t << 14);
+	t = (x & 0xF0F0F0F0) | ((y >> 4) & 0x0F0F0F0F);
+	y = ((x << 4) & 0xF0F0F0F0) | (y & 0x0F0F0F0F);
+	x = t;
+
+	Out[0] = x >> 24; Out[1] = x >> 16; Out[2] = x >> 8; Out[3] = x;
+	Out[4] = y >> 24; Out[5] = y >> 16; Out[6] = y >> 8; Out[7] = y;
+}
+
+/****************************************************************************************
+ * Write rows of 8 pixels from transposed blocks. Framebuffer is written by 32 bits words
+ * using a table that expands bitmap into pixels (a byte for 4 bits depth, a nibble for 
+ * others) so WRITE is per-depth. Bitmap's MSB is leftmost pixel
+ */
+#define CBR_BLIT(WRITE) {													\
+	uint32_t *Framebuffer = (uint32_t*) Device->Framebuffer;				\
+	int LineLen = Device->Width * Device->Depth / 32;						\
+	for (int c = 0; c < Columns; c += 8) {									\
+		uint32_t *optr = Framebuffer + c * Device->Depth / 32;				\
+		for (int r = 0; r < Lines; r++) {									\
+			uint8_t Rows[8];												\
+			Transpose8x8(Data + c * Lines + r, Lines, Rows);				\
+			for (int k = 0; k < 8; k++, optr += LineLen) {					\
+				uint8_t Bits = Rows[k];										\
+				WRITE;														\
+			}																\
+		}																	\
+	}																		\
+}
+
 void IRAM_ATTR GDS_DrawPixelFast( struct GDS_Device* Device, int X, int Y, int Color ) {
 	DrawPixelFast( Device, X, Y, Color );
 }
@@ -213,107 +256,60 @@ void GDS_DrawBitmapCBR(struct GDS_Device* Device, uint8_t *Data, int Width, int
 				iptr += Height;
 			}	
 		}
-	} else if (Device->Depth == 4)	{
-		uint8_t *optr = Device->Framebuffer;
-		int LineLen = Device->Width >> 1;
-		
-		Height >>= 3;
-		Color &= 0x0f;
+	} else if ((Device->Depth == 4 || Device->Depth == 8 || Device->Depth == 16 || Device->Depth == 24) &&
+			   !((uintptr_t) Device->Framebuffer & 0x03) && !(Device->Width * Device->Depth & 0x1f)) {
+		int Lines = Height >> 3, Columns = Width & ~0x07, Pixel = Color;
+		// a nibble is 4 pixels so it is Depth / 8 words
+		int Bytes = Device->Depth / 8, Words = Device->Depth / 8;
+		// expansion table is 1kB, too much for callers' stacks, and only rebuilt when needed
+		static uint32_t Expand[256];
+		static struct { int Depth, Mode, Color; } Built = { 0 };
+		uint8_t Serial[3];
 		
-		for (int i = Width * Height, r = 0, c = 0; --i >= 0;) {
-			uint8_t Byte = BitReverseTable256[*Data++];
-			// we need to linearize code to let compiler better optimize
-			if (c & 0x01) {
-				*optr = (*optr & 0x0f) | (((Byte & 0x01)*Color)<<4); optr += LineLen; Byte >>= 1;
-				*optr = (*optr & 0x0f) | (((Byte & 0x01)*Color)<<4); optr += LineLen; Byte >>= 1;
-				*optr = (*optr & 0x0f) | (((Byte & 0x01)*Color)<<4); optr += LineLen; Byte >>= 1;
-				*optr = (*optr & 0x0f) | (((Byte & 0x01)*Color)<<4); optr += LineLen; Byte >>= 1;
-				*optr = (*optr & 0x0f) | (((Byte & 0x01)*Color)<<4); optr += LineLen; Byte >>= 1;
-				*optr = (*optr & 0x0f) | (((Byte & 0x01)*Color)<<4); optr += LineLen; Byte >>= 1;
-				*optr = (*optr & 0x0f) | (((Byte & 0x01)*Color)<<4); optr += LineLen; Byte >>= 1;
-				*optr = (*optr & 0x0f) | (((Byte & 0x01)*Color)<<4); optr += LineLen; 
-			} else {
-				*optr = (*optr & 0xf0) | (((Byte & 0x01)*Color)); optr += LineLen; Byte >>= 1;
-				*optr = (*optr & 0xf0) | (((Byte & 0x01)*Color)); optr += LineLen; Byte >>= 1;
-				*optr = (*optr & 0xf0) | (((Byte & 0x01)*Color)); optr += LineLen; Byte >>= 1;
-				*optr = (*optr & 0xf0) | (((Byte & 0x01)*Color)); optr += LineLen; Byte >>= 1;
-				*optr = (*optr & 0xf0) | (((Byte & 0x01)*Color)); optr += LineLen; Byte >>= 1;
-				*optr = (*optr & 0xf0) | (((Byte & 0x01)*Color)); optr += LineLen; Byte >>= 1;
-				*optr = (*optr & 0xf0) | (((Byte & 0x01)*Color)); optr += LineLen; Byte >>= 1;
-				*optr = (*optr & 0xf0) | (((Byte & 0x01)*Color)); optr += LineLen;
+		// build expansion tables with pixels as they are serialized in framebuffer
+		if (Built.Depth == Device->Depth && Built.Mode == Device->Mode && Built.Color == Color) {
+			// already done for that color
+		} else if (Device->Depth == 4) {
+			Built.Depth = Device->Depth; Built.Mode = Device->Mode; Built.Color = Color;
+			Color &= 0x0f;
+			for (int i = 0; i < 256; i++) {
+				uint8_t *p = (uint8_t*) (Expand + i);
+				// even pixel is low nibble, odd is high
+				for (int j = 0; j < 4; j++) p[j] = ((i >> (7 - 2*j)) & 0x01) * Color | ((((i >> (6 - 2*j)) & 0x01) * Color) << 4);
+			}
+		} else {
+			Built.Depth = Device->Depth; Built.Mode = Device->Mode; Built.Color = Color;
+			if (Device->Mode == GDS_RGB666) Color = ((Color << 4) & 0xff0000) | ((Color << 2) & 0xff00) | (Color & 0x00ff);
+			for (int i = 0; i < Bytes; i++) Serial[i] = Color >> ((Bytes - 1 - i) * 8);
+			for (int i = 0; i < 16; i++) {
+				uint8_t *p = (uint8_t*) (Expand + i * Words);
+				for (int j = 0; j < 4; j++, p += Bytes) {
+					if ((i >> (3 - j)) & 0x01) memcpy(p, Serial, Bytes);
+					else memset(p, 0, Bytes);
+				}	
 			}	
-			// end of a column, move to next one
-			if (++r == Height) { c++; r = 0; optr = Device->Framebuffer + (c >> 1); }		
 		}
-	} else if (Device->Depth == 8) {
-		uint8_t *optr = Device->Framebuffer;
-		int LineLen = Device->Width;
-	
-		Height >>= 3;
-			
-		for (int i = Width * Height, r = 0, c = 0; --i >= 0;) {
-			uint8_t Byte = BitReverseTable256[*Data++];
 		
-			// we need to linearize code to let compiler better optimize
-			*optr = ((Byte & 0x01) * Color); optr += LineLen; Byte >>= 1;
-			*optr = ((Byte & 0x01) * Color); optr += LineLen; Byte >>= 1;
-			*optr = ((Byte & 0x01) * Color); optr += LineLen; Byte >>= 1;
-			*optr = ((Byte & 0x01) * Color); optr += LineLen; Byte >>= 1;
-			*optr = ((Byte & 0x01) * Color); optr += LineLen; Byte >>= 1;
-			*optr = ((Byte & 0x01) * Color); optr += LineLen; Byte >>= 1;
-			*optr = ((Byte & 0x01) * Color); optr += LineLen; Byte >>= 1;
-			*optr = ((Byte & 0x01) * Color); optr += LineLen; 
-
-			// end of a column, move to next one
-			if (++r == Height) { c++; r = 0; optr = Device->Framebuffer + c; }		
+		// transpose 8x8 blocks so that framebuffer is written row by row and without read-modify-write
+		if (Device->Depth == 4) {
+			CBR_BLIT(optr[0] = Expand[Bits]);
+		} else if (Device->Depth == 8) {
+			CBR_BLIT(optr[0] = Expand[Bits >> 4]; optr[1] = Expand[Bits & 0x0f]);
+		} else if (Device->Depth == 16) {
+			CBR_BLIT(uint32_t *e = Expand + (Bits >> 4) * 2; optr[0] = e[0]; optr[1] = e[1];
+					 e = Expand + (Bits & 0x0f) * 2; optr[2] = e[0]; optr[3] = e[1]);
+		} else {
+			CBR_BLIT(uint32_t *e = Expand + (Bits >> 4) * 3; optr[0] = e[0]; optr[1] = e[1]; optr[2] = e[2];
+					 e = Expand + (Bits & 0x0f) * 3; optr[3] = e[0]; optr[4] = e[1]; optr[5] = e[2]);
 		}	
-	} else if (Device->Depth == 16) {
-		uint16_t *optr = (uint16_t*) Device->Framebuffer;
-		int LineLen = Device->Width;
-	
-		Height >>= 3;
-		Color = __builtin_bswap16(Color);
-	
-		for (int i = Width * Height, r = 0, c = 0; --i >= 0;) {
-			uint8_t Byte = BitReverseTable256[*Data++];
-		
-			// we need to linearize code to let compiler better optimize
-			*optr = ((Byte & 0x01) * Color); optr += LineLen; Byte >>= 1;
-			*optr = ((Byte & 0x01) * Color); optr += LineLen; Byte >>= 1;
-			*optr = ((Byte & 0x01) * Color); optr += LineLen; Byte >>= 1;
-			*optr = ((Byte & 0x01) * Color); optr += LineLen; Byte >>= 1;
-			*optr = ((Byte & 0x01) * Color); optr += LineLen; Byte >>= 1;
-			*optr = ((Byte & 0x01) * Color); optr += LineLen; Byte >>= 1;
-			*optr = ((Byte & 0x01) * Color); optr += LineLen; Byte >>= 1;
-			*optr = ((Byte & 0x01) * Color); optr += LineLen; 
-
-			// end of a column, move to next one
-			if (++r == Height) { c++; r = 0; optr = (uint16_t*) Device->Framebuffer + c; }		
-		}
-	} else if (Device->Depth == 24) {
-		uint8_t *optr = Device->Framebuffer;
-		int LineLen = Device->Width * 3;
 		
-		Height >>= 3;
-		if (Device->Mode == GDS_RGB666) Color = ((Color << 4) & 0xff0000) | ((Color << 2) & 0xff00) | (Color & 0x00ff);
-			
-		for (int i = Width * Height, r = 0, c = 0; --i >= 0;) {
-			uint8_t Byte = BitReverseTable256[*Data++];
-		
-			// we need to linearize code to let compiler better optimize		
-			#define SET24(O,D) O[0]=(D)>>16; O[1]=(D)>>8; O[2]=(D);
-			SET24(optr,(Byte & 0x01) * Color); optr += LineLen; Byte >>= 1;
-			SET24(optr,(Byte & 0x01) * Color); optr += LineLen; Byte >>= 1;
-			SET24(optr,(Byte & 0x01) * Color); optr += LineLen; Byte >>= 1;
-			SET24(optr,(Byte & 0x01) * Color); optr += LineLen; Byte >>= 1;
-			SET24(optr,(Byte & 0x01) * Color); optr += LineLen; Byte >>= 1;
-			SET24(optr,(Byte & 0x01) * Color); optr += LineLen; Byte >>= 1;
-			SET24(optr,(Byte & 0x01) * Color); optr += LineLen; Byte >>= 1;
-			SET24(optr,(Byte & 0x01) * Color); optr += LineLen;
-
-			// end of a column, move to next one
-			if (++r == Height) { c++; r = 0; optr = Device->Framebuffer + c * 3; }		
-		}
+		// leftover columns when width is not a multiple of 8
+		for (int c = Columns; c < Width; c++) {
+			for (int r = 0; r < Lines; r++) {
+				uint8_t Byte = Data[c * Lines + r];
+				for (int k = 0; k < 8; k++, Byte <<= 1) DrawPixelFast( Device, c, (r << 3) + k, ((Byte >> 7) & 0x01) * Pixel );
+			}
+		}	
 	} else {
 		Height >>= 3;
 		
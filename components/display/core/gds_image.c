@@ -19,10 +19,15 @@ const char TAG[] = "ImageDec";
 
 #define SCRATCH_SIZE	3100
 
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+#define max(a,b) (((a) > (b)) ? (a) : (b))
+
 //Data that is passed from the decoder function to the infunc/outfunc functions.
 typedef struct {
     const unsigned char *InData;	// Pointer to jpeg data
     int InPos;						// Current position in jpeg data
+	GDS_JPEGReader Reader;			// or caller-supplied reader (when data arrives progressively)
+	void *ReaderArg;
 	int Width, Height;	
 	uint8_t Mode;
 	union {
@@ -31,6 +36,7 @@ typedef struct {
 			struct GDS_Device *Device;
 			int XOfs, YOfs;
 			int XMin, YMin;
+			int XMax, YMax;
 			int Depth;
 		};	
 	};	
@@ -72,6 +78,7 @@ static inline int ScalerGray(uint8_t *Pixels) {
 
 static unsigned InHandler(JDEC *Decoder, uint8_t *Buf, unsigned Len) {
     JpegCtx *Context = (JpegCtx*) Decoder->device;
+	if (Context->Reader) return Context->Reader(Context->ReaderArg, Buf, Len);
     if (Buf) memcpy(Buf, Context->InData +  Context->InPos, Len);
     Context->InPos += Len;
     return Len;
@@ -126,15 +133,13 @@ static unsigned OutHandler(JDEC *Decoder, void *Bitmap, JRECT *Frame) {
     return 1;
 }
 
-// Convert the RGB888 to destination color plane, use DrawPixel and not "fast" 
-// version as X,Y may be beyond screen				
+// Convert the RGB888 to destination color plane. MCU block is clipped once against
+// the requested window and the screen so that we can use "fast" version per pixel
 #define OUTHANDLERDIRECT(F,S)																		\
-	for (int y = Frame->top; y <= Frame->bottom; y++) {												\
-		if (y < Context->YMin) continue;															\
-		for (int x = Frame->left; x <= Frame->right; x++) {											\
-			if (x < Context->XMin) continue;														\
-			DrawPixel( Context->Device, x + Context->XOfs, y + Context->YOfs, F(Pixels) >> S);	\
-			Pixels += 3;																			\
+	for (int y = Top; y <= Bottom; y++, Pixels += Stride) {											\
+		uint8_t *p = Pixels;																		\
+		for (int x = Left; x <= Right; x++, p += 3) {												\
+			DrawPixelFast( Context->Device, x + Context->XOfs, y + Context->YOfs, F(p) >> S);		\
 		}																							\
 	}
 	
@@ -142,6 +147,13 @@ static unsigned OutHandlerDirect(JDEC *Decoder, void *Bitmap, JRECT *Frame) {
 	JpegCtx *Context = (JpegCtx*) Decoder->device;
     uint8_t *Pixels = (uint8_t*) Bitmap;
 	int Shift = 8 - Context->Depth;
+	int Left = max(Frame->left, Context->XMin), Right = min(Frame->right, Context->XMax);
+	int Top = max(Frame->top, Context->YMin), Bottom = min(Frame->bottom, Context->YMax);
+	int Stride = (Frame->right - Frame->left + 1) * 3;
+	
+	// nothing visible in that block
+	if (Left > Right || Top > Bottom) return 1;
+	Pixels += (Top - Frame->top) * Stride + (Left - Frame->left) * 3;
 	
 	// decoded image is RGB888, shift only make sense for grayscale
 	if (Context->Mode == GDS_RGB888) {
@@ -177,6 +189,7 @@ static void* DecodeJPEG(uint8_t *Source, int *Width, int *Height, float Scale, b
 	Context.OutData = NULL;
     Context.InData = Source;
     Context.InPos = 0;
+	Context.Reader = NULL;
 	        
     //Prepare and decode the jpeg.
     int Res = jd_prepare(&Decoder, InHandler, Scratch, SCRATCH_SIZE, (void*) &Context);
@@ -368,7 +381,7 @@ void GDS_DrawRGB( struct GDS_Device* Device, uint8_t *Image, int x, int y, int W
 /****************************************************************************************
  *  Decode the embedded image into pixel lines that can be used with the rest of the logic.
  */
-bool GDS_DrawJPEG(struct GDS_Device* Device, uint8_t *Source, int x, int y, int Fit) {
+static bool DrawJPEG(struct GDS_Device* Device, uint8_t *Source, GDS_JPEGReader Reader, void *ReaderArg, int x, int y, int Fit) {
     JDEC Decoder;
     JpegCtx Context;
 	bool Ret = false;
@@ -376,12 +389,14 @@ bool GDS_DrawJPEG(struct GDS_Device* Device, uint8_t *Source, int x, int y, int
 	
     if (!Scratch) {
         ESP_LOGE(TAG, "Cannot allocate workspace");
-        return NULL;
+        return false;
     }
 
     // Populate fields of the JpegCtx struct.
     Context.InData = Source;
     Context.InPos = 0;
+	Context.Reader = Reader;
+	Context.ReaderArg = ReaderArg;
 	Context.XOfs = x;
 	Context.YOfs = y;
 	Context.Device = Device;
@@ -415,8 +430,10 @@ bool GDS_DrawJPEG(struct GDS_Device* Device, uint8_t *Source, int x, int y, int
 		if (Fit & GDS_IMAGE_CENTER_Y) Context.YOfs = (Device->Height + y - Context.Height) / 2;
 		else if (Fit & GDS_IMAGE_BOTTOM) Context.YOfs = Device->Height - Context.Height;
 
-		Context.XMin = x - Context.XOfs;
-		Context.YMin = y - Context.YOfs;
+		Context.XMin = max(x, 0) - Context.XOfs;
+		Context.YMin = max(y, 0) - Context.YOfs;
+		Context.XMax = Device->Width - 1 - Context.XOfs;
+		Context.YMax = Device->Height - 1 - Context.YOfs;
 		Context.Mode = Device->Mode;
 					
 		// do decompress & draw
@@ -436,3 +453,18 @@ bool GDS_DrawJPEG(struct GDS_Device* Device, uint8_t *Source, int x, int y, int
 	return Ret;
 }
 
+
+/****************************************************************************************
+ *  Decode a JPEG already fully in memory
+ */
+bool GDS_DrawJPEG(struct GDS_Device* Device, uint8_t *Source, int x, int y, int Fit) {
+	return DrawJPEG(Device, Source, NULL, NULL, x, y, Fit);
+}
+
+/****************************************************************************************
+ *  Decode a JPEG as its data arrives, Reader is called from within the decoder and can 
+ *  block until data is available (so not from the thread that receives it)
+ */
+bool GDS_DrawJPEGReader(struct GDS_Device* Device, GDS_JPEGReader Reader, void *Arg, int x, int y, int Fit) {
+	return DrawJPEG(Device, NULL, Reader, Arg, x, y, Fit);
+}
@@ -25,8 +25,12 @@ struct GDS_Device;
 #define GDS_IMAGE_CENTER	(GDS_IMAGE_CENTER_X | GDS_IMAGE_CENTER_Y)
 #define GDS_IMAGE_FIT		0x10	// re-scale by a factor of 2^N (up to 3)
 
+// JPEG data reader: copy (or skip if Buf is NULL) up to Len bytes, returns 0 to abort
+typedef unsigned (*GDS_JPEGReader)(void *Arg, uint8_t *Buf, unsigned Len);
+
 // Width and Height can be NULL if you already know them (actual scaling is closest ^2)
 void*	 	GDS_DecodeJPEG(uint8_t *Source, int *Width, int *Height, float Scale, int RGB_Mode);	// can be 8, 16 or 24 bits per pixel in return
 void	 	GDS_GetJPEGSize(uint8_t *Source, int *Width, int *Height);
 bool 		GDS_DrawJPEG( struct GDS_Device* Device, uint8_t *Source, int x, int y, int Fit);	
+bool 		GDS_DrawJPEGReader( struct GDS_Device* Device, GDS_JPEGReader Reader, void *Arg, int x, int y, int Fit);	
 void 		GDS_DrawRGB( struct GDS_Device* Device, uint8_t *Image, int x, int y, int Width, int Height, int RGB_Mode );
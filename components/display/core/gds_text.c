@@ -6,10 +6,13 @@
  * 
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdint.h>
 #include <arpa/inet.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "esp_log.h"
 
 #include "gds_private.h"
@@ -18,9 +21,30 @@
 #include "gds_text.h"
 
 #define max(a,b) (((a) > (b)) ? (a) : (b))
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+
+#define TEXT_CACHE_SIZE	4
 
 static char TAG[] = "gds";
 
+/*
+ Lines are mostly redrawn with the same text (scrolling, header, elapsed time refresh) so
+ each (font, monospace, text) is rendered once into a column bitmap using font's layout
+ (one column is Stride bytes, LSB on top). A redraw is then just a blit of that bitmap,
+ done directly in framebuffer for 1-bit displays. Entries are recycled LRU.
+*/
+static struct {
+	const struct GDS_FontDef *Font;
+	bool Monospace;
+	char *Text;
+	int Width, Stride;
+	uint8_t *Bitmap;
+	uint32_t Used;
+} TextCache[TEXT_CACHE_SIZE];
+
+static uint32_t TextCacheTick;
+static SemaphoreHandle_t TextCacheMutex;
+
 /****************************************************************************************
  *  Set fonts for each line in text mode
  */
@@ -66,6 +90,9 @@ bool GDS_TextSetFontAuto(struct GDS_Device* Device, int N, int FontType, int Spa
  */
 bool GDS_TextSetFont(struct GDS_Device* Device, int N, const struct GDS_FontDef *Font, int Space) {
 	if (--N >= MAX_LINES) return false;
+	
+	// lines are set before any text is drawn, from whichever task
+	if (!TextCacheMutex) TextCacheMutex = xSemaphoreCreateMutex();
 
 	Device->Lines[N].Font = Font;
 	
@@ -84,11 +111,109 @@ bool GDS_TextSetFont(struct GDS_Device* Device, int N, const struct GDS_FontDef
 	return true;
 }
 
+/****************************************************************************************
+ * Find or render text using Device's current font settings, must be called with cache locked
+ */
+static int TextCacheGet( struct GDS_Device* Device, const char *Text ) {
+	const struct GDS_FontDef *Font = Device->Font;
+	int i, Entry = 0, Width = 0, Stride = (Font->Height + 7) / 8;
+	
+	for (i = 0; i < TEXT_CACHE_SIZE; i++) {
+		if (TextCache[i].Font == Font && TextCache[i].Monospace == Device->FontForceMonospace && 
+			TextCache[i].Text && !strcmp(TextCache[i].Text, Text)) {
+			TextCache[i].Used = ++TextCacheTick;
+			return i;
+		}
+		if (TextCache[i].Used < TextCache[Entry].Used) Entry = i;
+	}	
+	
+	// glyph widths are measured once, then columns are copied from font
+	for (const char *p = Text; *p; p++) Width += GDS_FontGetCharWidth( Device, *p );
+	
+	uint8_t *Bitmap = malloc(Width * Stride + 1);
+	char *Copy = strdup(Text);
+	
+	if (!Bitmap || !Copy) {
+		free(Bitmap);
+		free(Copy);
+		return -1;
+	}	
+	
+	for (uint8_t *Column = Bitmap; *Text; Text++) {
+		int CharWidth = GDS_FontGetCharWidth( Device, *Text );
+		if (!CharWidth) continue;
+		memcpy(Column, Font->FontData + (*Text - Font->StartChar) * (Font->Width * Stride + 1) + 1, CharWidth * Stride);
+		Column += CharWidth * Stride;
+	}	
+	
+	free(TextCache[Entry].Text);
+	free(TextCache[Entry].Bitmap);
+	TextCache[Entry].Font = Font;
+	TextCache[Entry].Monospace = Device->FontForceMonospace;
+	TextCache[Entry].Text = Copy;
+	TextCache[Entry].Width = Width;
+	TextCache[Entry].Stride = Stride;
+	TextCache[Entry].Bitmap = Bitmap;
+	TextCache[Entry].Used = ++TextCacheTick;
+	
+	return Entry;
+}
+
+/****************************************************************************************
+ * Blit a cached text at X,Y, clearing line from ClearX if ClearX >= 0
+ */
+static void TextCacheBlit( struct GDS_Device* Device, int Entry, int X, int Y, int ClearX ) {
+	int Width = TextCache[Entry].Width, Stride = TextCache[Entry].Stride, Height = TextCache[Entry].Font->Height;
+	uint8_t *Bitmap = TextCache[Entry].Bitmap;
+	int Start = max(0, ClearX >= 0 ? ClearX : X), End = ClearX >= 0 ? Device->Width : min(Device->Width, X + Width);
+	
+	if (Device->Depth == 1 && !Device->DrawPixelFast && Stride <= 4) {
+		// framebuffer pages are 8 rows with LSB on top, like font columns
+		int Page = max(0, Y) >> 3, Pages = min(Device->Height, Y + Height) > max(0, Y) ? ((min(Device->Height, Y + Height) - 1) >> 3) - Page + 1 : 0;
+		uint64_t Mask = (1ULL << Height) - 1;
+		
+		Mask = Y >= 0 ? Mask << (Y & 0x07) : Mask >> -Y;
+		
+		for (int c = Start; c < End; c++) {
+			uint64_t Bits = 0;
+			uint8_t *optr = Device->Framebuffer + Page * Device->Width + c;
+			
+			if (c >= X && c < X + Width) {
+				uint8_t *Column = Bitmap + (c - X) * Stride;
+				for (int i = Stride; --i >= 0;) Bits = (Bits << 8) | Column[i];
+				Bits = (Y >= 0 ? Bits << (Y & 0x07) : Bits >> -Y) & Mask;
+			}	
+			
+			for (int p = 0; p < Pages; p++, optr += Device->Width) {
+				uint8_t Data = Bits >> (p * 8);
+				*optr = ClearX >= 0 ? (*optr & ~(Mask >> (p * 8))) | Data : *optr | Data;
+			}	
+		}
+	} else {
+		int Y_min = max(0, Y), Y_max = min(Device->Height, Y + Height);
+		
+		// 1-bit window clear is not safe on non-aligned rows
+		if (ClearX >= 0 && Y_max > Y_min && Start < End) {
+			if (Device->Depth != 1) GDS_ClearWindow( Device, Start, Y_min, End - 1, Y_max - 1, GDS_COLOR_BLACK );
+			else for (int c = Start; c < End; c++) 
+				for (int y = Y_min; y < Y_max; y++)
+					DrawPixelFast( Device, c, y, GDS_COLOR_BLACK );
+		}	
+		
+		for (int c = max(0, X); c < min(Device->Width, X + Width); c++) {
+			uint8_t *Column = Bitmap + (c - X) * Stride;
+			for (int i = 0; i < Height; i++) {
+				if (Column[i >> 3] & BIT(i & 0x07)) DrawPixel( Device, c, Y + i, GDS_COLOR_WHITE );
+			}	
+		}	
+	}	
+}
+
 /****************************************************************************************
  * 
  */
 bool GDS_TextLine(struct GDS_Device* Device, int N, int Pos, int Attr, char *Text) {
-	int Width, X = Pos;
+	int Width, X = Pos, Entry = -1;
 
 	// counting 1..n
 	N--;
@@ -96,23 +221,32 @@ bool GDS_TextLine(struct GDS_Device* Device, int N, int Pos, int Attr, char *Tex
 	GDS_SetFont( Device, Device->Lines[N].Font );	
 	if (Attr & GDS_TEXT_MONOSPACE) GDS_FontForceMonospace( Device, true );
 	
-	Width = GDS_FontMeasureString( Device, Text );
+	if (TextCacheMutex) xSemaphoreTake(TextCacheMutex, portMAX_DELAY);
+	
+	if (TextCacheMutex && Text) Entry = TextCacheGet( Device, Text );
+	Width = Entry >= 0 ? TextCache[Entry].Width : GDS_FontMeasureString( Device, Text );
 	
 	// adjusting position, erase only EoL for rigth-justified
 	if (Pos == GDS_TEXT_RIGHT) X = Device->Width - Width - 1;
 	else if (Pos == GDS_TEXT_CENTER) X = (Device->Width - Width) / 2;
 	
-	// erase if requested
-	if (Attr & GDS_TEXT_CLEAR) {
-		int Y_min = max(0, Device->Lines[N].Y), Y_max = max(0, Device->Lines[N].Y + Device->Lines[N].Font->Height);
-		for (int c = (Attr & GDS_TEXT_CLEAR_EOL) ? X : 0; c < Device->Width; c++) 
-			for (int y = Y_min; y < Y_max; y++)
-				DrawPixelFast( Device, c, y, GDS_COLOR_BLACK );
-	}
+	if (Entry >= 0) {
+		TextCacheBlit( Device, Entry, X, Device->Lines[N].Y, (Attr & GDS_TEXT_CLEAR) ? ((Attr & GDS_TEXT_CLEAR_EOL) ? X : 0) : -1 );
+	} else {
+		// erase if requested
+		if (Attr & GDS_TEXT_CLEAR) {
+			int Y_min = max(0, Device->Lines[N].Y), Y_max = max(0, Device->Lines[N].Y + Device->Lines[N].Font->Height);
+			for (int c = (Attr & GDS_TEXT_CLEAR_EOL) ? X : 0; c < Device->Width; c++) 
+				for (int y = Y_min; y < Y_max; y++)
+					DrawPixelFast( Device, c, y, GDS_COLOR_BLACK );
+		}
 		
-	GDS_FontDrawString( Device, X, Device->Lines[N].Y, Text, GDS_COLOR_WHITE );
+		GDS_FontDrawString( Device, X, Device->Lines[N].Y, Text, GDS_COLOR_WHITE );
+	}	
+	
+	if (TextCacheMutex) xSemaphoreGive(TextCacheMutex);
 	
-	ESP_LOGD(TAG, "displaying %s line %u (x:%d, attr:%u)", Text, N+1, X, Attr);
+	ESP_LOGD(TAG, "displaying %s line %u (x:%d, attr:%u, cached:%d)", Text, N+1, X, Attr, Entry >= 0);
 	
 	// update whole display if requested
 	Device->Dirty = true;
@@ -142,9 +276,10 @@ int GDS_TextStretch(struct GDS_Device* Device, int N, char *String, int Max) {
 	// mark the end of the extended string
 	Boundary = GDS_FontMeasureString( Device, String );
 			
-	// add a full display width	
-	while (Len < Max && GDS_FontMeasureString( Device, String ) - Boundary < Device->Width) {
-		String[Len++] = String[Extra++];
+	// add a full display width, measuring only what is appended
+	for (int Width = 0; Len < Max && Width < Device->Width; Extra++) {
+		Width += GDS_FontGetCharWidth( Device, String[Extra] );
+		String[Len++] = String[Extra];
 		String[Len] = '\0';
 	}
 		
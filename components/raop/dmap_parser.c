@@ -317,8 +317,6 @@ static const dmap_field dmap_fields[] = {
 };
 static const size_t dmap_field_count = sizeof(dmap_fields) / sizeof(dmap_field);
 
-typedef int (*sort_func) (const void *, const void *);
-
 int dmap_version(void) {
 	return DMAP_VERSION;
 }
@@ -329,14 +327,33 @@ const char *dmap_version_string(void) {
 	       DMAP_STRINGIFY(DMAP_VERSION_PATCH);
 }
 
-static int dmap_field_sort(const dmap_field *a, const dmap_field *b) {
-	return memcmp(a->code, b->code, 4);
+static uint32_t dmap_read_u32(const char *buf);
+
+/*
+ * Content codes are 4 chars and the table is sorted with memcmp, so comparing
+ * them as big-endian 32 bits integers gives the same order without having to
+ * go through bsearch and a comparator for each step.
+ */
+static const dmap_field *dmap_field_from_tag(uint32_t tag) {
+	size_t lo = 0, hi = dmap_field_count;
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		uint32_t key = dmap_read_u32(dmap_fields[mid].code);
+
+		if (key == tag)
+			return &dmap_fields[mid];
+		else if (key < tag)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return NULL;
 }
 
 static const dmap_field *dmap_field_from_code(const char *code) {
-	dmap_field key;
-	key.code = code;
-	return bsearch(&key, dmap_fields, dmap_field_count, sizeof(dmap_field), (sort_func)dmap_field_sort);
+	return dmap_field_from_tag(dmap_read_u32(code));
 }
 
 const char *dmap_name_from_code(const char *code) {
@@ -402,7 +419,7 @@ static int dmap_parse_internal(const dmap_settings *settings, const char *buf, s
 		field_len = dmap_read_u32(p);
 		p += 4;
 
-		if (p + field_len > end)
+		if (field_len > (size_t)(end - p))
 			return -1;
 
 		if (field) {
@@ -543,3 +560,41 @@ static int dmap_parse_internal(const dmap_settings *settings, const char *buf, s
 int dmap_parse(const dmap_settings *settings, const char *buf, size_t len) {
 	return dmap_parse_internal(settings, buf, len, NULL);
 }
+
+static int dmap_visit_internal(const char *buf, size_t len, const dmap_field *parent, dmap_visit_cb cb, void *ctx) {
+	const char *p = buf;
+	const char *end = buf + len;
+
+	while (end - p >= 8) {
+		uint32_t tag = dmap_read_u32(p);
+		size_t field_len = dmap_read_u32(p + 4);
+		const dmap_field *field = dmap_field_from_tag(tag);
+		DMAP_TYPE field_type = field ? field->type : DMAP_UNKNOWN;
+
+		p += 8;
+		if (field_len > (size_t)(end - p))
+			return -1;
+
+		if (field_type == DMAP_ITEM)
+			field_type = (parent && parent->list_item_type) ? parent->list_item_type : DMAP_DICT;
+
+		/* Only containers we know about are walked, everything else is a leaf */
+		if (field_type == DMAP_DICT) {
+			if (dmap_visit_internal(p, field_len, field, cb, ctx) != 0)
+				return -1;
+		} else {
+			cb(ctx, tag, p, field_len);
+		}
+
+		p += field_len;
+	}
+
+	return p == end ? 0 : -1;
+}
+
+int dmap_visit(const char *buf, size_t len, dmap_visit_cb cb, void *ctx) {
+	if (!buf || !cb)
+		return -1;
+
+	return dmap_visit_internal(buf, len, NULL, cb, ctx);
+}
@@ -84,6 +84,30 @@ const char *dmap_name_from_code(const char *code);
  */
 int dmap_parse(const dmap_settings *settings, const char *buf, size_t len);
 
+/**
+ * Builds the 32 bits tag of a content code, e.g. DMAP_TAG('m','i','n','m').
+ */
+#define DMAP_TAG(a, b, c, d) (((uint32_t)(a) << 24) | ((uint32_t)(b) << 16) | \
+                              ((uint32_t)(c) << 8) | (uint32_t)(d))
+
+/*
+ * Callback invoked for each leaf field by dmap_visit.
+ *
+ * @param ctx  The context pointer given to dmap_visit.
+ * @param tag  The content code as a 32 bits integer (see DMAP_TAG).
+ * @param buf  Pointer to the raw field value, inside the message buffer.
+ * @param len  The length of the raw field value.
+ */
+typedef void (*dmap_visit_cb)  (void *ctx, uint32_t tag, const char *buf, size_t len);
+
+/**
+ * Walks a DMAP message without any allocation or formatting. Known containers
+ * are descended into and every other field is handed as a view into buf.
+ *
+ * @return 0 if parsing was successful, or -1 if an error occurred.
+ */
+int dmap_visit(const char *buf, size_t len, dmap_visit_cb cb, void *ctx);
+
 #ifdef __cplusplus
 }
 #endif
@@ -28,13 +28,21 @@ typedef enum { lERROR = 0, lWARN, lINFO, lDEBUG, lSDEBUG } log_level;
 
 const char *logtime(void);
 void logprint(const char *fmt, ...);
+void logprint_sync(const char *fmt, ...);
 log_level debug2level(char *level);
 char *level2debug(log_level level);
 
-#define LOG_ERROR(fmt, ...) logprint("%s %s:%d " fmt "\n", logtime(), __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define LOG_WARN(fmt, ...)  if (*loglevel >= lWARN)  logprint("%s %s:%d " fmt "\n", logtime(), __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define LOG_INFO(fmt, ...)  if (*loglevel >= lINFO)  logprint("%s %s:%d " fmt "\n", logtime(), __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define LOG_DEBUG(fmt, ...) if (*loglevel >= lDEBUG) logprint("%s %s:%d " fmt "\n", logtime(), __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define LOG_SDEBUG(fmt, ...) if (*loglevel >= lSDEBUG) logprint("%s %s:%d " fmt "\n", logtime(), __FUNCTION__, __LINE__, ##__VA_ARGS__)
+#ifdef WIN32
+#define LOG_FORMAT(fmt) "%s %s:%d " fmt "\n", logtime(), __FUNCTION__, __LINE__
+#else
+// timestamp is taken by logprint, formatting is deferred to a low priority task
+#define LOG_FORMAT(fmt) "%s:%d " fmt "\n", __FUNCTION__, __LINE__
+#endif
+
+#define LOG_ERROR(fmt, ...) logprint_sync(LOG_FORMAT(fmt), ##__VA_ARGS__)
+#define LOG_WARN(fmt, ...)  if (*loglevel >= lWARN)  logprint(LOG_FORMAT(fmt), ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...)  if (*loglevel >= lINFO)  logprint(LOG_FORMAT(fmt), ##__VA_ARGS__)
+#define LOG_DEBUG(fmt, ...) if (*loglevel >= lDEBUG) logprint(LOG_FORMAT(fmt), ##__VA_ARGS__)
+#define LOG_SDEBUG(fmt, ...) if (*loglevel >= lSDEBUG) logprint(LOG_FORMAT(fmt), ##__VA_ARGS__)
 
 #endif
\ No newline at end of file
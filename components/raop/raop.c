@@ -108,7 +108,12 @@ static int 		base64_decode(const char *str, void *data);
 extern char private_key[];
 enum { RSA_MODE_KEY, RSA_MODE_AUTH };
 
-static void on_dmap_string(void *ctx, const char *code, const char *name, const char *buf, size_t len);
+struct dmap_view_s {
+	char *artist, *album, *title;
+	size_t artist_len, album_len, title_len;
+};
+
+static void on_dmap_field(void *ctx, uint32_t tag, const char *buf, size_t len);
 
 /*----------------------------------------------------------------------------*/
 struct raop_ctx_s *raop_create(struct in_addr host, char *name,
@@ -607,20 +612,18 @@ static bool handle_rtsp(raop_ctx_t *ctx, int sock)
 			LOG_INFO("[%p]: SET PARAMETER progress %d/%u %s", ctx, current, stop, p);
 			success = ctx->cmd_cb(RAOP_PROGRESS, max(current, 0), stop);
 		} else if (body && ((p = kd_lookup(headers, "Content-Type")) != NULL) && !strcasecmp(p, "application/x-dmap-tagged")) {
-			struct metadata_s metadata;
-			dmap_settings settings = {
-				NULL, NULL, NULL, NULL,	NULL, NULL,	NULL, on_dmap_string, NULL,
-				NULL
-			};
+			struct dmap_view_s view;
 
 			LOG_INFO("[%p]: received metadata", ctx);
-			settings.ctx = &metadata;
-			memset(&metadata, 0, sizeof(struct metadata_s));
-			if (!dmap_parse(&settings, body, len)) {
+			memset(&view, 0, sizeof(struct dmap_view_s));
+			if (!dmap_visit(body, len, on_dmap_field, &view)) {
+				// body has a trailing NUL and parsing is done, so strings can be terminated in place
+				if (view.artist) view.artist[view.artist_len] = '\0';
+				if (view.album) view.album[view.album_len] = '\0';
+				if (view.title) view.title[view.title_len] = '\0';
 				LOG_INFO("[%p]: received metadata\n\tartist: %s\n\talbum:  %s\n\ttitle:  %s",
-						 ctx, metadata.artist, metadata.album, metadata.title);
-				success = ctx->cmd_cb(RAOP_METADATA, metadata.artist, metadata.album, metadata.title);
-				free_metadata(&metadata);
+						 ctx, view.artist, view.album, view.title);
+				success = ctx->cmd_cb(RAOP_METADATA, view.artist, view.album, view.title);
 			}
 		} else {
 			char *dump = kd_dump(headers);
@@ -949,11 +952,24 @@ static int base64_decode(const char *str, void *data)
 }
 
 /*----------------------------------------------------------------------------*/
-static void on_dmap_string(void *ctx, const char *code, const char *name, const char *buf, size_t len) {
-	struct metadata_s *metadata = (struct metadata_s *) ctx;
+static void on_dmap_field(void *ctx, uint32_t tag, const char *buf, size_t len) {
+	struct dmap_view_s *view = (struct dmap_view_s *) ctx;
 
-	if (!strcasecmp(code, "asar")) metadata->artist = strndup(buf, len);
-	else if (!strcasecmp(code, "asal")) metadata->album = strndup(buf, len);
-	else if (!strcasecmp(code, "minm")) metadata->title = strndup(buf, len);
+	switch (tag) {
+	case DMAP_TAG('a','s','a','r'):
+		view->artist = (char*) buf;
+		view->artist_len = len;
+		break;
+	case DMAP_TAG('a','s','a','l'):
+		view->album = (char*) buf;
+		view->album_len = len;
+		break;
+	case DMAP_TAG('m','i','n','m'):
+		view->title = (char*) buf;
+		view->title_len = len;
+		break;
+	default:
+		break;
+	}
 }
 
@@ -53,6 +53,7 @@
 #else
 #include "esp_pthread.h"
 #include "esp_system.h"
+#include "monitor.h"
 #include <mbedtls/version.h>
 #include <mbedtls/aes.h>
 #include "alac_wrapper.h"
@@ -87,6 +88,11 @@ enum { DATA = 0, CONTROL, TIMING };
 
 static const u8_t silence_frame[MAX_PACKET] = { 0 };
 
+// same as per-session counters but never reset, for metrics
+static struct {
+	u32_t resent_req, resent_rec, silent_frames, discarded;
+} rtp_totals;
+
 typedef u16_t seq_t;
 typedef struct audio_buffer_entry {   // decoded audio packets
 	int ready;
@@ -230,6 +236,13 @@ rtp_resp_t rtp_init(struct in_addr host, int latency, char *aeskey, char *aesiv,
 	ctx->latency = latency;
 	ctx->ab_read = ctx->ab_write;
 
+#ifndef WIN32
+	monitor_metric_add("rtp_resent_requested_total", "AirPlay frames requested for resend", true, &rtp_totals.resent_req, NULL);
+	monitor_metric_add("rtp_resent_recovered_total", "AirPlay frames recovered by resend", true, &rtp_totals.resent_rec, NULL);
+	monitor_metric_add("rtp_silent_frames_total", "AirPlay frames replaced by silence", true, &rtp_totals.silent_frames, NULL);
+	monitor_metric_add("rtp_discarded_total", "AirPlay frames received too late", true, &rtp_totals.discarded, NULL);
+#endif
+
 #ifdef __RTP_STORE
 	ctx->rtpIN = fopen("airplay.rtpin", "wb");
 	ctx->rtpOUT = fopen("airplay.rtpout", "wb");
@@ -477,6 +490,7 @@ static void buffer_put_packet(rtp_t *ctx, seq_t seqno, unsigned rtptime, bool fi
 		// recovered packet, not yet sent
 		abuf = ctx->audio_buffer + BUFIDX(seqno);
 		ctx->resent_rec++;
+		rtp_totals.resent_rec++;
 		LOG_DEBUG("[%p]: packet recovered seqno:%hu rtptime:%u (W:%hu R:%hu)", ctx, seqno, rtptime, ctx->ab_write, ctx->ab_read);
 	} else {
 		// too late
@@ -526,6 +540,7 @@ static void buffer_push_packet(rtp_t *ctx) {
 		if (now > playtime) {
 			LOG_DEBUG("[%p]: discarded frame now:%u missed by:%d (W:%hu R:%hu)", ctx, now, now - playtime, ctx->ab_write, ctx->ab_read);
 			ctx->discarded++;
+			rtp_totals.discarded++;
 			curframe->ready = 0;
 		} else if (playtime - now <= hold) {
 			if (curframe->ready) {
@@ -535,6 +550,7 @@ static void buffer_push_packet(rtp_t *ctx) {
 				LOG_DEBUG("[%p]: created zero frame (W:%hu R:%hu)", ctx, ctx->ab_write, ctx->ab_read);
 				ctx->data_cb(silence_frame, ctx->frame_size * 4, playtime);
 				ctx->silent_frames++;
+				rtp_totals.silent_frames++;
 			}
 		} else if (curframe->ready) {
 			ctx->data_cb((const u8_t*) curframe->data, curframe->len, playtime);
@@ -795,6 +811,7 @@ static bool rtp_request_resend(rtp_t *ctx, seq_t first, seq_t last) {
 	if (seq_order(last, first) || last - first > BUFFER_FRAMES / 2) return false;
 	
 	ctx->resent_req += (seq_t) (last - first) + 1;
+	rtp_totals.resent_req += (seq_t) (last - first) + 1;
 
 	LOG_DEBUG("resend request [W:%hu R:%hu first=%hu last=%hu]", ctx->ab_write, ctx->ab_read, first, last);
 
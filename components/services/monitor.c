@@ -12,7 +12,10 @@
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/timers.h"
+#include "freertos/semphr.h"
 #include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
 #include "esp_log.h"
 #include "monitor.h"
 #include "driver/gpio.h"
@@ -24,11 +27,35 @@
 
 #define MONITOR_TIMER	(10*1000)
 #define SCRATCH_SIZE	256
+#define MONITOR_METRICS	24
+#define MONITOR_TASKS_HEADROOM	16
 
 static const char *TAG = "monitor";
 
 static TimerHandle_t monitor_timer;
 
+struct metric_s {
+	const char *name, *help;
+	bool counter;
+	volatile uint32_t *value;
+	uint32_t (*get)(void);
+};
+
+// metrics can be registered from any task, even before monitor is initialized
+static portMUX_TYPE metrics_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static struct {
+	SemaphoreHandle_t mutex;
+	bool log;
+	int count;
+	struct metric_s metrics[MONITOR_METRICS];
+	uint32_t n, size;
+	struct {
+		char name[configMAX_TASK_NAME_LEN];
+		uint32_t cpu, stack;
+	} *tasks;
+} monitor;
+
 static struct {
 	int gpio;
 	int active;
@@ -41,32 +68,93 @@ bool jack_inserted_svc(void);
 void (*spkfault_handler_svc)(bool inserted);
 bool spkfault_svc(void);
 
+// ms of audio buffered ahead of output, -1 when not playing
+int (*audio_headroom_svc)(void);
+
+#ifdef CONFIG_FREERTOS_USE_TRACE_FACILITY 
+static TaskStatus_t *task_status[2];
+static struct {
+	TaskStatus_t *tasks;
+	uint32_t total, n;
+} current, previous;
+
 /****************************************************************************************
- * 
+ * (Re)allocate sampling and exported tables for <size> tasks, must be called with monitor
+ * locked. Previous sample is lost, so CPU load restarts from next one
+ */
+static bool task_tables(uint32_t size) {
+	TaskStatus_t *status[2] = { heap_caps_malloc(size * sizeof(TaskStatus_t), MALLOC_CAP_SPIRAM), 
+								heap_caps_malloc(size * sizeof(TaskStatus_t), MALLOC_CAP_SPIRAM) };
+	void *tasks = heap_caps_calloc(size, sizeof(*monitor.tasks), MALLOC_CAP_SPIRAM);
+	
+	if (!status[0] || !status[1] || !tasks) {
+		ESP_LOGE(TAG, "can't allocate tables for %u tasks", size);
+		free(status[0]);
+		free(status[1]);
+		free(tasks);
+		return false;
+	}	
+	
+	free(task_status[0]);
+	free(task_status[1]);
+	free(monitor.tasks);
+	
+	task_status[0] = status[0];
+	task_status[1] = status[1];
+	previous.tasks = NULL;
+	previous.n = 0;
+	monitor.tasks = tasks;
+	monitor.size = size;
+	monitor.n = 0;
+	
+	return true;
+}	
+#endif
+
+/****************************************************************************************
+ * Sample tasks in preallocated tables (one being filled while the other holds the
+ * previous sample) and publish CPU load and stack high-water marks for exporter
  */
 static void task_stats( void ) {
 #ifdef CONFIG_FREERTOS_USE_TRACE_FACILITY 
-	static struct {
-		TaskStatus_t *tasks;
-		uint32_t total, n;
-	} current, previous;
+	static uint32_t failed;
+	
+	// we run in timer's task, so never wait for exporter and rather skip that sample
+	if (xSemaphoreTake(monitor.mutex, 0) != pdTRUE) return;
+	
+	// tasks have been created since tables were sized, try to grow once per new count
+	uint32_t count = uxTaskGetNumberOfTasks();
+	if (count > monitor.size && count > failed && !task_tables(count + MONITOR_TASKS_HEADROOM)) failed = count;
 	
-	current.n = uxTaskGetNumberOfTasks();
-	current.tasks = malloc( current.n * sizeof( TaskStatus_t ) );
-	current.n = uxTaskGetSystemState( current.tasks, current.n, &current.total );
+	current.tasks = task_status[previous.tasks == task_status[0] ? 1 : 0];
+	current.n = current.tasks ? uxTaskGetSystemState( current.tasks, monitor.size, &current.total ) : 0;
+	
+	// a task might have been created since uxTaskGetNumberOfTasks(), next sample will do
+	if (!current.n) {
+		xSemaphoreGive(monitor.mutex);
+		return;
+	}	
 	
 	static EXT_RAM_ATTR char scratch[SCRATCH_SIZE];
 	*scratch = '\0';
 
+	monitor.n = current.n;
+
 #ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
 	uint32_t elapsed = current.total - previous.total;
     
 	for(int i = 0, n = 0; i < current.n; i++ ) {
+		strlcpy(monitor.tasks[i].name, current.tasks[i].pcTaskName, sizeof(monitor.tasks[i].name));
+		monitor.tasks[i].stack = current.tasks[i].usStackHighWaterMark;
+		monitor.tasks[i].cpu = 0;
+		
 		for (int j = 0; j < previous.n; j++) {
 			if (current.tasks[i].xTaskNumber == previous.tasks[j].xTaskNumber) {
+				if (elapsed) monitor.tasks[i].cpu = 100ULL * (current.tasks[i].ulRunTimeCounter - previous.tasks[j].ulRunTimeCounter) / elapsed;
+				if (!monitor.log) break;
 				n += snprintf(scratch + n, SCRATCH_SIZE - n, "%16s (%u) %2u%% s:%5u", current.tasks[i].pcTaskName, 
 																		   current.tasks[i].eCurrentState,
-																		   100 * (current.tasks[i].ulRunTimeCounter - previous.tasks[j].ulRunTimeCounter) / elapsed, 
+																		   monitor.tasks[i].cpu, 
 																		   current.tasks[i].usStackHighWaterMark);
 				if (i % 3 == 2 || i == current.n - 1) {
 					ESP_LOGI(TAG, "%s", scratch);
@@ -78,6 +166,9 @@ static void task_stats( void ) {
 	}	
 #else
 	for (int i = 0, n = 0; i < current.n; i ++) {
+		strlcpy(monitor.tasks[i].name, current.tasks[i].pcTaskName, sizeof(monitor.tasks[i].name));
+		monitor.tasks[i].stack = current.tasks[i].usStackHighWaterMark;
+		if (!monitor.log) continue;
 		n += sprintf(scratch + n, "%16s s:%5u\t", current.tasks[i].pcTaskName, current.tasks[i].usStackHighWaterMark);
 		if (i % 3 == 2 || i == current.n - 1) {
 			ESP_LOGI(TAG, "%s", scratch);
@@ -85,8 +176,8 @@ static void task_stats( void ) {
 		}	
 	}
 #endif	
-	
-	if (previous.tasks) free(previous.tasks);
+
+	xSemaphoreGive(monitor.mutex);
 	previous = current;
 #endif	
 }
@@ -95,15 +186,119 @@ static void task_stats( void ) {
  * 
  */
 static void monitor_callback(TimerHandle_t xTimer) {
-	ESP_LOGI(TAG, "Heap internal:%zu (min:%zu) external:%zu (min:%zu)", 
-			heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
-			heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL),
-			heap_caps_get_free_size(MALLOC_CAP_SPIRAM),
-			heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM));
+	if (monitor.log) {
+		ESP_LOGI(TAG, "Heap internal:%zu (min:%zu) external:%zu (min:%zu)", 
+				heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+				heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL),
+				heap_caps_get_free_size(MALLOC_CAP_SPIRAM),
+				heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM));
+	}		
 			
 	task_stats();
 }
 
+/****************************************************************************************
+ * Register a metric, either a counter/gauge read directly or a callback. Name must be
+ * a static string, registering an existing name just updates its source
+ */
+bool monitor_metric_add(const char *name, const char *help, bool counter, volatile uint32_t *value, uint32_t (*get)(void)) {
+	int i;
+	
+	portENTER_CRITICAL(&metrics_mux);
+	
+	for (i = 0; i < monitor.count && strcmp(monitor.metrics[i].name, name); i++);
+	
+	if (i < MONITOR_METRICS) {
+		monitor.metrics[i] = (struct metric_s) { name, help, counter, value, get };
+		if (i == monitor.count) monitor.count++;
+	}	
+	
+	portEXIT_CRITICAL(&metrics_mux);
+	
+	if (i == MONITOR_METRICS) {
+		ESP_LOGW(TAG, "no room for metric %s", name);
+		return false;
+	}	
+	
+	return true;
+}
+
+/****************************************************************************************
+ * Export all metrics in Prometheus text format or in JSON. Only reads what has been
+ * sampled or registered, so it does not interact with audio tasks. Returns the size
+ * that would be needed, which can be larger than size (output is then truncated)
+ */
+size_t monitor_metrics(char *buf, size_t size, bool json) {
+	size_t n = 0;
+	wifi_ap_record_t ap;
+	
+#define METRIC_PRINT(...) do { n += snprintf(buf + n, n < size ? size - n : 0, __VA_ARGS__); } while (0)
+#define METRIC_ADD(name, help, type, fmt, value) do {							\
+		if (json) METRIC_PRINT("%s\"%s\":" fmt, n > 1 ? "," : "", name, value);	\
+		else METRIC_PRINT("# HELP %s %s\n# TYPE %s %s\n%s " fmt "\n", 			\
+						  name, help, name, type, name, value);					\
+	} while (0)
+	
+	if (size) *buf = '\0';
+	if (json) METRIC_PRINT("{");
+	
+	METRIC_ADD("heap_internal_free_bytes", "Free internal heap", "gauge", "%zu", heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+	METRIC_ADD("heap_internal_min_free_bytes", "Lowest free internal heap", "gauge", "%zu", heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL));
+	METRIC_ADD("heap_internal_largest_block_bytes", "Largest free internal block", "gauge", "%zu", heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL));
+	METRIC_ADD("heap_psram_free_bytes", "Free PSRAM heap", "gauge", "%zu", heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+	METRIC_ADD("heap_psram_min_free_bytes", "Lowest free PSRAM heap", "gauge", "%zu", heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM));
+	if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) METRIC_ADD("wifi_rssi_dbm", "Wi-Fi signal strength", "gauge", "%d", ap.rssi);
+	METRIC_ADD("uptime_seconds", "Time since boot", "counter", "%u", (unsigned) (esp_timer_get_time() / 1000000));
+	
+	// take a copy of each entry so that getters are not called in critical section
+	for (int i = 0; ; i++) {
+		struct metric_s metric;
+		
+		portENTER_CRITICAL(&metrics_mux);
+		bool last = i >= monitor.count;
+		if (!last) metric = monitor.metrics[i];
+		portEXIT_CRITICAL(&metrics_mux);
+		
+		if (last) break;
+		uint32_t value = metric.get ? metric.get() : *metric.value;
+		METRIC_ADD(metric.name, metric.help, metric.counter ? "counter" : "gauge", "%u", value);
+	}	
+	
+	// monitor not started yet, nothing sampled
+	if (!monitor.mutex) {
+		if (json) METRIC_PRINT("}");
+		return n;
+	}
+	
+	xSemaphoreTake(monitor.mutex, portMAX_DELAY);
+	
+	if (json) {
+		METRIC_PRINT(",\"tasks\":[");
+		for (int i = 0; i < monitor.n; i++) {
+			METRIC_PRINT("%s{\"name\":\"%s\",\"stack_free\":%u", i ? "," : "", monitor.tasks[i].name, monitor.tasks[i].stack);
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+			METRIC_PRINT(",\"cpu\":%u", monitor.tasks[i].cpu);
+#endif			
+			METRIC_PRINT("}");
+		}	
+		METRIC_PRINT("]}");
+	} else if (monitor.n) {
+		METRIC_PRINT("# HELP task_stack_free_bytes Task stack high-water mark\n# TYPE task_stack_free_bytes gauge\n");
+		for (int i = 0; i < monitor.n; i++) METRIC_PRINT("task_stack_free_bytes{task=\"%s\"} %u\n", monitor.tasks[i].name, monitor.tasks[i].stack);
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+		METRIC_PRINT("# HELP task_cpu_percent Task CPU load over last period\n# TYPE task_cpu_percent gauge\n");
+		for (int i = 0; i < monitor.n; i++) METRIC_PRINT("task_cpu_percent{task=\"%s\"} %u\n", monitor.tasks[i].name, monitor.tasks[i].cpu);
+#endif		
+	}
+	
+	xSemaphoreGive(monitor.mutex);
+	
+#undef METRIC_ADD	
+#undef METRIC_PRINT	
+	
+	return n;
+}
+
 /****************************************************************************************
  * 
  */
@@ -197,14 +392,21 @@ void monitor_svc_init(void) {
 		button_create(NULL, spkfault.gpio, spkfault.active ? BUTTON_HIGH : BUTTON_LOW, false, 0, spkfault_handler_default, 0, -1);
 	}	
 
-	// do we want stats
+	// sampling always runs for metrics exporter, "stats" only decides if we log it
 	char *p = config_alloc_get_default(NVS_TYPE_STR, "stats", "n", 0);
-	if (p && (*p == '1' || *p == 'Y' || *p == 'y')) {
-		monitor_timer = xTimerCreate("monitor", MONITOR_TIMER / portTICK_RATE_MS, pdTRUE, NULL, monitor_callback);
-		xTimerStart(monitor_timer, portMAX_DELAY);
-	}	
+	monitor.log = p && (*p == '1' || *p == 'Y' || *p == 'y');
 	free(p);
 	
+	monitor.mutex = xSemaphoreCreateMutex();
+	
+#ifdef CONFIG_FREERTOS_USE_TRACE_FACILITY 
+	// most tasks are not created yet, table grows later if needed
+	task_tables(uxTaskGetNumberOfTasks() + MONITOR_TASKS_HEADROOM);
+#endif
+	
+	monitor_timer = xTimerCreate("monitor", MONITOR_TIMER / portTICK_RATE_MS, pdTRUE, NULL, monitor_callback);
+	xTimerStart(monitor_timer, portMAX_DELAY);
+	
 	ESP_LOGI(TAG, "Heap internal:%zu (min:%zu) external:%zu (min:%zu)", 
 			heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
 			heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL),
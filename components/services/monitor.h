@@ -16,6 +16,11 @@ extern bool jack_inserted_svc(void);
 extern void (*spkfault_handler_svc)(bool inserted);
 extern bool spkfault_svc(void);
 
+extern int (*audio_headroom_svc)(void);
+
 extern int battery_value_svc(void);
 extern uint8_t battery_level_svc(void);
 
+
+extern bool monitor_metric_add(const char *name, const char *help, bool counter, volatile uint32_t *value, uint32_t (*get)(void));
+extern size_t monitor_metrics(char *buf, size_t size, bool json);
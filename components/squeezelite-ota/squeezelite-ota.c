@@ -11,6 +11,7 @@
 #endif
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "esp_system.h"
 #include "esp_event.h"
 #include "esp_log.h"
@@ -33,6 +34,7 @@
 #include "sdkconfig.h"
 
 #include "esp_ota_ops.h"
+#include "mbedtls/sha256.h"
 extern const char * get_certificate();
 
 static const char *TAG = "squeezelite-ota";
@@ -41,6 +43,45 @@ esp_http_client_handle_t ota_http_client = NULL;
 #define IMAGE_HEADER_SIZE sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t) + 1
 #define BUFFSIZE 4096
 #define HASH_LEN 32 /* SHA-256 digest length */
+#define OTA_BUFFERS 2
+#define OTA_WRITER_STACK 4096
+#define OTA_PROGRESS_MS 1000
+
+// OTA task and its flash writer stay away from the core Wi-Fi is pinned to
+#ifdef CONFIG_ESP32_WIFI_TASK_PINNED_TO_CORE_1
+#define OTA_CORE 0
+#warning "OTA will run on core 0"
+#else
+#pragma message "OTA will run on core 1"
+#define OTA_CORE 1
+#endif
+
+/*
+ * Download and flash write are pipelined: ota_task receives into one buffer (and hashes it)
+ * while a writer task erases ahead of its write pointer and flashes the other one. Buffers
+ * go around through two queues, a chunk of length 0 tells the writer to stop. Only the
+ * sectors the image needs are erased, in steps of "ota_erase_blk".
+ */
+typedef struct {
+	char * data;
+	int len;
+} ota_chunk_t;
+
+static struct {
+	QueueHandle_t free_q;
+	QueueHandle_t full_q;
+	TaskHandle_t reader;
+	TaskHandle_t writer;
+	esp_ota_handle_t handle;
+	const esp_partition_t * partition;
+	uint32_t erase_step;
+	uint32_t erased;
+	uint32_t written;
+	esp_err_t err;
+	mbedtls_sha256_context sha;
+	uint8_t hash[HASH_LEN];
+	bool hash_appended;
+} ota_pipe;
 
 
 static struct {
@@ -191,7 +232,7 @@ esp_err_t init_config(char * url){
 	ota_config.skip_cert_common_name_check = false;
 	ota_config.url = strdup(url);
 	ota_config.max_redirection_count = 3;
-	ota_write_data = heap_caps_malloc(ota_config.buffer_size+1 , MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+	ota_write_data = heap_caps_malloc(OTA_BUFFERS*ota_config.buffer_size+1 , MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
 	//ota_write_data = malloc(ota_config.buffer_size+1);
 	if(ota_write_data== NULL){
 		ESP_LOGE(TAG,"Error allocating the ota buffer");
@@ -223,12 +264,8 @@ esp_partition_t * _get_ota_partition(esp_partition_subtype_t subtype){
 
 
 
-esp_err_t _erase_last_boot_app_partition(esp_partition_t *ota_partition)
-{
-	uint16_t num_passes=0;
-	uint16_t remain_size=0;
+static uint32_t _get_erase_block_size(){
 	uint32_t single_pass_size=0;
-	esp_err_t err=ESP_OK;
 
     char * ota_erase_size=config_alloc_get(NVS_TYPE_STR, "ota_erase_blk");
 	if(ota_erase_size!=NULL) {
@@ -246,27 +283,104 @@ esp_err_t _erase_last_boot_app_partition(esp_partition_t *ota_partition)
 		ESP_LOGW(TAG,"Invalid erase block size of %u. Value should be a multiple of %d and will be adjusted to %u.", single_pass_size, SPI_FLASH_SEC_SIZE,temp_single_pass_size);
 		single_pass_size=temp_single_pass_size;
 	}
-	ESP_LOGI(TAG,"Erasing flash partition of size %u in blocks of %d bytes", ota_partition->size, single_pass_size);
-	num_passes=ota_partition->size/single_pass_size;
-	remain_size=ota_partition->size-(num_passes*single_pass_size);
-	ESP_LOGI(TAG,"Erasing in %d passes with blocks of %d bytes ", num_passes,single_pass_size);
-	for(uint16_t i=0;i<num_passes;i++){
-		ESP_LOGD(TAG,"Erasing flash (%u%%)",i/num_passes);
-		ESP_LOGD(TAG,"Pass %d of %d, with chunks of %d bytes, from %d to %d", i+1, num_passes,single_pass_size,i*single_pass_size,i*single_pass_size+single_pass_size);
-		err=esp_partition_erase_range(ota_partition, i*single_pass_size, single_pass_size);
+	if(single_pass_size == 0) single_pass_size = SPI_FLASH_SEC_SIZE;
+	return single_pass_size;
+}
+
+static esp_err_t _ota_write_chunk(const char * data, int len){
+	esp_err_t err=ESP_OK;
+	uint32_t image_end = (ota_status.ota_total_len + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE;
+	// keep at least one buffer worth of erased flash ahead of the write pointer
+	while(ota_pipe.written + len + BUFFSIZE > ota_pipe.erased && ota_pipe.erased < image_end){
+		uint32_t size = image_end - ota_pipe.erased;
+		if(size > ota_pipe.erase_step) size = ota_pipe.erase_step;
+		ESP_LOGD(TAG,"Erasing flash from %u to %u", ota_pipe.erased, ota_pipe.erased+size);
+		err=esp_partition_erase_range(ota_pipe.partition, ota_pipe.erased, size);
 		if(err!=ESP_OK) return err;
-//		triggerStatusJsonRefresh(i%10==0?true:false,"Erasing flash (%u/%u)",i,num_passes);
-		if(i%2) {
-			triggerStatusJsonRefresh(false,"Erasing flash (%u/%u)",i,num_passes);
-		}
-		vTaskDelay(200/ portTICK_PERIOD_MS);  // wait here for a short amount of time.  This will help with reducing WDT errors
+		ota_pipe.erased += size;
 	}
-	if(remain_size>0){
-		err=esp_partition_erase_range(ota_partition, ota_partition->size-remain_size, remain_size);
-		if(err!=ESP_OK) return err;
+	err = esp_ota_write(ota_pipe.handle, (const void *)data, len);
+	if(err==ESP_OK) ota_pipe.written += len;
+	return err;
+}
+
+static void ota_writer_task(void *pvParameter){
+	ota_chunk_t chunk;
+	while(xQueueReceive(ota_pipe.full_q, &chunk, portMAX_DELAY)==pdTRUE && chunk.len>0){
+		// after an error, keep recycling buffers so the reader never blocks
+		if(ota_pipe.err==ESP_OK) ota_pipe.err=_ota_write_chunk(chunk.data, chunk.len);
+		xQueueSend(ota_pipe.free_q, &chunk, portMAX_DELAY);
 	}
-	triggerStatusJsonRefresh(true,"Erasing flash complete.");
-	taskYIELD();
+	xTaskNotifyGive(ota_pipe.reader);
+	vTaskDelete(NULL);
+}
+
+static esp_err_t _ota_pipe_start(const esp_partition_t * partition){
+	ota_chunk_t chunk = { .len = 0 };
+	ota_pipe.partition = partition;
+	ota_pipe.erase_step = _get_erase_block_size();
+	ota_pipe.erased = ota_pipe.written = 0;
+	ota_pipe.err = ESP_OK;
+	ota_pipe.reader = xTaskGetCurrentTaskHandle();
+	ota_pipe.free_q = xQueueCreate(OTA_BUFFERS, sizeof(ota_chunk_t));
+	// one more slot for the stop chunk
+	ota_pipe.full_q = xQueueCreate(OTA_BUFFERS+1, sizeof(ota_chunk_t));
+	if(ota_pipe.free_q==NULL || ota_pipe.full_q==NULL) return ESP_ERR_NO_MEM;
+	for(int i=0;i<OTA_BUFFERS;i++){
+		chunk.data = ota_write_data + i*BUFFSIZE;
+		xQueueSend(ota_pipe.free_q, &chunk, 0);
+	}
+	mbedtls_sha256_init(&ota_pipe.sha);
+	mbedtls_sha256_starts_ret(&ota_pipe.sha, 0);
+	if(xTaskCreatePinnedToCore(&ota_writer_task, "ota_writer", OTA_WRITER_STACK, NULL, uxTaskPriorityGet(NULL), &ota_pipe.writer, OTA_CORE)!=pdPASS){
+		ota_pipe.writer=NULL;
+		return ESP_ERR_NO_MEM;
+	}
+	ESP_LOGI(TAG,"OTA pipeline started with %d buffers of %d bytes, erasing ahead in blocks of %u bytes", OTA_BUFFERS, BUFFSIZE, ota_pipe.erase_step);
+	return ESP_OK;
+}
+
+static esp_err_t _ota_pipe_stop(){
+	ota_chunk_t chunk = { .len = 0 };
+	if(ota_pipe.writer!=NULL){
+		xQueueSend(ota_pipe.full_q, &chunk, portMAX_DELAY);
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		ota_pipe.writer=NULL;
+	}
+	if(ota_pipe.free_q!=NULL) vQueueDelete(ota_pipe.free_q);
+	if(ota_pipe.full_q!=NULL) vQueueDelete(ota_pipe.full_q);
+	ota_pipe.free_q = ota_pipe.full_q = NULL;
+	return ota_pipe.err;
+}
+
+static void _ota_hash_chunk(const char * data, int len, uint32_t offset){
+	// image SHA-256 covers everything but the appended digest itself
+	uint32_t hashed_len = ota_status.ota_total_len - HASH_LEN;
+	if(offset < hashed_len){
+		int count = hashed_len - offset < len ? hashed_len - offset : len;
+		mbedtls_sha256_update_ret(&ota_pipe.sha, (const unsigned char *)data, count);
+		data += count;
+		offset += count;
+		len -= count;
+	}
+	if(len > 0 && offset >= hashed_len && offset + len <= ota_status.ota_total_len){
+		memcpy(ota_pipe.hash + offset - hashed_len, data, len);
+	}
+}
+
+static esp_err_t _ota_hash_check(){
+	uint8_t digest[HASH_LEN];
+	if(!ota_pipe.hash_appended){
+		ESP_LOGW(TAG,"Image has no appended SHA-256, relying on image verification only");
+		return ESP_OK;
+	}
+	mbedtls_sha256_finish_ret(&ota_pipe.sha, digest);
+	mbedtls_sha256_free(&ota_pipe.sha);
+	if(memcmp(digest, ota_pipe.hash, HASH_LEN)!=0){
+		ESP_LOGE(TAG,"Image SHA-256 mismatch");
+		return ESP_ERR_IMAGE_INVALID;
+	}
+	ESP_LOGI(TAG,"Image SHA-256 verified while streaming");
 	return ESP_OK;
 }
 
@@ -354,12 +468,16 @@ static esp_err_t _http_connect(esp_http_client_handle_t http_client)
 }
 void ota_task_cleanup(const char * message, ...){
 	ota_status.bOTAThreadStarted=false;
+	_ota_pipe_stop();
+	mbedtls_sha256_free(&ota_pipe.sha);
 	if(message!=NULL){
-
+	    // format here, a va_list can't be passed on to a variadic function
+	    char text[sizeof(ota_status.status_text)];
 	    va_list args;
 	    va_start(args, message);
-		triggerStatusJsonRefresh(true,message, args);
+	    vsnprintf(text, sizeof(text), message, args);
 	    va_end(args);
+		triggerStatusJsonRefresh(true,"%s",text);
 	    ESP_LOGE(TAG, "%s",ota_status.status_text);
 	}
 	FREE_RESET(ota_status.redirected_url);
@@ -398,21 +516,13 @@ void ota_task(void *pvParameter)
 		return;
 	}
 
-	/* Locate and erase ota application partition */
-	ESP_LOGW(TAG,"****************  Expecting WATCHDOG errors below during flash erase. This is OK and not to worry about **************** ");
-	triggerStatusJsonRefresh(true,"Erasing OTA partition");
+	/* Locate ota application partition, it is erased ahead of writes */
 	esp_partition_t *ota_partition = _get_ota_partition(ESP_PARTITION_SUBTYPE_APP_OTA_0);
 	if(ota_partition == NULL){
 		ESP_LOGE(TAG,"Unable to locate OTA application partition. ");
         ota_task_cleanup("Error: OTA application partition not found. (%s)",esp_err_to_name(err));
         return;
 	}
-	_printMemStats();
-	err=_erase_last_boot_app_partition(ota_partition);
-	if(err!=ESP_OK){
-		ota_task_cleanup("Error: Unable to erase last APP partition. (%s)",esp_err_to_name(err));
-		return;
-	}
 
 	_printMemStats();
 	ota_status.bOTAStarted = true;
@@ -430,15 +540,32 @@ void ota_task(void *pvParameter)
        return;
     }
 
+    if (ota_status.ota_total_len <= HASH_LEN || ota_status.ota_total_len > ota_partition->size) {
+    	ota_task_cleanup("Error: Invalid binary size %u for partition size %u", ota_status.ota_total_len, ota_partition->size);
+    	return;
+    }
+
+    err = _ota_pipe_start(ota_partition);
+    if (err != ESP_OK) {
+    	ota_task_cleanup("Error: Unable to start OTA pipeline. (%s)",esp_err_to_name(err));
+    	return;
+    }
+
     _printMemStats();
 
-    esp_ota_handle_t update_handle = 0 ;
     int binary_file_length = 0;
+    uint32_t last_refresh_ms = 0;
 
     /*deal with all receive packet*/
     bool image_header_was_checked = false;
     while (1) {
-        int data_read = esp_http_client_read(ota_http_client, ota_write_data, buffer_size);
+    	ota_chunk_t chunk;
+    	xQueueReceive(ota_pipe.free_q, &chunk, portMAX_DELAY);
+    	if (ota_pipe.err != ESP_OK) {
+    		ota_task_cleanup("Error: OTA Partition write failure. (%s)",esp_err_to_name(ota_pipe.err));
+    		return;
+    	}
+        int data_read = esp_http_client_read(ota_http_client, chunk.data, buffer_size);
         if (data_read < 0) {
             ota_task_cleanup("Error: Data read error");
             return;
@@ -447,7 +574,7 @@ void ota_task(void *pvParameter)
                 esp_app_desc_t new_app_info;
                 if (data_read > sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t)) {
                     // check current version with downloading
-                    memcpy(&new_app_info, &ota_write_data[sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t)], sizeof(esp_app_desc_t));
+                    memcpy(&new_app_info, &chunk.data[sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t)], sizeof(esp_app_desc_t));
                     ESP_LOGI(TAG, "New firmware version: %s", new_app_info.version);
 
                     esp_app_desc_t running_app_info;
@@ -476,36 +603,38 @@ void ota_task(void *pvParameter)
                     }
 
                     image_header_was_checked = true;
+                    ota_pipe.hash_appended = ((esp_image_header_t *)chunk.data)->hash_appended == 1;
 
-                    // Call OTA Begin with a small partition size - this drives the erase operation which was already done;
-                    err = esp_ota_begin(ota_partition, 512, &update_handle);
+                    // Call OTA Begin with a small partition size - it only erases the first sector, writer erases the rest ahead;
+                    err = esp_ota_begin(ota_partition, 512, &ota_pipe.handle);
                     if (err != ESP_OK) {
                         ota_task_cleanup("esp_ota_begin failed (%s)", esp_err_to_name(err));
                         return;
                     }
+                    ota_pipe.erased = SPI_FLASH_SEC_SIZE;
 					ESP_LOGD(TAG, "esp_ota_begin succeeded");
                 } else {
                     ota_task_cleanup("Error: Binary file too large for the current partition");
                     return;
                 }
             }
-            err = esp_ota_write( update_handle, (const void *)ota_write_data, data_read);
-            if (err != ESP_OK) {
-                ota_task_cleanup("Error: OTA Partition write failure. (%s)",esp_err_to_name(err));
-                return;
-            }
+            _ota_hash_chunk(chunk.data, data_read, binary_file_length);
+            chunk.len = data_read;
+            xQueueSend(ota_pipe.full_q, &chunk, portMAX_DELAY);
             binary_file_length += data_read;
-            ESP_LOGD(TAG, "Written image length %d", binary_file_length);
-			ota_status.ota_actual_len=binary_file_length;
-			if(ota_get_pct_complete()%5 == 0) ota_status.newpct = ota_get_pct_complete();
-			if(ota_status.lastpct!=ota_status.newpct ) {
-				gettimeofday(&tv, NULL);
-				uint32_t elapsed_ms= (tv.tv_sec-ota_status.OTA_start.tv_sec )*1000+(tv.tv_usec-ota_status.OTA_start.tv_usec)/1000;
+            ESP_LOGD(TAG, "Received image length %d", binary_file_length);
+
+            // progress is what has been written, UI refresh is rate limited and does not hold the task
+            ota_status.ota_actual_len=ota_pipe.written;
+            ota_status.newpct = ota_get_pct_complete();
+            gettimeofday(&tv, NULL);
+            uint32_t elapsed_ms= (tv.tv_sec-ota_status.OTA_start.tv_sec )*1000+(tv.tv_usec-ota_status.OTA_start.tv_usec)/1000;
+            if(ota_status.lastpct!=ota_status.newpct && elapsed_ms - last_refresh_ms >= OTA_PROGRESS_MS) {
 				ESP_LOGI(TAG,"OTA progress : %d/%d (%d pct), %d KB/s", ota_status.ota_actual_len, ota_status.ota_total_len, ota_status.newpct, elapsed_ms>0?ota_status.ota_actual_len*1000/elapsed_ms/1024:0);
-				triggerStatusJsonRefresh(true,"Downloading & writing update.");
+				triggerStatusJsonRefresh(false,"Downloading & writing update.");
 				ota_status.lastpct=ota_status.newpct;
+				last_refresh_ms=elapsed_ms;
 			}
-			taskYIELD();
 
         } else if (data_read == 0) {
             ESP_LOGI(TAG, "Connection closed");
@@ -513,14 +642,26 @@ void ota_task(void *pvParameter)
         }
     }
 
-    ESP_LOGI(TAG, "Total Write binary data length: %d", binary_file_length);
-    if (ota_status.ota_total_len != binary_file_length) {
+    err = _ota_pipe_stop();
+    if (err != ESP_OK) {
+        ota_task_cleanup("Error: OTA Partition write failure. (%s)",esp_err_to_name(err));
+        return;
+    }
+    ota_status.ota_actual_len=ota_pipe.written;
+    gettimeofday(&tv, NULL);
+    ESP_LOGI(TAG, "Total Write binary data length: %d in %ld ms", ota_pipe.written,
+    		(tv.tv_sec-ota_status.OTA_start.tv_sec )*1000+(tv.tv_usec-ota_status.OTA_start.tv_usec)/1000);
+    if (ota_status.ota_total_len != binary_file_length || ota_pipe.written != binary_file_length) {
         ota_task_cleanup("Error: Error in receiving complete file");
         return;
     }
+    if (_ota_hash_check() != ESP_OK) {
+        ota_task_cleanup("Error: Downloaded image is corrupted");
+        return;
+    }
     _printMemStats();
 
-    err = esp_ota_end(update_handle);
+    err = esp_ota_end(ota_pipe.handle);
     if (err != ESP_OK) {
         ota_task_cleanup("Error: %s",esp_err_to_name(err));
         return;
@@ -553,13 +694,6 @@ esp_err_t process_recovery_ota(const char * bin_url){
 	// the first thing we need to do here is to erase the firmware url
 	// to avoid a boot loop
 
-#ifdef CONFIG_ESP32_WIFI_TASK_PINNED_TO_CORE_1
-#define OTA_CORE 0
-#warning "OTA will run on core 0"
-#else
-#pragma message "OTA will run on core 1"
-#define OTA_CORE 1
-#endif
     ESP_LOGI(TAG, "Starting ota on core %u for : %s", OTA_CORE,urlPtr);
     char * num_buffer=config_alloc_get(NVS_TYPE_STR, "ota_stack");
   	if(num_buffer!=NULL) {
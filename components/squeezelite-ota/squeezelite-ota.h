@@ -21,7 +21,8 @@
 
 
 // ERASE BLOCK needs to be a multiple of sector size. If a different multiple is passed
-// the OTA process will adjust. Here, we need to strike the balance between speed and
+// the OTA process will adjust. Flash is erased by blocks of that size just ahead of the
+// write pointer. Here, we need to strike the balance between speed and
 // stability.  The larger the blocks, the faster the erase will be, but the more likely
 // the system will throw WDT while the flash chip is locked and the more likely
 // the OTA process will derail
@@ -0,0 +1,39 @@
+/* 
+ *  Squeezelite for esp32
+ *
+ *  (c) Philippe G. 2020, philippe_44@outlook.com
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+ 
+#include "bt_link.h"
+
+/****************************************************************************************
+ * Grade one heartbeat window, returns true when pre-buffer level has changed
+ */
+bool bt_link_update(struct link_s *ctrl, uint32_t expected, uint32_t requested, uint32_t gap_ms, uint32_t underruns) {
+	uint64_t ratio = expected ? (uint64_t) requested * 100 / expected : 100;
+	int delta;
+	
+	if (ratio > 100) ratio = 100;
+	delta = (int) ratio - (int) ctrl->quality;
+	
+	// 1/8 smoothing that still settles exactly on ratio
+	ctrl->quality += delta / 8 ? delta / 8 : delta;
+	
+	if (underruns || gap_ms > LINK_STALL_MS || ratio < LINK_MIN_RATIO) {
+		ctrl->stalls++;
+		ctrl->good = 0;
+		if (ctrl->level == LINK_LEVELS - 1) return false;
+		ctrl->level++;
+		return true;
+	}
+	
+	if (++ctrl->good < LINK_STABLE || ctrl->level == 0) return false;
+	
+	ctrl->good = 0;
+	ctrl->level--;
+	return true;
+}
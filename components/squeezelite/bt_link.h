@@ -0,0 +1,34 @@
+/* 
+ *  Squeezelite for esp32
+ *
+ *  (c) Philippe G. 2020, philippe_44@outlook.com
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+ 
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ When 2.4 GHz is busy (our own WiFi stream included), BT stack stops pulling for a while
+ then catches up with large requests. Link is graded at every heartbeat from what the
+ stack requested vs real time, longest gap between callbacks and FIFO underruns. A bad
+ window immediately deepens FIFO pre-buffer by one level, LINK_STABLE good ones in a row
+ lower it by one. This has no dependency so that it can be simulated on host.
+*/
+#define LINK_LEVELS		4
+#define LINK_START		1
+#define LINK_STABLE		20
+#define LINK_STALL_MS	60
+#define LINK_MIN_RATIO	75
+
+struct link_s {
+	int level, good;
+	uint32_t quality, stalls;
+};
+
+bool bt_link_update(struct link_s *ctrl, uint32_t expected, uint32_t requested, uint32_t gap_ms, uint32_t underruns);
@@ -22,6 +22,9 @@
 // decode thread
 
 #include "squeezelite.h"
+#if EMBEDDED
+#include "config.h"
+#endif
 
 log_level loglevel;
 
@@ -35,6 +38,43 @@ struct decodestate decode;
 struct codec *codecs[MAX_CODECS];
 struct codec *codec;
 static bool running = true;
+static u32_t open_time;
+
+// There is no pre-roll of the next track with a second codec: there is one streambuf and one 
+// stream connection, and LMS sends the next 'strm s' only once STMd says this track is fully
+// decoded. The new stream is then connected, its header parsed and first frames decoded while
+// the previous track drains from outputbuf, so the only thing left to shorten is polling.
+// Poll faster while a new stream is being opened and primed
+#define DECODE_WAIT		100000
+#define PRIMING_WAIT	10000
+
+// decode (and process) load is measured per codec on every track longer than LOAD_MIN_MS. When 
+// it uses more than LOAD_MAX % of real time for LOAD_STRIKES tracks in a row (it's wall clock 
+// so one busy moment elsewhere should not count), that codec's rate is limited to the next 
+// lower supported rate, but never below LOAD_FLOOR. When it would use less than LOAD_RAISE % 
+// at the next higher rate it's raised and after LOAD_EXPIRE tracks, limit is removed to be 
+// measured again. Limits are kept in LOAD_NVS_KEY, set it empty to reset them.
+#define LOAD_MIN_MS		10000
+#define LOAD_MAX		85
+#define LOAD_RAISE		70
+#define LOAD_STRIKES	2
+#define LOAD_FLOOR		44100
+#define LOAD_EXPIRE		50
+#define LOAD_NVS_KEY	"decode_limits"
+
+struct load_codec_s {
+	u8_t id;
+	unsigned limit;
+	u8_t strikes;
+	u16_t tracks;
+};
+
+static struct {
+	u32_t busy, frames;
+	unsigned rate;
+	bool changed;
+	struct load_codec_s codecs[MAX_CODECS];
+} load;
 
 #define LOCK_S   mutex_lock(streambuf->mutex)
 #define UNLOCK_S mutex_unlock(streambuf->mutex)
@@ -53,12 +93,142 @@ static bool running = true;
 #define MAY_PROCESS(x)
 #endif
 
+/****************************************************************************************
+ * Get the load slot of a codec, creating it if needed
+ */
+static struct load_codec_s *load_codec(u8_t id) {
+	int i;
+
+	for (i = 0; i < MAX_CODECS && load.codecs[i].id; i++) {
+		if (load.codecs[i].id == id) return load.codecs + i;
+	}
+
+	if (i == MAX_CODECS) return NULL;
+
+	memset(load.codecs + i, 0, sizeof(struct load_codec_s));
+	load.codecs[i].id = id;
+	return load.codecs + i;
+}
+
+/****************************************************************************************
+ * Retrieve/store measured limits as "<id>:<rate>,..." so they survive reboots
+ */
+static void load_restore(void) {
+#if EMBEDDED
+	char *p, *config = config_alloc_get_default(NVS_TYPE_STR, LOAD_NVS_KEY, "", 0);
+
+	for (p = config; p && *p; p = strchr(p, ',')) {
+		struct load_codec_s *slot;
+
+		if (*p == ',') p++;
+		if (*p && p[1] == ':' && (slot = load_codec(*p)) != NULL) {
+			slot->limit = atoi(p + 2);
+			if (slot->limit && slot->limit < LOAD_FLOOR) slot->limit = LOAD_FLOOR;
+			LOG_INFO("codec '%c' limited to %u Hz", *p, slot->limit);
+		}
+	}
+
+	free(config);
+#endif
+}
+
+static void load_store(void) {
+#if EMBEDDED
+	char config[MAX_CODECS * 10 + 1] = "";
+
+	for (int i = 0; i < MAX_CODECS && load.codecs[i].id; i++) {
+		if (!load.codecs[i].limit) continue;
+		sprintf(config + strlen(config), "%s%c:%u", *config ? "," : "", load.codecs[i].id, load.codecs[i].limit);
+	}
+
+	config_set_value(NVS_TYPE_STR, LOAD_NVS_KEY, config);
+#endif
+}
+
+/****************************************************************************************
+ * Evaluate how much of real time decoding used for the track that just completed
+ * (called with O locked)
+ */
+static void decode_load(void) {
+	u32_t duration = load.rate ? ((u64_t) load.frames * 1000) / output.next_sample_rate : 0;
+	struct load_codec_s *slot = load_codec(codec->id);
+
+	if (duration > LOAD_MIN_MS && slot) {
+		unsigned percent = ((u64_t) load.busy * 100) / duration;
+		unsigned prev = slot->limit;
+
+		LOG_INFO("codec '%c' at %u Hz used %u%% of real time (%u ms for %u ms)", codec->id, load.rate, percent, load.busy, duration);
+
+		// sources at or above that rate will have to be resampled by LMS
+		if (percent > LOAD_MAX && (!slot->limit || load.rate <= slot->limit)) {
+			unsigned lower = 0;
+			
+			for (int i = 0; output.supported_rates[i]; i++) {
+				if (output.supported_rates[i] < load.rate) {
+					lower = output.supported_rates[i];
+					break;
+				}	
+			}	
+			
+			if (++slot->strikes < LOAD_STRIKES) {
+				LOG_INFO("codec '%c' too slow (%u/%u)", codec->id, slot->strikes, LOAD_STRIKES);
+			} else if (lower < LOAD_FLOOR) {
+				slot->strikes = 0;
+				LOG_WARN("codec '%c' too slow even at %u Hz, not limiting further", codec->id, load.rate);
+			} else {
+				slot->limit = lower;
+				LOG_WARN("codec '%c' too slow, max sample rate will be %u at next connection", codec->id, slot->limit);
+			}
+		} else if (slot->limit && load.rate <= slot->limit) {
+			unsigned next = 0;
+
+			slot->strikes = 0;
+			
+			// supported rates are in descending order, project load at next step up
+			for (int i = 0; output.supported_rates[i] && output.supported_rates[i] > slot->limit; i++) {
+				next = output.supported_rates[i];
+			}	
+
+			if (!next || ++slot->tracks >= LOAD_EXPIRE) slot->limit = 0;
+			else if (((u64_t) percent * next) / load.rate < LOAD_RAISE) slot->limit = next == output.supported_rates[0] ? 0 : next;
+
+			if (slot->limit != prev) LOG_INFO("codec '%c' has headroom or limit expired, max sample rate will be %u at next connection", codec->id, slot->limit ? slot->limit : output.supported_rates[0]);
+		} else {
+			slot->strikes = 0;
+		}
+
+		if (slot->limit != prev) {
+			slot->strikes = slot->tracks = 0;
+			load.changed = true;
+			load_store();
+		}	
+	}
+
+	load.busy = load.frames = 0;
+}
+
+/****************************************************************************************
+ * Rate limit of a codec (0 when none)
+ */
+unsigned decode_rate_limit(u8_t id) {
+	for (int i = 0; i < MAX_CODECS && load.codecs[i].id; i++) {
+		if (load.codecs[i].id == id) return load.codecs[i].limit;
+	}
+	return 0;
+}
+
+bool decode_limits_changed(void) {
+	bool changed = load.changed;
+	load.changed = false;
+	return changed;
+}
+
 static void *decode_thread() {
 	
 	while (running) {
-		size_t bytes, space, min_space;
+		size_t bytes, space, used, min_space;
 		bool toend;
-		bool ran = false;
+		bool ran = false, priming;
 		
 		LOCK_S;
 		bytes = _buf_used(streambuf);
@@ -66,6 +236,7 @@ static void *decode_thread() {
 		UNLOCK_S;
 		LOCK_O;
 		space = _buf_space(outputbuf);
+		used = output.state == OUTPUT_RUNNING ? _buf_used(outputbuf) : 0;
 		UNLOCK_O;
 
 		LOCK_D;
@@ -78,12 +249,26 @@ static void *decode_thread() {
 				min_space = codec->min_space;
 			);
 			IF_PROCESS(
-				min_space = process.max_out_frames * BYTES_PER_FRAME;
+				// one block may still be in the processing stage when the next one is decoded and a
+				// block larger than process buffer is pushed in chunks, but never ask for more than
+				// output can offer
+				unsigned chunks = (decode.max_block_frames + process.max_in_frames - 1) / process.max_in_frames;
+				if (!chunks) chunks = 1;
+				min_space = min((1 + chunks) * process.max_out_frames * BYTES_PER_FRAME, outputbuf->size * 3 / 4);
 			);
 
 			if (space > min_space && (bytes > codec->min_read_bytes || toend)) {
+				bool new_stream = decode.new_stream;
+				u8_t *writep = outputbuf->writep;
+				u32_t start = gettime_ms();
 				
 				decode.state = codec->decode();
+				
+				// first frames of a stream, what's left of previous track is how close we were from a gap
+				if (new_stream && !decode.new_stream && open_time) {
+					LOG_INFO("stream primed in %u ms, %u frames left to play", gettime_ms() - open_time, used / BYTES_PER_FRAME);
+					open_time = 0;
+				}	
 
 				IF_PROCESS(
 					if (process.in_frames) {
@@ -95,11 +280,16 @@ static void *decode_thread() {
 					}
 				);
 
+				// only decode thread moves writep (approximate when processing is pipelined)
+				load.busy += gettime_ms() - start;
+				load.frames += ((outputbuf->writep - writep + outputbuf->size) % outputbuf->size) / BYTES_PER_FRAME;
+
 				if (decode.state != DECODE_RUNNING) {
 
 					LOG_INFO("decode %s", decode.state == DECODE_COMPLETE ? "complete" : "error");
 
 					LOCK_O;
+					if (decode.state == DECODE_COMPLETE) decode_load();
 					if (output.fade_mode) _checkfade(false);
 					UNLOCK_O;
 
@@ -110,10 +300,12 @@ static void *decode_thread() {
 			}
 		}
 		
+		priming = decode.state == DECODE_READY || (decode.state == DECODE_RUNNING && decode.new_stream);
+		
 		UNLOCK_D;
 
 		if (!ran) {
-			usleep(100000);
+			usleep(priming ? PRIMING_WAIT : DECODE_WAIT);
 		}
 	}
 	
@@ -152,6 +344,9 @@ void decode_init(log_level level, const char *include_codecs, const char *exclud
 
 	LOG_INFO("init decode");
 
+	// rate limits measured in previous sessions
+	load_restore();
+
 	// register codecs
 	// dsf,dff,alc,wma,wmap,wmal,aac,spt,ogg,ogf,flc,aif,pcm,mp3
 	i = 0;
@@ -262,6 +457,8 @@ unsigned decode_newstream(unsigned sample_rate, unsigned supported_rates[]) {
 	// called with O locked to get sample rate for potentially processed output stream
 	// release O mutex during process_newstream as it can take some time
 
+	load.rate = sample_rate;
+
 	MAY_PROCESS(
 		if (decode.process) {
 			UNLOCK_O;
@@ -282,9 +479,12 @@ void codec_open(u8_t format, u8_t sample_size, u8_t sample_rate, u8_t channels,
 
 	decode.new_stream = true;
 	decode.state = DECODE_STOPPED;
+	open_time = gettime_ms();
+	load.busy = load.frames = load.rate = 0;
 
 	MAY_PROCESS(
 		decode.direct = true; // potentially changed within codec when processing enabled
+		decode.max_block_frames = 0;
 	);
 
 	// find the required codec
@@ -9,6 +9,7 @@
 #include <ctype.h>
 #include <math.h>
 #include "esp_dsp.h"
+#include "esp_heap_caps.h"
 #include "squeezelite.h"
 #include "slimproto.h"
 #include "display.h"
@@ -165,9 +166,13 @@ static struct scroller_s {
 
 static struct {
 	u8_t *data;
-	u32_t size;
+	u32_t size, length, pos;
 	u16_t x, y;
-	bool enable;
+	bool enable, busy, abort;
+	u32_t start;
+	size_t heap, min_heap;		// free heap before artwork buffer, lowest while decoding
+	TaskHandle_t task;
+	SemaphoreHandle_t ready, done;
 } artwork;
 
 #define MAX_BARS	32
@@ -200,6 +205,9 @@ extern const uint8_t vu_bitmap[]   asm("_binary_vu_data_start");
 #define ANIM_SCREEN_2     0x08 
 
 #define SCROLL_STACK_SIZE	(3*1024)
+#define ARTWORK_STACK_SIZE	(3*1024)
+#define ARTWORK_TIMEOUT		(5*1000)
+#define ARTWORK_DONE_WAIT	500
 #define LINELEN				40
 
 static log_level loglevel = lINFO;
@@ -223,6 +231,7 @@ static void grfg_handler(u8_t *data, int len);
 static void grfa_handler(u8_t *data, int len);
 static void visu_handler(u8_t *data, int len);
 static void displayer_task(void* arg);
+static void artwork_task(void* arg);
 
 /* scrolling undocumented information
 	grfs	
@@ -284,6 +293,8 @@ static void displayer_task(void* arg);
 bool sb_display_init(void) {
 	static DRAM_ATTR StaticTask_t xTaskBuffer __attribute__ ((aligned (4)));
 	static EXT_RAM_ATTR StackType_t xStack[SCROLL_STACK_SIZE] __attribute__ ((aligned (4)));
+	static DRAM_ATTR StaticTask_t xArtworkTaskBuffer __attribute__ ((aligned (4)));
+	static EXT_RAM_ATTR StackType_t xArtworkStack[ARTWORK_STACK_SIZE] __attribute__ ((aligned (4)));
 	
 	// no display, just make sure we won't have requests
 	if (!display || GDS_GetWidth(display) <= 0 || GDS_GetHeight(display) <= 0) {
@@ -315,6 +326,11 @@ bool sb_display_init(void) {
 	displayer.mutex = xSemaphoreCreateMutex();
 	displayer.task = xTaskCreateStatic( (TaskFunction_t) displayer_task, "displayer_thread", SCROLL_STACK_SIZE, NULL, ESP_TASK_PRIO_MIN + 1, xStack, &xTaskBuffer);
 	
+	// artwork is decoded while it is received, in its own task
+	artwork.ready = xSemaphoreCreateBinary();
+	artwork.done = xSemaphoreCreateBinary();
+	artwork.task = xTaskCreateStatic( (TaskFunction_t) artwork_task, "artwork_thread", ARTWORK_STACK_SIZE, NULL, ESP_TASK_PRIO_MIN + 1, xArtworkStack, &xArtworkTaskBuffer);
+	
 	// size scroller (width + current screen)
 	scroller.scroll.max = (displayer.width * displayer.height / 8) * (15 + 1);
 	scroller.scroll.frame = malloc(scroller.scroll.max);
@@ -788,6 +804,79 @@ static void grfg_handler(u8_t *data, int len) {
 }
 
 
+/****************************************************************************************
+ * Artwork data feeder, called by JPEG decoder which waits for data to be received. The 
+ * decoder owns displayer's mutex, which is released while waiting so that other display 
+ * updates (and slimproto thread) are not stalled by network
+ */
+static unsigned artwork_reader(void *arg, uint8_t *buf, unsigned len) {
+	len = min(len, artwork.length - artwork.pos);
+	
+	if (artwork.size < artwork.pos + len && !artwork.abort) {
+		xSemaphoreGive(displayer.mutex);
+		while (artwork.size < artwork.pos + len && !artwork.abort) {
+			if (xSemaphoreTake(artwork.ready, pdMS_TO_TICKS(ARTWORK_TIMEOUT)) != pdTRUE) break;
+		}	
+		xSemaphoreTake(displayer.mutex, portMAX_DELAY);
+	}	
+
+	// aborted or timeout
+	if (artwork.abort || artwork.size < artwork.pos + len) return 0;
+	
+	// decoder's scratch area is allocated by now
+	artwork.min_heap = min(artwork.min_heap, heap_caps_get_free_size(MALLOC_CAP_8BIT));
+	
+	if (buf) memcpy(buf, artwork.data + artwork.pos, len);
+	artwork.pos += len;
+	
+	return len;
+}
+
+/****************************************************************************************
+ * Artwork decoding task, starts as soon as first packet is received
+ */
+static void artwork_task(void *arg) {
+	while (1) {
+		bool success;
+		
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	
+		// framebuffer is shared with grfe/grfs/grfb handlers and displayer task
+		xSemaphoreTake(displayer.mutex, portMAX_DELAY);
+		GDS_ClearWindow(display, artwork.x, artwork.y, -1, -1, GDS_COLOR_BLACK);
+		success = GDS_DrawJPEGReader(display, artwork_reader, NULL, artwork.x, artwork.y, artwork.y < displayer.height ? (GDS_IMAGE_RIGHT | GDS_IMAGE_TOP) : GDS_IMAGE_CENTER);
+		xSemaphoreGive(displayer.mutex);
+		
+		if (success) {
+			LOG_INFO("artwork displayed in %u ms (%u/%u bytes received), peak heap %u bytes", gettime_ms() - artwork.start, 
+					 artwork.size, artwork.length, artwork.heap - artwork.min_heap);
+		} else if (!artwork.abort) {
+			LOG_WARN("artwork decoding failed");
+		}	
+		
+		xSemaphoreGive(artwork.done);
+	}	
+}
+
+/****************************************************************************************
+ * Wait for artwork decoder to complete (or abort it) and release data. When not aborting, 
+ * wait is bounded and release is deferred to next call if decoder is still busy
+ */
+static void artwork_release(bool abort) {
+	if (artwork.busy) {
+		artwork.abort = abort;
+		xSemaphoreGive(artwork.ready);
+		if (xSemaphoreTake(artwork.done, abort ? portMAX_DELAY : pdMS_TO_TICKS(ARTWORK_DONE_WAIT)) != pdTRUE) {
+			LOG_INFO("artwork still decoding, release deferred");
+			return;
+		}	
+		artwork.busy = artwork.abort = false;
+	}
+	
+	if (artwork.data) free(artwork.data);
+	artwork.data = NULL;
+}
+
 /****************************************************************************************
  * Artwork
  */
@@ -802,11 +891,16 @@ static void grfa_handler(u8_t *data, int len) {
 	
 	// just a config or an actual artwork	
 	if (length < 32) {
+		artwork_release(true);
 		if (artwork.enable) {
 			// this is just to specify artwork coordinates
 			artwork.x = htons(pkt->x);
 			artwork.y = htons(pkt->y);		
-		} else if (artwork.size) GDS_ClearWindow(display, artwork.x, artwork.y, -1, -1, GDS_COLOR_BLACK);
+		} else if (artwork.size) {
+			xSemaphoreTake(displayer.mutex, portMAX_DELAY);
+			GDS_ClearWindow(display, artwork.x, artwork.y, -1, -1, GDS_COLOR_BLACK);
+			xSemaphoreGive(displayer.mutex);
+		}	
 		
 		// done in any case
 		return;
@@ -814,28 +908,46 @@ static void grfa_handler(u8_t *data, int len) {
 	
 	// new grfa artwork, allocate memory
 	if (!offset) {	
+		// stop any ongoing decoding
+		artwork_release(true);
+		
 		// same trick to clean current/previous window
 		if (artwork.size) {
+			xSemaphoreTake(displayer.mutex, portMAX_DELAY);
 			GDS_ClearWindow(display, artwork.x, artwork.y, -1, -1, GDS_COLOR_BLACK);
+			xSemaphoreGive(displayer.mutex);
 			artwork.size = 0;
 		}
 		
 		// now use new parameters
 		artwork.x = htons(pkt->x);
 		artwork.y = htons(pkt->y);
-		if (artwork.data) free(artwork.data);
+		artwork.heap = artwork.min_heap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
 		artwork.data = malloc(length);
+		artwork.length = length;
+		artwork.pos = 0;
+		artwork.start = gettime_ms();
+	}	
+	
+	// missed beginning or corrupted packet
+	if (!artwork.data || offset + size > artwork.length) {
+		LOG_WARN("incorrect artwork packet o:%u s:%u l:%u", offset, size, artwork.length);
+		return;
 	}	
 	
-	// copy artwork data
+	// copy artwork data and let decoder know (it starts with first packet)
 	memcpy(artwork.data + offset, data + sizeof(struct grfa_packet), size);
 	artwork.size += size;
-	if (artwork.size == length) {
-		GDS_ClearWindow(display, artwork.x, artwork.y, -1, -1, GDS_COLOR_BLACK);
-		GDS_DrawJPEG(display, artwork.data, artwork.x, artwork.y, artwork.y < displayer.height ? (GDS_IMAGE_RIGHT | GDS_IMAGE_TOP) : GDS_IMAGE_CENTER);
-		free(artwork.data);
-		artwork.data = NULL;
-	} 
+	
+	if (!offset) {
+		artwork.busy = true;
+		xTaskNotifyGive(artwork.task);
+	} else {
+		xSemaphoreGive(artwork.ready);
+	}	
+	
+	// wait for decoder to finish before releasing data
+	if (artwork.size == length) artwork_release(false);
 	
 	LOG_INFO("gfra l:%u x:%hu, y:%hu, o:%u s:%u", length, artwork.x, artwork.y, offset, size);
 }
@@ -11,12 +11,16 @@
 #include "squeezelite.h"
 #include "pthread.h"
 #include "esp_pthread.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "esp_system.h"
 #include "esp_timer.h"
 #include "esp_wifi.h"
 #include "monitor.h"
+#include "config.h"
 
 mutex_type slimp_mutex;
+static log_level loglevel = lINFO;
 
 void get_mac(u8_t mac[]) {
     esp_read_mac(mac, ESP_MAC_WIFI_STA);
@@ -30,11 +34,46 @@ void *audio_calloc(size_t nmemb, size_t size) {
 	return calloc(nmemb, size);
 }
 
+/****************************************************************************************
+ * Get core affinity and priority of a thread from "thread_config" which is a list of 
+ * <name>=<core>[:<prio>]. Core -1 means no affinity. Values are unchanged if not set 
+ * or invalid (core must be < portNUM_PROCESSORS, prio < configMAX_PRIORITIES)
+ */
+void thread_config(char *name, int *core, int *prio) {
+	char *p, *config = config_alloc_get_default(NVS_TYPE_STR, "thread_config", "", 0);
+	size_t len = strlen(name);
+
+	if (!config) return;
+
+	for (p = config; (p = strcasestr(p, name)) != NULL; p += len) {
+		// must be a full word followed by '='
+		if ((p != config && p[-1] != ',' && p[-1] != ' ') || p[len] != '=') continue;
+		p += len + 1;
+		if (*p != ':' && *p != ',' && *p && core) {
+			int value = atoi(p);
+			if (value == -1) *core = tskNO_AFFINITY;
+			else if (value >= 0 && value < portNUM_PROCESSORS) *core = value;
+			else LOG_WARN("invalid core %d for %s", value, name);
+		}	
+		// priority must belong to this entry
+		p += strcspn(p, ":,");
+		if (*p == ':' && prio && p[1] && p[1] != ',') {
+			int value = atoi(p + 1);
+			if (value > 0 && value < configMAX_PRIORITIES) *prio = value;
+			else LOG_WARN("invalid priority %d for %s", value, name);
+		}	
+		break;
+	}
+
+	free(config);
+}
+
 int	pthread_create_name(pthread_t *thread, _CONST pthread_attr_t  *attr, 
 				   void *(*start_routine)( void * ), void *arg, char *name) {
 	esp_pthread_cfg_t cfg = esp_pthread_get_default_config(); 
 	cfg.thread_name = name; 
 	cfg.inherit_cfg = true; 
+	thread_config(name, &cfg.pin_to_core, &cfg.prio);
 	esp_pthread_set_cfg(&cfg); 
 	return pthread_create(thread, attr, start_routine, arg);
 }
@@ -30,6 +30,7 @@ typedef unsigned long long u64_t;
 #define STREAM_THREAD_STACK_SIZE  6 * 1024
 #define DECODE_THREAD_STACK_SIZE 16 * 1024
 #define OUTPUT_THREAD_STACK_SIZE  6 * 1024
+#define PROCESS_THREAD_STACK_SIZE 4 * 1024
 #define IR_THREAD_STACK_SIZE      6 * 1024
 
 // number of 5s times search for a server will happen beforee slimproto exits (0 = no limit)
@@ -52,6 +53,7 @@ uint32_t 	_gettime_ms_(void);
 
 int			pthread_create_name(pthread_t *thread, _CONST pthread_attr_t  *attr, 
 				   void *(*start_routine)( void * ), void *arg, char *name);
+void		thread_config(char *name, int *core, int *prio);
 
 // must provide	of #define as empty macros		
 void		embedded_init(void);
@@ -82,6 +84,8 @@ void 		output_visu_export(s16_t *frames, frames_t out_frames, u32_t rate, bool s
 void 		output_visu_init(log_level level);
 void 		output_visu_close(void);
 
+#include "overlay.h"
+
 // optional, please chain if used 
 bool		(*slimp_handler)(u8_t *data, int len);
 void 		(*slimp_loop)(void);
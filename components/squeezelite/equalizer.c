@@ -1,4 +1,4 @@
-/* 
+/*
  *  Squeezelite for esp32
  *
  *  (c) Philippe G. 2020, philippe_44@outlook.com
@@ -7,82 +7,232 @@
  *  https://opensource.org/licenses/MIT
  *
  */
- 
-#include "squeezelite.h" 
+
+#include <math.h>
+#include "squeezelite.h"
 #include "equalizer.h"
-#include "esp_equalizer.h"
- 
+#if EMBEDDED
+#include "config.h"
+#endif
+
+/*
+ A cascade of peaking biquads (RBJ cookbook) in transposed direct form II, one
+ per band. ESP32 has a single precision FPU so float is used for coefficients
+ and state. Any sample rate is supported, bands above 0.45 x rate are ignored.
+ Gain changes and rate changes do not reset the filters: gains move towards
+ their target by EQ_STEP dB per processed buffer and coefficients are re-
+ calculated for the bands that moved, so there is no click when user changes
+ settings. Bands at 0dB are bypassed.
+ Bands are octaves from 31Hz to 16kHz by default, but each band's center and Q 
+ can be set (parametric) using "equalizer" config "<freq>[:<q>],..." where an
+ empty entry keeps that band's default. Gains always come from LMS.
+*/
+
 #define EQ_BANDS	10
+#define EQ_STEP		1.0f
+#define EQ_Q		1.41f
+#define EQ_FREQ_MIN	10
+#define EQ_Q_MIN	0.1f
+#define EQ_Q_MAX	20.0f
+
+#if BYTES_PER_FRAME == 4
+#define EQ_SCALE	32768.0f
+#define EQ_MAX		32767.0f
+#else
+#define EQ_SCALE	2147483648.0f
+#define EQ_MAX		2147483520.0f
+#endif
 
 static log_level loglevel = lINFO;
- 
+
+static const float frequencies[EQ_BANDS] = { 31, 62, 125, 250, 500, 1000, 2000, 4000, 8000, 16000 };
+
+struct biquad_s {
+	float b0, b1, b2, a1, a2;
+	float z1[2], z2[2];
+	float gain, freq, q;
+	bool active;
+};
+
 static struct {
-	void *handle;
-	float gain[EQ_BANDS];
+	struct biquad_s band[EQ_BANDS];
+	float target[EQ_BANDS];
+	u32_t sample_rate;
 	bool update;
-} equalizer = { .update = true };
- 
+} equalizer;
+
 /****************************************************************************************
- * open equalizer
+ * calculate coefficients of a peaking filter
  */
-void equalizer_open(u32_t sample_rate) {
-	// in any case, need to clear update flag
-	equalizer.update = false;
-	
-	if (sample_rate != 11025 && sample_rate != 22050 && sample_rate != 44100 && sample_rate != 48000) {
-		LOG_WARN("equalizer only supports 11025, 22050, 44100 and 48000 sample rates, not %u", sample_rate);
-		return;
-	}	
-	
-	equalizer.handle = esp_equalizer_init(2, sample_rate, EQ_BANDS, 0);
-	    
-	if (equalizer.handle) {
-		bool active = false;
+static void biquad_peaking(struct biquad_s *biquad, float freq, float q, float gain, u32_t sample_rate) {
+	float A = powf(10.0f, gain / 40.0f);
+	float w0 = 2.0f * M_PI * freq / sample_rate;
+	float alpha = sinf(w0) / (2.0f * q);
+	float a0 = 1.0f + alpha / A;
+
+	biquad->b0 = (1.0f + alpha * A) / a0;
+	biquad->b1 = -2.0f * cosf(w0) / a0;
+	biquad->b2 = (1.0f - alpha * A) / a0;
+	biquad->a1 = biquad->b1;
+	biquad->a2 = (1.0f - alpha / A) / a0;
+}
+
+/****************************************************************************************
+ * (re)calculate one band, keeping its state unless it becomes active
+ */
+static void band_set(int i, float gain) {
+	struct biquad_s *band = equalizer.band + i;
+	bool active = gain != 0 && band->freq < 0.45f * equalizer.sample_rate;
+
+	// filter has not been running, don't start with old state
+	if (active && !band->active) {
+		memset(band->z1, 0, sizeof(band->z1));
+		memset(band->z2, 0, sizeof(band->z2));
+	}
+
+	band->gain = gain;
+	band->active = active;
+	if (active) biquad_peaking(band, band->freq, band->q, gain, equalizer.sample_rate);
+}
+
+/****************************************************************************************
+ * set bands center and Q from "<freq>[:<q>],..." (NULL for defaults)
+ */
+void equalizer_bands(const char *config) {
+	const char *p = config;
+
+	for (int i = 0; i < EQ_BANDS; i++) {
+		struct biquad_s *band = equalizer.band + i;
 		
-		for (int i = 0; i < EQ_BANDS; i++) {
-			esp_equalizer_set_band_value(equalizer.handle, equalizer.gain[i], i, 0);
-			esp_equalizer_set_band_value(equalizer.handle, equalizer.gain[i], i, 1);
-			active |= equalizer.gain[i] != 0;
+		band->freq = frequencies[i];
+		band->q = EQ_Q;
+
+		if (p && *p) {
+			char *end;
+			float freq = strtof(p, &end), q = EQ_Q;
+			
+			if (*end == ':') q = strtof(end + 1, &end);
+			
+			if (end != p && (freq < EQ_FREQ_MIN || q < EQ_Q_MIN || q > EQ_Q_MAX)) {
+				LOG_WARN("invalid band %d (%.0f Hz, Q=%.2f), using default", i, freq, q);
+			} else if (end != p) {
+				band->freq = freq;
+				band->q = q;
+			}	
+
+			p = strchr(p, ',');
+			if (p) p++;
 		}
-		
-		// do not activate equalizer if all gain are 0
-		if (!active) equalizer_close();
-		
-		LOG_INFO("equalizer initialized %u", active);
-	} else {
-		LOG_WARN("can't init equalizer");
-	}	
-}	
+
+		if (equalizer.sample_rate) band_set(i, band->gain);
+		LOG_DEBUG("band %d at %.0f Hz, Q=%.2f", i, band->freq, band->q);
+	}
+}
+
+/****************************************************************************************
+ * open equalizer (can be called at every rate change)
+ */
+void equalizer_open(u32_t sample_rate) {
+	if (sample_rate == equalizer.sample_rate) return;
+
+	// first use, get bands layout
+	if (!equalizer.band[0].freq) {
+#if EMBEDDED
+		char *config = config_alloc_get_default(NVS_TYPE_STR, "equalizer", "", 0);
+		equalizer_bands(config);
+		free(config);
+#else
+		equalizer_bands(NULL);
+#endif
+	}
+
+	equalizer.sample_rate = sample_rate;
+	for (int i = 0; i < EQ_BANDS; i++) band_set(i, equalizer.band[i].gain);
+
+	LOG_INFO("equalizer set for %u Hz", sample_rate);
+}
 
 /****************************************************************************************
  * close equalizer
  */
 void equalizer_close(void) {
-	if (equalizer.handle) {
-		esp_equalizer_uninit(equalizer.handle);
-		equalizer.handle = NULL;
-	}
-}	
+	for (int i = 0; i < EQ_BANDS; i++) equalizer.band[i].active = false;
+	equalizer.sample_rate = 0;
+}
 
 /****************************************************************************************
  * update equalizer gain
  */
 void equalizer_update(s8_t *gain) {
-	for (int i = 0; i < EQ_BANDS; i++) equalizer.gain[i] = gain[i];
+	for (int i = 0; i < EQ_BANDS; i++) equalizer.target[i] = gain[i];
 	equalizer.update = true;
 }
 
 /****************************************************************************************
- * process equalizer 
+ * move gains one step toward their target, returns true when all have reached it
+ */
+static bool equalizer_step(void) {
+	bool done = true;
+
+	for (int i = 0; i < EQ_BANDS; i++) {
+		float gain = equalizer.band[i].gain, target = equalizer.target[i];
+
+		if (gain == target) continue;
+
+		if (gain < target) gain = gain + EQ_STEP < target ? gain + EQ_STEP : target;
+		else gain = gain - EQ_STEP > target ? gain - EQ_STEP : target;
+
+		band_set(i, gain);
+		done &= gain == target;
+	}
+
+	return done;
+}
+
+/****************************************************************************************
+ * process equalizer
  */
 void equalizer_process(u8_t *buf, u32_t bytes, u32_t sample_rate) {
-	// don't want to process with output locked, so tak ethe small risk to miss one parametric update
+	ISAMPLE_T *samples = (ISAMPLE_T*) buf;
+	size_t count = bytes / sizeof(ISAMPLE_T);
+
+	if (sample_rate != equalizer.sample_rate) equalizer_open(sample_rate);
+
+	// don't want to process with output locked, so take the small risk to miss one parametric update
 	if (equalizer.update) {
-		equalizer_close();
-		equalizer_open(sample_rate);
+		equalizer.update = false;
+		if (!equalizer_step()) equalizer.update = true;
 	}
+
+	struct biquad_s *active[EQ_BANDS];
+	int bands = 0;
 	
-	if (equalizer.handle) {
-		esp_equalizer_process(equalizer.handle, buf, bytes, sample_rate, 2);
-	}	
-}
\ No newline at end of file
+	for (int i = 0; i < EQ_BANDS; i++) if (equalizer.band[i].active) active[bands++] = equalizer.band + i;
+	if (!bands) return;
+
+	// whole cascade is done in float and output is clipped only once
+	for (size_t n = 0; n < count; n++) {
+		int c = n & 0x01;
+		float y = samples[n] / EQ_SCALE;
+
+		for (int i = 0; i < bands; i++) {
+			struct biquad_s *band = active[i];
+			float x = y;
+
+			y = band->b0 * x + band->z1[c];
+			band->z1[c] = band->b1 * x - band->a1 * y + band->z2[c];
+			band->z2[c] = band->b2 * x - band->a2 * y;
+		}
+
+		y *= EQ_SCALE;
+		samples[n] = y > EQ_MAX ? EQ_MAX : (y < -EQ_SCALE ? -EQ_SCALE : y);
+	}
+
+	// avoid denormals when signal fades out
+	for (int i = 0; i < bands; i++) {
+		for (int c = 0; c < 2; c++) {
+			if (fabsf(active[i]->z1[c]) < 1e-15f) active[i]->z1[c] = 0;
+			if (fabsf(active[i]->z2[c]) < 1e-15f) active[i]->z2[c] = 0;
+		}
+	}
+}
@@ -13,4 +13,5 @@
 void equalizer_open(u32_t sample_rate);
 void equalizer_close(void);
 void equalizer_update(s8_t *gain);
+void equalizer_bands(const char *config);
 void equalizer_process(u8_t *buf, u32_t bytes, u32_t sample_rate);
@@ -108,17 +108,38 @@ extern struct processstate process;
 #define FLAC_A(h, a)     (h)->FLAC__ ## a
 #endif
 
+// interleave unrolled by 4 frames, remainder is done one by one
+#define INTERLEAVE(ALIGN) {						\
+	while (count >= 4) {						\
+		optr[0] = ALIGN(lptr[0]); optr[1] = ALIGN(rptr[0]);	\
+		optr[2] = ALIGN(lptr[1]); optr[3] = ALIGN(rptr[1]);	\
+		optr[4] = ALIGN(lptr[2]); optr[5] = ALIGN(rptr[2]);	\
+		optr[6] = ALIGN(lptr[3]); optr[7] = ALIGN(rptr[3]);	\
+		optr += 8; lptr += 4; rptr += 4; count -= 4;	\
+	}											\
+	while (count--) {							\
+		*optr++ = ALIGN(*lptr++);				\
+		*optr++ = ALIGN(*rptr++);				\
+	}											\
+}
+
 static FLAC__StreamDecoderReadStatus read_cb(const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *want, void *client_data) {
-	size_t bytes;
+	size_t bytes, cont;
 	bool end;
 
 	LOCK_S;
-	bytes = min(_buf_used(streambuf), _buf_cont_read(streambuf));
-	bytes = min(bytes, *want);
+	bytes = min(_buf_used(streambuf), *want);
 	end = (stream.state <= DISCONNECT && bytes == 0);
 
-	memcpy(buffer, streambuf->readp, bytes);
-	_buf_inc_readp(streambuf, bytes);
+	// serve the whole request even when it wraps to save a round trip in libFLAC
+	cont = min(bytes, _buf_cont_read(streambuf));
+	memcpy(buffer, streambuf->readp, cont);
+	_buf_inc_readp(streambuf, cont);
+	
+	if (bytes > cont) {
+		memcpy(buffer + cont, streambuf->readp, bytes - cont);
+		_buf_inc_readp(streambuf, bytes - cont);
+	}	
 	UNLOCK_S;
 
 	*want = bytes;
@@ -133,6 +154,11 @@ static FLAC__StreamDecoderWriteStatus write_cb(const FLAC__StreamDecoder *decode
 	unsigned bits_per_sample = frame->header.bits_per_sample;
 	unsigned channels = frame->header.channels;
 
+#if PROCESS
+	// in case STREAMINFO was missing or lying
+	if (frames > decode.max_block_frames) decode.max_block_frames = frames;
+#endif	
+
 	FLAC__int32 *lptr = (FLAC__int32 *)buffer[0];
 	FLAC__int32 *rptr = (FLAC__int32 *)buffer[channels > 1 ? 1 : 0];
 	
@@ -190,25 +216,13 @@ static FLAC__StreamDecoderWriteStatus write_cb(const FLAC__StreamDecoder *decode
 		count = f;
 				
 		if (bits_per_sample == 8) {
-			while (count--) {
-				*optr++ = ALIGN8(*lptr++);
-				*optr++ = ALIGN8(*rptr++);
-			}
+			INTERLEAVE(ALIGN8);
 		} else if (bits_per_sample == 16) {
-			while (count--) {
-				*optr++ = ALIGN16(*lptr++);
-				*optr++ = ALIGN16(*rptr++);
-			}
+			INTERLEAVE(ALIGN16);
 		} else if (bits_per_sample == 24) {
-			while (count--) {
-				*optr++ = ALIGN24(*lptr++);
-				*optr++ = ALIGN24(*rptr++);
-			}
+			INTERLEAVE(ALIGN24);
 		} else if (bits_per_sample == 32) {
-			while (count--) {
-				*optr++ = ALIGN32(*lptr++);
-				*optr++ = ALIGN32(*rptr++);
-			}
+			INTERLEAVE(ALIGN32);
 		} else {
 			LOG_ERROR("unsupported bits per sample: %u", bits_per_sample);
 		}
@@ -220,7 +234,8 @@ static FLAC__StreamDecoderWriteStatus write_cb(const FLAC__StreamDecoder *decode
 		);
 		IF_PROCESS(
 			process.in_frames = f;
-			if (frames) LOG_ERROR("unhandled case");
+			// block is larger than process buffer, push this chunk through (we have decode mutex)
+			if (frames) process_samples();
 		);
 	}
 
@@ -229,6 +244,16 @@ static FLAC__StreamDecoderWriteStatus write_cb(const FLAC__StreamDecoder *decode
 	return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
 
+static void metadata_cb(const FLAC__StreamDecoder *decoder, const FLAC__StreamMetadata *metadata, void *client_data) {
+#if PROCESS
+	// decoder must leave enough room in outputbuf for largest block to go through process
+	if (metadata->type == FLAC__METADATA_TYPE_STREAMINFO) {
+		decode.max_block_frames = metadata->data.stream_info.max_blocksize;
+		LOG_INFO("max blocksize: %u", decode.max_block_frames);
+	}	
+#endif	
+}
+
 static void error_cb(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status, void *client_data) {
 	LOG_INFO("flac error: %s", FLAC_A(f, StreamDecoderErrorStatusString)[status]);
 }
@@ -253,9 +278,9 @@ static void flac_open(u8_t sample_size, u8_t sample_rate, u8_t channels, u8_t en
 	
 	if ( f->container == 'o' ) {
 		LOG_INFO("ogg/flac container - using init_ogg_stream");
-		FLAC(f, stream_decoder_init_ogg_stream, f->decoder, &read_cb, NULL, NULL, NULL, NULL, &write_cb, NULL, &error_cb, NULL);
+		FLAC(f, stream_decoder_init_ogg_stream, f->decoder, &read_cb, NULL, NULL, NULL, NULL, &write_cb, &metadata_cb, &error_cb, NULL);
 	} else {
-		FLAC(f, stream_decoder_init_stream, f->decoder, &read_cb, NULL, NULL, NULL, NULL, &write_cb, NULL, &error_cb, NULL);
+		FLAC(f, stream_decoder_init_stream, f->decoder, &read_cb, NULL, NULL, NULL, NULL, &write_cb, &metadata_cb, &error_cb, NULL);
 	}
 }
 
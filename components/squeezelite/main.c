@@ -813,6 +813,12 @@ int main(int argc, char **argv) {
 	decode_close();
 	stream_close();
 
+#if RESAMPLE || RESAMPLE16
+	if (resample) {
+		process_close();
+	}
+#endif
+
 #if EMBEDDED
 	output_close_embedded();	
 #else
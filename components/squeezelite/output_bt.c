@@ -12,7 +12,11 @@
 #include "driver/gpio.h"
 #include "squeezelite.h"
 #include "equalizer.h"
+#include "bt_link.h"
 #include "perf_trace.h"
+#include "esp_pthread.h"
+#include "esp_heap_caps.h"
+#include "monitor.h"
 #include "config.h"
 
 extern struct outputstate output;
@@ -29,6 +33,24 @@ extern u8_t *silencebuf;
 
 #define STATS_REPORT_DELAY_MS 15000
 
+/*
+ BT stack pulls audio from its own task, with little time to spare. A render thread
+ does all the work (output buffer, crossfade, gain, overlay, equalizer) ahead of it
+ into a single producer / single consumer FIFO, so callback only has to copy. Indexes
+ are free-running byte counters, each one written by one side only.
+*/
+#define FIFO_SIZE	(16*1024)
+#define FIFO_BLOCK	(FIFO_SIZE / 8)
+#define FIFO_WAIT	10
+
+// link quality controller is in bt_link.c, level 1 is the historical 8 kB
+#define LINK_WINDOW_MAX	2000
+#define LINK_DEPTH(l)	(((l) + 1) * (FIFO_SIZE / LINK_LEVELS))
+
+// callback duration histogram upper bounds (us), last bin is everything above
+static const u32_t cb_bins[] = { 20, 50, 100, 200, 500 };
+#define CB_BINS		(sizeof(cb_bins) / sizeof(*cb_bins) + 1)
+
 extern void hal_bluetooth_init(const char * options);
 extern void hal_bluetooth_stop(void);
 extern u8_t config_spdif_gpio;
@@ -38,6 +60,26 @@ static bool running = false;
 static uint8_t *btout;
 static frames_t oframes;
 static bool stats;
+static pthread_t thread;
+
+static struct {
+	u8_t *buf;
+	u32_t wp, rp;
+	u32_t cut, last_cut;	// wp at last flush (render), last one applied (callback)
+	u32_t depth;
+	TaskHandle_t task;
+	u32_t underruns;
+	u32_t histogram[CB_BINS];
+} fifo;
+
+static struct {
+	struct link_s ctrl;
+	u32_t requested, gap;	// written by callback, reset by tick
+	int64_t last_cb;
+	u32_t underruns, time;	// at last tick
+} bt_link;
+
+static void *output_thread_bt(void *arg);
 
 static int _write_frames(frames_t out_frames, bool silence, s32_t gainL, s32_t gainR,
 								s32_t cross_gain_in, s32_t cross_gain_out, ISAMPLE_T **cross_ptr);
@@ -48,7 +90,8 @@ static int _write_frames(frames_t out_frames, bool silence, s32_t gainL, s32_t g
 	DECLARE_MIN_MAX(bt);\
 	DECLARE_MIN_MAX(under);\
 	DECLARE_MIN_MAX(stream_buf);\
-	DECLARE_MIN_MAX_DURATION(lock_out_time)								
+	DECLARE_MIN_MAX_DURATION(lock_out_time);\
+	DECLARE_MIN_MAX_DURATION(cb_time)
 	
 #define RESET_ALL_MIN_MAX \
 	RESET_MIN_MAX(bt);	\
@@ -56,15 +99,40 @@ static int _write_frames(frames_t out_frames, bool silence, s32_t gainL, s32_t g
 	RESET_MIN_MAX(rec);  \
 	RESET_MIN_MAX(under);  \
 	RESET_MIN_MAX(stream_buf); \
-	RESET_MIN_MAX_DURATION(lock_out_time)
+	RESET_MIN_MAX_DURATION(lock_out_time); \
+	RESET_MIN_MAX_DURATION(cb_time)
 	
 DECLARE_ALL_MIN_MAX;	
 	
 void output_init_bt(log_level level, char *device, unsigned output_buf_size, char *params, unsigned rates[], unsigned rate_delay, unsigned idle) {
 	loglevel = level;
-	running = true;
 	output.write_cb = &_write_frames;
+	
+	// FIFO is read by BT callback, keep it in internal RAM
+	fifo.buf = heap_caps_malloc(FIFO_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+	if (!fifo.buf) fifo.buf = malloc(FIFO_SIZE);
+	fifo.wp = fifo.rp = fifo.cut = fifo.last_cut = 0;
+	fifo.depth = LINK_DEPTH(LINK_START);
+	bt_link.ctrl = (struct link_s) { .level = LINK_START, .quality = 100 };
+	running = true;
+	
+	esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
+	
+	cfg.thread_name= "output_bt";
+	cfg.inherit_cfg = false;
+	cfg.prio = CONFIG_ESP32_PTHREAD_TASK_PRIO_DEFAULT + 1;
+	cfg.stack_size = PTHREAD_STACK_MIN + OUTPUT_THREAD_STACK_SIZE;
+	thread_config("output", &cfg.pin_to_core, &cfg.prio);
+	esp_pthread_set_cfg(&cfg);
+	pthread_create(&thread, NULL, output_thread_bt, NULL);
+	
 	hal_bluetooth_init(device);
+	
+	monitor_metric_add("output_bt_underruns_total", "BT callbacks not fully served from FIFO", true, &fifo.underruns, NULL);
+	monitor_metric_add("bt_link_quality_percent", "BT stack requests vs real time (smoothed)", false, &bt_link.ctrl.quality, NULL);
+	monitor_metric_add("bt_link_stalls_total", "BT heartbeats with a stall or an underrun", true, &bt_link.ctrl.stalls, NULL);
+	monitor_metric_add("bt_prebuffer_bytes", "BT FIFO pre-buffer depth", false, &fifo.depth, NULL);
+	
 	char *p = config_alloc_get_default(NVS_TYPE_STR, "stats", "n", 0);
 	stats = p && (*p == '1' || *p == 'Y' || *p == 'y');
 	free(p);
@@ -75,12 +143,18 @@ void output_close_bt(void) {
 	running = false;
 	UNLOCK;
 	hal_bluetooth_stop();
+	if (fifo.task) xTaskNotifyGive(fifo.task);
+	pthread_join(thread, NULL);
+	free(fifo.buf);
+	fifo.buf = NULL;
 	equalizer_close();
 }	
 
 static int _write_frames(frames_t out_frames, bool silence, s32_t gainL, s32_t gainR,
 						 s32_t cross_gain_in, s32_t cross_gain_out, ISAMPLE_T **cross_ptr) {
 	
+	bool overlay = _output_overlay_duck(&gainL, &gainR);
+	
 	assert(btout != NULL);
 	
 	if (!silence ) {
@@ -113,49 +187,172 @@ static int _write_frames(frames_t out_frames, bool silence, s32_t gainL, s32_t g
 		memcpy(btout + oframes * BYTES_PER_FRAME, buf, out_frames * BYTES_PER_FRAME);
 	}
 	
+#if BYTES_PER_FRAME == 4
+	if (overlay) _output_overlay_mix((ISAMPLE_T*) (btout + oframes * BYTES_PER_FRAME), out_frames);
+#else
+	(void) overlay;
+#endif	
+	
 	output_visu_export((s16_t*) (btout + oframes * BYTES_PER_FRAME), out_frames, output.current_sample_rate, silence, (gainL + gainR) / 2);
+	oframes += out_frames;
 
 	return (int)out_frames;
 }
 
+/****************************************************************************************
+ * Keep FIFO full of processed audio, it is woken up by callback when there is room
+ */
+static void *output_thread_bt(void *arg) {
+	int64_t start_timer;
+	output_state last_state = OUTPUT_OFF;
+	unsigned last_played = 0;
+	
+	fifo.task = xTaskGetCurrentTaskHandle();
+	
+	while (running) {
+		bool flushed;
+		
+		// output has been flushed (stop, seek...), what's in FIFO must not be played
+		LOCK;
+		flushed = output.state <= OUTPUT_STOPPED && !output.frames_played && (last_state > OUTPUT_STOPPED || last_played);
+		last_state = output.state;
+		last_played = output.frames_played;
+		UNLOCK;
+		
+		if (flushed) {
+			LOG_INFO("flushing FIFO (%u bytes)", fifo.wp - __atomic_load_n(&fifo.rp, __ATOMIC_ACQUIRE));
+			__atomic_store_n(&fifo.cut, fifo.wp, __ATOMIC_RELEASE);
+		}	
+		
+		u32_t used = fifo.wp - __atomic_load_n(&fifo.rp, __ATOMIC_ACQUIRE);
+		u32_t offset = fifo.wp % FIFO_SIZE;
+		u32_t depth = fifo.depth;
+		frames_t frames;
+		
+		// depth might just have been lowered below what is already rendered
+		if (used + FIFO_BLOCK > depth) {
+			ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(FIFO_WAIT));
+			continue;
+		}	
+		
+		// don't wrap, next iteration will do the rest
+		frames = min(depth - used, FIFO_SIZE - offset) / BYTES_PER_FRAME;
+		btout = fifo.buf + offset;
+		oframes = 0;
+		
+		TIME_MEASUREMENT_START(start_timer);
+		LOCK;
+		
+		// what has been rendered but not yet taken by BT is still to be played
+		output.device_frames = used / BYTES_PER_FRAME;
+		output.updated = gettime_ms();
+		output.frames_played_dmp = output.frames_played;
+		SET_MIN_MAX_SIZED(_buf_used(outputbuf),bt,outputbuf->size);
+		
+		while (oframes < frames && _output_frames(frames - oframes));
+		output.frames_in_process = oframes;
+		
+		UNLOCK;
+		SET_MIN_MAX(TIME_MEASUREMENT_GET(start_timer),lock_out_time);
+		SET_MIN_MAX(oframes * BYTES_PER_FRAME, rec);
+		
+		// nothing to render (output is off)
+		if (!oframes) {
+			usleep(FIFO_WAIT * 1000);
+			continue;
+		}	
+		
+		equalizer_process(btout, oframes * BYTES_PER_FRAME, output.current_sample_rate);
+		__atomic_store_n(&fifo.wp, fifo.wp + oframes * BYTES_PER_FRAME, __ATOMIC_RELEASE);
+	}
+	
+	fifo.task = NULL;
+	return NULL;
+}
+
+/****************************************************************************************
+ * BT stack data callback, only copies from FIFO
+ */
 int32_t output_bt_data(uint8_t *data, int32_t len) {
-	int32_t avail_data = 0, wanted_len = 0, start_timer = 0;
+	int64_t start_timer;
+	u32_t avail, offset, bytes, elapsed, cut;
+	int bin;
 
-	if (len < 0 || data == NULL || !running) {
+	if (len < 0 || data == NULL || !running || !fifo.buf) {
 		return 0;
 	}
 	
-	btout = data;
-	oframes = 0;
-
-	// This is how the BTC layer calculates the number of bytes to
-	// for us to send. (BTC_SBC_DEC_PCM_DATA_LEN * sizeof(OI_INT16) - availPcmBytes
-	wanted_len=len;
-	SET_MIN_MAX(len,req);
 	TIME_MEASUREMENT_START(start_timer);
-	LOCK;
-	output.device_frames = 0; // todo: check if this is the right way do to this.
-	output.updated = gettime_ms();
-	output.frames_played_dmp = output.frames_played;
-	SET_MIN_MAX_SIZED(_buf_used(outputbuf),bt,outputbuf->size);
-	do {
-		avail_data = _output_frames( wanted_len/BYTES_PER_FRAME )*BYTES_PER_FRAME; // Keep the transfer buffer full
-		wanted_len-=avail_data;
-	} while (wanted_len > 0 && avail_data != 0);
-	
-	if (wanted_len > 0) {
-		SET_MIN_MAX(wanted_len, under);
+	SET_MIN_MAX(len,req);
+	
+	// feed link quality estimation (longer gaps are pauses, not stalls), tick resets counters concurrently
+	if (start_timer - bt_link.last_cb < LINK_WINDOW_MAX * 1000) {
+		u32_t gap = start_timer - bt_link.last_cb, max = __atomic_load_n(&bt_link.gap, __ATOMIC_RELAXED);
+		while (gap > max && !__atomic_compare_exchange_n(&bt_link.gap, &max, gap, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	}	
+	bt_link.last_cb = start_timer;
+	__atomic_fetch_add(&bt_link.requested, len, __ATOMIC_RELAXED);
+	
+	// render thread wants what was rendered before a flush to be dropped
+	cut = __atomic_load_n(&fifo.cut, __ATOMIC_ACQUIRE);
+	if (cut != fifo.last_cut) {
+		if ((s32_t) (cut - fifo.rp) > 0) __atomic_store_n(&fifo.rp, cut, __ATOMIC_RELEASE);
+		fifo.last_cut = cut;
+	}	
+	
+	avail = __atomic_load_n(&fifo.wp, __ATOMIC_ACQUIRE) - fifo.rp;
+	offset = fifo.rp % FIFO_SIZE;
+	bytes = min(avail, len - len % BYTES_PER_FRAME);
+	
+	if (bytes > FIFO_SIZE - offset) {
+		memcpy(data, fifo.buf + offset, FIFO_SIZE - offset);
+		memcpy(data + FIFO_SIZE - offset, fifo.buf, bytes - (FIFO_SIZE - offset));
+	} else {
+		memcpy(data, fifo.buf + offset, bytes);
+	}	
+	
+	__atomic_store_n(&fifo.rp, fifo.rp + bytes, __ATOMIC_RELEASE);
+	
+	// render thread waits for room, it might be a bit early if it's still rendering
+	if (avail - bytes + FIFO_BLOCK <= fifo.depth && fifo.task) xTaskNotifyGive(fifo.task);
+	
+	// not playing is not an underrun (silence is rendered when stopped, nothing when off)
+	if (bytes < len && output.state == OUTPUT_RUNNING) {
+		fifo.underruns++;
+		SET_MIN_MAX(len - bytes, under);
 	}
-	output.frames_in_process = len-wanted_len;
 	
-	equalizer_process(data, (len - wanted_len) * BYTES_PER_FRAME, output.current_sample_rate);
-
-	UNLOCK;
-	SET_MIN_MAX(TIME_MEASUREMENT_GET(start_timer),lock_out_time);
-	SET_MIN_MAX((len-wanted_len), rec);
-	TIME_MEASUREMENT_START(start_timer);
+	elapsed = TIME_MEASUREMENT_GET(start_timer);
+	for (bin = 0; bin < CB_BINS - 1 && elapsed > cb_bins[bin]; bin++);
+	fifo.histogram[bin]++;
+	SET_MIN_MAX(elapsed, cb_time);
+	
+	return bytes;
+}
 
-	return len-wanted_len;
+/****************************************************************************************
+ * Measure last heartbeat window and adapt FIFO depth
+ */
+static void link_tick(void) {
+	u32_t now = gettime_ms(), elapsed = now - bt_link.time;
+	u32_t requested = __atomic_exchange_n(&bt_link.requested, 0, __ATOMIC_RELAXED);
+	u32_t gap = __atomic_exchange_n(&bt_link.gap, 0, __ATOMIC_RELAXED) / 1000;
+	u32_t underruns = fifo.underruns - bt_link.underruns;
+	
+	bt_link.underruns = fifo.underruns;
+	bt_link.time = now;
+	
+	// only grade steady playback windows (first one after a pause is meaningless)
+	if (output.state != OUTPUT_RUNNING || !output.current_sample_rate || elapsed > LINK_WINDOW_MAX) return;
+	
+	u32_t expected = (u64_t) elapsed * output.current_sample_rate / 1000 * BYTES_PER_FRAME;
+	
+	if (bt_link_update(&bt_link.ctrl, expected, requested, gap, underruns)) {
+		u32_t depth = fifo.depth;
+		fifo.depth = LINK_DEPTH(bt_link.ctrl.level);
+		LOG_INFO("BT link %s (quality:%u%%, gap:%ums, underruns:%u), pre-buffer %u => %u bytes", 
+				 fifo.depth > depth ? "degraded" : "stable", bt_link.ctrl.quality, gap, underruns, depth, fifo.depth);
+	}	
 }
 
 void output_bt_tick(void) {
@@ -163,6 +360,8 @@ void output_bt_tick(void) {
 	
 	if (!running) return;
 	
+	link_tick();
+	
 	LOCK_S;
     SET_MIN_MAX_SIZED(_buf_used(streambuf), stream_buf, streambuf->size);
     UNLOCK_S;
@@ -186,7 +385,12 @@ void output_bt_tick(void) {
 		LOG_INFO("              max (us)  | min (us) |   avg(us) |  count    |  ");
 		LOG_INFO("              ==========+==========+===========+===========+  ");
 		LOG_INFO(LINE_MIN_MAX_DURATION_FORMAT,LINE_MIN_MAX_DURATION("Out Buf Lock",lock_out_time));
+		LOG_INFO(LINE_MIN_MAX_DURATION_FORMAT,LINE_MIN_MAX_DURATION("BT callback",cb_time));
 		LOG_INFO("              ==========+==========+===========+===========+");
+		LOG_INFO("BT callback (us) <=%u:%u <=%u:%u <=%u:%u <=%u:%u <=%u:%u >%u:%u, underruns:%u", 
+				 cb_bins[0], fifo.histogram[0], cb_bins[1], fifo.histogram[1], cb_bins[2], fifo.histogram[2],
+				 cb_bins[3], fifo.histogram[3], cb_bins[4], fifo.histogram[4], cb_bins[4], fifo.histogram[5], fifo.underruns);
+		LOG_INFO("BT link quality:%u%%, stalls:%u, pre-buffer:%u bytes", bt_link.ctrl.quality, bt_link.ctrl.stalls, fifo.depth);
 		RESET_ALL_MIN_MAX;
 	}	
 }	
\ No newline at end of file
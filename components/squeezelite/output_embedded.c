@@ -8,11 +8,14 @@
  *  https://opensource.org/licenses/MIT
  *
  */
+#include <math.h>
 #include "squeezelite.h"
 #include "equalizer.h"
+#include "monitor.h"
 
 extern struct outputstate output;
 extern struct buffer *outputbuf;
+extern struct buffer *streambuf;
 
 static bool (*slimp_handler_chain)(u8_t *data, int len);
 
@@ -40,6 +43,23 @@ static log_level loglevel;
 static bool (*volume_cb)(unsigned left, unsigned right);
 static void (*close_cb)(void);
 
+/****************************************************************************************
+ * Overlay mixer: a secondary PCM source (alerts, TTS...) mixed on top of whatever is 
+ * played, with the main stream ducked. The writer pushes s16 frames at its own rate, 
+ * the output thread reads them with linear interpolation to the current output rate. 
+ * Nothing is done but testing a flag when no overlay is active
+ */
+#define OVERLAY_BUF_SIZE	(4096 * 4)
+
+static struct {
+	struct buffer buf;
+	bool active, draining;
+	u32_t step, phase;
+	s32_t gain, duck;
+	s16_t cur[2], next[2];
+	u32_t rate, out_rate;
+} overlay;
+
 #pragma pack(push, 1)
 struct eqlz_packet {
 	char  opcode[4];
@@ -64,6 +84,29 @@ static bool handler(u8_t *data, int len){
 	return res;
 }
 
+/****************************************************************************************
+ * buffers fill level for metrics, read unlocked as this is only an indication
+ */
+static uint32_t buffer_fill(struct buffer *buf) {
+	return buf && buf->size ? (uint32_t) (_buf_used(buf) * 100ULL / buf->size) : 0;
+}
+
+static uint32_t streambuf_fill(void) {
+	return buffer_fill(streambuf);
+}
+
+static uint32_t outputbuf_fill(void) {
+	return buffer_fill(outputbuf);
+}
+
+/****************************************************************************************
+ * audio ready to be played, used to decide when radio can go off-channel
+ */
+static int output_headroom(void) {
+	if (output.state < OUTPUT_BUFFER || !output.current_sample_rate) return -1;
+	return (u64_t) _buf_used(outputbuf) / BYTES_PER_FRAME * 1000 / output.current_sample_rate;
+}
+
 void output_init_embedded(log_level level, char *device, unsigned output_buf_size, char *params, 
 						  unsigned rates[], unsigned rate_delay, unsigned idle) {
 	loglevel = level;						
@@ -91,6 +134,10 @@ void output_init_embedded(log_level level, char *device, unsigned output_buf_siz
 	
 	output_visu_init(level);
 	
+	monitor_metric_add("streambuf_fill_percent", "Stream buffer fill level", false, NULL, streambuf_fill);
+	monitor_metric_add("outputbuf_fill_percent", "Output buffer fill level", false, NULL, outputbuf_fill);
+	audio_headroom_svc = output_headroom;
+	
 	LOG_INFO("init completed.");
 }	
 
@@ -99,6 +146,8 @@ void output_close_embedded(void) {
 	if (close_cb) (*close_cb)();		
 	output_close_common();
 	output_visu_close();
+	overlay.active = false;
+	buf_destroy(&overlay.buf);
 }
 
 void set_volume(unsigned left, unsigned right) { 
@@ -151,7 +200,260 @@ bool output_stopped(void) {
 	UNLOCK;
 	return state <= OUTPUT_STOPPED;
 }	
+
+/****************************************************************************************
+ * open an overlay source, unless one is already active when <exclusive> is set
+ */
+static bool overlay_open(u32_t sample_rate, s32_t gain, s32_t duck, bool exclusive) {
+	// allocation is done once, under output lock so that concurrent openers don't race
+	LOCK;
+	if (!overlay.buf.buf) buf_init(&overlay.buf, OVERLAY_BUF_SIZE);
+	UNLOCK;
+	
+	if (!overlay.buf.buf) {
+		LOG_ERROR("can't allocate overlay buffer");
+		return false;
+	}
+	
+	mutex_lock(overlay.buf.mutex);
+	if (exclusive && overlay.active) {
+		mutex_unlock(overlay.buf.mutex);
+		return false;
+	}	
+	_buf_flush(&overlay.buf);
+	overlay.rate = sample_rate;
+	overlay.out_rate = 0;
+	// need two source frames before producing anything
+	overlay.phase = 2 * FIXED_ONE;
+	overlay.gain = gain;
+	overlay.duck = duck;
+	memset(overlay.cur, 0, sizeof(overlay.cur));
+	memset(overlay.next, 0, sizeof(overlay.next));
+	overlay.draining = false;
+	overlay.active = true;
+	mutex_unlock(overlay.buf.mutex);
+	
+	LOG_INFO("overlay opened at %u Hz (gain:%d duck:%d)", sample_rate, gain, duck);
+	return true;
+}
+
+/****************************************************************************************
+ * open an overlay source, gains are FIXED_ONE based
+ */
+bool output_overlay_open(u32_t sample_rate, s32_t gain, s32_t duck) {
+	return overlay_open(sample_rate, gain, duck, false);
+}
+
+/****************************************************************************************
+ * change overlay gains on the fly (nothing to change if never opened)
+ */
+void output_overlay_gain(s32_t gain, s32_t duck) {
+	if (!overlay.buf.buf) return;
+	
+	mutex_lock(overlay.buf.mutex);
+	overlay.gain = gain;
+	overlay.duck = duck;
+	mutex_unlock(overlay.buf.mutex);
+}	
+
+/****************************************************************************************
+ * push mono or stereo s16 frames, returns how many frames have been accepted
+ */
+size_t output_overlay_write(s16_t *data, size_t frames, u8_t channels) {
+	size_t count;
+	
+	if (!overlay.active || overlay.draining) return 0;
+	
+	mutex_lock(overlay.buf.mutex);
+	count = frames = min(frames, _buf_space(&overlay.buf) / 4);
+	
+	while (count) {
+		size_t cont = min(count, _buf_cont_write(&overlay.buf) / 4);
+		s16_t *dst = (s16_t*) overlay.buf.writep;
+		
+		if (channels == 1) {
+			for (size_t i = 0; i < cont; i++, data++) {
+				*dst++ = *data;
+				*dst++ = *data;
+			}	
+		} else {
+			memcpy(dst, data, cont * 4);
+			data += cont * 2;
+		}
+		
+		_buf_inc_writep(&overlay.buf, cont * 4);
+		count -= cont;
+	}
+	
+	mutex_unlock(overlay.buf.mutex);
+	
+	return frames;
+}
+
+/****************************************************************************************
+ * close overlay, either immediately or once what has been written is played
+ */
+void output_overlay_close(bool drain) {
+	mutex_lock(overlay.buf.mutex);
+	if (drain) overlay.draining = true;
+	else overlay.active = false;
+	mutex_unlock(overlay.buf.mutex);
+	LOG_INFO("overlay closing (drain:%d)", drain);
+}
+
+/****************************************************************************************
+ * overlay status, used by output threads that otherwise idle
+ */
+bool output_overlay_active(void) {
+	return overlay.active;
+}
+
+/****************************************************************************************
+ * scale main stream gains if overlay is active (called with output locked)
+ */
+bool _output_overlay_duck(s32_t *gainL, s32_t *gainR) {
+	if (!overlay.active) return false;
+	
+	*gainL = gain(*gainL, overlay.duck);
+	*gainR = gain(*gainR, overlay.duck);
+	
+	return true;
+}
+
+/****************************************************************************************
+ * mix overlay into output frames (called with output locked)
+ */
+void _output_overlay_mix(ISAMPLE_T *dst, frames_t frames) {
+	s32_t g = overlay.gain;
+	
+	mutex_lock(overlay.buf.mutex);
+	
+	if (!overlay.active) {
+		mutex_unlock(overlay.buf.mutex);
+		return;
+	}
+	
+	// (re)calculate step from what we are actually playing
+	if (overlay.out_rate != output.current_sample_rate) {
+		overlay.out_rate = output.current_sample_rate;
+		overlay.step = ((u64_t) overlay.rate << 16) / (overlay.out_rate ? overlay.out_rate : overlay.rate);
+	}	
 	
+	while (frames) {
+		// move to next source frame(s)
+		while (overlay.phase >= FIXED_ONE) {
+			if (_buf_used(&overlay.buf) < 4) break;
+			s16_t *src = (s16_t*) overlay.buf.readp;
+			overlay.cur[0] = overlay.next[0];
+			overlay.cur[1] = overlay.next[1];
+			overlay.next[0] = src[0];
+			overlay.next[1] = src[1];
+			_buf_inc_readp(&overlay.buf, 4);
+			overlay.phase -= FIXED_ONE;
+		}	
+		
+		// starved, wait for writer or finish
+		if (overlay.phase >= FIXED_ONE) {
+			if (overlay.draining) {
+				overlay.active = false;
+				LOG_INFO("overlay done");
+			}	
+			break;
+		}	
+		
+		for (int i = 0; i < 2; i++, dst++) {
+			s32_t sample = overlay.cur[i] + (((overlay.next[i] - overlay.cur[i]) * (s32_t) (overlay.phase >> 1)) >> 15);
+#if BYTES_PER_FRAME == 4
+			sample = *dst + gain(g, sample);
+			*dst = sample > 32767 ? 32767 : (sample < -32768 ? -32768 : sample);
+#else
+			s64_t mix = (s64_t) *dst + gain(g, sample << 16);
+			*dst = mix > INT32_MAX ? INT32_MAX : (mix < INT32_MIN ? INT32_MIN : mix);
+#endif
+		}	
+		
+		overlay.phase += overlay.step;
+		frames--;
+	}
+	
+	mutex_unlock(overlay.buf.mutex);
+}
+
+/****************************************************************************************
+ * Chime: a decaying tone pushed through the overlay by its own (short-lived) thread
+ */
+#define CHIME_RATE		16000
+#define CHIME_BLOCK		256
+#define CHIME_MAX_MS	10000
 
+static struct {
+	unsigned freq, duration;
+} chime;
 
+static void *chime_thread(void *arg) {
+	s16_t block[CHIME_BLOCK];
+	u32_t total = chime.duration * CHIME_RATE / 1000, n = 0;
+	float phase = 0, w = 2.0f * M_PI * chime.freq / CHIME_RATE;
+	
+	while (n < total && output_overlay_active()) {
+		size_t count = min(CHIME_BLOCK, total - n), done = 0;
+		
+		for (size_t i = 0; i < count; i++, n++) {
+			block[i] = 16384.0f * (total - n) / total * sinf(phase);
+			phase += w;
+			if (phase > 2.0f * M_PI) phase -= 2.0f * M_PI;
+		}
+		
+		// overlay buffer holds 256ms at CHIME_RATE, then we follow output's pace
+		for (int wait = 50; done < count && output_overlay_active(); ) {
+			size_t written = output_overlay_write(block + done, count - done, 1);
+			done += written;
+			if (written) wait = 50;
+			else if (!wait--) break;
+			if (done < count) usleep(20000);
+		}	
+		
+		// output does not consume overlay (off or stalled), give up
+		if (done < count) {
+			output_overlay_close(false);
+			break;
+		}	
+	}
+	
+	if (output_overlay_active()) output_overlay_close(true);
+	LOG_INFO("chime done (%u/%u frames)", n, total);
+	
+	return NULL;
+}
 
+/****************************************************************************************
+ * play a chime of <freq> Hz for <duration> ms over whatever is playing
+ */
+bool output_overlay_chime(unsigned freq, unsigned duration) {
+	pthread_attr_t attr;
+	pthread_t thread;
+	
+	// no output thread to consume the overlay until output is initialized
+	if (!close_cb || !freq || freq >= CHIME_RATE / 2 || !duration) return false;
+	
+	// test and open atomically, so only one caller owns the overlay (and chime)
+	if (!overlay_open(CHIME_RATE, FIXED_ONE / 2, FIXED_ONE / 4, true)) {
+		LOG_WARN("overlay busy, no chime");
+		return false;
+	}
+	
+	chime.freq = freq;
+	chime.duration = min(duration, CHIME_MAX_MS);
+	
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, PTHREAD_STACK_MIN + 2048 + CHIME_BLOCK * sizeof(s16_t));
+	if (pthread_create_name(&thread, &attr, chime_thread, NULL, "chime")) {
+		LOG_ERROR("can't create chime thread");
+		output_overlay_close(false);
+	} else {
+		pthread_detach(thread);
+	}	
+	pthread_attr_destroy(&attr);
+	
+	return overlay.active;
+}
@@ -18,11 +18,13 @@ has been written (it uses a queue with produce / consume).
 The first hack is to consume that length at the beginning of tracks when
 synchronization is active. It's about ~180ms @ 44.1kHz
 
-The second hack is that we never know exactly the number of frames in the 
-DMA buffers when we update the output.frames_played_dmp. We assume that
-after i2s_write, these buffers are always full so by measuring the gap
-between time after i2s_write and update of frames_played_dmp, we have a
-good idea of the error. 
+The number of frames in the DMA buffers when we update the 
+output.frames_played_dmp is obtained by counting DMA descriptors completion
+events (I2S_EVENT_TX_DONE) against what has been written. As the driver is
+full when it starts, the ring holds LEN * COUNT frames plus what we wrote 
+minus what has been played. The output thread is paced by these events as 
+well and only feeds what the DMA has room for (by descriptors, up to a
+block) so that what we process reaches the DAC as soon as possible.
 
 The third hack is when sample rate changes, buffers are reset and we also
 do the change too early, but can't do that exaclty at the right time. So 
@@ -56,6 +58,16 @@ sure that using rate_delay would fix that
 #define DMA_BUF_LEN		512	
 #define DMA_BUF_COUNT	12
 
+// can be overloaded by "i2s_dma" config (len=<frames>,count=<n>,block=<frames>), a 
+// descriptor can't exceed 4092 bytes, so 1020 frames for 16 bits stereo (and spdif)
+#define DMA_BUF_LEN_MIN		64
+#define DMA_BUF_LEN_MAX		1020
+#define DMA_BUF_COUNT_MIN	2
+#define DMA_BUF_COUNT_MAX	32
+
+// gain changes and pause are done on a short ramp to avoid zipper noise and clicks
+#define RAMP_FRAMES		128
+
 #define DECLARE_ALL_MIN_MAX 	\
 	DECLARE_MIN_MAX(o); 		\
 	DECLARE_MIN_MAX(s); 		\
@@ -91,6 +103,18 @@ static u8_t *obuf;
 static frames_t oframes;
 static bool spdif;
 static size_t dma_buf_frames;
+static struct {
+	size_t len, count;		// true audio frames per descriptor, number of descriptors
+	size_t events;			// depth of driver's event queue
+	frames_t block;			// maximum frames processed at once
+	QueueHandle_t queue;
+	u32_t written, played;
+	u32_t underruns;
+} dma = { DMA_BUF_LEN, DMA_BUF_COUNT, FRAME_BLOCK };
+static struct {
+	s32_t gainL, gainR;		// last applied gain
+	u32_t time;				// time of last volume change
+} dezipper = { FIXED_ONE, FIXED_ONE };
 static pthread_t thread;
 static TaskHandle_t stats_task;
 static bool stats;
@@ -106,6 +130,7 @@ static int _i2s_write_frames(frames_t out_frames, bool silence, s32_t gainL, s32
 static void *output_thread_i2s(void *arg);
 static void output_thread_i2s_stats(void *arg);
 static void spdif_convert(ISAMPLE_T *src, size_t frames, u32_t *dst, size_t *count);
+static void dma_config(void);
 static void (*jack_handler_chain)(bool inserted);
 
 #define I2C_PORT	0
@@ -213,7 +238,8 @@ void output_init_i2s(log_level level, char *device, unsigned output_buf_size, ch
 
 	output.write_cb = &_i2s_write_frames;
 	
-	obuf = malloc(FRAME_BLOCK * BYTES_PER_FRAME);
+	dma_config();
+	obuf = malloc(dma.block * BYTES_PER_FRAME);
 	if (!obuf) {
 		LOG_ERROR("Cannot allocate i2s buffer");
 		return;
@@ -260,28 +286,31 @@ void output_init_i2s(log_level level, char *device, unsigned output_buf_size, ch
 		i2s_config.sample_rate = output.current_sample_rate * 2;
 		i2s_config.bits_per_sample = 32;
 		// Normally counted in frames, but 16 sample are transformed into 32 bits in spdif
-		i2s_config.dma_buf_len = DMA_BUF_LEN / 2;	
-		i2s_config.dma_buf_count = DMA_BUF_COUNT * 2;
+		i2s_config.dma_buf_len = dma.len / 2;	
+		i2s_config.dma_buf_count = dma.count * 2;
 		/* 
 		   In DMA, we have room for (LEN * COUNT) frames of 32 bits samples that 
 		   we push at sample_rate * 2. Each of these peuso-frames is a single true
 		   audio frame. So the real depth is true frames is (LEN * COUNT / 2)
 		*/   
-		dma_buf_frames = DMA_BUF_COUNT * DMA_BUF_LEN / 2;	
+		dma_buf_frames = dma.count * dma.len / 2;	
+		dma.len /= 4;
+		dma.count *= 2;
 		
 		// silence DAC output if sharing the same ws/bck
 		if (i2s_dac_pin.ws_io_num == i2s_spdif_pin.ws_io_num && i2s_dac_pin.bck_io_num == i2s_spdif_pin.bck_io_num)	silent_do = i2s_dac_pin.data_out_num;		
 		
-		res = i2s_driver_install(CONFIG_I2S_NUM, &i2s_config, 0, NULL);
+		dma.events = dma.count * 2;
+		res = i2s_driver_install(CONFIG_I2S_NUM, &i2s_config, dma.events, &dma.queue);
 		res |= i2s_set_pin(CONFIG_I2S_NUM, &i2s_spdif_pin);
 		LOG_INFO("SPDIF using I2S bck:%u, ws:%u, do:%u", i2s_spdif_pin.bck_io_num, i2s_spdif_pin.ws_io_num, i2s_spdif_pin.data_out_num);
 	} else {
 		i2s_config.sample_rate = output.current_sample_rate;
 		i2s_config.bits_per_sample = BYTES_PER_FRAME * 8 / 2;
 		// Counted in frames (but i2s allocates a buffer <= 4092 bytes)
-		i2s_config.dma_buf_len = DMA_BUF_LEN;	
-		i2s_config.dma_buf_count = DMA_BUF_COUNT;
-		dma_buf_frames = DMA_BUF_COUNT * DMA_BUF_LEN;	
+		i2s_config.dma_buf_len = dma.len;	
+		i2s_config.dma_buf_count = dma.count;
+		dma_buf_frames = dma.count * dma.len;	
 		
 		// silence SPDIF output
 		silent_do = i2s_spdif_pin.data_out_num;		
@@ -298,7 +327,8 @@ void output_init_i2s(log_level level, char *device, unsigned output_buf_size, ch
 		for (int i = 0; adac == &dac_external && dac_set[i]; i++) if (strcasestr(dac_set[i]->model, model)) adac = dac_set[i];
 		res = adac->init(dac_config, I2C_PORT, &i2s_config) ? ESP_OK : ESP_FAIL;
 
-		res |= i2s_driver_install(CONFIG_I2S_NUM, &i2s_config, 0, NULL);
+		dma.events = dma.count * 2;
+		res |= i2s_driver_install(CONFIG_I2S_NUM, &i2s_config, dma.events, &dma.queue);
 		res |= i2s_set_pin(CONFIG_I2S_NUM, &i2s_dac_pin);
 		
 		if (res == ESP_OK && mute_control.gpio >= 0) {
@@ -326,9 +356,9 @@ void output_init_i2s(log_level level, char *device, unsigned output_buf_size, ch
 		gpio_set_level(silent_do, 0);
 	}	
 
-	LOG_INFO("Initializing I2S mode %s with rate: %d, bits per sample: %d, buffer frames: %d, number of buffers: %d ", 
+	LOG_INFO("Initializing I2S mode %s with rate: %d, bits per sample: %d, buffer frames: %d, number of buffers: %d, block: %d", 
 			spdif ? "S/PDIF" : "normal", 
-			i2s_config.sample_rate, i2s_config.bits_per_sample, i2s_config.dma_buf_len, i2s_config.dma_buf_count);
+			i2s_config.sample_rate, i2s_config.bits_per_sample, i2s_config.dma_buf_len, i2s_config.dma_buf_count, dma.block);
 	
 	i2s_stop(CONFIG_I2S_NUM);
 	i2s_zero_dma_buffer(CONFIG_I2S_NUM);
@@ -352,9 +382,12 @@ void output_init_i2s(log_level level, char *device, unsigned output_buf_size, ch
     cfg.inherit_cfg = false;
 	cfg.prio = CONFIG_ESP32_PTHREAD_TASK_PRIO_DEFAULT + 1;
     cfg.stack_size = PTHREAD_STACK_MIN + OUTPUT_THREAD_STACK_SIZE;
+	thread_config("output", &cfg.pin_to_core, &cfg.prio);
     esp_pthread_set_cfg(&cfg);
 	pthread_create(&thread, NULL, output_thread_i2s, NULL);
 	
+	monitor_metric_add("output_dma_underruns_total", "I2S DMA underruns", true, &dma.underruns, NULL);
+	
 	// do we want stats
 	p = config_alloc_get_default(NVS_TYPE_STR, "stats", "n", 0);
 	stats = p && (*p == '1' || *p == 'Y' || *p == 'y');
@@ -392,7 +425,10 @@ void output_close_i2s(void) {
  */
 bool output_volume_i2s(unsigned left, unsigned right) {
 	if (mute_control.gpio >= 0) gpio_set_level(mute_control.gpio, (left | right) ? !mute_control.active : mute_control.active);
-	return adac->volume(left, right);
+	if (adac->volume(left, right)) return true;
+	// software volume, measure when it will be audible
+	dezipper.time = gettime_ms();
+	return false;
 } 
 
 /****************************************************************************************
@@ -400,31 +436,64 @@ bool output_volume_i2s(unsigned left, unsigned right) {
  */
 static int _i2s_write_frames(frames_t out_frames, bool silence, s32_t gainL, s32_t gainR,
 								s32_t cross_gain_in, s32_t cross_gain_out, ISAMPLE_T **cross_ptr) {
+	ISAMPLE_T *dst = (ISAMPLE_T*) (obuf + oframes * BYTES_PER_FRAME);	
+	frames_t ramp = 0, faded;
 #if BYTES_PER_FRAME == 8									
 	s32_t *optr;
 #endif	
+	// ducking is just a gain change, so it is ramped like any volume change
+	bool overlay = _output_overlay_duck(&gainL, &gainR);
 	
 	if (!silence) {
 		if (output.fade == FADE_ACTIVE && output.fade_dir == FADE_CROSS && *cross_ptr) {
 			_apply_cross(outputbuf, out_frames, cross_gain_in, cross_gain_out, cross_ptr);
 		}
 		
+		// gain has changed (or we were silent), ramp it once frames are in obuf
+		if (gainL != dezipper.gainL || gainR != dezipper.gainR) {
+			ramp = min(out_frames, RAMP_FRAMES);
+			if (dezipper.time) {
+				u32_t now = gettime_ms();
+				LOG_DEBUG("volume applied after %u ms, audible after %u ms", now - dezipper.time, 
+						  now - dezipper.time + output.device_frames * 1000 / output.current_sample_rate);
+				dezipper.time = 0;
+			}	
+		}	
+		
 #if BYTES_PER_FRAME == 4
-		if (gainL != FIXED_ONE || gainR!= FIXED_ONE) {
+		if (!ramp && (gainL != FIXED_ONE || gainR!= FIXED_ONE)) {
 			_apply_gain(outputbuf, out_frames, gainL, gainR);
 		}
 			
-		memcpy(obuf + oframes * BYTES_PER_FRAME, outputbuf->readp, out_frames * BYTES_PER_FRAME);
+		memcpy(dst, outputbuf->readp, out_frames * BYTES_PER_FRAME);
 #else
 		optr = (s32_t*) outputbuf->readp;	
 #endif		
 	} else {
+		// pausing when we were playing: micro fade-out of what is next, then consumed (not replayed)
+		if ((dezipper.gainL || dezipper.gainR) && (output.state == OUTPUT_STOPPED || output.state == OUTPUT_PAUSE_FRAMES)) {
+			ramp = min(min(out_frames, RAMP_FRAMES), _buf_cont_read(outputbuf) / BYTES_PER_FRAME);
+			// don't eat into next track
+			if (output.track_start && output.track_start > outputbuf->readp) {
+				ramp = min(ramp, (output.track_start - outputbuf->readp) / BYTES_PER_FRAME);
+			}	
+			LOG_DEBUG("pause fading over %u frames, audible after %u ms", ramp, gettime_ms() - output.stop_time + 
+					  output.device_frames * 1000 / output.current_sample_rate);
+		}	
+		
+		// silence has null gain so that resuming ramps up
+		gainL = gainR = 0;
+		
 #if BYTES_PER_FRAME == 4		
-		memcpy(obuf + oframes * BYTES_PER_FRAME, silencebuf, out_frames * BYTES_PER_FRAME);
+		memcpy(dst, silencebuf, out_frames * BYTES_PER_FRAME);
 #else		
 		optr = (s32_t*) silencebuf;
 #endif	
 	}
+	
+	// DSD can't be ramped
+	IF_DSD( if (output.outfmt != PCM) ramp = 0; )
+	faded = silence ? ramp : 0;
 
 #if BYTES_PER_FRAME == 8
 	IF_DSD(
@@ -434,35 +503,148 @@ static int _i2s_write_frames(frames_t out_frames, bool silence, s32_t gainL, s32
 			dsd_invert((u32_t *) optr, out_frames);
 	)
 
-	_scale_and_pack_frames(obuf + oframes * BYTES_PER_FRAME, optr, out_frames, gainL, gainR, output.format);
+	if ((overlay || ramp) IF_DSD( && output.outfmt == PCM )) {
+		// ramp and overlay work on ISAMPLE_T, so do them in dst and then pack in place 
+		memcpy(dst, optr, out_frames * BYTES_PER_FRAME);
+		// fade-out source is what would have been played next
+		if (ramp && silence) memcpy(dst, outputbuf->readp, ramp * BYTES_PER_FRAME);
+		_apply_gain_ramp_and_pack(dst, out_frames, ramp, dezipper.gainL, dezipper.gainR, gainL, gainR,
+								  overlay ? _output_overlay_mix : NULL, output.format);
+	} else {	
+		_scale_and_pack_frames(dst, optr, out_frames, gainL, gainR, output.format);
+	}	
+#else
+	if (ramp) {
+		// fade-out source is what would have been played next
+		if (silence) memcpy(dst, outputbuf->readp, ramp * BYTES_PER_FRAME);
+		_apply_gain_ramp(dst, silence ? ramp : out_frames, ramp, dezipper.gainL, dezipper.gainR, gainL, gainR);
+	}	
+
+	// dst is still ISAMPLE_T (nothing is packed) so overlay goes last
+	if (overlay) _output_overlay_mix(dst, out_frames);
 #endif	
+	
+	// faded-out frames have been played
+	if (faded) {
+		_buf_inc_readp(outputbuf, faded * BYTES_PER_FRAME);
+		output.frames_played += faded;
+	}	
+	
+	dezipper.gainL = gainL;
+	dezipper.gainR = gainR;
 
-	output_visu_export((s16_t*) (obuf + oframes * BYTES_PER_FRAME), out_frames, output.current_sample_rate, silence, (gainL + gainR) / 2);
+	output_visu_export((s16_t*) dst, out_frames, output.current_sample_rate, silence, (gainL + gainR) / 2);
 
 	oframes += out_frames;
 	
 	return out_frames;
 }
 
+/****************************************************************************************
+ * Get DMA sizing from config
+ */
+static void dma_config(void) {
+	char *p, *config = config_alloc_get_default(NVS_TYPE_STR, "i2s_dma", "", 0);
+	
+	if (config) {
+		if ((p = strcasestr(config, "len")) != NULL && (p = strchr(p, '=')) != NULL) dma.len = atoi(p + 1);
+		if ((p = strcasestr(config, "count")) != NULL && (p = strchr(p, '=')) != NULL) dma.count = atoi(p + 1);
+		if ((p = strcasestr(config, "block")) != NULL && (p = strchr(p, '=')) != NULL) dma.block = atoi(p + 1);
+		free(config);
+	}	
+	
+	// length must be a multiple of 4 (spdif), fit in a descriptor and block a multiple of length 
+	size_t len = dma.len;
+	dma.len = dma.len < DMA_BUF_LEN_MIN ? DMA_BUF_LEN_MIN : min(dma.len, DMA_BUF_LEN_MAX) & ~0x03;
+	if (dma.len != len) LOG_WARN("DMA length %d clamped to %d frames", (int) len, (int) dma.len);
+	dma.count = dma.count < DMA_BUF_COUNT_MIN ? DMA_BUF_COUNT_MIN : min(dma.count, DMA_BUF_COUNT_MAX);
+	dma.block = dma.block < dma.len ? dma.len : min(dma.block, MAX_SILENCE_FRAMES);
+	dma.block -= dma.block % dma.len;
+}
+
+/****************************************************************************************
+ * Reset DMA accounting: when (re)started, driver is full 
+ */
+static void dma_reset(void) {
+	xQueueReset(dma.queue);
+	dma.written = dma.played = 0;
+}
+
+/****************************************************************************************
+ * Frames queued in DMA and not played yet (in true audio frames)
+ */
+static frames_t dma_pending(void) {
+	i2s_event_t event;
+	s32_t pending;
+	
+	/* 
+	   Driver drops the oldest event when its queue is full. That happens only when at least 
+	   twice the ring has been played since we last looked, so all we gave is gone and counting
+	   is lost: resync as starved 
+	*/   
+	if (uxQueueMessagesWaiting(dma.queue) >= dma.events) {
+		xQueueReset(dma.queue);
+		dma.underruns++;
+		dma.played = dma.len * dma.count + dma.written;
+		return 0;
+	}
+	
+	while (xQueueReceive(dma.queue, &event, 0) == pdTRUE) {
+		if (event.type == I2S_EVENT_TX_DONE) dma.played += dma.len;
+	}	
+	
+	pending = dma.len * dma.count + dma.written - dma.played;
+	
+	// DMA has played more than what we gave, so we are starving
+	if (pending < 0) {
+		dma.underruns++;
+		dma.played = dma.len * dma.count + dma.written;
+		pending = 0;
+	}
+	
+	return pending;
+}
+
+/****************************************************************************************
+ * Wait for room for at least one descriptor in DMA and return how much (up to a block)
+ */
+static frames_t dma_room(void) {
+	i2s_event_t event;
+	s32_t room = dma.len * dma.count - dma_pending();
+	
+	while (room < (s32_t) dma.len && running) {
+		// driver sends an event every time a descriptor has been consumed
+		if (xQueueReceive(dma.queue, &event, pdMS_TO_TICKS(100)) == pdTRUE && event.type == I2S_EVENT_TX_DONE) {
+			dma.played += dma.len;
+		}	
+		room = dma.len * dma.count - dma_pending();
+	}
+		
+	if (room < (s32_t) dma.len) return 0;
+	return min(room - room % dma.len, dma.block);
+}
+
 /****************************************************************************************
  * Main output thread
  */
 static void *output_thread_i2s(void *arg) {
 	size_t count = 0, bytes;
-	frames_t iframes = FRAME_BLOCK;
+	frames_t iframes = dma.block;
 	uint32_t timer_start = 0;
 	int discard = 0;
-	uint32_t fullness = gettime_ms();
 	bool synced;
 	output_state state = OUTPUT_OFF - 1;
 	char *sbuf = NULL;
 	
 	// spdif needs 16 bytes per frame : 32 bits/sample, 2 channels, BMC encoded
-	if (spdif && (sbuf = malloc(FRAME_BLOCK * 16)) == NULL) {
+	if (spdif && (sbuf = malloc(dma.block * 16)) == NULL) {
 		LOG_ERROR("Cannot allocate SPDIF buffer");
 	}
 	
 	while (running) {
+		
+		// paced by DMA, feed only what it can take (when started, otherwise a full block)
+		frames_t room = isI2SStarted ? dma_room() : dma.block;
 			
 		TIME_MEASUREMENT_START(timer_start);
 
@@ -485,7 +667,7 @@ static void *output_thread_i2s(void *arg) {
 		}
 		state = output.state;
 		
-		if (output.state == OUTPUT_OFF) {
+		if (output.state == OUTPUT_OFF && !output_overlay_active()) {
 			UNLOCK;
 			if (isI2SStarted) {
 				isI2SStarted = false;
@@ -502,8 +684,9 @@ static void *output_thread_i2s(void *arg) {
 		oframes = 0;
 		output.updated = gettime_ms();
 		output.frames_played_dmp = output.frames_played;
-		// try to estimate how much we have consumed from the DMA buffer (calculation is incorrect at the very beginning ...)
-		output.device_frames = dma_buf_frames - ((output.updated - fullness) * output.current_sample_rate) / 1000;
+		// exact count of what is still queued in DMA (driver is full at the very beginning)
+		output.device_frames = isI2SStarted ? dma_pending() : dma_buf_frames;
+		if (!discard) iframes = room;
 		_output_frames( iframes );
 		// oframes must be a global updated by the write callback
 		output.frames_in_process = oframes;
@@ -521,7 +704,7 @@ static void *output_thread_i2s(void *arg) {
 			synced = true;
 		} else if (discard) {
 			discard -= oframes;
-			iframes = discard ? min(FRAME_BLOCK, discard) : FRAME_BLOCK;
+			iframes = discard ? min(dma.block, discard) : dma.block;
 			UNLOCK;
 			continue;
 		}
@@ -535,6 +718,7 @@ static void *output_thread_i2s(void *arg) {
 			isI2SStarted = true;
 			LOG_INFO("Restarting I2S.");
 			i2s_zero_dma_buffer(CONFIG_I2S_NUM);
+			dma_reset();
 			i2s_start(CONFIG_I2S_NUM);
 			adac->power(ADAC_ON);	
 			if (amp_control.gpio != -1) gpio_set_level(amp_control.gpio, amp_control.active);
@@ -553,13 +737,11 @@ static void *output_thread_i2s(void *arg) {
 			i2s_config.sample_rate = output.current_sample_rate;
 			i2s_set_sample_rates(CONFIG_I2S_NUM, spdif ? i2s_config.sample_rate * 2 : i2s_config.sample_rate);
 			i2s_zero_dma_buffer(CONFIG_I2S_NUM);
-			
-			equalizer_close();
-			equalizer_open(output.current_sample_rate);
+			dma_reset();
 			//return;
 		}
 		
-		// run equalizer
+		// run equalizer (follows sample rate changes without losing its state)
 		equalizer_process(obuf, oframes * BYTES_PER_FRAME, output.current_sample_rate);
 		
 		// we assume that here we have been able to entirely fill the DMA buffers
@@ -575,7 +757,7 @@ static void *output_thread_i2s(void *arg) {
 			i2s_write(CONFIG_I2S_NUM, obuf, oframes * BYTES_PER_FRAME, &bytes, portMAX_DELAY);
 		}
 
-		fullness = gettime_ms();
+		dma.written += oframes;
 			
 		if (bytes != oframes * BYTES_PER_FRAME) {
 			LOG_WARN("I2S DMA Overflow! available bytes: %d, I2S wrote %d bytes", oframes * BYTES_PER_FRAME, bytes);
@@ -609,6 +791,7 @@ static void output_thread_i2s_stats(void *arg) {
 			LOG_INFO(LINE_MIN_MAX_FORMAT_FOOTER);
 			LOG_INFO(LINE_MIN_MAX_FORMAT,LINE_MIN_MAX("received",rec));
 			LOG_INFO(LINE_MIN_MAX_FORMAT_FOOTER);
+			LOG_INFO("DMA underruns: %u", dma.underruns);
 			LOG_INFO("");
 			LOG_INFO("              ----------+----------+-----------+-----------+  ");
 			LOG_INFO("              max (us)  | min (us) |   avg(us) |  count    |  ");
@@ -370,3 +370,35 @@ void _apply_gain(struct buffer *outputbuf, frames_t count, s32_t gainL, s32_t ga
 	}
 }
 
+/*
+ * Ramp linearly from one gain to another over the first frames, then apply 
+ * target gain on the remaining ones (ptr is interleaved L/R)
+ */
+void _apply_gain_ramp(ISAMPLE_T *ptr, frames_t count, frames_t ramp, s32_t fromL, s32_t fromR, s32_t toL, s32_t toR) {
+	frames_t i;
+	
+	for (i = 0; i < ramp && i < count; i++) {
+		*ptr = gain(fromL + (s32_t) (((s64_t) (toL - fromL) * i) / ramp), *ptr); ptr++;
+		*ptr = gain(fromR + (s32_t) (((s64_t) (toR - fromR) * i) / ramp), *ptr); ptr++;
+	}
+	
+	if (toL == FIXED_ONE && toR == FIXED_ONE) return;
+	
+	for (; i < count; i++) {
+		*ptr = gain(toL, *ptr); ptr++;
+		*ptr = gain(toR, *ptr); ptr++;
+	}
+}
+
+#if BYTES_PER_FRAME == 8
+/*
+ * Gain (ramp) and optional <mix> are done on ISAMPLE_T, so before frames are packed in 
+ * place to <format> (which for anything but S32_LE is no more ISAMPLE_T)
+ */
+void _apply_gain_ramp_and_pack(ISAMPLE_T *ptr, frames_t count, frames_t ramp, s32_t fromL, s32_t fromR, s32_t toL, s32_t toR,
+							   void (*mix)(ISAMPLE_T *ptr, frames_t count), output_format format) {
+	_apply_gain_ramp(ptr, count, ramp, fromL, fromR, toL, toR);
+	if (mix) mix(ptr, count);
+	if (format != S32_LE) _scale_and_pack_frames(ptr, (s32_t*) ptr, count, FIXED_ONE, FIXED_ONE, format);
+}
+#endif
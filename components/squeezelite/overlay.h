@@ -0,0 +1,24 @@
+/* 
+ *  Squeezelite for esp32
+ *
+ *  (c) Philippe G. 2020, philippe_44@outlook.com
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+ 
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// secondary source mixed over the main one (s16, any rate, gains are FIXED_ONE based)
+// self-contained so that it can be used without squeezelite.h (e.g. console commands)
+bool		output_overlay_open(uint32_t sample_rate, int32_t gain, int32_t duck);
+void		output_overlay_gain(int32_t gain, int32_t duck);
+size_t		output_overlay_write(int16_t *data, size_t frames, uint8_t channels);
+void		output_overlay_close(bool drain);
+bool		output_overlay_active(void);
+bool		output_overlay_chime(unsigned freq, unsigned duration);
@@ -47,11 +47,31 @@ extern struct codec *codec;
 #define INIT_FUNC    resample_init
 #endif
 
+// when threads are available, processing is a pipeline stage of its own so that decode of 
+// next block can happen (on the other core) while current block is being processed
+#if LINUX || OSX || FREEBSD || EMBEDDED
+#define PROCESS_THREAD 1
+#ifndef PROCESS_THREAD_STACK_SIZE
+#define PROCESS_THREAD_STACK_SIZE	DECODE_THREAD_STACK_SIZE / 4
+#endif
+
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	thread_type thread;
+	bool running, busy;
+	u8_t *spare;
+	struct processstate job;
+} stage;
+#else
+#define PROCESS_THREAD 0
+#endif
+
 
 // transfer all processed frames to the output buf
-static void _write_samples(void) {
-	frames_t frames = process.out_frames;
-	ISAMPLE_T *iptr   = (ISAMPLE_T *) process.outbuf;
+static void _write_samples(struct processstate *process) {
+	frames_t frames = process->out_frames;
+	ISAMPLE_T *iptr   = (ISAMPLE_T *) process->outbuf;
 	unsigned cnt  = 10;
 
 	LOCK_O;
@@ -91,12 +111,81 @@ static void _write_samples(void) {
 	UNLOCK_O;
 }
 
+#if PROCESS_THREAD
+// processing stage - only uses the job it has been given and never takes decode mutex
+static void *process_thread(void *arg) {
+
+	pthread_mutex_lock(&stage.mutex);
+
+	while (stage.running) {
+
+		if (!stage.busy) {
+			pthread_cond_wait(&stage.cond, &stage.mutex);
+			continue;
+		}
+
+		pthread_mutex_unlock(&stage.mutex);
+
+		SAMPLES_FUNC(&stage.job);
+
+		_write_samples(&stage.job);
+
+		pthread_mutex_lock(&stage.mutex);
+		stage.busy = false;
+		pthread_cond_broadcast(&stage.cond);
+	}
+
+	pthread_mutex_unlock(&stage.mutex);
+
+	return 0;
+}
+
+// wait for processing stage to be idle - called with decode mutex set
+static void _stage_sync(void) {
+
+	if (!stage.running) return;
+
+	pthread_mutex_lock(&stage.mutex);
+
+	while (stage.busy) pthread_cond_wait(&stage.cond, &stage.mutex);
+
+	process.total_in += stage.job.total_in;
+	process.total_out += stage.job.total_out;
+	stage.job.total_in = stage.job.total_out = 0;
+
+	pthread_mutex_unlock(&stage.mutex);
+}
+#else
+#define _stage_sync()
+#endif
+
 // process samples - called with decode mutex set
 void process_samples(void) {
 
+#if PROCESS_THREAD
+	if (stage.running && stage.spare) {
+		u8_t *inbuf = process.inbuf;
+
+		_stage_sync();
+
+		// give filled buffer to processing stage and let decoder continue with the spare one
+		pthread_mutex_lock(&stage.mutex);
+		stage.job = process;
+		stage.job.total_in = stage.job.total_out = 0;
+		process.inbuf = stage.spare;
+		stage.spare = inbuf;
+		stage.busy = true;
+		pthread_cond_broadcast(&stage.cond);
+		pthread_mutex_unlock(&stage.mutex);
+
+		process.in_frames = 0;
+		return;
+	}
+#endif
+
 	SAMPLES_FUNC(&process);
 
-	_write_samples();
+	_write_samples(&process);
 
 	process.in_frames = 0;
 }
@@ -105,11 +194,13 @@ void process_samples(void) {
 void process_drain(void) {
 	bool done;
 
+	_stage_sync();
+
 	do {
 
 		done = DRAIN_FUNC(&process);
 
-		_write_samples();
+		_write_samples(&process);
 
 	} while (!done);
 
@@ -119,7 +210,11 @@ void process_drain(void) {
 // new stream - called with decode mutex set
 unsigned process_newstream(bool *direct, unsigned raw_sample_rate, unsigned supported_rates[]) {
 
-	bool active = NEWSTREAM_FUNC(&process, raw_sample_rate, supported_rates);
+	bool active;
+
+	_stage_sync();
+
+	active = NEWSTREAM_FUNC(&process, raw_sample_rate, supported_rates);
 
 	LOG_INFO("processing: %s", active ? "active" : "inactive");
 
@@ -146,6 +241,13 @@ unsigned process_newstream(bool *direct, unsigned raw_sample_rate, unsigned supp
 			if (process.inbuf) free(process.inbuf);
 			process.inbuf = malloc(max_in_frames * BYTES_PER_FRAME);
 			process.max_in_frames = max_in_frames;
+#if PROCESS_THREAD
+			// not fatal, processing will just not be pipelined
+			if (stage.running) {
+				if (stage.spare) free(stage.spare);
+				stage.spare = malloc(max_in_frames * BYTES_PER_FRAME);
+			}
+#endif
 		}
 		
 		if (process.max_out_frames != max_out_frames) {
@@ -172,6 +274,8 @@ void process_flush(void) {
 
 	LOG_INFO("process flush");
 
+	_stage_sync();
+
 	FLUSH_FUNC();
 
 	process.in_frames = 0;
@@ -189,6 +293,46 @@ void process_init(char *opt) {
 		decode.process = true;
 		UNLOCK_D;
 	}
+
+#if PROCESS_THREAD
+	if (enabled) {
+		pthread_attr_t attr;
+
+		pthread_mutex_init(&stage.mutex, NULL);
+		pthread_cond_init(&stage.cond, NULL);
+		stage.running = true;
+
+		pthread_attr_init(&attr);
+#ifdef PTHREAD_STACK_MIN
+		pthread_attr_setstacksize(&attr, PTHREAD_STACK_MIN + PROCESS_THREAD_STACK_SIZE);
+#endif
+		if (pthread_create_name(&stage.thread, &attr, process_thread, NULL, "process")) {
+			LOG_WARN("cannot create process thread, processing will be done in decode thread");
+			stage.running = false;
+		}
+		pthread_attr_destroy(&attr);
+	}
+#endif
+}
+
+// close - called with no mutex
+void process_close(void) {
+
+#if PROCESS_THREAD
+	if (!stage.running) return;
+
+	pthread_mutex_lock(&stage.mutex);
+	stage.running = false;
+	pthread_cond_broadcast(&stage.cond);
+	pthread_mutex_unlock(&stage.mutex);
+
+	pthread_join(stage.thread, NULL);
+	pthread_cond_destroy(&stage.cond);
+	pthread_mutex_destroy(&stage.mutex);
+
+	if (stage.spare) free(stage.spare);
+	stage.spare = NULL;
+#endif
 }
 
 #endif // #if PROCESS
@@ -543,8 +543,13 @@ static struct handler handlers[] = {
 	{ "",     NULL  },
 };
 
+// commands that take longer than this delay STAT and following commands
+#define SLOW_HANDLER_MS	50
+
 static void process(u8_t *pack, int len) {
 	struct handler *h = handlers;
+	u32_t start = gettime_ms(), elapsed;
+	
 	while (h->handler && strncmp((char *)pack, h->opcode, 4)) { h++; }
 
 	if (h->handler) {
@@ -553,7 +558,16 @@ static void process(u8_t *pack, int len) {
 	} else if (!slimp_handler || !(*slimp_handler)(pack, len)) {
 		pack[4] = '\0';
 		LOG_WARN("unhandled %s", (char *)pack);
+		return;
 	}
+	
+	// slimproto thread is blocked while handlers run (display ones in particular)
+	elapsed = gettime_ms() - start;
+	if (elapsed > SLOW_HANDLER_MS) {
+		LOG_INFO("slow command %.4s (%d bytes): %u ms", (char *)pack, len, elapsed);
+	} else {
+		LOG_SDEBUG("command %.4s (%d bytes): %u ms", (char *)pack, len, elapsed);
+	}	
 }
 
 static bool running;
@@ -647,6 +661,7 @@ static void slimproto_run() {
 			bool _sendSTMn = false;
 			bool _stream_disconnect = false;
 			bool _start_output = false;
+			bool _relimit = false;
 			decode_state _decode_state;
 			disconnect_code disconnect_code;
 			static char EXT_BSS header[MAX_HEADER];
@@ -754,6 +769,10 @@ static void slimproto_run() {
 				_sendSTMt = true;
 				status.last = now;
 			}
+			// codec rate limits changed, reconnect while idle to announce them
+			if ((output.state == OUTPUT_STOPPED || output.state == OUTPUT_OFF) && decode_limits_changed()) {
+				_relimit = true;
+			}
 			UNLOCK_O;
 
 #if IR
@@ -784,6 +803,11 @@ static void slimproto_run() {
 			if (_sendIR)   sendIR(ir_code, ir_ts);
 #endif
 			if (*slimp_loop) (*slimp_loop)();
+
+			if (_relimit) {
+				LOG_INFO("decode rate limits changed, reconnecting");
+				return;
+			}
 		}
 	}
 }
@@ -912,15 +936,7 @@ void slimproto(log_level level, char *server, u8_t mac[6], const char *name, con
 	if (!running) return;
 
 	LOCK_O;
-	snprintf(fixed_cap, FIXED_CAP_LEN, ",ModelName=%s,MaxSampleRate=%u", modelname ? modelname : MODEL_NAME_STRING,
-			 ((maxSampleRate > 0) ? maxSampleRate : output.supported_rates[0]));
-	
-	for (i = 0; i < MAX_CODECS; i++) {
-		if (codecs[i] && codecs[i]->id && strlen(fixed_cap) < FIXED_CAP_LEN - 10) {
-			strcat(fixed_cap, ",");
-			strcat(fixed_cap, codecs[i]->types);
-		}
-	}
+	if (maxSampleRate <= 0) maxSampleRate = output.supported_rates[0];
 	UNLOCK_O;
 
 	memset(&serv_addr, 0, sizeof(serv_addr));
@@ -977,9 +993,30 @@ void slimproto(log_level level, char *server, u8_t mac[6], const char *name, con
 
 			LOG_INFO("connected");
 
-			var_cap[0] = '\0';
 			failed_connect = 0;
 
+			// all codecs are always announced and as there is only one MaxSampleRate, it is 
+			// clamped to the lowest limit measured for any of them
+			unsigned maxRate = maxSampleRate;
+			decode_limits_changed();
+
+			LOCK_O;
+			snprintf(fixed_cap, FIXED_CAP_LEN, ",ModelName=%s", modelname ? modelname : MODEL_NAME_STRING);
+
+			for (i = 0; i < MAX_CODECS; i++) {
+				if (codecs[i] && codecs[i]->id && strlen(fixed_cap) < FIXED_CAP_LEN - 10) {
+					unsigned limit = decode_rate_limit(codecs[i]->id);
+
+					if (limit && limit < maxRate) maxRate = limit;
+					strcat(fixed_cap, ",");
+					strcat(fixed_cap, codecs[i]->types);
+				}
+			}
+			UNLOCK_O;
+
+			if (maxRate < (unsigned) maxSampleRate) LOG_WARN("limiting sample rate to %u (was %u)", maxRate, maxSampleRate);
+			snprintf(var_cap, VAR_CAP_LEN, ",MaxSampleRate=%u", maxRate);
+
 			// check if this is a local player now we are connected & signal to server via 'loc' format
 			// this requires LocalPlayer server plugin to enable direct file access
 			len = sizeof(our_addr);
@@ -392,12 +392,20 @@ typedef enum { lERROR = 0, lWARN, lINFO, lDEBUG, lSDEBUG } log_level;
 
 const char *logtime(void);
 void logprint(const char *fmt, ...);
+void logprint_sync(const char *fmt, ...);
 
-#define LOG_ERROR(fmt, ...) logprint("%s %s:%d " fmt "\n", logtime(), __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define LOG_WARN(fmt, ...)  if (loglevel >= lWARN)  logprint("%s %s:%d " fmt "\n", logtime(), __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define LOG_INFO(fmt, ...)  if (loglevel >= lINFO)  logprint("%s %s:%d " fmt "\n", logtime(), __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define LOG_DEBUG(fmt, ...) if (loglevel >= lDEBUG) logprint("%s %s:%d " fmt "\n", logtime(), __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define LOG_SDEBUG(fmt, ...) if (loglevel >= lSDEBUG) logprint("%s %s:%d " fmt "\n", logtime(), __FUNCTION__, __LINE__, ##__VA_ARGS__)
+#if EMBEDDED
+// timestamp is taken by logprint, formatting is deferred to a low priority task
+#define LOG_FORMAT(fmt) "%s:%d " fmt "\n", __FUNCTION__, __LINE__
+#else
+#define LOG_FORMAT(fmt) "%s %s:%d " fmt "\n", logtime(), __FUNCTION__, __LINE__
+#endif
+
+#define LOG_ERROR(fmt, ...) logprint_sync(LOG_FORMAT(fmt), ##__VA_ARGS__)
+#define LOG_WARN(fmt, ...)  if (loglevel >= lWARN)  logprint(LOG_FORMAT(fmt), ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...)  if (loglevel >= lINFO)  logprint(LOG_FORMAT(fmt), ##__VA_ARGS__)
+#define LOG_DEBUG(fmt, ...) if (loglevel >= lDEBUG) logprint(LOG_FORMAT(fmt), ##__VA_ARGS__)
+#define LOG_SDEBUG(fmt, ...) if (loglevel >= lSDEBUG) logprint(LOG_FORMAT(fmt), ##__VA_ARGS__)
 	
 typedef uint32_t frames_t;
 typedef int sockfd;
@@ -592,6 +600,7 @@ struct decodestate {
 #if PROCESS
 	bool direct;
 	bool process;
+	unsigned max_block_frames;	// largest block codec may give at once to process (0 = unknown)
 #endif
 };
 
@@ -619,6 +628,8 @@ void decode_init(log_level level, const char *include_codecs, const char *exclud
 void decode_close(void);
 void decode_flush(void);
 unsigned decode_newstream(unsigned sample_rate, unsigned supported_rates[]);
+unsigned decode_rate_limit(u8_t id);
+bool decode_limits_changed(void);
 void codec_open(u8_t format, u8_t sample_size, u8_t sample_rate, u8_t channels, u8_t endianness);
 
 #if PROCESS
@@ -628,6 +639,7 @@ void process_drain(void);
 void process_flush(void);
 unsigned process_newstream(bool *direct, unsigned raw_sample_rate, unsigned supported_rates[]);
 void process_init(char *opt);
+void process_close(void);
 #endif
 
 #if RESAMPLE || RESAMPLE16
@@ -749,6 +761,8 @@ void set_volume(unsigned left, unsigned right);
 bool test_open(const char *device, unsigned rates[], bool userdef_rates);
 void output_init_embedded(log_level level, char *device, unsigned output_buf_size, char *params, unsigned rates[], unsigned rate_delay, unsigned idle);
 void output_close_embedded(void);
+bool _output_overlay_duck(s32_t *gainL, s32_t *gainR);
+void _output_overlay_mix(ISAMPLE_T *dst, frames_t frames);
 #else 
 // output_stdout.c
 void output_init_stdout(log_level level, unsigned output_buf_size, char *params, unsigned rates[], unsigned rate_delay);
@@ -759,6 +773,11 @@ void output_close_stdout(void);
 void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_t gainL, s32_t gainR, output_format format);
 void _apply_cross(struct buffer *outputbuf, frames_t out_frames, s32_t cross_gain_in, s32_t cross_gain_out, ISAMPLE_T **cross_ptr);
 void _apply_gain(struct buffer *outputbuf, frames_t count, s32_t gainL, s32_t gainR);
+void _apply_gain_ramp(ISAMPLE_T *ptr, frames_t count, frames_t ramp, s32_t fromL, s32_t fromR, s32_t toL, s32_t toR);
+#if BYTES_PER_FRAME == 8
+void _apply_gain_ramp_and_pack(ISAMPLE_T *ptr, frames_t count, frames_t ramp, s32_t fromL, s32_t fromR, s32_t toL, s32_t toR,
+							   void (*mix)(ISAMPLE_T *ptr, frames_t count), output_format format);
+#endif
 s32_t gain(s32_t gain, s32_t sample);
 s32_t to_gain(float f);
 
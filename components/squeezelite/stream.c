@@ -59,6 +59,28 @@ is enough and much faster than a mutex
 static bool polling;
 static sockfd fd;
 
+/*
+When an HTTP connection is lost in the middle of a byte-addressable body, the 
+stream thread tries to reconnect and to continue with a Range request instead 
+of ending the stream. The original request is kept as stream.header is re-used 
+for response and icy data. Any change of stream made by the controller bumps 
+the generation so that a reconnection in progress is abandonned.
+*/
+#define RESUME_TRIES	3
+#define RESUME_TIMEOUT	5
+
+static struct {
+	u32_t ip;
+	u16_t port;
+	char *request;
+	size_t len;
+	u64_t length;
+	bool allowed, active;
+	stream_state state;
+	unsigned generation, count;
+	u32_t start;
+} resume;
+
 struct streamstate stream;
 
 #if USE_SSL
@@ -160,6 +182,126 @@ static void _disconnect(stream_state state, disconnect_code disconnect) {
 	wake_controller();
 }
 
+/****************************************************************************************
+ * Reconnect and request remainder of the body - called with mutex locked, fd is open
+ */
+static bool _resume(void) {
+	unsigned generation = resume.generation;
+	struct sockaddr_in addr;
+
+	if (!resume.allowed || stream.meta_interval || (stream.state != STREAMING_HTTP && stream.state != STREAMING_BUFFERING)) {
+		return false;
+	}
+
+	LOG_WARN("connection lost after " FMT_u64 " bytes, trying to resume", stream.bytes);
+
+	closesocket(fd);
+	fd = -1;
+
+	resume.start = gettime_ms();
+	resume.state = stream.state;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = resume.ip;
+	addr.sin_port = resume.port;
+
+	for (int tries = 1; tries <= RESUME_TRIES; tries++) {
+		int sock, len, n;
+
+		// don't hold the buffer while connecting, decoder can continue
+		UNLOCK;
+		if (tries > 1) usleep(500000);
+		sock = socket(AF_INET, SOCK_STREAM, 0);
+		if (sock >= 0) {
+			set_nonblock(sock);
+			set_nosigpipe(sock);
+			if (connect_timeout(sock, (struct sockaddr *) &addr, sizeof(addr), RESUME_TIMEOUT) < 0) {
+				closesocket(sock);
+				sock = -1;
+			}
+		}
+		LOCK;
+
+		// stream has been changed or stopped by controller meanwhile, it owns the state now
+		if (generation != resume.generation || !running) {
+			if (sock >= 0) closesocket(sock);
+			return true;
+		}
+
+		if (sock < 0) {
+			LOG_INFO("resume attempt %d failed", tries);
+			continue;
+		}
+
+		// same request, asking for what we are missing (request ends with an empty line)
+		len = resume.len - 2;
+		memcpy(stream.header, resume.request, len);
+		n = snprintf(stream.header + len, MAX_HEADER - len, "Range: bytes=" FMT_u64 "-\r\n\r\n", stream.bytes);
+
+		// request too long to add a range, can't resume this stream
+		if (n >= MAX_HEADER - len) {
+			LOG_WARN("request too long to resume (%d bytes)", len + n);
+			closesocket(sock);
+			resume.allowed = false;
+			return false;
+		}
+
+		stream.header_len = len + n;
+
+		fd = sock;
+		resume.active = true;
+		stream.state = SEND_HEADERS;
+
+		return true;
+	}
+
+	return false;
+}
+
+/****************************************************************************************
+ * Remove icy meta data from what has just been received (in place) and return count of
+ * audio bytes. Meta data are collected in stream.header - called with mutex locked
+ */
+static int _icy_demux(u8_t *buffer, int n) {
+	u8_t *in = buffer, *out = buffer;
+
+	while (n) {
+		if (stream.meta_next) {
+			// audio, only need to move it once we have found meta data
+			int bytes = min((u32_t) n, stream.meta_next);
+			if (out != in) memmove(out, in, bytes);
+			out += bytes;
+			in += bytes;
+			n -= bytes;
+			stream.meta_next -= bytes;
+		} else if (!stream.meta_left) {
+			// meta length (MAX_HEADER must be more than meta max of 16 * 255)
+			stream.meta_left = 16 * *in++;
+			stream.header_len = 0;
+			n--;
+			if (!stream.meta_left) stream.meta_next = stream.meta_interval;
+		} else {
+			int bytes = min((u32_t) n, stream.meta_left);
+			memcpy(stream.header + stream.header_len, in, bytes);
+			stream.header_len += bytes;
+			stream.meta_left -= bytes;
+			in += bytes;
+			n -= bytes;
+
+			if (!stream.meta_left) {
+				*(stream.header + stream.header_len) = '\0';
+				LOG_INFO("icy meta: len: %u\n%s", stream.header_len, stream.header);
+				stream.meta_send = true;
+				stream.meta_next = stream.meta_interval;
+				wake_controller();
+			}
+		}
+	}
+
+	return out - buffer;
+}
+
 static void *stream_thread() {
 
 	while (running) {
@@ -262,8 +404,26 @@ static void *stream_thread() {
 						if (endtok == 4) {
 							*(stream.header + stream.header_len) = '\0';
 							LOG_INFO("headers: len: %d\n%s", stream.header_len, stream.header);
-							stream.state = stream.cont_wait ? STREAMING_WAIT : STREAMING_BUFFERING;
-							wake_controller();
+							if (resume.active) {
+								// headers of a resumed connection are not for the controller
+								char *p = strchr(stream.header, ' ');
+								resume.active = false;
+								if (p && atoi(p) == 206) {
+									resume.count++;
+									stream.state = resume.state;
+									LOG_INFO("stream resumed in %u ms (%u rebuffering avoided)", gettime_ms() - resume.start, resume.count);
+								} else {
+									LOG_WARN("server did not accept to resume");
+									_disconnect(DISCONNECT, REMOTE_DISCONNECT);
+								}
+							} else {
+								char *p = strcasestr(stream.header, "Content-Length:");
+								// can only resume a plain body that server can address
+								resume.allowed &= strcasestr(stream.header, "Accept-Ranges: bytes") && !strcasestr(stream.header, "Transfer-Encoding:");
+								resume.length = p ? strtoull(p + 15, NULL, 10) : 0;
+								stream.state = stream.cont_wait ? STREAMING_WAIT : STREAMING_BUFFERING;
+								wake_controller();
+							}	
 						}
 					} else {
 						endtok = 0;
@@ -273,81 +433,39 @@ static void *stream_thread() {
 					continue;
 				}
 				
-				// receive icy meta data
-				if (stream.meta_interval && stream.meta_next == 0) {
-
-					if (stream.meta_left == 0) {
-						// read meta length
-						u8_t c;
-						int n = _recv(ssl, fd, &c, 1, 0);
-						if (n <= 0) {
-							if (n < 0 && _last_error() == ERROR_WOULDBLOCK) {
-								UNLOCK;
-								continue;
-							}
-							LOG_INFO("error reading icy meta: %s", n ? strerror(last_error()) : "closed");
-							_disconnect(STOPPED, LOCAL_DISCONNECT);
-							UNLOCK;
-							continue;
-						}
-						stream.meta_left = 16 * c;
-						stream.header_len = 0; // amount of received meta data
-						// MAX_HEADER must be more than meta max of 16 * 255
-					}
-
-					if (stream.meta_left) {
-						int n = _recv(ssl, fd, stream.header + stream.header_len, stream.meta_left, 0);
-						if (n <= 0) {
-							if (n < 0 && _last_error() == ERROR_WOULDBLOCK) {
-								UNLOCK;
-								continue;
-							}
-							LOG_INFO("error reading icy meta: %s", n ? strerror(last_error()) : "closed");
-							_disconnect(STOPPED, LOCAL_DISCONNECT);
-							UNLOCK;
-							continue;
-						}
-						stream.meta_left -= n;
-						stream.header_len += n;
-					}
-					
-					if (stream.meta_left == 0) {
-						if (stream.header_len) {
-							*(stream.header + stream.header_len) = '\0';
-							LOG_INFO("icy meta: len: %u\n%s", stream.header_len, stream.header);
-							stream.meta_send = true;
-							wake_controller();
-						}
-						stream.meta_next = stream.meta_interval;
-						UNLOCK;
-						continue;
-					}
-
 				// stream body into streambuf
-				} else {
+				{
 					int n;
 
 					space = min(_buf_space(streambuf), _buf_cont_write(streambuf));
-					if (stream.meta_interval) {
-						space = min(space, stream.meta_next);
-					}
 					
 					n = _recv(ssl, fd, streambuf->writep, space, 0);
 					if (n == 0) {
+						// a closed connection is not the end if we know there is more
+						if (resume.length && stream.bytes < resume.length && _resume()) {
+							UNLOCK;
+							continue;
+						}
 						LOG_INFO("end of stream");
 						_disconnect(DISCONNECT, DISCONNECT_OK);
 					}
 					if (n < 0 && _last_error() != ERROR_WOULDBLOCK) {
 						LOG_INFO("error reading: %s", strerror(last_error()));
+						if (_resume()) {
+							UNLOCK;
+							continue;
+						}	
 						_disconnect(DISCONNECT, REMOTE_DISCONNECT);
 					}
 					
+					// icy meta data are interleaved with audio, take them out in place
+					if (n > 0 && stream.meta_interval) {
+						n = _icy_demux(streambuf->writep, n);
+					}
+
 					if (n > 0) {
 						_buf_inc_writep(streambuf, n);
 						stream.bytes += n;
-						if (stream.meta_interval) {
-							stream.meta_next -= n;
-						}
 					} else {
 						UNLOCK;
 						continue;
@@ -416,6 +534,7 @@ void stream_init(log_level level, unsigned stream_buf_size) {
 	stream.state = STOPPED;
 	stream.header = malloc(MAX_HEADER);
 	*stream.header = '\0';
+	resume.request = malloc(MAX_HEADER);
 
 	fd = -1;
 
@@ -446,6 +565,7 @@ void stream_close(void) {
 	pthread_join(thread, NULL);
 #endif
 	free(stream.header);
+	free(resume.request);
 	buf_destroy(streambuf);
 }
 
@@ -482,6 +602,9 @@ void stream_file(const char *header, size_t header_len, unsigned threshold) {
 	stream.bytes = 0;
 	stream.threshold = threshold;
 
+	resume.allowed = resume.active = false;
+	resume.generation++;
+
 	UNLOCK;
 }
 
@@ -588,6 +711,18 @@ void stream_sock(u32_t ip, u16_t port, const char *header, size_t header_len, un
 	stream.bytes = 0;
 	stream.threshold = threshold;
 
+	// keep what's needed to resume, not for SSL or when request already is a range
+	resume.ip = ip;
+	resume.port = port;
+	resume.len = header_len;
+	memcpy(resume.request, header, header_len);
+	resume.allowed = header_len > 4 && !strcasestr(stream.header, "Range:") && !memcmp(header + header_len - 4, "\r\n\r\n", 4);
+#if USE_SSL
+	resume.allowed &= ssl == NULL;
+#endif
+	resume.active = false;
+	resume.generation++;
+
 	UNLOCK;
 }
 
@@ -607,6 +742,8 @@ bool stream_disconnect(void) {
 		disc = true;
 	}
 	stream.state = STOPPED;
+	resume.active = false;
+	resume.generation++;
 	UNLOCK;
 	return disc;
 }
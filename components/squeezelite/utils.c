@@ -58,6 +58,10 @@
 
 #include <fcntl.h>
 
+#if EMBEDDED
+#include "log_ring.h"
+#endif
+
 // logging functions
 const char *logtime(void) {
 	static char buf[100];
@@ -77,6 +81,28 @@ const char *logtime(void) {
 void logprint(const char *fmt, ...) {
 	va_list args;
 	va_start(args, fmt);
+#if EMBEDDED
+	// only fall back to synchronous output if deferred logger is not running
+	if (log_ring_vprint(fmt, args)) {
+		va_end(args);
+		return;
+	}
+	fprintf(stderr, "%s ", logtime());
+#endif
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fflush(stderr);
+}
+
+// errors are not deferred so that they are out before a crash they might explain
+void logprint_sync(const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+#if EMBEDDED
+	// what is already queued is older, so it goes first
+	log_ring_flush();
+	fprintf(stderr, "%s ", logtime());
+#endif
 	vfprintf(stderr, fmt, args);
 	va_end(args);
 	fflush(stderr);
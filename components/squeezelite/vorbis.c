@@ -238,14 +238,19 @@ static decode_state vorbis_decode(void) {
 		iptr = (s16_t *) write_buf + count;
 		optr = (ISAMPLE_T *) write_buf + frames * 2;
 
+#if FRAME_BUF
+		// decoder used the interim buffer, unpack straight into outputbuf in the same pass
+		IF_DIRECT(
+			optr = (ISAMPLE_T *) outputbuf->writep + frames * 2;
+		);
+#endif
+
 		if (channels == 2) {
 #if BYTES_PER_FRAME == 4
-#if FRAME_BUF
-			// copy needed only when DIRECT and FRAME_BUF
-			IF_DIRECT(
-				memcpy(outputbuf->writep, write_buf, frames * BYTES_PER_FRAME);
-			)
-#endif			
+			// samples are already in place unless an interim buffer was used
+			if ((void*) optr != (void*) iptr) {
+				memcpy(optr - count, iptr - count, count * sizeof(s16_t));
+			}	
 #else
 			while (count--) {
 				*--optr = ALIGN(*--iptr);
@@ -257,7 +262,7 @@ static decode_state vorbis_decode(void) {
 				*--optr = ALIGN(*iptr);
 			}
 		}
-		
+
 		IF_DIRECT(
 			_buf_inc_writep(outputbuf, frames * BYTES_PER_FRAME);
 		);
@@ -0,0 +1,404 @@
+/*
+ *  Deferred logger
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "xtensa/hal.h"
+#include "esp_system.h"
+#include "esp_task.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "log_ring.h"
+
+/*
+ Callers, including audio tasks, only store a timestamp, the format pointer and
+ the raw arguments (strings are copied) in a record. A low priority task does the
+ formatting and writes to stderr, which is UART or telnet redirection.
+ Records are reserved by a CAS on head so any task on any core can log without
+ lock nor wait, and each is published by its state byte. Consumer zeroes what it
+ has read so a reserved record is always seen as busy until it is published. A
+ record never wraps, end of ring is filled with a skip record instead. When ring
+ is full, messages are dropped and counted. The ring can also be drained by any task
+ (see log_ring_flush), so a lock makes sure there is only one reader at a time.
+*/
+
+#define LOG_RING_STACK_SIZE	(3*1024)
+#define LOG_RING_POLL_MS	20
+#define LOG_RING_ARGS		192
+#define LOG_RING_LINE		512
+#define LOG_RING_SPEC		32
+#define LOG_RING_CYCLES_MAX	100000		// beyond is preemption or a core switch
+
+enum { LOG_BUSY = 0, LOG_READY, LOG_SKIP };
+typedef enum { ARG_NONE, ARG_INT, ARG_LONG, ARG_LLONG, ARG_SIZE, ARG_PTR, ARG_DOUBLE, ARG_LDOUBLE, ARG_STR, ARG_COUNT } arg_type_t;
+
+typedef struct {
+	uint16_t size;			// header + arguments, not aligned
+	uint8_t state;
+	uint8_t unused;
+	uint32_t sec, usec;
+	const char *fmt;
+} log_record_t;
+
+struct log_spec {
+	const char *start, *end;
+	int precision;			// -1 when not set or set by '*'
+	bool width_arg, precision_arg;
+	arg_type_t type;
+};
+
+static struct {
+	uint8_t *buf;
+	uint32_t size;			// power of 2
+	uint32_t head, tail;	// free running, head is reserved not published
+	uint32_t dropped;
+	SemaphoreHandle_t lock;
+	log_ring_stats_t stats;
+} ring;
+
+/****************************************************************************************
+ * Parse a conversion starting at '%', returns NULL if we don't know how to handle it
+ */
+static const char *log_parse(const char *p, struct log_spec *spec) {
+	int longs = 0;
+	bool size = false, ldouble = false;
+
+	spec->start = p++;
+	spec->precision = -1;
+	spec->width_arg = spec->precision_arg = false;
+
+	while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0') p++;
+	if (*p == '*') {
+		spec->width_arg = true;
+		p++;
+	} else while (isdigit((int) *p)) p++;
+
+	if (*p == '.') {
+		if (*++p == '*') {
+			spec->precision_arg = true;
+			p++;
+		} else for (spec->precision = 0; isdigit((int) *p); p++) spec->precision = spec->precision * 10 + *p - '0';
+	}
+
+	for (;; p++) {
+		if (*p == 'l') longs++;
+		else if (*p == 'j') longs = 2;
+		else if (*p == 'L') ldouble = true;
+		else if (*p == 'z' || *p == 't') size = true;
+		else if (*p != 'h') break;
+	}
+
+	switch (*p) {
+	case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+		spec->type = longs >= 2 ? ARG_LLONG : (longs ? ARG_LONG : (size ? ARG_SIZE : ARG_INT));
+		break;
+	case 'c':
+		spec->type = ARG_INT;
+		break;
+	case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+		spec->type = ldouble ? ARG_LDOUBLE : ARG_DOUBLE;
+		break;
+	case 's':
+		if (longs) return NULL;
+		spec->type = ARG_STR;
+		break;
+	case 'p':
+		spec->type = ARG_PTR;
+		break;
+	case 'n':
+		spec->type = ARG_COUNT;
+		break;
+	case '%':
+		spec->type = ARG_NONE;
+		break;
+	default:
+		return NULL;
+	}
+
+	spec->end = p + 1;
+	return spec->end;
+}
+
+/****************************************************************************************
+ * Format a record, returns formatted length
+ */
+static size_t log_render(log_record_t *rec, char *line, size_t size) {
+	const uint8_t *p = (uint8_t*) (rec + 1), *end = (uint8_t*) rec + rec->size;
+	const char *f = rec->fmt, *next;
+	time_t sec = rec->sec;
+	struct log_spec spec;
+	struct tm tm;
+	size_t n;
+
+#define LOG_POP(type, var) if (p + sizeof(type) > end) break; memcpy(&var, p, sizeof(type)); p += sizeof(type)
+#define LOG_OUT(...) do { n += snprintf(line + n, size - n, __VA_ARGS__); if (n >= size) n = size - 1; } while (0)
+
+	localtime_r(&sec, &tm);
+	n = strftime(line, size, "[%T.", &tm);
+	LOG_OUT("%06u] ", rec->usec);
+
+	for (; (next = strchr(f, '%')) != NULL && n < size - 1; f = spec.end) {
+		char fmt[LOG_RING_SPEC], *s = fmt;
+		int value;
+
+		// anything we can't parse or arguments missing, end with raw format
+		if (!log_parse(next, &spec) || spec.end - spec.start >= LOG_RING_SPEC - 20) break;
+
+		LOG_OUT("%.*s", (int) (next - f), f);
+		f = next;
+
+		// rebuild spec with '*' replaced by their values and no 'L'
+		for (const char *c = spec.start; c < spec.end; c++) {
+			if (*c == '*') {
+				LOG_POP(int, value);
+				s += sprintf(s, "%d", value);
+			} else if (*c != 'L') *s++ = *c;
+		}
+		if (s[-1] != *(spec.end - 1)) break;
+		*s = '\0';
+
+		switch (spec.type) {
+		case ARG_INT: {
+			int v;
+			LOG_POP(int, v);
+			LOG_OUT(fmt, v);
+			continue;
+		}
+		case ARG_LONG: {
+			long v;
+			LOG_POP(long, v);
+			LOG_OUT(fmt, v);
+			continue;
+		}
+		case ARG_LLONG: {
+			long long v;
+			LOG_POP(long long, v);
+			LOG_OUT(fmt, v);
+			continue;
+		}
+		case ARG_SIZE: {
+			size_t v;
+			LOG_POP(size_t, v);
+			LOG_OUT(fmt, v);
+			continue;
+		}
+		case ARG_PTR: {
+			void *v;
+			LOG_POP(void*, v);
+			LOG_OUT(fmt, v);
+			continue;
+		}
+		case ARG_DOUBLE:
+		case ARG_LDOUBLE: {
+			double v;
+			LOG_POP(double, v);
+			LOG_OUT(fmt, v);
+			continue;
+		}
+		case ARG_STR: {
+			const char *v = (const char*) p;
+			p += strnlen(v, end - p) + 1;
+			if (p > end) break;
+			LOG_OUT(fmt, v);
+			continue;
+		}
+		case ARG_NONE:
+			LOG_OUT("%%");
+			continue;
+		case ARG_COUNT:
+			continue;
+		}
+
+		// only reached when arguments are missing
+		break;
+	}
+
+	LOG_OUT("%s", f);
+
+#undef LOG_OUT
+#undef LOG_POP
+
+	return n;
+}
+
+/****************************************************************************************
+ * Serialize arguments and queue record, returns false only when not running
+ */
+bool log_ring_vprint(const char *fmt, va_list args) {
+	uint8_t data[LOG_RING_ARGS], *p = data, *end = data + sizeof(data);
+	uint32_t head, next, pad, len, cycles = xthal_get_ccount();
+	struct log_spec spec;
+	struct timeval tv;
+
+	if (!ring.buf) return false;
+
+	gettimeofday(&tv, NULL);
+
+#define LOG_PUSH(type, value) do { type v = value; if (p + sizeof(type) <= end) memcpy(p, &v, sizeof(type)); p += sizeof(type); } while (0)
+
+	for (const char *f = fmt; (f = strchr(f, '%')) != NULL && p <= end; f = spec.end) {
+		int precision;
+
+		if (!log_parse(f, &spec)) break;
+		if (spec.width_arg) LOG_PUSH(int, va_arg(args, int));
+		if (spec.precision_arg) {
+			precision = va_arg(args, int);
+			LOG_PUSH(int, precision);
+		} else precision = spec.precision;
+
+		switch (spec.type) {
+		case ARG_INT: LOG_PUSH(int, va_arg(args, int)); break;
+		case ARG_LONG: LOG_PUSH(long, va_arg(args, long)); break;
+		case ARG_LLONG: LOG_PUSH(long long, va_arg(args, long long)); break;
+		case ARG_SIZE: LOG_PUSH(size_t, va_arg(args, size_t)); break;
+		case ARG_PTR: LOG_PUSH(void*, va_arg(args, void*)); break;
+		case ARG_DOUBLE: LOG_PUSH(double, va_arg(args, double)); break;
+		case ARG_LDOUBLE: LOG_PUSH(double, va_arg(args, long double)); break;
+		case ARG_COUNT: (void) va_arg(args, void*); break;
+		case ARG_NONE: break;
+		case ARG_STR: {
+			const char *s = va_arg(args, const char*);
+			size_t n;
+
+			if (!s) s = "(null)";
+			n = precision >= 0 ? strnlen(s, precision) : strlen(s);
+			// truncate what does not fit, there is nothing after anyway
+			if (p < end) {
+				if (n >= end - p) n = end - p - 1;
+				memcpy(p, s, n);
+				p[n] = '\0';
+			}
+			p += n + 1;
+			break;
+		}
+		}
+	}
+
+#undef LOG_PUSH
+
+	// a partial argument is ignored by renderer
+	if (p > end) p = end;
+	len = sizeof(log_record_t) + (p - data);
+	len = (len + 3) & ~3;
+
+	do {
+		head = __atomic_load_n(&ring.head, __ATOMIC_RELAXED);
+		pad = (head & (ring.size - 1)) + len > ring.size ? ring.size - (head & (ring.size - 1)) : 0;
+		next = head + pad + len;
+		if (next - __atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE) > ring.size) {
+			__atomic_fetch_add(&ring.dropped, 1, __ATOMIC_RELAXED);
+			__atomic_fetch_add(&ring.stats.dropped, 1, __ATOMIC_RELAXED);
+			return true;
+		}
+	} while (!__atomic_compare_exchange_n(&ring.head, &head, next, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	if (pad) {
+		log_record_t *skip = (log_record_t*) (ring.buf + (head & (ring.size - 1)));
+		skip->size = pad;
+		__atomic_store_n(&skip->state, LOG_SKIP, __ATOMIC_RELEASE);
+	}
+
+	log_record_t *rec = (log_record_t*) (ring.buf + ((head + pad) & (ring.size - 1)));
+	rec->size = sizeof(log_record_t) + (p - data);
+	rec->sec = tv.tv_sec;
+	rec->usec = tv.tv_usec;
+	rec->fmt = fmt;
+	memcpy(rec + 1, data, p - data);
+	__atomic_store_n(&rec->state, LOG_READY, __ATOMIC_RELEASE);
+
+	// cost on target is only measured from the field, see log_ring_stats()
+	cycles = xthal_get_ccount() - cycles;
+	if (cycles < LOG_RING_CYCLES_MAX) __atomic_fetch_add(&ring.stats.cycles, cycles, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&ring.stats.records, 1, __ATOMIC_RELAXED);
+
+	return true;
+}
+
+/****************************************************************************************
+ * Format and output all published records, from caller's task
+ */
+void log_ring_flush(void) {
+	static EXT_RAM_ATTR char line[LOG_RING_LINE];
+	uint32_t dropped;
+
+	if (!ring.buf) return;
+
+	xSemaphoreTake(ring.lock, portMAX_DELAY);
+
+	while (ring.tail != __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE)) {
+		log_record_t *rec = (log_record_t*) (ring.buf + (ring.tail & (ring.size - 1)));
+		uint8_t state = __atomic_load_n(&rec->state, __ATOMIC_ACQUIRE);
+		uint32_t size = (rec->size + 3) & ~3;
+
+		// writer has reserved but not published yet
+		if (state == LOG_BUSY) break;
+
+		if (state == LOG_READY) fwrite(line, 1, log_render(rec, line, sizeof(line)), stderr);
+
+		memset(rec, 0, size);
+		__atomic_store_n(&ring.tail, ring.tail + size, __ATOMIC_RELEASE);
+	}
+
+	if ((dropped = __atomic_exchange_n(&ring.dropped, 0, __ATOMIC_RELAXED)) != 0) {
+		fprintf(stderr, "*** %u log messages dropped ***\n", dropped);
+	}
+
+	fflush(stderr);
+	xSemaphoreGive(ring.lock);
+}
+
+/****************************************************************************************
+ * Counters since boot, for metrics
+ */
+log_ring_stats_t *log_ring_stats(void) {
+	return &ring.stats;
+}
+
+/****************************************************************************************
+ * Periodically output queued records
+ */
+static void log_ring_task(void *arg) {
+	while (1) {
+		log_ring_flush();
+		vTaskDelay(pdMS_TO_TICKS(LOG_RING_POLL_MS));
+	}
+}
+
+/****************************************************************************************
+ * Create ring (size is rounded down to a power of 2) and formatting task
+ */
+bool log_ring_init(size_t size) {
+	static StaticTask_t xTaskBuffer __attribute__ ((aligned (4)));
+	static EXT_RAM_ATTR StackType_t xStack[LOG_RING_STACK_SIZE] __attribute__ ((aligned (4)));
+	static StaticSemaphore_t xLockBuffer;
+	uint8_t *buf;
+
+	if (ring.buf) return true;
+
+	for (ring.size = 1024; ring.size * 2 <= size; ring.size *= 2);
+	buf = heap_caps_calloc(1, ring.size, MALLOC_CAP_SPIRAM);
+	if (!buf) buf = calloc(1, ring.size);
+	if (!buf) return false;
+
+	ring.lock = xSemaphoreCreateMutexStatic(&xLockBuffer);
+	xTaskCreateStatic( (TaskFunction_t) log_ring_task, "log_ring", LOG_RING_STACK_SIZE, NULL, ESP_TASK_PRIO_MIN + 1, xStack, &xTaskBuffer);
+	ring.buf = buf;
+	
+	// what is still queued is not lost on a software restart
+	esp_register_shutdown_handler(log_ring_flush);
+
+	return true;
+}
@@ -0,0 +1,23 @@
+/*
+ *  Deferred logger
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#pragma once
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+	volatile uint32_t records, dropped, cycles;
+} log_ring_stats_t;
+
+bool log_ring_init(size_t size);
+bool log_ring_vprint(const char *fmt, va_list args);
+void log_ring_flush(void);
+log_ring_stats_t *log_ring_stats(void);
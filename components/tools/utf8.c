@@ -43,42 +43,24 @@ static uint32_t decode(uint32_t* state, uint32_t* codep, uint32_t byte) {
 	return *state;
 }
 
-static uint8_t UNICODEtoCP1252(uint16_t chr) {
-	if (chr <= 0xff)
-		return (chr&0xff);
-	else {
-		ESP_LOGI(TAG, "some multi-byte %hx", chr);
-		switch(chr) {
-			case 0x20ac: return 0x80; break;
-			case 0x201a: return 0x82; break;
-			case 0x0192: return 0x83; break;
-			case 0x201e: return 0x84; break;
-			case 0x2026: return 0x85; break;
-			case 0x2020: return 0x86; break;
-			case 0x2021: return 0x87; break;
-			case 0x02c6: return 0x88; break;
-			case 0x2030: return 0x89; break;
-			case 0x0160: return 0x8a; break;
-			case 0x2039: return 0x8b; break;
-			case 0x0152: return 0x8c; break;
-			case 0x017d: return 0x8e; break;
-			case 0x2018: return 0x91; break;
-			case 0x2019: return 0x92; break;
-			case 0x201c: return 0x93; break;
-			case 0x201d: return 0x94; break;
-			case 0x2022: return 0x95; break;
-			case 0x2013: return 0x96; break;
-			case 0x2014: return 0x97; break;
-			case 0x02dc: return 0x98; break;
-			case 0x2122: return 0x99; break;
-			case 0x0161: return 0x9a; break;
-			case 0x203a: return 0x9b; break;
-			case 0x0153: return 0x9c; break;
-			case 0x017e: return 0x9e; break;
-			case 0x0178: return 0x9f; break;
-			default: return 0x00; break;
-		}
-	}
+// unicode of CP1252 0x80..0x9f, 0 when undefined
+static const uint16_t cp1252[32] = {
+	0x20ac, 0,      0x201a, 0x0192, 0x201e, 0x2026, 0x2020, 0x2021, 
+	0x02c6, 0x2030, 0x0160, 0x2039, 0x0152, 0,      0x017d, 0,
+	0,      0x2018, 0x2019, 0x201c, 0x201d, 0x2022, 0x2013, 0x2014, 
+	0x02dc, 0x2122, 0x0161, 0x203a, 0x0153, 0,      0x017e, 0x0178,
+};
+
+static uint8_t UNICODEtoCP1252(uint32_t chr) {
+	if (chr <= 0xff) return chr;
+	
+	// all of them are between 0x0152 and 0x2122
+	if (chr >= 0x0152 && chr <= 0x2122) {
+		for (int i = 0; i < 32; i++) if (cp1252[i] == chr) return 0x80 + i;
+	}	
+	
+	ESP_LOGD(TAG, "no CP1252 for %x", chr);
+	return 0x00;
 }
 
 void utf8_decode(char *src) {
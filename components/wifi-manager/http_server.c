@@ -38,13 +38,23 @@ function to process requests, decode URLs, serve files, etc. etc.
 #include "nvs_utilities.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <ctype.h>
 #include "cJSON.h"
 #include "esp_system.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "config.h"
+#include "monitor.h"
 
-#define HTTP_STACK_SIZE	(5*1024)
+#include "freertos/queue.h"
+
+#define HTTP_STACK_SIZE		(5*1024)
+#define HTTP_WORKERS		2
+#define HTTP_POLL_MS		250
+#define HTTP_KEEPALIVE_MS	5000
+#define HTTP_MAX_HEADER		4096
+#define HTTP_MAX_REQUEST	(32*1024)
+#define HTTP_METRICS_SIZE	2048
 
 /* @brief tag used for ESP serial console messages */
 static const char TAG[] = "http_server";
@@ -79,18 +89,64 @@ extern const uint8_t index_html_start[] asm("_binary_index_html_start");
 extern const uint8_t index_html_end[] asm("_binary_index_html_end");
 
 
-/* const http headers stored in ROM */
-const static char http_hdr_template[] = "HTTP/1.1 200 OK\nContent-type: %s\nAccept-Ranges: bytes\nContent-Length: %d\nContent-Encoding: %s\nAccess-Control-Allow-Origin: *\n\n";
-const static char http_html_hdr[] = "HTTP/1.1 200 OK\nContent-type: text/html\nAccess-Control-Allow-Origin: *\nAccept-Encoding: identity\n\n";
-const static char http_css_hdr[] = "HTTP/1.1 200 OK\nContent-type: text/css\nCache-Control: public, max-age=31536000\nAccess-Control-Allow-Origin: *\n\n";
-const static char http_js_hdr[] = "HTTP/1.1 200 OK\nContent-type: text/javascript\nAccess-Control-Allow-Origin: *\n\n";
-const static char http_400_hdr[] = "HTTP/1.1 400 Bad Request\nContent-Length: 0\n\n";
-const static char http_404_hdr[] = "HTTP/1.1 404 Not Found\nContent-Length: 0\n\n";
-const static char http_503_hdr[] = "HTTP/1.1 503 Service Unavailable\nContent-Length: 0\n\n";
-const static char http_ok_json_no_cache_hdr[] = "HTTP/1.1 200 OK\nContent-type: application/json\nCache-Control: no-store, no-cache, must-revalidate, max-age=0\nPragma: no-cache\nAccess-Control-Allow-Origin: *\nAccept-Encoding: identity\n\n";
-const static char http_redirect_hdr_start[] = "HTTP/1.1 302 Found\nLocation: http://";
-const static char http_redirect_hdr_end[] = "/\n\n";
+/* @brief connections are handed over to a pool of workers, so a slow or idle one does not block others */
+static QueueHandle_t http_queue;
+static StaticTask_t task_worker_buffer[HTTP_WORKERS];
+#if RECOVERY_APPLICATION
+static StackType_t task_worker_stack[HTTP_WORKERS][HTTP_STACK_SIZE];
+#else
+static StackType_t EXT_RAM_ATTR task_worker_stack[HTTP_WORKERS][HTTP_STACK_SIZE];
+#endif
 
+/* const http headers stored in ROM */
+const static char http_400_hdr[] = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+const static char http_503_hdr[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+const static char http_json_no_cache_hdr[] = "Cache-Control: no-store, no-cache, must-revalidate, max-age=0\r\nPragma: no-cache\r\n";
+const static char http_json_type[] = "application/json";
+const static char http_metrics_type[] = "text/plain; version=0.0.4";
+
+/* @brief a connection and what has been received so far (can be more than one request) */
+struct http_conn {
+	struct netconn *conn;
+	char *buf;
+	size_t len, size;
+	char *ap_ip_address, *remote_address;
+	const char *host_name;
+};
+
+/* @brief a parsed request, all pointers are in the connection's buffer */
+struct http_request {
+	struct http_conn *c;
+	char *method, *path, *query, *version;
+	char *headers;
+	char *body;
+	size_t body_len;
+	bool keep_alive;
+};
+
+/* @brief static files, ETag is calculated once when server starts */
+static struct http_asset {
+	const char *path;
+	const uint8_t *start, *end;
+	const char *type, *encoding;
+	char etag[11];
+} http_assets[] = {
+	{ "/", index_html_start, index_html_end, "text/html", NULL },
+	{ "/code.js", code_js_start, code_js_end, "text/javascript", NULL },
+	{ "/style.css", style_css_start, style_css_end, "text/css", NULL },
+	{ "/jquery.js", jquery_gz_start, jquery_gz_end, "text/javascript", "gzip" },
+	{ "/popper.js", popper_gz_start, popper_gz_end, "text/javascript", "gzip" },
+	{ "/bootstrap.js", bootstrap_js_gz_start, bootstrap_js_gz_end, "text/javascript", "gzip" },
+	{ "/bootstrap.css", bootstrap_css_gz_start, bootstrap_css_gz_end, "text/css", "gzip" },
+};
+
+static void http_assets_init(void) {
+	for (int i = 0; i < sizeof(http_assets) / sizeof(*http_assets); i++) {
+		uint32_t hash = 2166136261u;
+		for (const uint8_t *p = http_assets[i].start; p < http_assets[i].end; p++) hash = (hash ^ *p) * 16777619u;
+		snprintf(http_assets[i].etag, sizeof(http_assets[i].etag), "\"%08" PRIx32 "\"", hash);
+	}
+}
 
 void http_server_start() {
 	ESP_LOGD(TAG,  "http_server_start ");
@@ -99,19 +155,42 @@ void http_server_start() {
 										 WIFI_MANAGER_TASK_PRIORITY, task_http_stack, &task_http_buffer);
 	}
 }
+
+static void http_worker(void *pvParameters) {
+	struct netconn *conn;
+	while (xQueueReceive(http_queue, &conn, portMAX_DELAY) == pdTRUE) {
+		http_server_netconn_serve(conn);
+		netconn_delete(conn);
+	}
+	vTaskDelete( NULL );
+}
+
 void http_server(void *pvParameters) {
 	http_server_config_mutex = xSemaphoreCreateMutex();
+	http_queue = xQueueCreate(HTTP_WORKERS * 2, sizeof(struct netconn*));
+	http_assets_init();
+	for (int i = 0; i < HTTP_WORKERS; i++) {
+		char name[configMAX_TASK_NAME_LEN];
+		snprintf(name, sizeof(name), "http_worker%d", i);
+		xTaskCreateStatic( (TaskFunction_t) &http_worker, name, HTTP_STACK_SIZE, NULL, 
+						  WIFI_MANAGER_TASK_PRIORITY, task_worker_stack[i], task_worker_buffer + i);
+	}
 	struct netconn *conn, *newconn;
 	err_t err;
 	conn = netconn_new(NETCONN_TCP);
 	netconn_bind(conn, IP_ADDR_ANY, 80);
 	netconn_listen(conn);
-	ESP_LOGI(TAG,   "HTTP Server listening on 80/tcp");
+	ESP_LOGI(TAG,   "HTTP Server listening on 80/tcp with %d workers", HTTP_WORKERS);
 	do {
 		err = netconn_accept(conn, &newconn);
 		if(err == ERR_OK) {
-			http_server_netconn_serve(newconn);
-			netconn_delete(newconn);
+			/* idle keep-alive connections are closed by workers when others are waiting */
+			if(xQueueSend(http_queue, &newconn, pdMS_TO_TICKS(HTTP_KEEPALIVE_MS)) != pdTRUE) {
+				ESP_LOGW(TAG,  "All HTTP workers busy, dropping connection");
+				netconn_write(newconn, http_503_hdr, sizeof(http_503_hdr) - 1, NETCONN_NOCOPY);
+				netconn_close(newconn);
+				netconn_delete(newconn);
+			}
 		}
 		else
 		{
@@ -198,36 +277,125 @@ char* http_server_search_header(char *request, char *header_name, int *len, char
 	ESP_LOGD(TAG,   "No more match for : %s", header_name);
 	return NULL;
 }
-void http_server_send_resource_file(struct netconn *conn,const uint8_t * start, const uint8_t * end, char * content_type,char * encoding) {
-	uint16_t len=end - start;
-	size_t  buff_length= sizeof(http_hdr_template)+strlen(content_type)+strlen(encoding);
-	char * http_hdr=malloc(buff_length);
-	if( http_hdr == NULL) {
-		ESP_LOGE(TAG,  "Cound not allocate %d bytes for headers.",buff_length);
-		netconn_write(conn, http_503_hdr, sizeof(http_503_hdr) - 1, NETCONN_NOCOPY);
+
+/* @brief case insensitive lookup of a header in a request, value is not NUL terminated */
+static char* http_header(char *headers, const char *name, int *len) {
+	size_t n = strlen(name);
+	char *line = headers;
+
+	*len = 0;
+	while (line && *line && *line != '\r' && *line != '\n') {
+		if (!strncasecmp(line, name, n) && line[n] == ':') {
+			char *p = line + n + 1;
+			while (*p == ' ' || *p == '\t') p++;
+			while (p[*len] && p[*len] != '\r' && p[*len] != '\n') (*len)++;
+			return p;
+		}
+		if ((line = strchr(line, '\n')) != NULL) line++;
+	}
+	return NULL;
+}
+
+/* @brief send a complete response, body (if any) is copied unless flags is NETCONN_NOCOPY */
+static void http_send(struct http_request *req, const char *status, const char *type, const char *extra, const void *body, size_t len, u8_t flags) {
+	char hdr[320];
+	int n = snprintf(hdr, sizeof(hdr), "HTTP/1.1 %s\r\n%s%s%s%sAccess-Control-Allow-Origin: *\r\nContent-Length: %u\r\n%s\r\n",
+					 status, type ? "Content-Type: " : "", type ? type : "", type ? "\r\n" : "", extra ? extra : "",
+					 (unsigned) len, req->keep_alive ? "" : "Connection: close\r\n");
+
+	if (n >= sizeof(hdr)) {
+		ESP_LOGE(TAG,  "Response header too long for %s", req->path);
+		netconn_write(req->c->conn, http_503_hdr, sizeof(http_503_hdr) - 1, NETCONN_NOCOPY);
+		req->keep_alive = false;
+		return;
+	}
+
+	ESP_LOGD(TAG,  "sending response : %s", hdr);
+	// any failure means we can't continue with that connection
+	if (netconn_write(req->c->conn, hdr, n, NETCONN_COPY) != ERR_OK ||
+		(len && netconn_write(req->c->conn, body, len, flags) != ERR_OK)) {
+		req->keep_alive = false;
+	}
+}
+
+static void http_send_json(struct http_request *req, const char *json) {
+	http_send(req, "200 OK", http_json_type, http_json_no_cache_hdr, json, json ? strlen(json) : 0, NETCONN_COPY);
+}
+
+/* @brief answer 304 if request's If-None-Match has that ETag */
+static bool http_not_modified(struct http_request *req, const char *etag) {
+	char hdr[96];
+	int len;
+	char *match = http_header(req->headers, "If-None-Match", &len);
+
+	if (!match || !*etag) return false;
+
+	for (int i = 0; i <= len - (int) strlen(etag); i++) {
+		if (memcmp(match + i, etag, strlen(etag))) continue;
+		int n = snprintf(hdr, sizeof(hdr), "HTTP/1.1 304 Not Modified\r\nETag: %s\r\n%s\r\n", 
+						 etag, req->keep_alive ? "" : "Connection: close\r\n");
+		if (netconn_write(req->c->conn, hdr, n, NETCONN_COPY) != ERR_OK) req->keep_alive = false;
+		return true;
 	}
-	else
-	{
-		memset(http_hdr,0x00,buff_length);
-		snprintf(http_hdr, buff_length-1,http_hdr_template,content_type,len,encoding);
-		netconn_write(conn, http_hdr, strlen(http_hdr), NETCONN_NOCOPY);
-		ESP_LOGD(TAG,  "sending response : %s",http_hdr);
-		netconn_write(conn, start, end - start, NETCONN_NOCOPY);
-		free(http_hdr);
+
+	return false;
+}
+
+/* @brief send a static file, or just 304 if browser's copy is still valid */
+static void http_send_asset(struct http_request *req, struct http_asset *asset) {
+	char extra[96];
+
+	if (http_not_modified(req, asset->etag)) return;
+
+	snprintf(extra, sizeof(extra), "ETag: %s\r\nCache-Control: no-cache\r\n%s%s%s", asset->etag, 
+			 asset->encoding ? "Content-Encoding: " : "", asset->encoding ? asset->encoding : "", asset->encoding ? "\r\n" : "");
+	http_send(req, "200 OK", asset->type, extra, asset->start, asset->end - asset->start, NETCONN_NOCOPY);
+}
+
+/* @brief decode up to <len> chars of a URL-encoded query value (%XX and '+') into <dst> of <size> */
+static void http_query_decode(char *dst, const char *src, size_t len, size_t size) {
+	const char *end = src + len;
+
+	while (src < end && *src && size > 1) {
+		if (*src == '%' && end - src > 2 && isxdigit((int) src[1]) && isxdigit((int) src[2])) {
+			char hex[3] = { src[1], src[2], '\0' };
+			*dst++ = strtol(hex, NULL, 16);
+			src += 3;
+		} else {
+			*dst++ = *src == '+' ? ' ' : *src;
+			src++;
+		}
+		size--;
 	}
+
+	*dst = '\0';
 }
 
-err_t http_server_send_config_json(struct netconn *conn) {
-	char * json = config_alloc_get_json(false);
+/* @brief full config or, with ?since=<etag>, only keys changed after that revision (deleted ones are null) */
+err_t http_server_send_config_json(struct http_request *req) {
+	char etag[24], since[24] = "", extra[96], *p;
+	bool delta;
+
+	// polling with an up to date copy costs neither serialization nor allocation
+	config_get_etag(etag, sizeof(etag));
+	if (http_not_modified(req, etag)) return ESP_OK;
+
+	// etag is quoted, so browsers send it encoded (%22)
+	if (req->query && (p = strstr(req->query, "since=")) != NULL) {
+		http_query_decode(since, p + 6, strcspn(p + 6, "&"), sizeof(since));
+	}
+
+	// an unknown base (other boot, stale) gets the full document, so tell which one it is
+	char * json = config_alloc_get_json_since(*since ? since : NULL, etag, sizeof(etag), &delta);
 	if(json!=NULL){
 		ESP_LOGD(TAG,  "config json : %s",json );
-		netconn_write(conn, http_ok_json_no_cache_hdr, sizeof(http_ok_json_no_cache_hdr) - 1, NETCONN_NOCOPY);
-		netconn_write(conn, json, strlen(json), NETCONN_NOCOPY);
+		snprintf(extra, sizeof(extra), "ETag: %s\r\nCache-Control: no-cache\r\nX-Config-Delta: %s\r\n", etag, delta ? "true" : "false");
+		http_send(req, "200 OK", http_json_type, extra, json, strlen(json), NETCONN_COPY);
 		free(json);
 	}
 	else{
 		ESP_LOGD(TAG,  "Error retrieving config json string. ");
-		netconn_write(conn, http_503_hdr, sizeof(http_503_hdr) - 1, NETCONN_NOCOPY);
+		http_send(req, "503 Service Unavailable", NULL, NULL, NULL, 0, NETCONN_NOCOPY);
 	}
 
 	return ESP_OK;
@@ -305,308 +473,466 @@ void dump_net_buffer(void * buf, u16_t buflen) {
 	free(curbuf);
 }
 
-void http_server_netconn_serve(struct netconn *conn) {
+static void http_get_scan(struct http_request *req) {
+	ESP_LOGI(TAG,  "Starting wifi scan");
+	wifi_manager_scan_async();
+	http_send_json(req, NULL);
+}
+
+static void http_get_ap(struct http_request *req) {
+	/* if we can get the mutex, write the last version of the AP list */
+	ESP_LOGI(TAG,  "Processing ap.json request");
+	if(wifi_manager_lock_json_buffer(( TickType_t ) 10)) {
+		char *buff = wifi_manager_alloc_get_ap_list_json();
+		wifi_manager_unlock_json_buffer();
+		if(buff!=NULL){
+			http_send_json(req, buff);
+			free(buff);
+		}
+		else {
+			ESP_LOGD(TAG,  "Error retrieving ap list json string. ");
+			http_send(req, "503 Service Unavailable", NULL, NULL, NULL, 0, NETCONN_NOCOPY);
+		}
+	}
+	else {
+		http_send(req, "503 Service Unavailable", NULL, NULL, NULL, 0, NETCONN_NOCOPY);
+		ESP_LOGE(TAG,   "http_server_netconn_serve: GET /ap.json failed to obtain mutex");
+	}
+	/* refresh list if it is getting old */
+	wifi_manager_scan_cached_async();
+	ESP_LOGI(TAG,  "Done serving ap.json");
+}
+
+static void http_get_config(struct http_request *req) {
+	ESP_LOGI(TAG,  "Serving config.json");
+	http_server_send_config_json(req);
+	ESP_LOGD(TAG,  "Done serving config.json");
+}
+
+static void http_post_config(struct http_request *req) {
+	ESP_LOGI(TAG,  "Serving POST config.json");
+	int lenA=0;
+	char * last_parm=req->headers;
+	char * next_parm=req->headers;
+	char * last_parm_name=NULL;
+	char * headers_end=req->headers + strlen(req->headers);
+	bool bErrorFound=false;
+	bool bOTA=false;
+	char * otaURL=NULL;
+	// todo:  implement json body parsing
+	//http_server_process_config(conn,save_ptr);
+
+	while(last_parm!=NULL) {
+		// Search will return
+		ESP_LOGD(TAG,   "Getting parameters from X-Custom headers");
+		last_parm = http_server_search_header(next_parm, "X-Custom-", &lenA, &last_parm_name,&next_parm,headers_end);
+		if(last_parm!=NULL && last_parm_name!=NULL) {
+			ESP_LOGI(TAG,   "http_server_netconn_serve: POST config.json, config %s=%s", last_parm_name, last_parm);
+			if(strcmp(last_parm_name, "fwurl")==0) {
+				// we're getting a request to do an OTA from that URL
+				ESP_LOGW(TAG,   "Found OTA request!");
+				otaURL=strdup(last_parm);
+				bOTA=true;
+			}
+			else {
+				ESP_LOGV(TAG,   "http_server_netconn_serve: POST config.json Storing parameter");
+				if(config_set_value(NVS_TYPE_STR, last_parm_name , last_parm) != ESP_OK){
+					ESP_LOGE(TAG,  "Unable to save nvs value.");
+				}
+			}
+		}
+		if(last_parm_name!=NULL) {
+			free(last_parm_name);
+			last_parm_name=NULL;
+		}
+	}
+	if(bErrorFound) {
+		http_send(req, "400 Bad Request", NULL, NULL, NULL, 0, NETCONN_NOCOPY); //400 invalid request
+	}
+	else {
+		http_send_json(req, NULL); //200ok
+		if(bOTA) {
+
+#if RECOVERY_APPLICATION
+			ESP_LOGW(TAG,   "Starting process OTA for url %s",otaURL);
+#else
+			ESP_LOGW(TAG,   "Restarting system to process OTA for url %s",otaURL);
+#endif
+			wifi_manager_reboot_ota(otaURL);
+			free(otaURL);
+		}
+	}
+	ESP_LOGI(TAG,  "Done Serving POST config.json");
+}
+
+static void http_post_connect(struct http_request *req) {
+	ESP_LOGI(TAG,   "http_server_netconn_serve: POST /connect.json");
+	bool found = false;
+	int lenS = 0, lenP = 0, lenN = 0;
+	char *ssid = NULL, *password = NULL;
+	ssid = http_server_get_header(req->headers, "X-Custom-ssid: ", &lenS);
+	password = http_server_get_header(req->headers, "X-Custom-pwd: ", &lenP);
+	char * new_host_name_b = http_server_get_header(req->headers, "X-Custom-host_name: ", &lenN);
+	if(lenN > 0){
+		lenN++;
+		char * new_host_name = malloc(lenN);
+		strlcpy(new_host_name, new_host_name_b, lenN);
+		if(config_set_value(NVS_TYPE_STR, "host_name", new_host_name) != ESP_OK){
+			ESP_LOGE(TAG,  "Unable to save host name configuration");
+		}
+		free(new_host_name);
+	}
+
+	if(ssid && lenS <= MAX_SSID_SIZE && password && lenP <= MAX_PASSWORD_SIZE) {
+		wifi_config_t* config = wifi_manager_get_wifi_sta_config();
+		memset(config, 0x00, sizeof(wifi_config_t));
+		memcpy(config->sta.ssid, ssid, lenS);
+		memcpy(config->sta.password, password, lenP);
+		ESP_LOGD(TAG,   "http_server_netconn_serve: wifi_manager_connect_async() call, with ssid: %s, password: %s", config->sta.ssid, config->sta.password);
+		wifi_manager_connect_async();
+		http_send_json(req, NULL); //200ok
+		found = true;
+	}
+	else{
+		ESP_LOGE(TAG,  "SSID or Password invalid");
+	}
+
+	if(!found) {
+		/* bad request the authentification header is not complete/not the correct format */
+		http_send(req, "400 Bad Request", NULL, NULL, NULL, 0, NETCONN_NOCOPY);
+		ESP_LOGE(TAG,   "bad request the authentification header is not complete/not the correct format");
+	}
+
+	ESP_LOGI(TAG,   "http_server_netconn_serve: done serving connect.json");
+}
+
+static void http_delete_connect(struct http_request *req) {
+	ESP_LOGI(TAG,   "http_server_netconn_serve: DELETE /connect.json");
+	/* request a disconnection from wifi and forget about it */
+	wifi_manager_disconnect_async();
+	http_send_json(req, NULL); /* 200 ok */
+	ESP_LOGI(TAG,   "http_server_netconn_serve: done serving DELETE /connect.json");
+}
+
+static void http_post_reboot_ota(struct http_request *req) {
+	ESP_LOGI(TAG,   "http_server_netconn_serve: POST reboot_ota.json");
+	http_send_json(req, NULL); /* 200 ok */
+	wifi_manager_reboot(OTA);
+	ESP_LOGI(TAG,   "http_server_netconn_serve: done serving POST reboot_ota.json");
+}
+
+static void http_post_reboot(struct http_request *req) {
+	ESP_LOGI(TAG,   "http_server_netconn_serve: POST reboot.json");
+	http_send_json(req, NULL); /* 200 ok */
+	wifi_manager_reboot(RESTART);
+	ESP_LOGI(TAG,   "http_server_netconn_serve: done serving POST reboot.json");
+}
+
+static void http_post_recovery(struct http_request *req) {
+	ESP_LOGI(TAG,   "http_server_netconn_serve: POST recovery.json");
+	http_send_json(req, NULL); /* 200 ok */
+	wifi_manager_reboot(RECOVERY);
+	ESP_LOGI(TAG,   "http_server_netconn_serve: done serving POST recovery.json");
+}
+
+static void http_get_status(struct http_request *req) {
+	ESP_LOGI(TAG,  "Serving status.json");
+	if(wifi_manager_lock_json_buffer(( TickType_t ) 10)) {
+		char *buff = wifi_manager_alloc_get_ip_info_json();
+		wifi_manager_unlock_json_buffer();
+		if(buff) {
+			http_send_json(req, buff);
+			free(buff);
+		}
+		else {
+			http_send(req, "503 Service Unavailable", NULL, NULL, NULL, 0, NETCONN_NOCOPY);
+		}
+	}
+	else {
+		http_send(req, "503 Service Unavailable", NULL, NULL, NULL, 0, NETCONN_NOCOPY);
+		ESP_LOGE(TAG,   "http_server_netconn_serve: GET /status failed to obtain mutex");
+	}
+	ESP_LOGI(TAG,  "Done Serving status.json");
+}
+
+/* @brief Prometheus text (/metrics) or JSON (/metrics.json) from monitor's preallocated counters */
+static void http_get_metrics(struct http_request *req) {
+	bool json = !strcmp(req->path, "/metrics.json");
+	size_t size = HTTP_METRICS_SIZE, len;
+	char *buff = malloc(size);
+
+	// grow once if sampled tasks and registered metrics do not fit
+	if (buff && (len = monitor_metrics(buff, size, json)) >= size) {
+		free(buff);
+		size = len + 1;
+		if ((buff = malloc(size)) != NULL) monitor_metrics(buff, size, json);
+	}
+
+	if (buff) {
+		http_send(req, "200 OK", json ? http_json_type : http_metrics_type, http_json_no_cache_hdr, buff, strnlen(buff, size - 1), NETCONN_COPY);
+		free(buff);
+	} else {
+		http_send(req, "503 Service Unavailable", NULL, NULL, NULL, 0, NETCONN_NOCOPY);
+	}
+}
 
+/* @brief dynamic content, static files are in http_assets */
+static const struct http_route {
+	const char *method, *path;
+	void (*handler)(struct http_request *req);
+} http_routes[] = {
+	{ "GET", "/scan.json", http_get_scan },
+	{ "GET", "/ap.json", http_get_ap },
+	{ "GET", "/config.json", http_get_config },
+	{ "POST", "/config.json", http_post_config },
+	{ "POST", "/connect.json", http_post_connect },
+	{ "DELETE", "/connect.json", http_delete_connect },
+	{ "POST", "/reboot_ota.json", http_post_reboot_ota },
+	{ "POST", "/reboot.json", http_post_reboot },
+	{ "POST", "/recovery.json", http_post_recovery },
+	{ "GET", "/status.json", http_get_status },
+	{ "GET", "/metrics", http_get_metrics },
+	{ "GET", "/metrics.json", http_get_metrics },
+};
+
+/* @brief append whatever netconn has for us to connection's buffer (always NUL terminated) */
+static err_t http_recv(struct http_conn *c) {
 	struct netbuf *inbuf;
-	char *buf = NULL;
-	u16_t buflen = 0;
-	err_t err;
+	err_t err = netconn_recv(c->conn, &inbuf);
+
+	if (err != ERR_OK) return err;
+
+	do {
+		void *data;
+		u16_t len;
+		netbuf_data(inbuf, &data, &len);
+		if (c->len + len + 1 > c->size) {
+			size_t size = c->len + len + 1 + 2048;
+			char *buf = realloc(c->buf, size);
+			if (!buf) {
+				netbuf_delete(inbuf);
+				return ERR_MEM;
+			}
+			c->buf = buf;
+			c->size = size;
+		}
+		memcpy(c->buf + c->len, data, len);
+		c->len += len;
+		c->buf[c->len] = '\0';
+	} while (netbuf_next(inbuf) != -1);
+
+	netbuf_delete(inbuf);
+	return ERR_OK;
+}
+
+/* @brief raw length of a complete chunked body, 0 if more is needed and -1 if invalid */
+static int http_chunked_length(char *body, size_t avail) {
+	size_t pos = 0;
+
+	while (1) {
+		char *eol = memchr(body + pos, '\n', avail - pos), *end;
+		unsigned long size;
+
+		if (!eol) return 0;
+		size = strtoul(body + pos, &end, 16);
+		if (end == body + pos || size > HTTP_MAX_REQUEST) return -1;
+		pos = eol - body + 1;
+
+		// last chunk, skip trailers up to empty line
+		if (!size) {
+			while ((eol = memchr(body + pos, '\n', avail - pos)) != NULL) {
+				bool empty = eol == body + pos || (eol == body + pos + 1 && body[pos] == '\r');
+				pos = eol - body + 1;
+				if (empty) return pos;
+			}
+			return 0;
+		}
+
+		// data and its CRLF
+		pos += size;
+		if (pos + 2 > avail) return 0;
+		if (body[pos] == '\r') pos++;
+		if (body[pos++] != '\n') return -1;
+	}
+}
+
+/* @brief decode a (complete and checked) chunked body in place */
+static size_t http_dechunk(char *body) {
+	char *src = body, *dst = body;
+	size_t size;
+
+	while ((size = strtoul(src, NULL, 16)) != 0) {
+		src = strchr(src, '\n') + 1;
+		memmove(dst, src, size);
+		dst += size;
+		src = strchr(src + size, '\n') + 1;
+	}
+
+	return dst - body;
+}
+
+/* @brief parse first request in buffer, returns 1 when complete, 0 if more is needed and -1 if invalid */
+static int http_parse(struct http_conn *c, struct http_request *req, size_t *consumed) {
+	char *buf = c->buf, *p, *save;
+	size_t head = 0, raw = 0;
+	bool chunked;
+	int len;
+
+	// headers end with an empty line, CRLF or just LF
+	for (p = buf; (p = strchr(p, '\n')) != NULL; p++) {
+		if (p[1] == '\n') { head = p - buf + 2; break; }
+		if (p[1] == '\r' && p[2] == '\n') { head = p - buf + 3; break; }
+	}
+	if (!head) return c->len > HTTP_MAX_HEADER ? -1 : 0;
+
+	req->c = c;
+	req->headers = strchr(buf, '\n') + 1;
+	req->body = buf + head;
+
+	// body is either chunked, sized by Content-Length or absent
+	p = http_header(req->headers, "Transfer-Encoding", &len);
+	chunked = p && len >= 7 && !strncasecmp(p + len - 7, "chunked", 7);
+	if (chunked) {
+		int n = http_chunked_length(req->body, c->len - head);
+		if (n <= 0) return n < 0 || c->len > HTTP_MAX_REQUEST ? -1 : 0;
+		raw = n;
+	} else if ((p = http_header(req->headers, "Content-Length", &len)) != NULL) {
+		raw = strtoul(p, NULL, 10);
+		if (head + raw > HTTP_MAX_REQUEST) return -1;
+		if (c->len < head + raw) return 0;
+	}
+
+	// request is complete, we can now modify the buffer
+	*consumed = head + raw;
+	req->body_len = chunked ? http_dechunk(req->body) : raw;
+	buf[head - (buf[head - 2] == '\r' ? 2 : 1)] = '\0';
+	req->headers[-1] = '\0';
+	if (req->headers - 1 > buf && req->headers[-2] == '\r') req->headers[-2] = '\0';
+
+	req->method = strtok_r(buf, " ", &save);
+	req->path = strtok_r(NULL, " ", &save);
+	req->version = strtok_r(NULL, " ", &save);
+	if (!req->method || !req->path) return -1;
+	if ((req->query = strchr(req->path, '?')) != NULL) *req->query++ = '\0';
+
+	// HTTP/1.1 is persistent unless told otherwise, HTTP/1.0 is the opposite
+	p = http_header(req->headers, "Connection", &len);
+	if (req->version && !strcmp(req->version, "HTTP/1.1")) req->keep_alive = !(p && len == 5 && !strncasecmp(p, "close", 5));
+	else req->keep_alive = p && len == 10 && !strncasecmp(p, "keep-alive", 10);
+
+	return 1;
+}
+
+static void http_dispatch(struct http_request *req) {
+	struct http_conn *c = req->c;
+	int len;
+	char *host = http_header(req->headers, "Host", &len);
+
+	ESP_LOGD(TAG,  "Request %s %s from %s", req->method, req->path, c->remote_address);
+
+	if (host && len) {
+		char name[64];
+		strlcpy(name, host, len + 1 < sizeof(name) ? len + 1 : sizeof(name));
+
+		/* captive portal functionality: redirect to access point IP for HOST that are not the access point IP OR the STA IP */
+		wifi_manager_lock_sta_ip_string(portMAX_DELAY);
+		bool access_from_sta_ip = strcasestr(name, wifi_manager_get_sta_ip_string());
+		wifi_manager_unlock_sta_ip_string();
+		bool access_from_host_name = (c->host_name!=NULL) && strcasestr(name, c->host_name);
+
+		if(!strcasestr(name, c->ap_ip_address) && !(access_from_sta_ip || access_from_host_name)) {
+			char location[64];
+			ESP_LOGI(TAG,  "Redirecting host [%s] to AP IP Address : %s", c->remote_address, c->ap_ip_address);
+			snprintf(location, sizeof(location), "Location: http://%s/\r\n", c->ap_ip_address);
+			http_send(req, "302 Found", NULL, location, NULL, 0, NETCONN_NOCOPY);
+			return;
+		}
+	}
+
+	if (!strcmp(req->method, "GET")) {
+		for (int i = 0; i < sizeof(http_assets) / sizeof(*http_assets); i++) {
+			if (!strcmp(req->path, http_assets[i].path)) {
+				http_send_asset(req, http_assets + i);
+				return;
+			}
+		}
+	}
+
+	for (int i = 0; i < sizeof(http_routes) / sizeof(*http_routes); i++) {
+		if (!strcmp(req->method, http_routes[i].method) && !strcmp(req->path, http_routes[i].path)) {
+			(*http_routes[i].handler)(req);
+			return;
+		}
+	}
+
+	ESP_LOGE(TAG,   "Not found from host: %s, request %s %s", c->remote_address, req->method, req->path);
+	http_send(req, "404 Not Found", NULL, NULL, NULL, 0, NETCONN_NOCOPY);
+}
+
+void http_server_netconn_serve(struct netconn *conn) {
+	struct http_conn c = { .conn = conn };
+	struct http_request req;
 	ip_addr_t remote_add;
 	u16_t port;
-	ESP_LOGV(TAG,  "Serving page.  Getting device AP address.");
-	const char new_line[2] = "\n";
-	char * ap_ip_address= config_alloc_get_default(NVS_TYPE_STR, "ap_ip_address", DEFAULT_AP_IP, 0);
-	if(ap_ip_address==NULL){
+	int idle = 0;
+
+	c.ap_ip_address = config_alloc_get_default(NVS_TYPE_STR, "ap_ip_address", DEFAULT_AP_IP, 0);
+	if(c.ap_ip_address==NULL){
 		ESP_LOGE(TAG,  "Unable to retrieve default AP IP Address");
 		netconn_write(conn, http_503_hdr, sizeof(http_503_hdr) - 1, NETCONN_NOCOPY);
 		netconn_close(conn);
 		return;
 	}
-	ESP_LOGV(TAG,  "Getting remote device IP address.");
 	netconn_getaddr(conn,	&remote_add,	&port,	0);
-	char * remote_address = strdup(ip4addr_ntoa(ip_2_ip4(&remote_add)));
-	ESP_LOGD(TAG,  "Local Access Point IP address is: %s. Remote device IP address is %s. Receiving request buffer", ap_ip_address, remote_address);
-
-	u16_t bufsize = 0;
-	netconn_set_recvtimeout(conn, 50);
-	while (netconn_recv(conn, &inbuf) == ERR_OK) {
-		do {
-			u8_t *rcvbuf;
-			u16_t rcvlen;
-			netbuf_data(inbuf, (void**)&rcvbuf, &rcvlen);
-			dump_net_buffer(rcvbuf, rcvlen);
-			if (buflen + rcvlen > bufsize) {
-				bufsize += rcvlen - bufsize < 2048 ? 2048 : rcvlen - bufsize;
-				buf = realloc(buf, bufsize);
-			}
-			memcpy(buf + buflen, rcvbuf, rcvlen);
-			buflen += rcvlen;
-			ESP_LOGI(TAG, "received netbuf of %hu", rcvlen);
-		} while (netbuf_next(inbuf) != -1);
-		netbuf_delete(inbuf);
-	}
-
-	if(buflen) {
-		ESP_LOGV(TAG,  "Getting data buffer.");
-		int lenH = 0;
-		/* extract the first line of the request */
-		char *save_ptr = buf;
-		char *line = strtok_r(save_ptr, new_line, &save_ptr);
-		char *temphost = http_server_get_header(save_ptr, "Host: ", &lenH);
-		char * host = malloc(lenH+1);
-		memset(host,0x00,lenH+1);
-		if(lenH>0){
-			strlcpy(host,temphost,lenH+1);
-		}
-		ESP_LOGD(TAG,  "http_server_netconn_serve Host: [%s], host: [%s], Processing line [%s]",remote_address,host,line);
+	c.remote_address = strdup(ip4addr_ntoa(ip_2_ip4(&remote_add)));
+	if(tcpip_adapter_get_hostname(TCPIP_ADAPTER_IF_STA, &c.host_name) != ESP_OK) c.host_name = NULL;
+	ESP_LOGD(TAG,  "Local Access Point IP address is: %s. Remote device IP address is %s", c.ap_ip_address, c.remote_address);
 
-		if(line) {
+	/* requests are served as soon as they are complete, the timeout only paces keep-alive idling */
+	netconn_set_recvtimeout(conn, HTTP_POLL_MS);
 
-			/* captive portal functionality: redirect to access point IP for HOST that are not the access point IP OR the STA IP */
-			const char * host_name=NULL;
-			if((err=tcpip_adapter_get_hostname(TCPIP_ADAPTER_IF_STA, &host_name )) !=ESP_OK) {
-				ESP_LOGE(TAG,  "Unable to get host name. Error: %s",esp_err_to_name(err));
-			}
-			else {
-				ESP_LOGI(TAG,"System host name %s, http requested host: %s.",host_name, host);
-			}
+	while (1) {
+		size_t consumed = 0, skip;
+		int status = 0;
 
-			/* determine if Host is from the STA IP address */
-			wifi_manager_lock_sta_ip_string(portMAX_DELAY);
-			bool access_from_sta_ip = lenH > 0?strcasestr(host, wifi_manager_get_sta_ip_string()):false;
-			wifi_manager_unlock_sta_ip_string();
-			bool access_from_host_name = (host_name!=NULL) && strcasestr(host,host_name);
-
-			if(lenH > 0 && !strcasestr(host, ap_ip_address) && !(access_from_sta_ip || access_from_host_name)) {
-				ESP_LOGI(TAG,  "Redirecting host [%s] to AP IP Address : %s",remote_address, ap_ip_address);
-				netconn_write(conn, http_redirect_hdr_start, sizeof(http_redirect_hdr_start) - 1, NETCONN_NOCOPY);
-				netconn_write(conn, ap_ip_address, strlen(ap_ip_address), NETCONN_NOCOPY);
-				netconn_write(conn, http_redirect_hdr_end, sizeof(http_redirect_hdr_end) - 1, NETCONN_NOCOPY);
-			}
-			else {
-                //static stuff
-				/* default page */
-				if(strstr(line, "GET / ")) {
-					netconn_write(conn, http_html_hdr, sizeof(http_html_hdr) - 1, NETCONN_NOCOPY);
-					netconn_write(conn, index_html_start, index_html_end- index_html_start, NETCONN_NOCOPY);
-				}
-				else if(strstr(line, "GET /code.js ")) {
-					netconn_write(conn, http_js_hdr, sizeof(http_js_hdr) - 1, NETCONN_NOCOPY);
-					netconn_write(conn, code_js_start, code_js_end - code_js_start, NETCONN_NOCOPY);
-				}
-				else if(strstr(line, "GET /style.css ")) {
-					netconn_write(conn, http_css_hdr, sizeof(http_css_hdr) - 1, NETCONN_NOCOPY);
-					netconn_write(conn, style_css_start, style_css_end - style_css_start, NETCONN_NOCOPY);
-				}
-				else if(strstr(line, "GET /jquery.js ")) {
-					http_server_send_resource_file(conn,jquery_gz_start, jquery_gz_end, "text/javascript", "gzip" );
-				}
-				else if(strstr(line, "GET /popper.js ")) {
-					http_server_send_resource_file(conn,popper_gz_start, popper_gz_end, "text/javascript", "gzip" );
-				}
-				else if(strstr(line, "GET /bootstrap.js ")) {
-					http_server_send_resource_file(conn,bootstrap_js_gz_start, bootstrap_js_gz_end, "text/javascript", "gzip" );
-				}
-				else if(strstr(line, "GET /bootstrap.css ")) {
-					http_server_send_resource_file(conn,bootstrap_css_gz_start, bootstrap_css_gz_end, "text/css", "gzip" );
-				}
-
-                //dynamic stuff
-				else if(strstr(line, "GET /scan.json ")) {
-					ESP_LOGI(TAG,  "Starting wifi scan");
-					wifi_manager_scan_async();
-				}
-				else if(strstr(line, "GET /ap.json ")) {
-					/* if we can get the mutex, write the last version of the AP list */
-					ESP_LOGI(TAG,  "Processing ap.json request");
-					if(wifi_manager_lock_json_buffer(( TickType_t ) 10)) {
-						netconn_write(conn, http_ok_json_no_cache_hdr, sizeof(http_ok_json_no_cache_hdr) - 1, NETCONN_NOCOPY);
-						char *buff = wifi_manager_alloc_get_ap_list_json();
-						wifi_manager_unlock_json_buffer();
-						if(buff!=NULL){
-							netconn_write(conn, buff, strlen(buff), NETCONN_NOCOPY);
-							free(buff);
-						}
-						else {
-							ESP_LOGD(TAG,  "Error retrieving ap list json string. ");
-							netconn_write(conn, http_503_hdr, sizeof(http_503_hdr) - 1, NETCONN_NOCOPY);
-						}
-					}
-					else {
-						netconn_write(conn, http_503_hdr, sizeof(http_503_hdr) - 1, NETCONN_NOCOPY);
-						ESP_LOGE(TAG,   "http_server_netconn_serve: GET /ap.json failed to obtain mutex");
-					}
-					/* request a wifi scan */
-					ESP_LOGI(TAG,  "Starting wifi scan");
-					wifi_manager_scan_async();
-					ESP_LOGI(TAG,  "Done serving ap.json");
-				}
-				else if(strstr(line, "GET /config.json ")) {
-					ESP_LOGI(TAG,  "Serving config.json");
-					ESP_LOGI(TAG,   "About to get config from flash");
-					http_server_send_config_json(conn);
-					ESP_LOGD(TAG,  "Done serving config.json");
-				}
-				else if(strstr(line, "POST /config.json ")) {
-					ESP_LOGI(TAG,  "Serving POST config.json");
-					int lenA=0;
-					char * last_parm=save_ptr;
-					char * next_parm=save_ptr;
-					char  * last_parm_name=NULL;
-					bool bErrorFound=false;
-					bool bOTA=false;
-					char * otaURL=NULL;
-					// todo:  implement json body parsing
-					//http_server_process_config(conn,save_ptr);
-
-					while(last_parm!=NULL) {
-						// Search will return
-						ESP_LOGD(TAG,   "Getting parameters from X-Custom headers");
-						last_parm = http_server_search_header(next_parm, "X-Custom-", &lenA, &last_parm_name,&next_parm,buf+buflen);
-						if(last_parm!=NULL && last_parm_name!=NULL) {
-							ESP_LOGI(TAG,   "http_server_netconn_serve: POST config.json, config %s=%s", last_parm_name, last_parm);
-							if(strcmp(last_parm_name, "fwurl")==0) {
-								// we're getting a request to do an OTA from that URL
-								ESP_LOGW(TAG,   "Found OTA request!");
-								otaURL=strdup(last_parm);
-								bOTA=true;
-							}
-							else {
-								ESP_LOGV(TAG,   "http_server_netconn_serve: POST config.json Storing parameter");
-								if(config_set_value(NVS_TYPE_STR, last_parm_name , last_parm) != ESP_OK){
-									ESP_LOGE(TAG,  "Unable to save nvs value.");
-								}
-							}
-						}
-						if(last_parm_name!=NULL) {
-							free(last_parm_name);
-							last_parm_name=NULL;
-						}
-					}
-					if(bErrorFound) {
-						netconn_write(conn, http_400_hdr, sizeof(http_400_hdr) - 1, NETCONN_NOCOPY); //400 invalid request
-					}
-					else {
-						netconn_write(conn, http_ok_json_no_cache_hdr, sizeof(http_ok_json_no_cache_hdr) - 1, NETCONN_NOCOPY); //200ok
-						if(bOTA) {
+		// tolerate empty lines between requests
+		if (c.len && (skip = strspn(c.buf, "\r\n")) != 0) {
+			memmove(c.buf, c.buf + skip, c.len - skip + 1);
+			c.len -= skip;
+		}
 
-#if RECOVERY_APPLICATION
-							ESP_LOGW(TAG,   "Starting process OTA for url %s",otaURL);
-#else
-							ESP_LOGW(TAG,   "Restarting system to process OTA for url %s",otaURL);
-#endif
-							wifi_manager_reboot_ota(otaURL);
-							free(otaURL);
-						}
-					}
-					ESP_LOGI(TAG,  "Done Serving POST config.json");
-				} 
-				else if(strstr(line, "POST /connect.json ")) {
-					ESP_LOGI(TAG,   "http_server_netconn_serve: POST /connect.json");
-					bool found = false;
-					int lenS = 0, lenP = 0, lenN = 0;
-					char *ssid = NULL, *password = NULL;
-					ssid = http_server_get_header(save_ptr, "X-Custom-ssid: ", &lenS);
-					password = http_server_get_header(save_ptr, "X-Custom-pwd: ", &lenP);
-					char * new_host_name_b = http_server_get_header(save_ptr, "X-Custom-host_name: ", &lenN);
-					if(lenN > 0){
-						lenN++;
-						char * new_host_name = malloc(lenN);
-						strlcpy(new_host_name, new_host_name_b, lenN);
-						if(config_set_value(NVS_TYPE_STR, "host_name", new_host_name) != ESP_OK){
-							ESP_LOGE(TAG,  "Unable to save host name configuration");
-						}
-						free(new_host_name);
-					}
-
-					if(ssid && lenS <= MAX_SSID_SIZE && password && lenP <= MAX_PASSWORD_SIZE) {
-						wifi_config_t* config = wifi_manager_get_wifi_sta_config();
-						memset(config, 0x00, sizeof(wifi_config_t));
-						memcpy(config->sta.ssid, ssid, lenS);
-						memcpy(config->sta.password, password, lenP);
-						ESP_LOGD(TAG,   "http_server_netconn_serve: wifi_manager_connect_async() call, with ssid: %s, password: %s", config->sta.ssid, config->sta.password);
-						wifi_manager_connect_async();
-						netconn_write(conn, http_ok_json_no_cache_hdr, sizeof(http_ok_json_no_cache_hdr) - 1, NETCONN_NOCOPY); //200ok
-						found = true;
-					}
-					else{
-						ESP_LOGE(TAG,  "SSID or Password invalid");
-					}
-
-
-					if(!found) {
-						/* bad request the authentification header is not complete/not the correct format */
-						netconn_write(conn, http_400_hdr, sizeof(http_400_hdr) - 1, NETCONN_NOCOPY);
-						ESP_LOGE(TAG,   "bad request the authentification header is not complete/not the correct format");
-					}
-
-					ESP_LOGI(TAG,   "http_server_netconn_serve: done serving connect.json");
-				}
-				else if(strstr(line, "DELETE /connect.json ")) {
-					ESP_LOGI(TAG,   "http_server_netconn_serve: DELETE /connect.json");
-					/* request a disconnection from wifi and forget about it */
-					wifi_manager_disconnect_async();
-					netconn_write(conn, http_ok_json_no_cache_hdr, sizeof(http_ok_json_no_cache_hdr) - 1, NETCONN_NOCOPY); /* 200 ok */
-					ESP_LOGI(TAG,   "http_server_netconn_serve: done serving DELETE /connect.json");
-				}
-				else if(strstr(line, "POST /reboot_ota.json ")) {
-					ESP_LOGI(TAG,   "http_server_netconn_serve: POST reboot_ota.json");
-					netconn_write(conn, http_ok_json_no_cache_hdr, sizeof(http_ok_json_no_cache_hdr) - 1, NETCONN_NOCOPY); /* 200 ok */
-					wifi_manager_reboot(OTA);
-					ESP_LOGI(TAG,   "http_server_netconn_serve: done serving POST reboot_ota.json");
-				}
-				else if(strstr(line, "POST /reboot.json ")) {
-					ESP_LOGI(TAG,   "http_server_netconn_serve: POST reboot.json");
-					netconn_write(conn, http_ok_json_no_cache_hdr, sizeof(http_ok_json_no_cache_hdr) - 1, NETCONN_NOCOPY); /* 200 ok */
-					wifi_manager_reboot(RESTART);
-					ESP_LOGI(TAG,   "http_server_netconn_serve: done serving POST reboot.json");
-				}
-				else if(strstr(line, "POST /recovery.json ")) {
-					ESP_LOGI(TAG,   "http_server_netconn_serve: POST recovery.json");
-					netconn_write(conn, http_ok_json_no_cache_hdr, sizeof(http_ok_json_no_cache_hdr) - 1, NETCONN_NOCOPY); /* 200 ok */
-					wifi_manager_reboot(RECOVERY);
-					ESP_LOGI(TAG,   "http_server_netconn_serve: done serving POST recovery.json");
-				}
-				else if(strstr(line, "GET /status.json ")) {
-					ESP_LOGI(TAG,  "Serving status.json");
-					if(wifi_manager_lock_json_buffer(( TickType_t ) 10)) {
-						char *buff = wifi_manager_alloc_get_ip_info_json();
-						wifi_manager_unlock_json_buffer();
-						if(buff) {
-							netconn_write(conn, http_ok_json_no_cache_hdr, sizeof(http_ok_json_no_cache_hdr) - 1, NETCONN_NOCOPY);
-							netconn_write(conn, buff, strlen(buff), NETCONN_NOCOPY);
-							free(buff);
-						}
-						else {
-							netconn_write(conn, http_503_hdr, sizeof(http_503_hdr) - 1, NETCONN_NOCOPY);
-						}
-
-					}
-					else {
-						netconn_write(conn, http_503_hdr, sizeof(http_503_hdr) - 1, NETCONN_NOCOPY);
-						ESP_LOGE(TAG,   "http_server_netconn_serve: GET /status failed to obtain mutex");
-					}
-					ESP_LOGI(TAG,  "Done Serving status.json");
-				}
-				else {
-					netconn_write(conn, http_400_hdr, sizeof(http_400_hdr) - 1, NETCONN_NOCOPY);
-					ESP_LOGE(TAG,   "bad request from host: %s, request %s",remote_address, line);
-				}
+		if (c.len) status = http_parse(&c, &req, &consumed);
+
+		if (status < 0) {
+			ESP_LOGE(TAG,   "Bad request from host: %s", c.remote_address);
+			netconn_write(conn, http_400_hdr, sizeof(http_400_hdr) - 1, NETCONN_NOCOPY);
+			break;
+		} else if (!status) {
+			err_t err = http_recv(&c);
+			if (err == ERR_TIMEOUT) {
+				idle += HTTP_POLL_MS;
+				// an idle persistent connection makes room for waiting ones
+				if (idle >= HTTP_KEEPALIVE_MS || (!c.len && uxQueueMessagesWaiting(http_queue))) break;
+			} else if (err != ERR_OK) {
+				break;
+			} else {
+				idle = 0;
 			}
+			continue;
 		}
-		else {
-			ESP_LOGE(TAG,   "URL not found processing for remote host : %s",remote_address);
-			netconn_write(conn, http_404_hdr, sizeof(http_404_hdr) - 1, NETCONN_NOCOPY);
-		}
-		free(host);
-		free(buf);
+
+		http_dispatch(&req);
+
+		// there might be a pipelined request behind
+		memmove(c.buf, c.buf + consumed, c.len - consumed + 1);
+		c.len -= consumed;
+		if (!req.keep_alive) break;
 	}
 
-	free(ap_ip_address);
-	free(remote_address);
+	free(c.buf);
+	free(c.ap_ip_address);
+	free(c.remote_address);
 	netconn_close(conn);
-	/* free the buffer */
-
 }
 
 bool http_server_lock_json_object(TickType_t xTicksToWait) {
@@ -42,6 +42,7 @@ Contains the freeRTOS task and all necessary support
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "freertos/timers.h"
 #include "esp_event_loop.h"
 #include "tcpip_adapter.h"
 #include "esp_event.h"
@@ -101,6 +102,18 @@ static const char TAG[] = "wifi_manager";
 /* @brief task handle for the main wifi_manager task */
 static TaskHandle_t task_wifi_manager = NULL;
 
+/* @brief scan scheduler, results are accumulated in records over split scans */
+static struct {
+	TimerHandle_t timer;
+	bool pending, playing;
+	bool ps_forced;					/* power save could not be set for current playback state */
+	uint8_t channel, last;			/* channel of current split scan step (0 for full scan) */
+	TickType_t done;				/* when last complete scan ended */
+	uint16_t count;
+	wifi_ap_record_t records[MAX_AP_NUM];
+	uint32_t deferred, underruns;
+} scan;
+
 /**
  * The actual WiFi settings in use
  */
@@ -214,6 +227,75 @@ void wifi_manager_scan_async(){
 	wifi_manager_send_message(ORDER_START_WIFI_SCAN, NULL);
 }
 
+void wifi_manager_scan_cached_async(){
+	wifi_manager_send_message(ORDER_START_WIFI_SCAN, (void*) true);
+}
+
+/* @brief periodic tick of scan scheduler, don't wait if queue is full, next tick will do */
+static void wifi_manager_scan_timer(TimerHandle_t timer){
+	queue_message msg = { .code = ORDER_SCHEDULE_SCAN, .param = NULL };
+	xQueueSend(wifi_manager_queue, &msg, 0);
+}
+
+/* @brief set power save according to playback and start a pending scan (or its next step) if audio can afford it */
+static void wifi_manager_scan_schedule(){
+	int headroom = audio_headroom_svc ? audio_headroom_svc() : -1;
+	bool playing = headroom >= 0;
+
+	/* power save delays packets until next DTIM and makes the radio drop some, only allowed when idle. 
+	   It can't be changed when BT coexistence requires modem sleep, then try again on every tick but 
+	   only log once. Playback state is tracked regardless as underrun counting relies on it */
+	if ((playing != scan.playing || scan.ps_forced) && !gpio36_39_used) {
+		wifi_ps_type_t ps = playing ? WIFI_PS_NONE : DEFAULT_STA_POWER_SAVE;
+		esp_err_t err = esp_wifi_set_ps(ps);
+		if (err == ESP_OK) {
+			ESP_LOGI(TAG,  "Playback %s, Wi-Fi power save %d", playing ? "started" : "stopped", ps);
+			scan.ps_forced = false;
+		} else if (!scan.ps_forced || playing != scan.playing) {
+			ESP_LOGW(TAG,  "Playback %s, unable to set Wi-Fi power save %d: %s", playing ? "started" : "stopped", ps, esp_err_to_name(err));
+			scan.ps_forced = true;
+		}
+	}
+	scan.playing = playing;
+
+	if (!scan.pending || isGroupBitSet(WIFI_MANAGER_SCAN_BIT)) return;
+
+	wifi_scan_config_t config = scan_config;
+
+	if (playing) {
+		if (headroom < WIFI_MANAGER_SCAN_HEADROOM_MS) {
+			scan.deferred++;
+			ESP_LOGI(TAG,  "Deferring Wi-Fi scan, only %d ms of audio buffered (%u deferred)", headroom, scan.deferred);
+			return;
+		}
+
+		/* start a split scan at first channel of our country */
+		if (!scan.channel) {
+			wifi_country_t country;
+			esp_wifi_get_country(&country);
+			scan.channel = country.schan;
+			scan.last = country.schan + country.nchan - 1;
+			scan.count = 0;
+		}
+
+		config.channel = scan.channel;
+		config.scan_type = WIFI_SCAN_TYPE_PASSIVE;
+		config.scan_time.passive = WIFI_MANAGER_SCAN_CHANNEL_MS;
+		ESP_LOGD(TAG,  "Scanning channel %u with %d ms of audio buffered", scan.channel, headroom);
+	} else {
+		scan.channel = 0;
+	}
+
+	if (esp_wifi_scan_start(&config, false) != ESP_OK) {
+		/* drop it, next request will try again */
+		ESP_LOGW(TAG,  "Unable to start scan; wifi is trying to connect");
+		scan.pending = false;
+		scan.channel = 0;
+	} else {
+		xEventGroupSetBits(wifi_manager_event_group, WIFI_MANAGER_SCAN_BIT);
+	}
+}
+
 void wifi_manager_disconnect_async(){
 	wifi_manager_send_message(ORDER_DISCONNECT_STA, NULL);
 	//xEventGroupSetBits(wifi_manager_event_group, WIFI_MANAGER_REQUEST_WIFI_DISCONNECT_BIT); TODO: delete
@@ -322,6 +404,12 @@ void wifi_manager_start(){
 	ESP_LOGD(TAG,   "About to call init wifi");
 	wifi_manager_init_wifi();
 
+	/* scan scheduler also tracks playback for power save */
+	scan.timer = xTimerCreate("scan", pdMS_TO_TICKS(WIFI_MANAGER_SCAN_PERIOD_MS), pdTRUE, NULL, wifi_manager_scan_timer);
+	xTimerStart(scan.timer, portMAX_DELAY);
+	monitor_metric_add("wifi_scans_deferred_total", "Wi-Fi scan steps deferred for lack of audio buffered", true, &scan.deferred, NULL);
+	monitor_metric_add("wifi_scan_underruns_total", "Audio buffer empty after a Wi-Fi scan step", true, &scan.underruns, NULL);
+
 	/* start wifi manager task */
 	ESP_LOGD(TAG,   "Creating wifi manager task");
 	xTaskCreate(&wifi_manager, "wifi_manager", 4096, NULL, WIFI_MANAGER_TASK_PRIORITY, &task_wifi_manager);
@@ -1106,14 +1194,35 @@ void wifi_manager( void * pvParameters ){
 		if( xStatus == pdPASS ){
 			switch(msg.code){
 
-			case EVENT_SCAN_DONE:
+			case EVENT_SCAN_DONE: {
+				/* a playback that ran dry while we were off-channel is on us */
+				int headroom = audio_headroom_svc ? audio_headroom_svc() : -1;
+				if (scan.playing && headroom == 0) {
+					scan.underruns++;
+					ESP_LOGW(TAG,  "Audio buffer empty after scan of channel %u (%u underruns)", scan.channel, scan.underruns);
+				}
+
 				/* As input param, it stores max AP number ap_records can hold. As output param, it receives the actual AP number this API returns.
-				 * As a consequence, ap_num MUST be reset to MAX_AP_NUM at every scan */
+				 * Split scans accumulate their steps, so it is whatever room is left */
 				ESP_LOGD(TAG,  "Getting AP list records");
-				ESP_ERROR_CHECK(esp_wifi_scan_get_ap_num(&ap_num));
+				if (!scan.channel) scan.count = 0;
+				uint16_t count = MAX_AP_NUM - scan.count;
+				ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&count, scan.records + scan.count));
+				scan.count += count;
+
+				/* next channel will be scanned by scheduler, when audio has recovered */
+				if (scan.channel && scan.channel < scan.last && scan.count < MAX_AP_NUM) {
+					scan.channel++;
+					break;
+				}
+
+				scan.channel = 0;
+				scan.pending = false;
+				scan.done = xTaskGetTickCount();
+				ap_num = scan.count;
+				accessp_records = scan.records;
+
 				if(ap_num>0){
-					accessp_records = (wifi_ap_record_t*)malloc(sizeof(wifi_ap_record_t) * ap_num);
-					ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&ap_num, accessp_records));
 					/* make sure the http server isn't trying to access the list while it gets refreshed */
 					ESP_LOGD(TAG,  "Preparing to build ap JSON list");
 					if(wifi_manager_lock_json_buffer( pdMS_TO_TICKS(1000) )){
@@ -1127,7 +1236,6 @@ void wifi_manager( void * pvParameters ){
 					else{
 						ESP_LOGE(TAG,   "could not get access to json mutex in wifi_scan");
 					}
-					free(accessp_records);
 				}
 				else{
 					//
@@ -1142,6 +1250,11 @@ void wifi_manager( void * pvParameters ){
 					ESP_LOGD(TAG,  "Done Invoking SCAN DONE callback");
 				}
 				break;
+			}
+			case ORDER_SCHEDULE_SCAN:
+				wifi_manager_scan_schedule();
+				break;
+
 			case EVENT_REFRESH_OTA:
 				if(wifi_manager_lock_json_buffer( portMAX_DELAY )){
 					wifi_manager_generate_ip_info_json( UPDATE_OTA );
@@ -1152,18 +1265,16 @@ void wifi_manager( void * pvParameters ){
 			case ORDER_START_WIFI_SCAN:
 				ESP_LOGD(TAG,   "MESSAGE: ORDER_START_WIFI_SCAN");
 
-				/* if a scan is already in progress this message is simply ignored thanks to the WIFI_MANAGER_SCAN_BIT uxBit */
-				if(! isGroupBitSet(WIFI_MANAGER_SCAN_BIT) ){
-					if(esp_wifi_scan_start(&scan_config, false)!=ESP_OK){
-						ESP_LOGW(TAG,  "Unable to start scan; wifi is trying to connect");
-//						set_status_message(WARNING, "Wifi Connecting. Cannot start scan.");
-					}
-					else {
-						xEventGroupSetBits(wifi_manager_event_group, WIFI_MANAGER_SCAN_BIT);
-					}
+				/* a scan already in progress or pending will serve this request as well */
+				if (msg.param && scan.done && xTaskGetTickCount() - scan.done < pdMS_TO_TICKS(WIFI_MANAGER_SCAN_CACHE_MS)) {
+					ESP_LOGD(TAG,  "Serving cached scan results");
+				}
+				else if (!scan.pending) {
+					scan.pending = true;
+					wifi_manager_scan_schedule();
 				}
 				else {
-					ESP_LOGW(TAG,  "Scan already in progress!");
+					ESP_LOGD(TAG,  "Scan already pending");
 				}
 
 
@@ -76,6 +76,19 @@ extern "C" {
  */
 #define MAX_AP_NUM 							15
 
+/**
+ * @brief Scan scheduling while audio is playing.
+ *
+ * A cached AP list younger than WIFI_MANAGER_SCAN_CACHE_MS is served without scanning.
+ * While playing, scans are split in passive single channel steps, one every
+ * WIFI_MANAGER_SCAN_PERIOD_MS, and a step is deferred until at least
+ * WIFI_MANAGER_SCAN_HEADROOM_MS of audio is buffered.
+ */
+#define WIFI_MANAGER_SCAN_CACHE_MS			30000
+#define WIFI_MANAGER_SCAN_PERIOD_MS			2000
+#define WIFI_MANAGER_SCAN_HEADROOM_MS		1500
+#define WIFI_MANAGER_SCAN_CHANNEL_MS		120
+
 
 
 /**
@@ -204,7 +217,8 @@ typedef enum message_code_t {
 	ORDER_RESTART_RECOVERY = 17,
 	ORDER_RESTART_OTA_URL = 18,
 	ORDER_RESTART = 19,
-	MESSAGE_CODE_COUNT = 20 /* important for the callback array */
+	ORDER_SCHEDULE_SCAN = 20,
+	MESSAGE_CODE_COUNT = 21 /* important for the callback array */
 
 }message_code_t;
 
@@ -322,6 +336,11 @@ void wifi_manager_connect_async();
  */
 void wifi_manager_scan_async();
 
+/**
+ * @brief requests a wifi scan unless last one is younger than WIFI_MANAGER_SCAN_CACHE_MS
+ */
+void wifi_manager_scan_cached_async();
+
 /**
  * @brief requests to disconnect and forget about the access point.
  */
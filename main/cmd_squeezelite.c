@@ -14,6 +14,7 @@
 #include "pthread.h"
 #include "platform_esp32.h"
 #include "config.h"
+#include "overlay.h"
 
 static const char * TAG = "squeezelite_cmd";
 #define SQUEEZELITE_THREAD_STACK_SIZE (6*1024)
@@ -26,6 +27,12 @@ static struct {
     struct arg_str *parameters;
     struct arg_end *end;
 } squeezelite_args;
+/** Arguments used by 'chime' function */
+static struct {
+    struct arg_int *freq;
+    struct arg_int *duration;
+    struct arg_end *end;
+} chime_args;
 static struct {
 	int argc;
 	char ** argv;
@@ -113,6 +120,22 @@ static int launchsqueezelite(int argc, char **argv)
 	ESP_LOGD(TAG ,"Back to console thread!");
     return 0;
 }
+static int play_chime(int argc, char **argv)
+{
+	int nerrors = arg_parse(argc, argv, (void **)&chime_args);
+	if (nerrors != 0) {
+		arg_print_errors(stderr, chime_args.end, argv[0]);
+		return 1;
+	}
+	unsigned freq = chime_args.freq->count ? chime_args.freq->ival[0] : 880;
+	unsigned duration = chime_args.duration->count ? chime_args.duration->ival[0] : 500;
+	if (!output_overlay_chime(freq, duration)) {
+		ESP_LOGW(TAG, "Unable to play chime (squeezelite not running, overlay busy or invalid parameters)");
+		return 1;
+	}
+	return 0;
+}
+
 void register_squeezelite(){
 
 	squeezelite_args.parameters = arg_str0(NULL, NULL, "<parms>", "command line for squeezelite. -h for help, --defaults to launch with default values.");
@@ -126,4 +149,16 @@ void register_squeezelite(){
 	};
 	ESP_ERROR_CHECK( esp_console_cmd_register(&launch_squeezelite) );
 
+	chime_args.freq = arg_int0("f", "freq", "<Hz>", "tone frequency, default 880");
+	chime_args.duration = arg_int0("d", "duration", "<ms>", "tone duration, default 500");
+	chime_args.end = arg_end(2);
+	const esp_console_cmd_t chime_cmd = {
+		.command = "chime",
+		.help = "Plays a chime over current audio",
+		.hint = NULL,
+		.func = &play_chime,
+		.argtable = &chime_args
+	};
+	ESP_ERROR_CHECK( esp_console_cmd_register(&chime_cmd) );
+
 }
@@ -38,6 +38,8 @@
 #include "config.h"
 #include "audio_controls.h"
 #include "telnet.h"
+#include "log_ring.h"
+#include "monitor.h"
 
 static const char certs_namespace[] = "certificates";
 static const char certs_key[] = "blob";
@@ -333,6 +335,15 @@ void register_default_nvs(){
 	ESP_LOGD(TAG,"Registering default value for key %s", "dac_controlset");
 	config_set_default(NVS_TYPE_STR, "dac_controlset", "", 0);
 	
+	ESP_LOGD(TAG,"Registering default value for key %s", "i2s_dma");
+	config_set_default(NVS_TYPE_STR, "i2s_dma", "", 0);
+
+	ESP_LOGD(TAG,"Registering default value for key %s", "decode_limits");
+	config_set_default(NVS_TYPE_STR, "decode_limits", "", 0);
+	
+	ESP_LOGD(TAG,"Registering default value for key %s", "thread_config");
+	config_set_default(NVS_TYPE_STR, "thread_config", "", 0);
+	
 	ESP_LOGD(TAG,"Registering default value for key %s", "jack_mutes_amp");
 	config_set_default(NVS_TYPE_STR, "jack_mutes_amp", "n", 0);
 	
@@ -364,6 +375,11 @@ void app_main()
 	initialize_nvs();
 	ESP_LOGI(TAG,"Setting up telnet.");
 	init_telnet(); // align on 32 bits boundaries
+	log_ring_init(8 * 1024);
+	// average cost of a LOG_* call on target is rate(cycles) / rate(records)
+	monitor_metric_add("log_records_total", "Log messages queued", true, &log_ring_stats()->records, NULL);
+	monitor_metric_add("log_dropped_total", "Log messages dropped, ring full", true, &log_ring_stats()->dropped, NULL);
+	monitor_metric_add("log_queue_cycles_total", "CPU cycles spent by callers queuing log messages", true, &log_ring_stats()->cycles, NULL);
 
 	ESP_LOGI(TAG,"Setting up config subsystem.");
 	config_init();
@@ -0,0 +1,117 @@
+/* 
+ *  Squeezelite for esp32 - BT link controller simulation (host)
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ *  Feeds bt_link_update() (components/squeezelite/bt_link.c) with heartbeat windows
+ *  of a simulated A2DP stack pulling from the FIFO through clean, congested and 
+ *  intermittent 2.4 GHz periods, then checks how pre-buffer depth reacts. Build and 
+ *  run with "make" in this directory, exit code is the number of failed checks.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "bt_link.h"
+
+// same values as output_bt.c
+#define FIFO_SIZE		(16*1024)
+#define LINK_DEPTH(l)	(((l) + 1) * (FIFO_SIZE / LINK_LEVELS))
+
+#define RATE			44100
+#define BYTES_PER_FRAME	4
+#define WINDOW_MS		500
+#define CB_MS			2
+
+struct sim_s {
+	struct link_s ctrl;
+	uint32_t fifo, underruns, changes;
+};
+
+/****************************************************************************************
+ * One heartbeat window: stack pulls every CB_MS unless it stalls for <stall> ms every 
+ * <period> ms, then catches up in one request. Render thread refills FIFO up to depth 
+ * between callbacks. Returns underruns of that window
+ */
+static uint32_t window(struct sim_s *sim, uint32_t stall, uint32_t period) {
+	uint32_t requested = 0, gap = 0, underruns = 0, last = 0;
+	uint32_t depth = LINK_DEPTH(sim->ctrl.level);
+	
+	for (uint32_t t = CB_MS; t <= WINDOW_MS; t += CB_MS) {
+		// stalled, nothing is requested
+		if (stall && (t % period) < stall) continue;
+		
+		uint32_t len = (t * RATE / 1000 - last * RATE / 1000) * BYTES_PER_FRAME;
+		if (t - last > gap) gap = t - last;
+		last = t;
+		requested += len;
+		
+		if (len > sim->fifo) {
+			underruns++;
+			sim->fifo = 0;
+		} else {
+			sim->fifo -= len;
+		}
+		
+		// render thread is much faster than real time
+		sim->fifo = depth;
+	}	
+	
+	sim->underruns += underruns;
+	if (bt_link_update(&sim->ctrl, WINDOW_MS * RATE / 1000 * BYTES_PER_FRAME, requested, gap, underruns)) sim->changes++;
+	
+	return underruns;
+}
+
+static int check(bool ok, const char *what, struct sim_s *sim) {
+	printf("%-48s level:%d depth:%5u quality:%3u%% stalls:%3u underruns:%3u %s\n", what, sim->ctrl.level, 
+		   LINK_DEPTH(sim->ctrl.level), sim->ctrl.quality, sim->ctrl.stalls, sim->underruns, ok ? "OK" : "FAIL");
+	return ok ? 0 : 1;
+}
+
+int main(void) {
+	struct sim_s sim = { .ctrl = { .level = LINK_START, .quality = 100 }, .fifo = LINK_DEPTH(LINK_START) };
+	uint32_t expected = WINDOW_MS * RATE / 1000 * BYTES_PER_FRAME;
+	int fails = 0, n;
+	
+	// clean link for 20s: pre-buffer goes down to minimum, nothing is lost
+	for (n = 0; n < 40; n++) window(&sim, 0, 0);
+	fails += check(sim.ctrl.level == 0 && !sim.underruns, "clean: shrinks to minimum", &sim);
+	
+	// short gaps (20ms) are normal scheduling jitter and fit in minimum depth
+	for (n = 0; n < 20; n++) window(&sim, 17, 250);
+	fails += check(sim.ctrl.level == 0 && !sim.ctrl.stalls, "20ms gaps: tolerated", &sim);
+	
+	// congestion: 150ms stalls every 400ms, depth must go to max within LINK_LEVELS windows 
+	// and then underruns must stop (catch-up fits in deepest FIFO)
+	sim.underruns = 0;
+	for (n = 0; n < LINK_LEVELS; n++) window(&sim, 150, 400);
+	fails += check(sim.ctrl.level == LINK_LEVELS - 1, "150ms stalls: deepens to max", &sim);
+	for (n = 0, sim.underruns = 0; n < 10; n++) window(&sim, 60, 400);
+	fails += check(sim.ctrl.level == LINK_LEVELS - 1 && !sim.underruns, "60ms stalls at max depth: no underrun", &sim);
+	
+	// recovery: one level less every LINK_STABLE clean windows
+	for (n = 0; sim.ctrl.level > 0 && n < 1000; n++) window(&sim, 0, 0);
+	fails += check(n == LINK_STABLE * (LINK_LEVELS - 1), "recovery: LINK_STABLE windows per level", &sim);
+	
+	// underruns alone (stack requested on time) degrade link too
+	bt_link_update(&sim.ctrl, expected, expected, 10, 3);
+	fails += check(sim.ctrl.level == 1, "underrun only: one level deeper", &sim);
+	
+	// stack under-requesting (ratio < LINK_MIN_RATIO) without long gaps
+	bt_link_update(&sim.ctrl, expected, expected * (LINK_MIN_RATIO - 10) / 100, 10, 0);
+	fails += check(sim.ctrl.level == 2, "low request ratio: one level deeper", &sim);
+	
+	// intermittent: one bad window out of 10 never lets depth go down
+	for (n = 0; n < 200; n++) window(&sim, n % 10 ? 0 : 120, 400);
+	fails += check(sim.ctrl.level == LINK_LEVELS - 1, "intermittent: stays deep", &sim);
+	
+	// quality settles back to 100% once clean
+	for (n = 0; n < 100; n++) window(&sim, 0, 0);
+	fails += check(sim.ctrl.quality == 100 && sim.ctrl.level == 0, "clean again: quality 100%", &sim);
+	
+	printf("%d level changes, %s\n", sim.changes, fails ? "FAILED" : "PASSED");
+	
+	return fails;
+}
@@ -0,0 +1,182 @@
+/*
+ *  Squeezelite for esp32 - DMAP parser fuzz and timing (host)
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ *  Feeds components/raop/dmap_parser.c with a RAOP-like metadata message, all its
+ *  truncations, oversized (up to 0xffffffff) field lengths and random mutations.
+ *  Each input is in its own exact-size allocation so that the sanitizers catch any
+ *  read outside of it, and every view handed by dmap_visit() must be inside. Then
+ *  dmap_visit() and dmap_parse() are timed on the valid message. Built by "make" in
+ *  this directory, exit code is the number of failed checks.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "dmap_parser.h"
+
+#define MUTATIONS	200000
+#define RANDOM		50000
+#define LOOPS		200000
+
+static char msg[512];
+static size_t msg_len, headers[16];
+static int n_headers;
+static int fails;
+static const char *view_start, *view_end;
+static unsigned leaves, sum;
+
+/****************************************************************************************
+ * Message builder, <len> of containers is patched once children are added
+ */
+static size_t put(size_t at, const char *code, const void *data, uint32_t len) {
+	if (!len || data) headers[n_headers++] = at;
+	memcpy(msg + at, code, 4);
+	msg[at + 4] = len >> 24; msg[at + 5] = len >> 16; msg[at + 6] = len >> 8; msg[at + 7] = len;
+	if (data) memcpy(msg + at + 8, data, len);
+	return at + 8 + (data ? len : 0);
+}
+
+static void build(void) {
+	uint32_t be = 0x01020304;
+	size_t p;
+
+	p = put(0, "mlit", NULL, 0);
+	p = put(p, "asal", "Kind of Blue", 12);
+	p = put(p, "asar", "Miles Davis", 11);
+	p = put(p, "minm", "So What", 7);
+	p = put(p, "asgn", "Jazz", 4);
+	p = put(p, "astn", &be, 2);
+	p = put(p, "mper", &be, 4);
+	p = put(p, "caps", &be, 1);
+	p = put(p, "astm", &be, 4);
+	p = put(p, "asdk", &be, 1);
+	p = put(p, "xxxx", "unknown tag", 11);
+	msg_len = p;
+	msg[4] = (msg_len - 8) >> 24; msg[5] = (msg_len - 8) >> 16; msg[6] = (msg_len - 8) >> 8; msg[7] = msg_len - 8;
+}
+
+/****************************************************************************************
+ * Callbacks touch every byte they are given
+ */
+static void touch(const char *buf, size_t len) {
+	while (len--) sum += (unsigned char) *buf++;
+}
+
+static void on_leaf(void *ctx, uint32_t tag, const char *buf, size_t len) {
+	if (buf < view_start || len > (size_t) (view_end - buf)) (*(int*) ctx)++;
+	touch(buf, len);
+	leaves++;
+}
+
+static void on_dict(void *ctx, const char *code, const char *name) { touch(name, strlen(name)); }
+static void on_i32(void *ctx, const char *code, const char *name, int32_t value) { sum += value; }
+static void on_i64(void *ctx, const char *code, const char *name, int64_t value) { sum += value; }
+static void on_u32(void *ctx, const char *code, const char *name, uint32_t value) { sum += value; }
+static void on_u64(void *ctx, const char *code, const char *name, uint64_t value) { sum += value; }
+static void on_data(void *ctx, const char *code, const char *name, const char *buf, size_t len) { touch(buf, len); }
+
+static const dmap_settings settings = { on_dict, on_dict, on_i32, on_i64, on_u32, on_u64, on_u32, on_data, on_data, NULL };
+
+/****************************************************************************************
+ * Run both parsers on a private copy of <buf>, returns dmap_visit() result
+ */
+static int run(const char *buf, size_t len, int *parsed) {
+	char *copy = malloc(len ? len : 1);
+	int bad = 0, res;
+
+	memcpy(copy, buf, len);
+	view_start = copy;
+	view_end = copy + len;
+	res = dmap_visit(copy, len, on_leaf, &bad);
+	if (bad) fails++;
+	*parsed = dmap_parse(&settings, copy, len);
+	free(copy);
+
+	return res;
+}
+
+static void check(bool ok, const char *what) {
+	if (!ok) fails++;
+	printf("%-48s %s\n", what, ok ? "OK" : "FAIL");
+}
+
+static double elapsed(struct timespec *start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
+
+int main(void) {
+	static const uint32_t oversized[] = { 0xffffffff, 0xfffffff8, 0x80000000, 0x7fffffff, 0x10000, 0 };
+	char work[sizeof(msg)];
+	int parsed, before;
+	bool ok;
+
+	build();
+
+	// valid message
+	leaves = 0;
+	ok = !run(msg, msg_len, &parsed) && !parsed && leaves == 10;
+	check(ok, "valid message: parsed, 10 leaves");
+
+	// every truncation fails as the outer container is always cut
+	ok = true;
+	before = fails;
+	for (size_t len = 1; len < msg_len; len++) {
+		if (!run(msg, len, &parsed) || !parsed) ok = false;
+	}
+	check(ok && fails == before, "truncated: rejected, no out of bounds");
+
+	// any length beyond the buffer fails, including ones that wrap a 32 bits pointer
+	ok = true;
+	before = fails;
+	for (int h = 0; h < n_headers; h++) {
+		size_t at = headers[h];
+		for (int i = 0; oversized[i]; i++) {
+			uint32_t len = oversized[i];
+			memcpy(work, msg, msg_len);
+			work[at + 4] = len >> 24; work[at + 5] = len >> 16; work[at + 6] = len >> 8; work[at + 7] = len;
+			if (!run(work, msg_len, &parsed) || !parsed) ok = false;
+		}
+		// 1 byte too long for the remaining buffer
+		memcpy(work, msg, msg_len);
+		uint32_t len = msg_len - at - 8 + 1;
+		work[at + 4] = len >> 24; work[at + 5] = len >> 16; work[at + 6] = len >> 8; work[at + 7] = len;
+		if (!run(work, msg_len, &parsed) || !parsed) ok = false;
+	}
+	check(ok && fails == before, "oversized lengths: rejected, no out of bounds");
+
+	// random mutations of the valid message, then random bytes
+	before = fails;
+	srand(1);
+	for (int n = 0; n < MUTATIONS; n++) {
+		size_t len = msg_len - rand() % 16;
+		memcpy(work, msg, msg_len);
+		for (int k = rand() % 4 + 1; k; k--) work[rand() % len] = rand();
+		run(work, len, &parsed);
+	}
+	for (int n = 0; n < RANDOM; n++) {
+		size_t len = rand() % 64;
+		for (size_t i = 0; i < len; i++) work[i] = i % 8 < 4 ? "mlitasarminm"[rand() % 12] : rand() % 8 ? 0 : rand();
+		run(work, len, &parsed);
+	}
+	check(fails == before, "random: no out of bounds");
+
+	// timing, meaningful only without sanitizers (dmap_time)
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int n = 0; n < LOOPS; n++) dmap_visit(msg, msg_len, on_leaf, &parsed);
+	printf("%-48s %.0f ns/message\n", "dmap_visit()", elapsed(&start) / LOOPS);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int n = 0; n < LOOPS; n++) dmap_parse(&settings, msg, msg_len);
+	printf("%-48s %.0f ns/message\n", "dmap_parse()", elapsed(&start) / LOOPS);
+
+	printf("%s\n", fails ? "FAILED" : "PASSED");
+
+	return fails;
+}
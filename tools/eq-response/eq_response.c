@@ -0,0 +1,184 @@
+/*
+ *  Squeezelite for esp32 - equalizer frequency response check (host)
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ *  Runs sines through equalizer_process() (components/squeezelite/equalizer.c) and
+ *  measures the gain at various frequencies, for every supported sample rate, with
+ *  default (octave) and parametric bands and while gains ramp. Built for 16 and 32
+ *  bits samples by "make" in this directory, exit code is the number of failed checks.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <math.h>
+#include "squeezelite.h"
+#include "equalizer.h"
+
+#if BYTES_PER_FRAME == 4
+#define FULL_SCALE	32768.0
+#else
+#define FULL_SCALE	2147483648.0
+#endif
+
+#define CHUNK		512
+#define RAMP_CHUNK	4096
+#define TOLERANCE	0.25
+
+static const u32_t rates[] = { 8000, 11025, 12000, 16000, 22050, 24000, 32000, 44100, 48000,
+							   88200, 96000, 176400, 192000, 352800, 384000, 0 };
+static ISAMPLE_T buf[CHUNK * 2], ramp[RAMP_CHUNK * 2];
+static int fails;
+
+// logging is done by utils.c on target
+const char *logtime(void) { return ""; }
+
+void logprint(const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+}
+
+/****************************************************************************************
+ * Set gains (dB) of all bands and let the ramp complete
+ */
+static void set_gains(s8_t *gain, u32_t rate) {
+	equalizer_update(gain);
+	for (int i = 0; i < 64; i++) {
+		memset(buf, 0, sizeof(buf));
+		equalizer_process((u8_t*) buf, sizeof(buf), rate);
+	}
+}
+
+/****************************************************************************************
+ * Gain in dB at <freq>: 0.25 full scale stereo sine, measured on the last half once
+ * filters have settled, left and right must match
+ */
+static double response(double freq, u32_t rate) {
+	size_t frames = rate / 2 > 4 * rate / freq ? rate / 2 : 4 * rate / freq;
+	size_t start = frames / 2, n = 0;
+	double in = 0, out[2] = { 0 };
+
+	while (n < frames) {
+		for (int i = 0; i < CHUNK; i++) {
+			double x = 0.25 * sin(2 * M_PI * freq * (n + i) / rate);
+			buf[2*i] = buf[2*i + 1] = x * FULL_SCALE;
+			if (n + i >= start) in += x * x;
+		}
+
+		equalizer_process((u8_t*) buf, sizeof(buf), rate);
+
+		for (int i = 0; i < CHUNK; i++) {
+			if (n + i < start) continue;
+			for (int c = 0; c < 2; c++) out[c] += pow(buf[2*i + c] / FULL_SCALE, 2);
+		}
+
+		n += CHUNK;
+	}
+
+	if (fabs(out[0] - out[1]) > out[0] * 1e-6) return NAN;
+	return 10 * log10(out[0] / in);
+}
+
+/****************************************************************************************
+ * Response of a single peaking filter (RBJ cookbook) in double precision
+ */
+static double peaking(double freq, double f0, double q, double gain, u32_t rate) {
+	double A = pow(10, gain / 40), w0 = 2 * M_PI * f0 / rate, alpha = sin(w0) / (2 * q);
+	double b[3] = { 1 + alpha * A, -2 * cos(w0), 1 - alpha * A };
+	double a[3] = { 1 + alpha / A, -2 * cos(w0), 1 - alpha / A };
+	double w = 2 * M_PI * freq / rate, num[2] = { 0 }, den[2] = { 0 };
+
+	for (int k = 0; k < 3; k++) {
+		num[0] += b[k] * cos(k * w); num[1] -= b[k] * sin(k * w);
+		den[0] += a[k] * cos(k * w); den[1] -= a[k] * sin(k * w);
+	}
+
+	return 10 * log10((num[0] * num[0] + num[1] * num[1]) / (den[0] * den[0] + den[1] * den[1]));
+}
+
+static void check(double freq, u32_t rate, double expected, const char *what) {
+	double db = response(freq, rate);
+	bool ok = fabs(db - expected) < TOLERANCE;
+
+	if (!ok) fails++;
+	printf("%-32s %6u Hz @%6u: %6.2f dB (expected %6.2f) %s\n", what, (unsigned) freq, rate, db, expected, ok ? "OK" : "FAIL");
+}
+
+int main(void) {
+	s8_t flat[10] = { 0 }, mid[10] = { 0, 0, 0, 0, 0, 6 }, cut[10] = { 0, 0, 0, 0, 0, -6 };
+	s8_t top[10] = { [9] = 6 }, boost[10] = { [5] = 12 };
+
+	printf("%u bits samples\n", (unsigned) sizeof(ISAMPLE_T) * 8);
+
+	// flat is bypassed, so bit exact
+	set_gains(flat, 44100);
+	for (int i = 0; i < CHUNK * 2; i++) buf[i] = (i * 7919) % 65536 - 32768;
+	equalizer_process((u8_t*) buf, sizeof(buf), 44100);
+	bool exact = true;
+	for (int i = 0; i < CHUNK * 2; i++) exact &= buf[i] == (ISAMPLE_T) ((i * 7919) % 65536 - 32768);
+	printf("%-32s %s\n", "flat: bit exact", exact ? "OK" : "FAIL");
+	if (!exact) fails++;
+
+	// 1kHz band on every rate, rate changes don't need re-open
+	for (int i = 0; rates[i]; i++) {
+		set_gains(mid, rates[i]);
+		check(1000, rates[i], 6, "+6dB at 1kHz");
+		check(1000, rates[i], 6, "+6dB at 1kHz, state kept");
+		check(1000 / 16.0, rates[i], 0, "+6dB at 1kHz, far below");
+		if (rates[i] >= 44100) check(16000, rates[i], 0, "+6dB at 1kHz, far above");
+	}
+
+	set_gains(cut, 48000);
+	check(1000, 48000, -6, "-6dB at 1kHz");
+
+	// band beyond 0.45 x rate is ignored
+	set_gains(top, 32000);
+	check(10000, 32000, 0, "16kHz band at 32kHz: bypassed");
+	set_gains(top, 44100);
+	check(16000, 44100, 6, "16kHz band at 44.1kHz");
+
+	// gains ramp by 1dB per processed buffer, measured on the second half of each
+	set_gains(flat, 44100);
+	equalizer_update(boost);
+	for (int k = 1; k <= 14; k++) {
+		double in = 0, out = 0;
+
+		for (int i = 0; i < RAMP_CHUNK; i++) {
+			double x = 0.25 * sin(2 * M_PI * 1000 * (k * RAMP_CHUNK + i) / 44100);
+			ramp[2*i] = ramp[2*i + 1] = x * FULL_SCALE;
+			if (i >= RAMP_CHUNK / 2) in += x * x;
+		}
+
+		equalizer_process((u8_t*) ramp, sizeof(ramp), 44100);
+		for (int i = RAMP_CHUNK / 2; i < RAMP_CHUNK; i++) out += pow(ramp[2*i] / FULL_SCALE, 2);
+
+		double db = 10 * log10(out / in), expected = k < 12 ? k : 12;
+		if (fabs(db - expected) >= TOLERANCE) {
+			printf("%-32s buffer %2d: %6.2f dB (expected %6.2f) FAIL\n", "ramp: 1dB per buffer", k, db, expected);
+			fails++;
+			break;
+		} else if (k == 14) printf("%-32s OK\n", "ramp: 1dB per buffer");
+	}
+
+	// parametric: move 1kHz band to 3kHz with narrow Q and 16kHz to 12kHz
+	equalizer_bands(",,,,,3000:4,,,,12000");
+	set_gains(mid, 44100);
+	check(3000, 44100, 6, "parametric: 3kHz Q=4");
+	check(2000, 44100, peaking(2000, 3000, 4, 6, 44100), "parametric: 3kHz Q=4, 2kHz");
+	check(1000, 44100, peaking(1000, 3000, 4, 6, 44100), "parametric: 3kHz Q=4, old center");
+	set_gains(top, 44100);
+	check(12000, 44100, 6, "parametric: 12kHz");
+
+	// invalid entries fall back to defaults
+	equalizer_bands("5,1000:50");
+	set_gains(mid, 44100);
+	check(1000, 44100, 6, "parametric: invalid Q, default");
+	equalizer_bands(NULL);
+
+	printf("%s\n", fails ? "FAILED" : "PASSED");
+
+	return fails;
+}
@@ -0,0 +1,213 @@
+/*
+ *  Squeezelite for esp32 - GDS text lines check and benchmark (host)
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ *  Draws now-playing screens (header, elapsed counter, scrolling title) with GDS_TextLine()
+ *  of components/display/core/gds_text.c on mock 1, 4 and 16 bits displays and compares
+ *  every frame with a reference build of gds_text.c: the same file without its text cache
+ *  (mutex creation fails) or, with "make compare BASE=<rev>", the one from <rev>. Glyph
+ *  clipping of gds_font.c never draws the last column and row, so they are not compared.
+ *  Also checks GDS_TextStretch() against the reference and utf8_decode() against iconv,
+ *  then times frames. Exit code is the number of failed checks.
+ */
+
+#include <string.h>
+#include <time.h>
+#include <iconv.h>
+#include "gds_private.h"
+#include "gds.h"
+#include "gds_text.h"
+#include "tools.h"
+
+#define FRAMES		2000
+#define SCROLL_MAX	384
+
+bool Ref_TextSetFontAuto(struct GDS_Device* Device, int N, int FontType, int Space);
+bool Ref_TextLine(struct GDS_Device* Device, int N, int Pos, int Attr, char *Text);
+int Ref_TextStretch(struct GDS_Device* Device, int N, char *String, int Max);
+
+typedef bool (*text_line_f)(struct GDS_Device*, int, int, int, char*);
+
+bool shim_mutex_fail;
+static int fails;
+
+static struct {
+	int Width, Height, Depth, Mode;
+	int Font1, Space1, Font2, Space2;
+	const char *Name;
+} configs[] = {
+	{ 128, 64, 1, GDS_MONO, GDS_FONT_LINE_1, -3, GDS_FONT_LINE_2, -3, "SSD1306 128x64, displayer lines" },
+	{ 128, 64, 1, GDS_MONO, GDS_FONT_SMALL, 2, GDS_FONT_MEDIUM, 3, "SSD1306 128x64, small/medium, unaligned" },
+	{ 128, 32, 1, GDS_MONO, GDS_FONT_SMALL, 0, GDS_FONT_SMALL, 1, "SSD1306 128x32, small" },
+	{ 256, 64, 4, GDS_GRAYSCALE, GDS_FONT_LINE_1, -3, GDS_FONT_LINE_2, -3, "SSD1322 256x64, displayer lines" },
+	{ 160, 128, 16, GDS_RGB565, GDS_FONT_LINE_1, -3, GDS_FONT_LINE_2, -3, "ST7735 160x128, displayer lines" },
+	{ 0 }
+};
+
+static bool Init(struct GDS_Device *Device) { return true; }
+static void Update(struct GDS_Device *Device) { }
+
+static double now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/****************************************************************************************
+ * Mock display, framebuffer is allocated by GDS_Init
+ */
+static void device_init(struct GDS_Device *Device, int n, bool reference) {
+	memset(Device, 0, sizeof(*Device));
+	Device->Width = configs[n].Width;
+	Device->Height = configs[n].Height;
+	Device->Depth = configs[n].Depth;
+	Device->Mode = configs[n].Mode;
+	Device->RSTPin = Device->Backlight.Pin = -1;
+	Device->Init = Init;
+	Device->Update = Update;
+	GDS_Init(Device);
+
+	if (reference) {
+		shim_mutex_fail = true;
+		Ref_TextSetFontAuto(Device, 1, configs[n].Font1, configs[n].Space1);
+		Ref_TextSetFontAuto(Device, 2, configs[n].Font2, configs[n].Space2);
+		shim_mutex_fail = false;
+	} else {
+		GDS_TextSetFontAuto(Device, 1, configs[n].Font1, configs[n].Space1);
+		GDS_TextSetFontAuto(Device, 2, configs[n].Font2, configs[n].Space2);
+	}
+}
+
+static int pixel(struct GDS_Device *Device, int x, int y) {
+	uint8_t *fb = Device->Framebuffer;
+	if (Device->Depth == 1) return fb[(y >> 3) * Device->Width + x] >> (y & 7) & 1;
+	if (Device->Depth == 4) return fb[(y * Device->Width + x) >> 1] >> ((x & 1) * 4) & 0x0f;
+	return ((uint16_t*) fb)[y * Device->Width + x];
+}
+
+static bool same(struct GDS_Device *A, struct GDS_Device *B, int *x, int *y) {
+	for (*y = 0; *y < A->Height - 1; (*y)++) {
+		for (*x = 0; *x < A->Width - 1; (*x)++) if (pixel(A, *x, *y) != pixel(B, *x, *y)) return false;
+	}
+	return true;
+}
+
+/****************************************************************************************
+ * One frame as the displayer draws it: header (sometimes overlaid, not cleared), elapsed
+ * time right-justified with clear to EOL and scrolling title. A centered monospace line
+ * now and then pushes the others out of the cache
+ */
+static void frame(struct GDS_Device *Device, text_line_f line, char *title, int offset, int i) {
+	char counter[16];
+
+	snprintf(counter, sizeof(counter), "%5u:%02u", i / 20 / 60, i / 20 % 60);
+	line(Device, 1, GDS_TEXT_LEFT, i % 7 ? GDS_TEXT_CLEAR : 0, "Miles Davis - Kind of Blue");
+	line(Device, 1, GDS_TEXT_RIGHT, GDS_TEXT_CLEAR | GDS_TEXT_CLEAR_EOL | GDS_TEXT_UPDATE, counter);
+	if (i % 50 == 49) line(Device, 2, GDS_TEXT_CENTER, GDS_TEXT_CLEAR | GDS_TEXT_MONOSPACE | GDS_TEXT_UPDATE, counter);
+	else line(Device, 2, -offset, GDS_TEXT_CLEAR | GDS_TEXT_UPDATE, title);
+}
+
+static void check(bool ok, const char *what, const char *name) {
+	char label[96];
+	snprintf(label, sizeof(label), "%s: %s", name, what);
+	printf("%-64s %s\n", label, ok ? "OK" : "FAIL");
+	if (!ok) fails++;
+}
+
+static void check_config(int n) {
+	struct GDS_Device A, R;
+	char title[SCROLL_MAX + 1] = "So What (Remastered 1997) \x96 Side A", ref_title[SCROLL_MAX + 1];
+	int boundary, ref_boundary, x = 0, y = 0, i;
+	bool ok = true;
+
+	device_init(&A, n, false);
+	device_init(&R, n, true);
+
+	strcpy(ref_title, title);
+	boundary = GDS_TextStretch(&A, 2, title, SCROLL_MAX);
+	ref_boundary = Ref_TextStretch(&R, 2, ref_title, SCROLL_MAX);
+	check(boundary == ref_boundary && !strcmp(title, ref_title), "stretch", configs[n].Name);
+
+	for (i = 0; ok && i < FRAMES; i++) {
+		int offset = boundary ? (i * 2) % boundary : 0;
+		frame(&A, GDS_TextLine, title, offset, i);
+		frame(&R, Ref_TextLine, ref_title, offset, i);
+		ok = same(&A, &R, &x, &y);
+	}
+	check(ok, "frames match reference", configs[n].Name);
+	if (!ok) printf("    frame %d, first difference at %d,%d\n", i - 1, x, y);
+
+	free(A.Framebuffer);
+	free(R.Framebuffer);
+}
+
+/****************************************************************************************
+ * Every BMP code point through utf8_decode() and iconv. Unmapped ones end the string
+ */
+static void check_cp1252(void) {
+	iconv_t cd = iconv_open("CP1252", "UTF-8");
+	int bad = -1;
+
+	for (uint32_t cp = 1; cp <= 0xffff && bad < 0; cp++) {
+		char utf8[8] = { 0 }, out[8] = { 0 }, *in = utf8, *optr = out;
+		size_t in_len, out_len = sizeof(out);
+		uint8_t expected;
+
+		if (cp >= 0xd800 && cp <= 0xdfff) continue;
+		if (cp < 0x80) utf8[0] = cp;
+		else if (cp < 0x800) utf8[0] = 0xc0 | cp >> 6, utf8[1] = 0x80 | (cp & 0x3f);
+		else utf8[0] = 0xe0 | cp >> 12, utf8[1] = 0x80 | (cp >> 6 & 0x3f), utf8[2] = 0x80 | (cp & 0x3f);
+
+		// CP1252 leaves 0x81, 0x8d, 0x8f, 0x90 and 0x9d undefined, they are passed through
+		in_len = strlen(utf8);
+		iconv(cd, NULL, NULL, NULL, NULL);
+		if (iconv(cd, &in, &in_len, &optr, &out_len) != (size_t) -1) expected = out[0];
+		else expected = cp <= 0xff ? cp : 0;
+
+		utf8_decode(utf8);
+		if ((uint8_t) utf8[0] != expected) bad = cp;
+	}
+
+	iconv_close(cd);
+	check(bad < 0, "all BMP code points match iconv", "utf8_decode");
+	if (bad >= 0) printf("    first difference at U+%04X\n", bad);
+}
+
+/****************************************************************************************
+ * Time per now-playing frame, with the title scrolling by 2 pixels per frame
+ */
+static void timing(int n) {
+	struct GDS_Device A, R;
+	char title[SCROLL_MAX + 1] = "So What (Remastered 1997) \x96 Side A";
+	double cached, reference, t;
+	int boundary;
+
+	device_init(&A, n, false);
+	device_init(&R, n, true);
+	boundary = GDS_TextStretch(&A, 2, title, SCROLL_MAX);
+
+	t = now_us();
+	for (int i = 0; i < FRAMES; i++) frame(&R, Ref_TextLine, title, (i * 2) % boundary, i);
+	reference = (now_us() - t) / FRAMES;
+
+	t = now_us();
+	for (int i = 0; i < FRAMES; i++) frame(&A, GDS_TextLine, title, (i * 2) % boundary, i);
+	cached = (now_us() - t) / FRAMES;
+
+	printf("%-40s reference %5.1f us, cached %5.1f us per frame (x%.1f)\n", configs[n].Name, reference, cached, reference / cached);
+
+	free(A.Framebuffer);
+	free(R.Framebuffer);
+}
+
+int main(void) {
+	for (int n = 0; configs[n].Width; n++) check_config(n);
+	check_cp1252();
+
+	for (int n = 0; configs[n].Width; n++) if (!strstr(configs[n].Name, "unaligned")) timing(n);
+
+	printf("%s\n", fails ? "FAILED" : "PASSED");
+	return fails;
+}
@@ -0,0 +1,70 @@
+/*
+ *  Squeezelite for esp32 - FreeRTOS/ESP-IDF shim of the GDS core (host)
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ *  Every ESP-IDF header included by components/display/core and components/tools
+ *  is replaced by this one (see Makefile). Mutexes are pthread ones, creating them
+ *  fails while shim_mutex_fail is set, GPIO and LEDC do nothing.
+ */
+
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define IRAM_ATTR
+#define MALLOC_CAP_INTERNAL		0
+#define MALLOC_CAP_DMA			0
+#define portMAX_DELAY			-1
+#define pdMS_TO_TICKS(ms)		(ms)
+
+#define ESP_LOGE(tag, ...)		((void) (tag))
+#define ESP_LOGW(tag, ...)		((void) (tag))
+#define ESP_LOGI(tag, ...)		((void) (tag))
+#define ESP_LOGD(tag, ...)		((void) (tag))
+
+typedef pthread_mutex_t *SemaphoreHandle_t;
+
+extern bool shim_mutex_fail;
+
+static inline SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+	SemaphoreHandle_t mutex;
+	if (shim_mutex_fail || !(mutex = malloc(sizeof(*mutex)))) return NULL;
+	pthread_mutex_init(mutex, NULL);
+	return mutex;
+}
+
+static inline int xSemaphoreTake(SemaphoreHandle_t sem, int ticks) {
+	return !pthread_mutex_lock(sem);
+}
+
+static inline int xSemaphoreGive(SemaphoreHandle_t sem) {
+	return !pthread_mutex_unlock(sem);
+}
+
+static inline void vTaskDelay(int ms) {
+	usleep(ms * 1000);
+}
+
+static inline void *heap_caps_calloc(size_t n, size_t size, int caps) {
+	return calloc(n, size);
+}
+
+// GPIO and backlight PWM
+#define LEDC_TIMER_13_BIT		13
+#define LEDC_HIGH_SPEED_MODE	0
+
+typedef struct { int duty_resolution, freq_hz, speed_mode, timer_num; } ledc_timer_config_t;
+typedef struct { int channel, duty, gpio_num, speed_mode, hpoint, timer_sel; } ledc_channel_config_t;
+
+static inline int ledc_timer_config(const ledc_timer_config_t *config) { return 0; }
+static inline int ledc_channel_config(const ledc_channel_config_t *config) { return 0; }
+static inline int ledc_set_duty(int mode, int channel, int duty) { return 0; }
+static inline int ledc_update_duty(int mode, int channel) { return 0; }
+static inline int gpio_set_level(int gpio, int level) { return 0; }
@@ -0,0 +1,211 @@
+#!/usr/bin/env python3
+#
+#  Squeezelite for esp32 - loopback client of the host build of http_server.c
+#
+#  This software is released under the MIT License.
+#  https://opensource.org/licenses/MIT
+#
+"""
+Talks to http_server.c built with shim.c on loopback (see Makefile).
+
+Unless --timing-only, checks request handling first: every page and JSON
+route, 304 on If-None-Match, config.json ?since= decoding, pipelining,
+chunked bodies, LF-only requests, 404, 400 and Connection: close. Exit code
+is the number of failed checks.
+
+Then measures:
+  - UI page load: the 9 requests of the web UI over 4 keep-alive connections
+  - sequential status.json requests per second on one connection
+  - time to serve a request queued behind 4 idle keep-alive connections
+"""
+
+import argparse
+import re
+import socket
+import sys
+import threading
+import time
+
+PAGE = ['/', '/code.js', '/style.css', '/jquery.js', '/popper.js', '/bootstrap.js',
+        '/bootstrap.css', '/config.json', '/status.json']
+
+
+def connect(port):
+    return socket.create_connection(('127.0.0.1', port))
+
+
+def raw(port, request, wait=0.4):
+    """send raw bytes, return all that is received until close or <wait> of silence"""
+    s = connect(port)
+    s.sendall(request)
+    s.settimeout(wait)
+    data = b''
+    try:
+        while True:
+            chunk = s.recv(65536)
+            if not chunk:
+                data += b'<CLOSED>'
+                break
+            data += chunk
+    except socket.timeout:
+        data += b'<OPEN>'
+    s.close()
+    return data
+
+
+def read_response(s, buf):
+    """one response from <buf> + socket, returns (head, body, rest) with rest None on close"""
+    while b'\r\n\r\n' not in buf and b'\n\n' not in buf:
+        chunk = s.recv(65536)
+        if not chunk:
+            break
+        buf += chunk
+    # servers before keep-alive may end headers with LF only
+    crlf, lf = buf.find(b'\r\n\r\n'), buf.find(b'\n\n')
+    if crlf < 0 or 0 <= lf < crlf:
+        head, rest = buf[:lf], buf[lf + 2:]
+    else:
+        head, rest = buf[:crlf], buf[crlf + 4:]
+    length = re.search(rb'Content-Length: (\d+)', head, re.I)
+    if length or head.startswith(b'HTTP/1.1 304'):
+        n = int(length.group(1)) if length else 0
+        while len(rest) < n:
+            chunk = s.recv(65536)
+            if not chunk:
+                break
+            rest += chunk
+        return head, rest[:n], rest[n:]
+    while True:
+        chunk = s.recv(65536)
+        if not chunk:
+            break
+        rest += chunk
+    return head, rest, None
+
+
+def get(s, url):
+    s.sendall(('GET %s HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n' % url).encode())
+
+
+def checks(port):
+    fails = 0
+
+    def check(ok, what):
+        nonlocal fails
+        fails += not ok
+        print('%-56s %s' % (what, 'OK' if ok else 'FAIL'))
+
+    for url in PAGE:
+        r = raw(port, ('GET %s HTTP/1.0\r\nHost: 127.0.0.1\r\n\r\n' % url).encode())
+        head, _, body = r.partition(b'\r\n\r\n')
+        check(head.startswith(b'HTTP/1.1 200') and len(body) > len(b'<CLOSED>') and r.endswith(b'<CLOSED>'),
+              'GET %s (HTTP/1.0 closes)' % url)
+
+    r = raw(port, b'GET /popper.js HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n')
+    etag = re.search(rb'ETag: (\S+)', r)
+    check(etag is not None and r.endswith(b'<OPEN>'), 'ETag on static file, HTTP/1.1 kept open')
+    if etag:
+        r = raw(port, b'GET /popper.js HTTP/1.1\r\nIf-None-Match: ' + etag.group(1) + b'\r\n\r\n')
+        check(r.startswith(b'HTTP/1.1 304'), '304 on If-None-Match')
+
+    r = raw(port, b'GET /config.json HTTP/1.1\r\nIf-None-Match: "abcdef01-7"\r\n\r\n')
+    check(r.startswith(b'HTTP/1.1 304'), 'config.json: 304 on current ETag')
+    r = raw(port, b'GET /config.json?x=2&since=%22abcdef01-3%22&y HTTP/1.1\r\n\r\n')
+    check(b'{"since":""abcdef01-3""}' in r and b'X-Config-Delta: true' in r, 'config.json: since= URL-decoded, delta')
+    r = raw(port, b'GET /config.json?since=%2212345678-3%22 HTTP/1.1\r\n\r\n')
+    check(b'"key_00"' in r and b'X-Config-Delta: false' in r, 'config.json: unknown base, full document')
+
+    r = raw(port, b'GET /status.json HTTP/1.1\r\n\r\nGET /nothing HTTP/1.1\r\n\r\n'
+                  b'GET /scan.json?x=1 HTTP/1.1\r\nConnection: close\r\n\r\n')
+    check(r.count(b'HTTP/1.1 200') == 2 and b'HTTP/1.1 404' in r and r.endswith(b'<CLOSED>'),
+          'pipelined: 200, 404, 200 with Connection: close')
+
+    r = raw(port, b'POST /config.json HTTP/1.1\r\nX-Custom-host_name: abc\r\nTransfer-Encoding: chunked\r\n\r\n'
+                  b'5\r\nhello\r\n6;ext\r\n world\r\n0\r\n\r\nGET /scan.json HTTP/1.0\r\n\r\n')
+    check(r.count(b'HTTP/1.1 200') == 2 and r.endswith(b'<CLOSED>'), 'chunked body, then next request')
+
+    r = raw(port, b'GET /status.json HTTP/1.1\nHost: 127.0.0.1\n\n')
+    check(r.startswith(b'HTTP/1.1 200'), 'LF only request')
+
+    r = raw(port, b'garbage\r\n\r\n')
+    check(r.startswith(b'HTTP/1.1 400') and r.endswith(b'<CLOSED>'), 'malformed request: 400 and close')
+
+    return fails
+
+
+def fetch(port, urls, out):
+    s = connect(port)
+    buf = b''
+    for url in urls:
+        get(s, url)
+        head, body, buf = read_response(s, buf)
+        out.append(len(body))
+        if buf is None:
+            s.close()
+            s = connect(port)
+            buf = b''
+    s.close()
+
+
+def page_load(port):
+    out = []
+    start = time.time()
+    threads = [threading.Thread(target=fetch, args=(port, PAGE[i::4], out)) for i in range(4)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    return time.time() - start, sum(out)
+
+
+def timing(port, label):
+    loads = [page_load(port) for _ in range(5)]
+    print('%s: page load (9 requests, 4 connections) best %.1f ms, avg %.1f ms, %d bytes' %
+          (label, min(l for l, _ in loads) * 1000, sum(l for l, _ in loads) / len(loads) * 1000, loads[0][1]))
+
+    n = 0
+    s = connect(port)
+    buf = b''
+    start = time.time()
+    while time.time() - start < 2:
+        get(s, '/status.json')
+        head, body, buf = read_response(s, buf)
+        n += 1
+        if buf is None:
+            s.close()
+            s = connect(port)
+            buf = b''
+    s.close()
+    print('%s: status.json %.0f req/s' % (label, n / (time.time() - start)))
+
+    idle = []
+    for _ in range(4):
+        s = connect(port)
+        get(s, '/status.json')
+        read_response(s, b'')
+        idle.append(s)
+    start = time.time()
+    s = connect(port)
+    get(s, '/status.json')
+    read_response(s, b'')
+    print('%s: request behind 4 idle keep-alive connections served in %.0f ms' % (label, (time.time() - start) * 1000))
+    for s in idle + [s]:
+        s.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--port', type=int, default=8086)
+    parser.add_argument('--label', default='http_server')
+    parser.add_argument('--timing-only', action='store_true')
+    args = parser.parse_args()
+
+    fails = 0 if args.timing_only else checks(args.port)
+    timing(args.port, args.label)
+    if not args.timing_only:
+        print('FAILED' if fails else 'PASSED')
+    sys.exit(fails)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,272 @@
+/*
+ *  Squeezelite for esp32 - netconn/FreeRTOS shim of http_server.c (host)
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ */
+
+#include "shim.h"
+
+// http_server.c's assets, as the component's COMPONENT_EMBED_FILES would
+#define ASSET(name, file) __asm__(".section .rodata\n" \
+	".global _binary_" #name "_start\n_binary_" #name "_start:\n.incbin \"" ASSET_DIR "/" file "\"\n" \
+	".global _binary_" #name "_end\n_binary_" #name "_end:\n.previous\n");
+
+ASSET(style_css, "style.css")
+ASSET(jquery_min_js_gz, "jquery.min.js.gz")
+ASSET(popper_min_js_gz, "popper.min.js.gz")
+ASSET(bootstrap_min_js_gz, "bootstrap.min.js.gz")
+ASSET(bootstrap_min_css_gz, "bootstrap.min.css.gz")
+ASSET(code_js, "code.js")
+ASSET(index_html, "index.html")
+
+static int port = 8080;
+
+/****************************************************************************************
+ * netconn over BSD sockets, server is bound to loopback
+ */
+struct netconn *netconn_new(int type) {
+	struct netconn *conn = calloc(1, sizeof(*conn));
+	int on = 1;
+	conn->fd = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(conn->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	return conn;
+}
+
+void netconn_bind(struct netconn *conn, void *addr, int unused) {
+	struct sockaddr_in sa = { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	if (bind(conn->fd, (struct sockaddr*) &sa, sizeof(sa))) {
+		perror("bind");
+		exit(1);
+	}
+}
+
+void netconn_listen(struct netconn *conn) {
+	listen(conn->fd, 16);
+}
+
+err_t netconn_accept(struct netconn *conn, struct netconn **new_conn) {
+	int on = 1, fd = accept(conn->fd, NULL, NULL);
+	if (fd < 0) return ERR_CLSD;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	*new_conn = calloc(1, sizeof(**new_conn));
+	(*new_conn)->fd = fd;
+	return ERR_OK;
+}
+
+err_t netconn_recv(struct netconn *conn, struct netbuf **buf) {
+	struct netbuf *nb = malloc(sizeof(*nb));
+	int n = recv(conn->fd, nb->data, sizeof(nb->data), 0);
+
+	if (n <= 0) {
+		free(nb);
+		return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ? ERR_TIMEOUT : ERR_CLSD;
+	}
+
+	nb->len = n;
+	*buf = nb;
+	return ERR_OK;
+}
+
+err_t netconn_write(struct netconn *conn, const void *data, size_t len, int flags) {
+	while (len) {
+		int n = send(conn->fd, data, len, MSG_NOSIGNAL);
+		if (n <= 0) return ERR_CLSD;
+		data = (const char*) data + n;
+		len -= n;
+	}
+	return ERR_OK;
+}
+
+void netconn_close(struct netconn *conn) {
+	shutdown(conn->fd, SHUT_RDWR);
+}
+
+void netconn_delete(struct netconn *conn) {
+	close(conn->fd);
+	free(conn);
+}
+
+void netconn_set_recvtimeout(struct netconn *conn, int ms) {
+	struct timeval tv = { ms / 1000, (ms % 1000) * 1000 };
+	setsockopt(conn->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+void netconn_getaddr(struct netconn *conn, ip_addr_t *addr, u16_t *port, int local) {
+	socklen_t len = sizeof(addr->sa);
+	getpeername(conn->fd, (struct sockaddr*) &addr->sa, &len);
+}
+
+void netbuf_data(struct netbuf *buf, void **data, u16_t *len) {
+	*data = buf->data;
+	*len = buf->len;
+}
+
+int netbuf_next(struct netbuf *buf) {
+	return -1;
+}
+
+void netbuf_delete(struct netbuf *buf) {
+	free(buf);
+}
+
+char *ip4addr_ntoa(ip_addr_t *addr) {
+	static __thread char buf[INET_ADDRSTRLEN];
+	return strcpy(buf, inet_ntoa(addr->sa.sin_addr));
+}
+
+int tcpip_adapter_get_hostname(int interface, const char **hostname) {
+	*hostname = "squeezelite";
+	return ESP_OK;
+}
+
+/****************************************************************************************
+ * FreeRTOS tasks, mutexes and queues of pointers over pthreads
+ */
+struct task_arg { TaskFunction_t fn; void *param; };
+
+static void *task_start(void *arg) {
+	struct task_arg task = *(struct task_arg*) arg;
+	free(arg);
+	task.fn(task.param);
+	return NULL;
+}
+
+TaskHandle_t xTaskCreateStatic(TaskFunction_t fn, const char *name, int stack_size, void *param, int prio, StackType_t *stack, StaticTask_t *buf) {
+	struct task_arg *arg = malloc(sizeof(*arg));
+	pthread_t thread;
+
+	arg->fn = fn;
+	arg->param = param;
+	pthread_create(&thread, NULL, task_start, arg);
+	pthread_detach(thread);
+
+	return (TaskHandle_t) arg;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+	pthread_mutex_t *mutex = malloc(sizeof(*mutex));
+	pthread_mutex_init(mutex, NULL);
+	return mutex;
+}
+
+int xSemaphoreTake(SemaphoreHandle_t sem, int ticks) {
+	pthread_mutex_lock(sem);
+	return pdTRUE;
+}
+
+void xSemaphoreGive(SemaphoreHandle_t sem) {
+	pthread_mutex_unlock(sem);
+}
+
+struct queue {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	void *items[64];
+	int count, length;
+};
+
+QueueHandle_t xQueueCreate(int length, int size) {
+	struct queue *queue = calloc(1, sizeof(*queue));
+	pthread_mutex_init(&queue->mutex, NULL);
+	pthread_cond_init(&queue->cond, NULL);
+	queue->length = length;
+	return queue;
+}
+
+int xQueueSend(QueueHandle_t queue, void *item, int ticks) {
+	pthread_mutex_lock(&queue->mutex);
+	while (queue->count == queue->length) pthread_cond_wait(&queue->cond, &queue->mutex);
+	queue->items[queue->count++] = *(void**) item;
+	pthread_cond_broadcast(&queue->cond);
+	pthread_mutex_unlock(&queue->mutex);
+	return pdTRUE;
+}
+
+int xQueueReceive(QueueHandle_t queue, void *item, int ticks) {
+	pthread_mutex_lock(&queue->mutex);
+	while (!queue->count) pthread_cond_wait(&queue->cond, &queue->mutex);
+	*(void**) item = queue->items[0];
+	memmove(queue->items, queue->items + 1, --queue->count * sizeof(void*));
+	pthread_cond_broadcast(&queue->cond);
+	pthread_mutex_unlock(&queue->mutex);
+	return pdTRUE;
+}
+
+int uxQueueMessagesWaiting(QueueHandle_t queue) {
+	return queue->count;
+}
+
+/****************************************************************************************
+ * wifi_manager, config and monitor
+ */
+static wifi_config_t sta_config;
+
+bool wifi_manager_lock_json_buffer(int ticks) { return true; }
+void wifi_manager_unlock_json_buffer(void) { }
+void wifi_manager_scan_async(void) { }
+void wifi_manager_scan_cached_async(void) { }
+void wifi_manager_connect_async(void) { }
+void wifi_manager_disconnect_async(void) { }
+void wifi_manager_reboot(int reason) { }
+void wifi_manager_reboot_ota(char *url) { }
+wifi_config_t *wifi_manager_get_wifi_sta_config(void) { return &sta_config; }
+bool wifi_manager_lock_sta_ip_string(int ticks) { return true; }
+void wifi_manager_unlock_sta_ip_string(void) { }
+char *wifi_manager_get_sta_ip_string(void) { return "127.0.0.1"; }
+
+char *wifi_manager_alloc_get_ap_list_json(void) {
+	return strdup("[{\"ssid\":\"home\",\"chan\":1,\"rssi\":-50,\"auth\":3}]");
+}
+
+char *wifi_manager_alloc_get_ip_info_json(void) {
+	return strdup("{\"ssid\":\"home\",\"ip\":\"127.0.0.1\",\"netmask\":\"255.255.255.0\",\"gw\":\"127.0.0.1\","
+				  "\"urc\":0,\"project_name\":\"squeezelite-esp32\",\"version\":\"host\"}");
+}
+
+void *config_alloc_get_default(int type, const char *key, void *default_value, int size) {
+	return default_value ? strdup(default_value) : NULL;
+}
+
+// about the size of a real nvs_json (40 keys)
+char *config_alloc_get_json(bool formatted) {
+	char *json = malloc(4096);
+	strcpy(json, "{");
+	for (int i = 0; i < 40; i++) {
+		sprintf(json + strlen(json), "%s\"key_%02d\":{\"value\":\"some value %d\",\"type\":33}", i ? "," : "", i, i);
+	}
+	strcat(json, "}");
+	return json;
+}
+
+int config_set_value(int type, const char *key, const char *value) {
+	return ESP_OK;
+}
+
+void config_get_etag(char *etag, size_t size) {
+	snprintf(etag, size, "\"%08x-%u\"", 0xabcdef01, 7);
+}
+
+// echoes "since" so that the client can check how the query was decoded, only this boot's 
+// epoch is a usable base
+char *config_alloc_get_json_since(const char *since, char *etag, size_t size, bool *delta) {
+	char *json;
+
+	config_get_etag(etag, size);
+	*delta = since && strstr(since, "abcdef01-");
+	if (!*delta) return config_alloc_get_json(false);
+
+	json = malloc(128);
+	snprintf(json, 128, "{\"since\":\"%s\"}", since);
+	return json;
+}
+
+size_t monitor_metrics(char *buf, size_t size, bool json) {
+	return snprintf(buf, size, json ? "{\"heap_free\":100000}" : "heap_free 100000\n");
+}
+
+int main(int argc, char **argv) {
+	if (argc > 1) port = atoi(argv[1]);
+	http_server(NULL);
+	return 0;
+}
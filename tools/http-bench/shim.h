@@ -0,0 +1,148 @@
+/*
+ *  Squeezelite for esp32 - netconn/FreeRTOS shim of http_server.c (host)
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ *  Every ESP-IDF/lwIP header included by http_server.c is replaced by this one (see
+ *  Makefile). netconn maps to BSD sockets, tasks to pthreads, queues/mutexes to
+ *  pthread ones and wifi_manager/config/monitor to canned answers.
+ */
+
+#pragma once
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// lwIP
+typedef uint8_t u8_t;
+typedef uint16_t u16_t;
+typedef int err_t;
+
+#define ERR_OK			0
+#define ERR_MEM			-1
+#define ERR_TIMEOUT		-3
+#define ERR_CLSD		-15
+#define NETCONN_NOCOPY	0
+#define NETCONN_COPY	1
+#define NETCONN_TCP		0
+#define IP_ADDR_ANY		NULL
+#define ip_2_ip4(a)		(a)
+
+typedef struct { struct sockaddr_in sa; } ip_addr_t;
+struct netconn { int fd; };
+struct netbuf { char data[2048]; int len; };
+
+struct netconn *netconn_new(int type);
+void netconn_bind(struct netconn *conn, void *addr, int port);
+void netconn_listen(struct netconn *conn);
+err_t netconn_accept(struct netconn *conn, struct netconn **new_conn);
+err_t netconn_recv(struct netconn *conn, struct netbuf **buf);
+err_t netconn_write(struct netconn *conn, const void *data, size_t len, int flags);
+void netconn_close(struct netconn *conn);
+void netconn_delete(struct netconn *conn);
+void netconn_set_recvtimeout(struct netconn *conn, int ms);
+void netconn_getaddr(struct netconn *conn, ip_addr_t *addr, u16_t *port, int local);
+void netbuf_data(struct netbuf *buf, void **data, u16_t *len);
+int netbuf_next(struct netbuf *buf);
+void netbuf_delete(struct netbuf *buf);
+char *ip4addr_ntoa(ip_addr_t *addr);
+
+// ESP-IDF
+#define ESP_OK						0
+#define TCPIP_ADAPTER_IF_STA		0
+#define EXT_RAM_ATTR
+#define CODE_RAM_LOCATION
+#define esp_err_to_name(e)			"error"
+#define ESP_LOGE(tag, ...)		((void) (tag))
+#define ESP_LOGW(tag, ...)		((void) (tag))
+#define ESP_LOGI(tag, ...)		((void) (tag))
+#define ESP_LOGD(tag, ...)		((void) (tag))
+#define ESP_LOGV(tag, ...)		((void) (tag))
+
+int tcpip_adapter_get_hostname(int interface, const char **hostname);
+static inline size_t strlcpy(char *dst, const char *src, size_t size) {
+	size_t len = strlen(src);
+	if (size) {
+		size_t n = len < size - 1 ? len : size - 1;
+		memcpy(dst, src, n);
+		dst[n] = '\0';
+	}
+	return len;
+}
+
+// FreeRTOS
+typedef void *TaskHandle_t;
+typedef int StaticTask_t;
+typedef uint8_t StackType_t;
+typedef pthread_mutex_t *SemaphoreHandle_t;
+typedef struct queue *QueueHandle_t;
+typedef int TickType_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdTRUE					1
+#define portMAX_DELAY			-1
+#define pdMS_TO_TICKS(ms)		(ms)
+#define configMAX_TASK_NAME_LEN	16
+#define taskYIELD()
+#define vTaskDelete(task)		pthread_exit(NULL)
+#define vSemaphoreDelete(sem)
+
+TaskHandle_t xTaskCreateStatic(TaskFunction_t fn, const char *name, int stack_size, void *param, int prio, StackType_t *stack, StaticTask_t *buf);
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+int xSemaphoreTake(SemaphoreHandle_t sem, int ticks);
+void xSemaphoreGive(SemaphoreHandle_t sem);
+QueueHandle_t xQueueCreate(int length, int size);
+int xQueueSend(QueueHandle_t queue, void *item, int ticks);
+int xQueueReceive(QueueHandle_t queue, void *item, int ticks);
+int uxQueueMessagesWaiting(QueueHandle_t queue);
+
+// wifi_manager, config, monitor
+#define WIFI_MANAGER_TASK_PRIORITY	5
+#define RECOVERY_APPLICATION		0
+#define MAX_SSID_SIZE				32
+#define MAX_PASSWORD_SIZE			64
+#define NVS_TYPE_STR				0
+#define DEFAULT_AP_IP				"192.168.4.1"
+
+typedef struct { struct { char ssid[32]; char password[64]; } sta; } wifi_config_t;
+enum { OTA, RESTART, RECOVERY };
+
+bool wifi_manager_lock_json_buffer(int ticks);
+void wifi_manager_unlock_json_buffer(void);
+char *wifi_manager_alloc_get_ap_list_json(void);
+char *wifi_manager_alloc_get_ip_info_json(void);
+void wifi_manager_scan_async(void);
+void wifi_manager_scan_cached_async(void);
+void wifi_manager_connect_async(void);
+void wifi_manager_disconnect_async(void);
+void wifi_manager_reboot(int reason);
+void wifi_manager_reboot_ota(char *url);
+wifi_config_t *wifi_manager_get_wifi_sta_config(void);
+bool wifi_manager_lock_sta_ip_string(int ticks);
+void wifi_manager_unlock_sta_ip_string(void);
+char *wifi_manager_get_sta_ip_string(void);
+
+void *config_alloc_get_default(int type, const char *key, void *default_value, int size);
+char *config_alloc_get_json(bool formatted);
+int config_set_value(int type, const char *key, const char *value);
+void config_get_etag(char *etag, size_t size);
+char *config_alloc_get_json_since(const char *since, char *etag, size_t size, bool *delta);
+
+size_t monitor_metrics(char *buf, size_t size, bool json);
+
+// http_server.h
+void http_server(void *param);
+void http_server_netconn_serve(struct netconn *conn);
+char *http_server_get_header(char *request, char *header_name, int *len);
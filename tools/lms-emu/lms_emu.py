@@ -0,0 +1,420 @@
+#!/usr/bin/env python3
+#
+#  Squeezelite for esp32 - stand-in LMS for load and latency measurements
+#
+#  This software is released under the MIT License.
+#  https://opensource.org/licenses/MIT
+#
+"""
+Minimal Logitech Media Server stand-in that scripts a slimproto session with
+one player and measures what the player does with it.
+
+It answers discovery, accepts the player's slimproto connection, serves an
+audio file over HTTP and runs a script of commands separated by ';':
+
+  play [autostart]        strm 's' for --file (autostart 0 waits for 'u')
+  pause                   strm 'p', latency measured up to STMp
+  unpause [delay_ms]      strm 'u', 0 or a start time in player's jiffies
+  skip <ms>               strm 'a'
+  stop                    strm 'q', latency measured up to STMf
+  volume <0..100>         audg (linear gain)
+  flood <fps> <seconds>   send grfe frames at <fps> (--width x --height)
+  ping <count>            strm 't' round trips
+  wait <seconds>          idle, polling STAT every --stat-ms
+
+While waiting or flooding, strm 't' is sent every --stat-ms. Its round-trip
+time is the command-to-effect latency of the slimproto thread under that
+load. STAT replies are checked against ground truth: within one play segment,
+elapsed_milliseconds must advance like the player's jiffies, and jiffies must
+advance like the host clock. A sync start ('unpause <delay>') is checked by
+comparing the requested jiffies with jiffies - elapsed_milliseconds.
+
+The player runs on real hardware, so CPU load can't be measured from here; use
+the player's own metrics (e.g. "tasks" on console) alongside this tool.
+
+Example:
+  lms_emu.py --file test.flac --script "play 0; wait 3; unpause 500; wait 10; \\
+              flood 30 10; pause; wait 2; unpause; skip 5000; wait 5; stop"
+"""
+
+import argparse
+import os
+import socket
+import socketserver
+import statistics
+import struct
+import threading
+import time
+
+SLIMPROTO_PORT = 3483
+
+# STAT packet after opcode and length, see slimproto.h
+STAT_FORMAT = '>4sBBBIIIIHIIIIHIIH'
+STAT_FIELDS = ('event', 'num_crlf', 'mas_initialized', 'mas_mode', 'stream_buffer_size',
+               'stream_buffer_fullness', 'bytes_received_H', 'bytes_received_L',
+               'signal_strength', 'jiffies', 'output_buffer_size', 'output_buffer_fullness',
+               'elapsed_seconds', 'voltage', 'elapsed_milliseconds', 'server_timestamp',
+               'error_code')
+
+CODECS = {'.mp3': 'm', '.flac': 'f', '.ogg': 'o', '.opus': 'u', '.aac': 'a',
+          '.wav': 'p', '.pcm': 'p', '.alac': 'l'}
+
+
+def now_ms():
+    return time.monotonic() * 1000.0
+
+
+def summary(values):
+    if not values:
+        return 'n/a'
+    values = sorted(values)
+    p95 = values[min(len(values) - 1, int(len(values) * 0.95))]
+    return 'n:%d min:%.1f avg:%.1f p95:%.1f max:%.1f' % (
+        len(values), values[0], statistics.mean(values), p95, values[-1])
+
+
+class Player:
+    """ one slimproto connection, packets are read by a thread into an event list """
+
+    def __init__(self, sock, verbose):
+        self.sock = sock
+        self.verbose = verbose
+        self.cond = threading.Condition()
+        self.events = []            # (host_ms, event, stat dict)
+        self.helo = None
+        self.send_lock = threading.Lock()
+        threading.Thread(target=self.reader, daemon=True).start()
+
+    def recv_all(self, size):
+        data = b''
+        while len(data) < size:
+            chunk = self.sock.recv(size - len(data))
+            if not chunk:
+                raise ConnectionError('player disconnected')
+            data += chunk
+        return data
+
+    def reader(self):
+        try:
+            while True:
+                opcode, length = struct.unpack('>4sI', self.recv_all(8))
+                payload = self.recv_all(length)
+                self.process(opcode.decode('latin-1'), payload)
+        except (ConnectionError, OSError) as e:
+            print('connection closed: %s' % e)
+            with self.cond:
+                self.events.append((now_ms(), 'DSCO', None))
+                self.cond.notify_all()
+
+    def process(self, opcode, payload):
+        at = now_ms()
+        if opcode == 'HELO':
+            self.helo = payload
+            mac = ':'.join('%02x' % b for b in payload[2:8])
+            caps = payload[36:].decode('latin-1', 'replace')
+            print('HELO from %s, capabilities: %s' % (mac, caps))
+            event, stat = 'HELO', None
+        elif opcode == 'STAT':
+            size = struct.calcsize(STAT_FORMAT)
+            stat = dict(zip(STAT_FIELDS, struct.unpack(STAT_FORMAT, payload[:size])))
+            event = stat['event'].decode('latin-1')
+            if self.verbose and event != 'STMt':
+                print('%10.1f %s elapsed:%u jiffies:%u' % (at, event, stat['elapsed_milliseconds'], stat['jiffies']))
+        else:
+            event, stat = opcode, None
+            if self.verbose:
+                print('%10.1f %s (%d bytes)' % (at, opcode, len(payload)))
+        with self.cond:
+            self.events.append((at, event, stat))
+            self.cond.notify_all()
+
+    def send(self, opcode, payload=b''):
+        body = opcode.encode('latin-1') + payload
+        with self.send_lock:
+            # timestamp first, reply might be processed before sendall returns
+            at = now_ms()
+            self.sock.sendall(struct.pack('>H', len(body)) + body)
+        return at
+
+    def wait_event(self, names, since, timeout_ms=5000, match=None):
+        """ first event in names received after host time since """
+        deadline = now_ms() + timeout_ms
+        with self.cond:
+            while True:
+                for at, event, stat in self.events:
+                    if at >= since and event in names and (match is None or match(stat)):
+                        return at, event, stat
+                remaining = deadline - now_ms()
+                if remaining <= 0:
+                    return None
+                self.cond.wait(remaining / 1000.0)
+
+    def strm(self, command, autostart='1', codec='?', threshold=255, replay_gain=0,
+             http_port=0, request=b''):
+        payload = struct.pack('>cccccccBBBcBBBIHI', command.encode(), autostart.encode(),
+                              codec.encode(), b'?', b'?', b'?', b'?', threshold, 0, 0, b'0',
+                              0, 0, 0, replay_gain & 0xffffffff, http_port, 0)
+        return self.send('strm', payload + request)
+
+
+class Session:
+    def __init__(self, player, args):
+        self.player = player
+        self.args = args
+        self.seq = 0
+        self.rtt = {}               # phase -> [ms]
+        self.latency = {}           # command -> [ms]
+        self.stats = []             # STAT samples with segment id
+        self.segment = None
+        self.clock = None           # (host_ms, jiffies) to estimate player's clock
+        self.sync_start = None
+        self.errors = []
+
+    # ------------------------------------------------------------------ helpers
+    def record(self, table, key, value):
+        table.setdefault(key, []).append(value)
+
+    def acked(self, command, sent, events, timeout_ms=5000):
+        got = self.player.wait_event(events, sent, timeout_ms)
+        if got is None:
+            self.errors.append('%s: no %s within %d ms' % (command, '/'.join(events), timeout_ms))
+            return None
+        self.record(self.latency, command, got[0] - sent)
+        return got
+
+    def ping(self, phase):
+        self.seq += 1
+        seq = self.seq
+        sent = self.player.strm('t', replay_gain=seq)
+        got = self.player.wait_event(('STMt',), sent, 2000, lambda s: s['server_timestamp'] == seq)
+        if got is None:
+            self.errors.append('%s: STMt %d lost' % (phase, seq))
+            return
+        at, _, stat = got
+        self.record(self.rtt, phase, at - sent)
+        # player's clock at the middle of the round trip
+        self.clock = ((sent + at) / 2, stat['jiffies'])
+        if self.segment is not None:
+            self.stats.append((self.segment, at, stat))
+
+    def poll(self, phase, seconds):
+        end = now_ms() + seconds * 1000
+        while now_ms() < end:
+            start = now_ms()
+            self.ping(phase)
+            time.sleep(max(0, self.args.stat_ms - (now_ms() - start)) / 1000.0)
+
+    def player_jiffies(self):
+        if self.clock is None:
+            self.ping('clock')
+        return int(self.clock[1] + now_ms() - self.clock[0])
+
+    # ------------------------------------------------------------------ commands
+    def cmd_play(self, autostart='1'):
+        name = os.path.basename(self.args.file)
+        request = ('GET /stream/%s HTTP/1.0\r\n\r\n' % name).encode()
+        codec = self.args.codec or CODECS.get(os.path.splitext(name)[1].lower(), '?')
+        sent = self.player.strm('s', autostart=autostart, codec=codec, http_port=self.args.http_port,
+                                request=request)
+        self.segment = None
+        if autostart == '1':
+            got = self.acked('play', sent, ('STMs',), 20000)
+            if got:
+                self.segment = got[0]
+        else:
+            self.acked('load', sent, ('STMl',), 20000)
+
+    def cmd_pause(self):
+        sent = self.player.strm('p')
+        self.segment = None
+        self.acked('pause', sent, ('STMp',))
+
+    def cmd_unpause(self, delay='0'):
+        delay = int(delay)
+        start_at = self.player_jiffies() + delay if delay else 0
+        sent = self.player.strm('u', replay_gain=start_at)
+        self.acked('unpause', sent, ('STMr',))
+        self.segment = sent + delay
+        if start_at:
+            # STAT of that segment tell when playback really started
+            self.sync_start = (self.segment, start_at)
+
+    def cmd_skip(self, ms):
+        self.player.strm('a', replay_gain=int(ms))
+        # position jumps, start a new segment
+        self.segment = now_ms()
+
+    def cmd_stop(self):
+        sent = self.player.strm('q')
+        self.segment = None
+        self.acked('stop', sent, ('STMf',))
+
+    def cmd_volume(self, pct):
+        gain = int(int(pct) * 65536 / 100)
+        self.player.send('audg', struct.pack('>IIBBII', 0, 0, 1, 255, gain, gain))
+
+    def cmd_flood(self, fps, seconds):
+        fps, seconds = float(fps), float(seconds)
+        width, height = self.args.width, self.args.height
+        size = width * height // 8
+        frame, start = 0, now_ms()
+        next_ping = start
+        while now_ms() < start + seconds * 1000:
+            # moving bar so every frame is different
+            data = bytearray(size)
+            column = frame % width
+            data[column * height // 8:(column + 1) * height // 8] = b'\xff' * (height // 8)
+            self.player.send('grfe', struct.pack('>HBB', 0, ord('c'), 0) + bytes(data))
+            frame += 1
+            if now_ms() >= next_ping:
+                self.ping('flood %g fps' % fps)
+                next_ping = now_ms() + self.args.stat_ms
+            time.sleep(max(0, frame * 1000 / fps - (now_ms() - start)) / 1000.0)
+        print('flood: %d frames of %d bytes in %.1fs' % (frame, size, seconds))
+
+    def cmd_ping(self, count):
+        for _ in range(int(count)):
+            self.ping('ping')
+
+    def cmd_wait(self, seconds):
+        self.poll('idle' if self.segment is None else 'playing', float(seconds))
+
+    # ------------------------------------------------------------------ report
+    def report(self):
+        print('\n--- command to effect latency (ms)')
+        for command, values in self.latency.items():
+            print('%-16s %s' % (command, summary(values)))
+
+        print('\n--- slimproto round trip (strm t -> STMt, ms)')
+        for phase, values in self.rtt.items():
+            print('%-16s %s' % (phase, summary(values)))
+
+        print('\n--- STAT accuracy')
+        by_segment = {}
+        for segment, at, stat in self.stats:
+            # not started yet (sync start) or nothing played
+            if stat['elapsed_milliseconds']:
+                by_segment.setdefault(segment, []).append((at, stat))
+        position_err, clock_ppm = [], []
+        for samples in by_segment.values():
+            at0, s0 = samples[0]
+            for at, stat in samples[1:]:
+                jiffies = (stat['jiffies'] - s0['jiffies']) & 0xffffffff
+                played = stat['elapsed_milliseconds'] - s0['elapsed_milliseconds']
+                position_err.append(abs(played - jiffies))
+            if len(samples) > 1 and samples[-1][0] - at0 > 1000:
+                at, stat = samples[-1]
+                jiffies = (stat['jiffies'] - s0['jiffies']) & 0xffffffff
+                clock_ppm.append((jiffies - (at - at0)) * 1e6 / (at - at0))
+        print('elapsed vs jiffies |error| ms %s' % summary(position_err))
+        if clock_ppm:
+            print('jiffies vs host clock ppm %s (includes network jitter)' % summary(clock_ppm))
+
+        if self.sync_start:
+            segment, start_at = self.sync_start
+            started = [stat['jiffies'] - stat['elapsed_milliseconds'] - start_at for _, stat in by_segment.get(segment, [])]
+            print('sync start error ms %s' % summary(started))
+
+        if self.errors:
+            print('\n--- errors')
+            for error in self.errors:
+                print(error)
+
+    def run(self, script):
+        for line in script.split(';'):
+            words = line.split()
+            if not words:
+                continue
+            print('> %s' % ' '.join(words))
+            getattr(self, 'cmd_' + words[0])(*words[1:])
+
+
+# ---------------------------------------------------------------------- servers
+def discovery(http_port):
+    """ answer player's 'e' broadcasts with our JSON (http) port """
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(('', SLIMPROTO_PORT))
+    port = str(http_port).encode()
+    while True:
+        data, addr = sock.recvfrom(1024)
+        if data[:1] == b'e':
+            sock.sendto(b'EJSON' + bytes([len(port)]) + port, addr)
+
+
+def http_server(args):
+    class Handler(socketserver.BaseRequestHandler):
+        def handle(self):
+            request = b''
+            while b'\r\n\r\n' not in request:
+                chunk = self.request.recv(1024)
+                if not chunk:
+                    return
+                request += chunk
+            print('HTTP %s' % request.split(b'\r\n')[0].decode('latin-1'))
+            self.request.sendall(b'HTTP/1.0 200 OK\r\nContent-Type: application/octet-stream\r\n\r\n')
+            # optional throttling to exercise buffering and underruns
+            rate = args.kbps * 1000 / 8 if args.kbps else 0
+            start, sent = time.monotonic(), 0
+            with open(args.file, 'rb') as f:
+                try:
+                    while True:
+                        data = f.read(4096)
+                        if not data:
+                            break
+                        self.request.sendall(data)
+                        sent += len(data)
+                        if rate:
+                            time.sleep(max(0, sent / rate - (time.monotonic() - start)))
+                except OSError:
+                    pass
+            print('HTTP sent %d bytes in %.1fs' % (sent, time.monotonic() - start))
+
+    socketserver.ThreadingTCPServer.allow_reuse_address = True
+    server = socketserver.ThreadingTCPServer(('', args.http_port), Handler)
+    server.daemon_threads = True
+    server.serve_forever()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--file', required=True, help='audio file to stream')
+    parser.add_argument('--codec', help='slimproto codec letter (default from file extension)')
+    parser.add_argument('--script', default='play; wait 10; stop', help='commands separated by ;')
+    parser.add_argument('--http-port', type=int, default=9000)
+    parser.add_argument('--kbps', type=int, default=0, help='throttle HTTP stream (0 = no limit)')
+    parser.add_argument('--stat-ms', type=int, default=250, help='strm t period while waiting')
+    parser.add_argument('--width', type=int, default=128, help='grfe frame width')
+    parser.add_argument('--height', type=int, default=32, help='grfe frame height')
+    parser.add_argument('--no-discovery', action='store_true', help='player is given server address')
+    parser.add_argument('-v', '--verbose', action='store_true')
+    args = parser.parse_args()
+
+    if not args.no_discovery:
+        threading.Thread(target=discovery, args=(args.http_port,), daemon=True).start()
+    threading.Thread(target=http_server, args=(args,), daemon=True).start()
+
+    listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    listener.bind(('', SLIMPROTO_PORT))
+    listener.listen(1)
+    print('waiting for player on port %d' % SLIMPROTO_PORT)
+    sock, addr = listener.accept()
+    sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    print('player connected from %s:%d' % addr)
+
+    player = Player(sock, args.verbose)
+    if player.wait_event(('HELO',), 0, 5000) is None:
+        print('no HELO received')
+        return 1
+
+    session = Session(player, args)
+    try:
+        session.run(args.script)
+    finally:
+        session.report()
+    return 0
+
+
+if __name__ == '__main__':
+    raise SystemExit(main())
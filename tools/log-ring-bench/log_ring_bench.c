@@ -0,0 +1,201 @@
+/*
+ *  Squeezelite for esp32 - deferred logger check and benchmark (host)
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ *  Runs components/telnet/log_ring.c with its formatting task on pthreads. Checks that
+ *  rendered lines match printf, that concurrent producers keep their order and that
+ *  every message is either output or counted as dropped. Then times the caller's side
+ *  of a typical LOG_INFO against formatting it synchronously. Built and run by "make"
+ *  in this directory, exit code is the number of failed checks.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include "log_ring.h"
+
+#define PRODUCERS	4
+#define MESSAGES	20000
+#define LOOPS		20000
+#define BATCH		32
+
+static int fails, out_fd, err_fd;
+static FILE *null;
+
+static void lp(const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	log_ring_vprint(fmt, args);
+	va_end(args);
+}
+
+static void check(bool ok, const char *what) {
+	if (!ok) fails++;
+	printf("%-52s %s\n", what, ok ? "OK" : "FAIL");
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/****************************************************************************************
+ * Send stderr (where log_ring writes) to a temporary file, returns what was written
+ */
+static void capture(void) {
+	FILE *tmp = tmpfile();
+	fflush(stderr);
+	dup2(fileno(tmp), STDERR_FILENO);
+	out_fd = dup(fileno(tmp));
+	fclose(tmp);
+}
+
+static char *captured(void) {
+	off_t size;
+	char *buf;
+
+	log_ring_flush();
+	fflush(stderr);
+	size = lseek(out_fd, 0, SEEK_END);
+	buf = calloc(1, size + 1);
+	pread(out_fd, buf, size, 0);
+	close(out_fd);
+	dup2(err_fd, STDERR_FILENO);
+
+	return buf;
+}
+
+/****************************************************************************************
+ * Old synchronous path, as LOG_* did before: logtime() and vfprintf
+ */
+static const char *logtime(void) {
+	static char buf[100];
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	strftime(buf, sizeof(buf), "[%T.", localtime(&tv.tv_sec));
+	sprintf(buf + strlen(buf), "%06ld]", (long) tv.tv_usec);
+	return buf;
+}
+
+static void sync_print(const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(null, fmt, args);
+	va_end(args);
+	fflush(null);
+}
+
+static void *producer(void *arg) {
+	for (int i = 0; i < MESSAGES; i++) lp("producer %d message %d\n", (int) (intptr_t) arg, i);
+	return NULL;
+}
+
+int main(void) {
+	char big[400], expected[16][512], *out, *line, *volatile nothing = NULL;
+	int n = 0;
+
+	err_fd = dup(STDERR_FILENO);
+	null = fopen("/dev/null", "w");
+	memset(big, 'x', sizeof(big) - 1);
+	big[sizeof(big) - 1] = '\0';
+	log_ring_init(64 * 1024);
+
+	// formatting matches printf
+#define CASE(fmt, ...) do { lp(fmt "\n", __VA_ARGS__); snprintf(expected[n++], sizeof(*expected), fmt "\n", __VA_ARGS__); } while (0)
+	capture();
+	CASE("%s:%d fill [level:%hu rec:%u] [W:%hu R:%hu]", "buffer_put_packet", 487, 12, 3u, 100, 88);
+	CASE("%-8s|%5.2f|%lld|%zu|%p|%%|%c|%lx", "ab", 3.14159, -5LL, (size_t) 77, (void*) 0x1234, 'z', 0xdeadbeefUL);
+	CASE("%*d|%-*d|%.*s|%.3s|%08.3f|%+d|%#x|% d", 4, 9, 5, 7, 3, "abcdef", "uvwxyz", -2.5, 7, 255, 42);
+	CASE("%Lf|%e|%g|%llu|%hhd|%jd", (long double) 2.5, 1234.5, 0.0001, 18446744073709551615ULL, 300, (intmax_t) -1);
+	CASE("null %s then %d", nothing, 5);
+	CASE("no argument at all%s", "");
+#undef CASE
+	out = captured();
+	line = out;
+	for (int i = 0; i < n; i++) {
+		char *next = strchr(line, '\n'), *text = strstr(line, "] ");
+		bool ok = next && text && text < next && !strncmp(text + 2, expected[i], next - text - 1);
+		if (!ok) printf("got: %.*s\nexp: %s", next ? (int) (next - line + 1) : (int) strlen(line), line, expected[i]);
+		check(ok, "format matches printf");
+		if (!next) break;
+		line = next + 1;
+	}
+	free(out);
+
+	// a string longer than argument space is truncated, not overflowing
+	capture();
+	lp("big %s then %d\n", big, 42);
+	out = captured();
+	check(strstr(out, "big xxxx") && strlen(out) < sizeof(big), "long string truncated");
+	free(out);
+
+	// concurrent producers: per producer order kept, each message output or dropped
+	log_ring_stats_t before = *log_ring_stats();
+	pthread_t threads[PRODUCERS];
+	capture();
+	for (intptr_t i = 0; i < PRODUCERS; i++) pthread_create(threads + i, NULL, producer, (void*) i);
+	for (int i = 0; i < PRODUCERS; i++) pthread_join(threads[i], NULL);
+	out = captured();
+
+	int last[PRODUCERS], lines = 0, dropped = 0;
+	bool ordered = true;
+	memset(last, -1, sizeof(last));
+	for (line = out; (line = strchr(line, ']')) != NULL; line++) {
+		int id, seq;
+		if (sscanf(line, "] producer %d message %d", &id, &seq) == 2 && id < PRODUCERS) {
+			if (seq <= last[id]) ordered = false;
+			last[id] = seq;
+			lines++;
+		}
+	}
+	// drop notices have no timestamp
+	for (line = out; (line = strstr(line, "*** ")) != NULL; line += 4) {
+		int count;
+		if (sscanf(line, "*** %d log messages dropped", &count) == 1) dropped += count;
+	}
+	free(out);
+
+	uint32_t records = log_ring_stats()->records - before.records, lost = log_ring_stats()->dropped - before.dropped;
+	printf("%d producers x %d messages: %d output, %d dropped\n", PRODUCERS, MESSAGES, lines, dropped);
+	check(ordered, "concurrent producers: order kept");
+	check(lines == records && dropped == lost && lines + dropped == PRODUCERS * MESSAGES, "concurrent producers: output + dropped = sent");
+
+	// timing of caller's side, ring is drained between batches like the task would
+	capture();
+	double t, ring = 0, ring_cycles, vsn, old;
+	before = *log_ring_stats();
+	for (int i = 0; i < LOOPS; i += BATCH) {
+		t = now();
+		for (int j = 0; j < BATCH; j++) lp("%s:%d fill [level:%hu rec:%u] [W:%hu R:%hu]\n", "buffer_put_packet", 487, i + j, 3u, 100, 88);
+		ring += now() - t;
+		log_ring_flush();
+	}
+	ring /= LOOPS;
+	ring_cycles = (double) (log_ring_stats()->cycles - before.cycles) / (log_ring_stats()->records - before.records);
+	free(captured());
+
+	char buf[512];
+	t = now();
+	for (int i = 0; i < LOOPS; i++) snprintf(buf, sizeof(buf), "%s %s:%d fill [level:%hu rec:%u] [W:%hu R:%hu]\n", "[12:00:00.000000]", "buffer_put_packet", 487, i, 3u, 100, 88);
+	vsn = (now() - t) / LOOPS;
+
+	t = now();
+	for (int i = 0; i < LOOPS; i++) sync_print("%s %s:%d fill [level:%hu rec:%u] [W:%hu R:%hu]\n", logtime(), "buffer_put_packet", 487, i, 3u, 100, 88);
+	old = (now() - t) / LOOPS;
+
+	printf("per LOG_INFO call, %d calls:\n", LOOPS);
+	printf("  logtime + vfprintf + fflush (before)   %6.0f ns\n", old);
+	printf("  snprintf only                          %6.0f ns\n", vsn);
+	printf("  log_ring_vprint                        %6.0f ns (%.0f as counted by log_ring_stats)\n", ring, ring_cycles);
+
+	printf("%s\n", fails ? "FAILED" : "PASSED");
+
+	return fails;
+}
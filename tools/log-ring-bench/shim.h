@@ -0,0 +1,66 @@
+/*
+ *  Squeezelite for esp32 - FreeRTOS/ESP-IDF shim of log_ring.c (host)
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ *  Every ESP-IDF header included by log_ring.c is replaced by this one (see Makefile).
+ *  Tasks are pthreads, mutexes are pthread ones and CPU cycles are nanoseconds.
+ */
+
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define EXT_RAM_ATTR
+#define ESP_TASK_PRIO_MIN		0
+#define MALLOC_CAP_SPIRAM		0
+#define portMAX_DELAY			-1
+#define pdMS_TO_TICKS(ms)		(ms)
+
+typedef int StackType_t;
+typedef struct { int unused; } StaticTask_t;
+typedef pthread_mutex_t StaticSemaphore_t;
+typedef pthread_mutex_t *SemaphoreHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+static inline void vTaskDelay(int ms) { 
+	usleep(ms * 1000); 
+}
+
+static inline void *xTaskCreateStatic(TaskFunction_t fn, const char *name, int size, void *arg, int prio, StackType_t *stack, StaticTask_t *buf) {
+	pthread_t thread;
+	pthread_create(&thread, NULL, (void *(*)(void *)) fn, arg);
+	pthread_detach(thread);
+	return buf;
+}
+
+static inline SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buf) {
+	pthread_mutex_init(buf, NULL);
+	return buf;
+}
+
+static inline int xSemaphoreTake(SemaphoreHandle_t sem, int ticks) { 
+	return !pthread_mutex_lock(sem); 
+}
+
+static inline int xSemaphoreGive(SemaphoreHandle_t sem) { 
+	return !pthread_mutex_unlock(sem); 
+}
+
+static inline void *heap_caps_calloc(size_t n, size_t size, int caps) { 
+	return NULL; 
+}
+
+static inline int esp_register_shutdown_handler(void (*handler)(void)) { 
+	return atexit(handler); 
+}
+
+static inline uint32_t xthal_get_ccount(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
@@ -0,0 +1,255 @@
+/*
+ *  Squeezelite for esp32 - OTA download and flash check (host)
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ *  Runs start_ota() of components/squeezelite-ota against a local HTTP server and the
+ *  flash mock of shim.c. Checks a valid image lands in flash with only the sectors it
+ *  needs erased, that corrupt, truncated and oversized downloads are refused and that
+ *  redirections are followed. Then times a whole update with the server paced to a Wi-Fi
+ *  like rate and typical SPI NOR erase/program costs. Each run is a child process, like
+ *  a device that reboots. Exit code is the number of failed checks.
+ *
+ *  usage: ota_bench [-v] [-t(iming only)] [-r <server kB/s>] [-s <image kB>]
+ */
+
+#include "shim.h"
+#include "squeezelite-ota.h"
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define HASH_LEN	32
+#define CHECKS		6
+#define PARTITION_SIZE	0x2A0000	// ota_0 in partitions.csv
+
+// W25Q32 typical: 64 kB block erase, 4 kB sector erase, 256 B page program
+#define BLOCK_MS	150
+#define SECTOR_MS	45
+#define PAGE_US		400
+
+static struct {
+	uint8_t *image;
+	uint32_t len;
+	uint32_t rate;			// bytes/s, 0 for unpaced
+	uint32_t corrupt;		// offset of a flipped byte, 0 for none
+	uint32_t truncate;		// bytes sent before closing, 0 for all
+	uint32_t claim;			// announced Content-Length, 0 for actual
+	int port;
+} server;
+
+/****************************************************************************************
+ * Image with header, segment, app descriptor and, if asked, the appended SHA-256
+ */
+static uint8_t *make_image(uint32_t len, bool hash_appended) {
+	uint8_t *image = malloc(len);
+	esp_image_header_t header = { .magic = ESP_IMAGE_HEADER_MAGIC, .segment_count = 1, .hash_appended = hash_appended };
+	esp_image_segment_header_t segment = { .load_addr = 0x3f400020, .data_len = len - sizeof(header) - sizeof(segment) };
+	esp_app_desc_t desc = { .magic_word = 0xabcd5432, .version = "ota-bench", .project_name = "squeezelite" };
+	uint32_t seed = 0x12345678;
+
+	for (uint32_t i = 0; i < len; i++) image[i] = (seed = seed * 1664525 + 1013904223) >> 24;
+	memcpy(image, &header, sizeof(header));
+	memcpy(image + sizeof(header), &segment, sizeof(segment));
+	memcpy(image + sizeof(header) + sizeof(segment), &desc, sizeof(desc));
+
+	if (hash_appended) {
+		mbedtls_sha256_context sha;
+		mbedtls_sha256_init(&sha);
+		mbedtls_sha256_starts_ret(&sha, 0);
+		mbedtls_sha256_update_ret(&sha, image, len - HASH_LEN);
+		mbedtls_sha256_finish_ret(&sha, image + len - HASH_LEN);
+	}
+
+	return image;
+}
+
+/****************************************************************************************
+ * One connection at a time: /redirect answers 302 to /fw.bin, which sends the image
+ */
+static void *server_thread(void *arg) {
+	int fd = *(int*) arg;
+
+	while (1) {
+		int client = accept(fd, NULL, NULL), n, len = 0, window = 16384;
+		char request[1024], path[64] = "";
+
+		if (client < 0) continue;
+		setsockopt(client, SOL_SOCKET, SO_SNDBUF, &window, sizeof(window));
+		while (len < sizeof(request) - 1 && (n = recv(client, request + len, sizeof(request) - 1 - len, 0)) > 0) {
+			request[len += n] = '\0';
+			if (strstr(request, "\r\n\r\n")) break;
+		}
+		sscanf(request, "GET %63s", path);
+
+		if (!strcmp(path, "/redirect")) {
+			dprintf(client, "HTTP/1.1 302 Found\r\nLocation: http://127.0.0.1:%d/fw.bin\r\nContent-Length: 0\r\n\r\n", server.port);
+		} else {
+			uint32_t end = server.truncate ? server.truncate : server.len;
+			double start = shim_now_ms();
+
+			dprintf(client, "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: %u\r\n\r\n",
+					server.claim ? server.claim : server.len);
+
+			for (uint32_t pos = 0; !server.claim && pos < end; ) {
+				uint8_t chunk[1460];
+				uint32_t size = end - pos < sizeof(chunk) ? end - pos : sizeof(chunk);
+				memcpy(chunk, server.image + pos, size);
+				if (server.corrupt && server.corrupt >= pos && server.corrupt < pos + size) chunk[server.corrupt - pos] ^= 0x01;
+				if (send(client, chunk, size, MSG_NOSIGNAL) != size) break;
+				pos += size;
+				if (server.rate) {
+					double wait = start + pos * 1000.0 / server.rate - shim_now_ms();
+					if (wait > 0) usleep(wait * 1000);
+				}
+			}
+		}
+
+		close(client);
+	}
+
+	return NULL;
+}
+
+static void server_start(void) {
+	struct sockaddr_in sa = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	socklen_t len = sizeof(sa);
+	static int fd;
+	pthread_t thread;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	bind(fd, (struct sockaddr*) &sa, sizeof(sa));
+	listen(fd, 4);
+	getsockname(fd, (struct sockaddr*) &sa, &len);
+	server.port = ntohs(sa.sin_port);
+	pthread_create(&thread, NULL, server_thread, &fd);
+}
+
+/****************************************************************************************
+ * Run one update, its outcome is in shim_ota. Every run is a child process (see fork_run)
+ */
+static void run_ota(const char *path, bool timed) {
+	char url[64];
+
+	server_start();
+	snprintf(url, sizeof(url), "http://127.0.0.1:%d%s", server.port, path);
+	if (timed) shim_ota_reset(BLOCK_MS, SECTOR_MS, PAGE_US);
+	else shim_ota_reset(0, 0, 0);
+
+	if (start_ota(url) != ESP_OK) {
+		printf("start_ota failed\n");
+		exit(1);
+	}
+	shim_ota_wait();
+}
+
+static bool check(bool ok, const char *what) {
+	printf("%-52s %s\n", what, ok ? "OK" : "FAIL");
+	return ok;
+}
+
+/****************************************************************************************
+ * One check per run, ota_task leaves its state behind like on a device that reboots
+ */
+static int run_check(uint32_t len, uint32_t n) {
+	struct shim_flash *flash = &shim_ota.flash;
+	uint32_t sectors = (len + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE;
+	char status[128];
+	bool ok;
+
+	server.image = make_image(len, n != 5);
+	server.len = len;
+
+	switch (n) {
+	case 0:
+		run_ota("/fw.bin", false);
+		ok = shim_ota.restarted && shim_ota.boot_set && flash->bad_writes == 0 && !memcmp(flash->data, server.image, len);
+		ok = check(ok, "valid image: written and booted");
+		ok &= flash->erases == sectors;
+		for (uint32_t i = sectors * SPI_FLASH_SEC_SIZE; ok && i < flash->size; i++) ok = flash->data[i] == 0x5a;
+		return !check(ok, "valid image: only its sectors erased");
+	case 1:
+		run_ota("/redirect", false);
+		return !check(shim_ota.restarted && !memcmp(flash->data, server.image, len), "redirect: followed");
+	case 2:
+		server.corrupt = len / 2;
+		run_ota("/fw.bin", false);
+		ok = !shim_ota.restarted && !shim_ota.boot_set && strstr(ota_get_status(), "corrupted");
+		return !check(ok, "one flipped bit: refused as corrupted");
+	case 3:
+		server.truncate = len - 1000;
+		run_ota("/fw.bin", false);
+		ok = !shim_ota.restarted && !shim_ota.boot_set && strstr(ota_get_status(), "complete file");
+		return !check(ok, "truncated download: refused");
+	case 4:
+		server.claim = PARTITION_SIZE + SPI_FLASH_SEC_SIZE;
+		run_ota("/fw.bin", false);
+		snprintf(status, sizeof(status), "Invalid binary size %u for partition size %u", server.claim, flash->size);
+		ok = !shim_ota.restarted && flash->erases == 0 && strstr(ota_get_status(), status);
+		return !check(ok, "larger than partition: refused before erase");
+	case 5:
+		run_ota("/fw.bin", false);
+		return !check(shim_ota.restarted && !memcmp(flash->data, server.image, len), "no appended hash: accepted");
+	}
+
+	return 0;
+}
+
+static int run_timing(uint32_t len, uint32_t rate) {
+	server.image = make_image(len, true);
+	server.len = len;
+	server.rate = rate;
+
+	run_ota("/fw.bin", true);
+	if (!shim_ota.boot_set) {
+		printf("timed update failed: %s\n", ota_get_status());
+		return 1;
+	}
+
+	printf("%u kB image at %u kB/s, flash %u/%u ms erase, %u us program: %.0f ms, %u sectors erased\n",
+		   len / 1024, rate / 1024, BLOCK_MS, SECTOR_MS, PAGE_US, shim_ota.boot_set_ms - shim_ota.start_ms, shim_ota.flash.erases);
+	return 0;
+}
+
+static int fork_run(int (*fn)(uint32_t, uint32_t), uint32_t len, uint32_t arg) {
+	int status;
+	pid_t pid = fork();
+
+	if (!pid) {
+		int fails = fn(len, arg);
+		fflush(stdout);
+		_exit(fails);
+	}
+
+	waitpid(pid, &status, 0);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+int main(int argc, char *argv[]) {
+	uint32_t len = 1600 * 1024, rate = 400 * 1024;
+	bool timing_only = false;
+	int opt, fails = 0;
+
+	while ((opt = getopt(argc, argv, "vtr:s:")) != -1) {
+		switch (opt) {
+		case 'v': shim_verbose = 1; break;
+		case 't': timing_only = true; break;
+		case 'r': rate = atoi(optarg) * 1024; break;
+		case 's': len = atoi(optarg) * 1024; break;
+		default: return 1;
+		}
+	}
+
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	if (!timing_only) {
+		// small image for checks, but spanning several erase steps
+		for (int n = 0; n < CHECKS; n++) fails += fork_run(run_check, 600 * 1024 + 123, n);
+	}
+	fails += fork_run(run_timing, len, rate);
+
+	if (!timing_only) printf("%s\n", fails ? "FAILED" : "PASSED");
+	return fails;
+}
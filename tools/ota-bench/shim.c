@@ -0,0 +1,598 @@
+/*
+ *  Squeezelite for esp32 - ESP-IDF/FreeRTOS shim of squeezelite-ota.c (host)
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ */
+
+#include "shim.h"
+#include "squeezelite-ota.h"
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+int shim_verbose;
+struct shim_ota shim_ota;
+
+static pthread_mutex_t flash_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t done_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static bool done;
+
+double shim_now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void sleep_us(uint64_t us) {
+	struct timespec ts = { .tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000 };
+	while (nanosleep(&ts, &ts) && errno == EINTR);
+}
+
+static void ota_done(void) {
+	pthread_mutex_lock(&done_mutex);
+	done = true;
+	pthread_cond_signal(&done_cond);
+	pthread_mutex_unlock(&done_mutex);
+}
+
+void shim_ota_wait(void) {
+	pthread_mutex_lock(&done_mutex);
+	while (!done) pthread_cond_wait(&done_cond, &done_mutex);
+	done = false;
+	pthread_mutex_unlock(&done_mutex);
+}
+
+/****************************************************************************************
+ * ESP-IDF system
+ */
+void shim_log(char level, const char *tag, const char *fmt, ...) {
+	va_list args;
+	if (!shim_verbose) return;
+	va_start(args, fmt);
+	fprintf(stderr, "%c (%.0f) %s: ", level, shim_now_ms() - shim_ota.start_ms, tag);
+	vfprintf(stderr, fmt, args);
+	fputc('\n', stderr);
+	va_end(args);
+}
+
+const char *esp_err_to_name(esp_err_t err) {
+	switch (err) {
+	case ESP_OK: return "ESP_OK";
+	case ESP_FAIL: return "ESP_FAIL";
+	case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+	case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+	case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+	case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+	case ESP_ERR_FLASH_OP_FAIL: return "ESP_ERR_FLASH_OP_FAIL";
+	case ESP_ERR_IMAGE_INVALID: return "ESP_ERR_IMAGE_INVALID";
+	case ESP_ERR_OTA_VALIDATE_FAILED: return "ESP_ERR_OTA_VALIDATE_FAILED";
+	default: return "UNKNOWN ERROR";
+	}
+}
+
+// the device reboots into the new image, ota_task never returns
+void esp_restart(void) {
+	shim_ota.restarted = true;
+	ota_done();
+	pthread_exit(NULL);
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps) {
+	return malloc(size);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps) {
+	return 100 * 1024;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps) {
+	return 100 * 1024;
+}
+
+/****************************************************************************************
+ * FreeRTOS tasks, queues and notifications
+ */
+struct task {
+	pthread_t thread;
+	char name[16];
+	TaskFunction_t fn;
+	void *param;
+	UBaseType_t prio;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	uint32_t notify;
+};
+
+struct queue {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	UBaseType_t length, size, count, head;
+	char data[];
+};
+
+static __thread struct task *current;
+
+static struct task *task_new(const char *name) {
+	struct task *task = calloc(1, sizeof(*task));
+	strncpy(task->name, name, sizeof(task->name) - 1);
+	pthread_mutex_init(&task->mutex, NULL);
+	pthread_cond_init(&task->cond, NULL);
+	return task;
+}
+
+static void *task_thread(void *arg) {
+	current = arg;
+	current->fn(current->param);
+	vTaskDelete(NULL);
+}
+
+// a FreeRTOS task that ends must delete itself, tasks structs are kept for late notifications
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_size, void *param, UBaseType_t prio, TaskHandle_t *handle, BaseType_t core) {
+	struct task *task = task_new(name);
+	task->fn = fn;
+	task->param = param;
+	task->prio = prio;
+	if (handle) *handle = task;
+	if (pthread_create(&task->thread, NULL, task_thread, task)) return pdFALSE;
+	pthread_detach(task->thread);
+	return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+	if (!current || task) abort();
+	if (!strcmp(current->name, "ota_task")) ota_done();
+	pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks) {
+	sleep_us(ticks * portTICK_PERIOD_MS * 1000ULL);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+	if (!current) current = task_new("main");
+	return current;
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task) {
+	return task ? task->prio : xTaskGetCurrentTaskHandle()->prio;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+	pthread_mutex_lock(&task->mutex);
+	task->notify++;
+	pthread_cond_signal(&task->cond);
+	pthread_mutex_unlock(&task->mutex);
+	return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) {
+	struct task *task = xTaskGetCurrentTaskHandle();
+	uint32_t value;
+	pthread_mutex_lock(&task->mutex);
+	while (!task->notify) pthread_cond_wait(&task->cond, &task->mutex);
+	value = task->notify;
+	task->notify = clear ? 0 : value - 1;
+	pthread_mutex_unlock(&task->mutex);
+	return value;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t size) {
+	struct queue *queue = calloc(1, sizeof(*queue) + length * size);
+	queue->length = length;
+	queue->size = size;
+	pthread_mutex_init(&queue->mutex, NULL);
+	pthread_cond_init(&queue->cond, NULL);
+	return queue;
+}
+
+// only "don't wait" and "wait forever" are used
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks) {
+	pthread_mutex_lock(&queue->mutex);
+	while (queue->count == queue->length) {
+		if (!ticks) {
+			pthread_mutex_unlock(&queue->mutex);
+			return pdFALSE;
+		}
+		pthread_cond_wait(&queue->cond, &queue->mutex);
+	}
+	memcpy(queue->data + (queue->head + queue->count++) % queue->length * queue->size, item, queue->size);
+	pthread_cond_broadcast(&queue->cond);
+	pthread_mutex_unlock(&queue->mutex);
+	return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks) {
+	pthread_mutex_lock(&queue->mutex);
+	while (!queue->count) {
+		if (!ticks) {
+			pthread_mutex_unlock(&queue->mutex);
+			return pdFALSE;
+		}
+		pthread_cond_wait(&queue->cond, &queue->mutex);
+	}
+	memcpy(item, queue->data + queue->head * queue->size, queue->size);
+	queue->head = (queue->head + 1) % queue->length;
+	queue->count--;
+	pthread_cond_broadcast(&queue->cond);
+	pthread_mutex_unlock(&queue->mutex);
+	return pdTRUE;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+	free(queue);
+}
+
+/****************************************************************************************
+ * esp_http_client over a blocking socket, plain http to an IPv4 address only. The receive
+ * buffer is the target's TCP window (CONFIG_LWIP_TCP_WND_DEFAULT)
+ */
+#define TCP_WINDOW	32768
+
+struct http_client {
+	esp_http_client_config_t config;
+	char url[256], location[256];
+	int fd, status;
+	long content_length, received;
+	char pending[2048];
+	int pending_len;
+};
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config) {
+	struct http_client *client = calloc(1, sizeof(*client));
+	client->config = *config;
+	strncpy(client->url, config->url, sizeof(client->url) - 1);
+	client->fd = -1;
+	return client;
+}
+
+static void http_event(struct http_client *client, esp_http_client_event_id_t id, char *key, char *value) {
+	esp_http_client_event_t evt = { .event_id = id, .client = client, .header_key = key, .header_value = value };
+	if (client->config.event_handler) client->config.event_handler(&evt);
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len) {
+	char host[64], path[192] = "/";
+	int port = 80, window = TCP_WINDOW / 2;	// Linux doubles it
+	struct sockaddr_in sa = { .sin_family = AF_INET };
+
+	if (sscanf(client->url, "http://%63[^:/]:%d%191s", host, &port, path) < 1) return ESP_ERR_INVALID_ARG;
+	if (client->fd >= 0) close(client->fd);
+
+	client->fd = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(client->fd, SOL_SOCKET, SO_RCVBUF, &window, sizeof(window));
+	sa.sin_port = htons(port);
+	inet_pton(AF_INET, host, &sa.sin_addr);
+	if (connect(client->fd, (struct sockaddr*) &sa, sizeof(sa))) {
+		http_event(client, HTTP_EVENT_ERROR, NULL, NULL);
+		return ESP_FAIL;
+	}
+	http_event(client, HTTP_EVENT_ON_CONNECTED, NULL, NULL);
+
+	dprintf(client->fd, "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n", path, host);
+	http_event(client, HTTP_EVENT_HEADER_SENT, NULL, NULL);
+	client->status = client->content_length = client->received = client->pending_len = 0;
+	*client->location = '\0';
+	return ESP_OK;
+}
+
+int esp_http_client_fetch_headers(esp_http_client_handle_t client) {
+	char head[2048], *line, *end, *save;
+	int len = 0, n;
+
+	while (!(end = memmem(head, len, "\r\n\r\n", 4))) {
+		if (len == sizeof(head) || (n = recv(client->fd, head + len, sizeof(head) - len, 0)) <= 0) return ESP_FAIL;
+		len += n;
+	}
+
+	// what follows headers is body
+	client->pending_len = head + len - (end + 4);
+	memcpy(client->pending, end + 4, client->pending_len);
+	*end = '\0';
+
+	sscanf(head, "HTTP/1.%*d %d", &client->status);
+	for (strtok_r(head, "\r\n", &save); (line = strtok_r(NULL, "\r\n", &save)); ) {
+		char *key = line, *value = strchr(key, ':');
+		if (!value) continue;
+		*value++ = '\0';
+		while (*value == ' ') value++;
+		if (!strcasecmp(key, "Content-Length")) client->content_length = atol(value);
+		if (!strcasecmp(key, "Location")) strncpy(client->location, value, sizeof(client->location) - 1);
+		http_event(client, HTTP_EVENT_ON_HEADER, key, value);
+	}
+
+	return client->content_length;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client) {
+	return client->status;
+}
+
+// like ESP-IDF, fill the buffer unless the body ends, CPU work waits while flash is busy
+int esp_http_client_read(esp_http_client_handle_t client, char *buffer, int len) {
+	int count = 0;
+
+	if (client->pending_len) {
+		count = client->pending_len < len ? client->pending_len : len;
+		memcpy(buffer, client->pending, count);
+		memmove(client->pending, client->pending + count, client->pending_len - count);
+		client->pending_len -= count;
+	}
+
+	while (count < len && client->received + count < client->content_length) {
+		int n = recv(client->fd, buffer + count, len - count, 0);
+		if (n < 0) return -1;
+		if (n == 0) break;
+		pthread_mutex_lock(&flash_lock);
+		pthread_mutex_unlock(&flash_lock);
+		count += n;
+	}
+
+	client->received += count;
+	if (count) http_event(client, HTTP_EVENT_ON_DATA, NULL, NULL);
+	return count;
+}
+
+esp_err_t esp_http_client_set_redirection(esp_http_client_handle_t client) {
+	if (!*client->location) return ESP_ERR_INVALID_ARG;
+	strcpy(client->url, client->location);
+	return ESP_OK;
+}
+
+void esp_http_client_add_auth(esp_http_client_handle_t client) {
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client) {
+	if (client->fd >= 0) close(client->fd);
+	free(client);
+	return ESP_OK;
+}
+
+/****************************************************************************************
+ * Partitions as in partitions.csv, flash of ota_0 is a RAM mock. Erase of 64 kB aligned
+ * blocks uses the block command like spi_flash_erase_range() does
+ */
+struct partition_iterator {
+	const esp_partition_t *partition;
+};
+
+static const esp_partition_t factory = { ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_FACTORY, 0x10000, 0x140000, "recovery" };
+static const esp_partition_t ota_0 = { ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, 0x150000, 0x2A0000, "ota_0" };
+static struct partition_iterator iterator = { &ota_0 };
+
+void shim_ota_reset(uint32_t block_ms, uint32_t sector_ms, uint32_t page_us) {
+	struct shim_flash *flash = &shim_ota.flash;
+	free(flash->data);
+	memset(&shim_ota, 0, sizeof(shim_ota));
+	flash->size = ota_0.size;
+	flash->data = malloc(flash->size);
+	// previous firmware
+	memset(flash->data, 0x5a, flash->size);
+	flash->block_ms = block_ms;
+	flash->sector_ms = sector_ms;
+	flash->page_us = page_us;
+	shim_ota.start_ms = shim_now_ms();
+}
+
+esp_partition_iterator_t esp_partition_find(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label) {
+	return subtype == ESP_PARTITION_SUBTYPE_APP_OTA_0 ? &iterator : NULL;
+}
+
+const esp_partition_t *esp_partition_get(esp_partition_iterator_t it) {
+	return it->partition;
+}
+
+void esp_partition_iterator_release(esp_partition_iterator_t it) {
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size) {
+	struct shim_flash *flash = &shim_ota.flash;
+	uint64_t cost = 0;
+
+	if (partition != &ota_0 || offset % SPI_FLASH_SEC_SIZE || size % SPI_FLASH_SEC_SIZE || offset + size > flash->size) {
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	for (size_t pos = offset; pos < offset + size; ) {
+		size_t step = (partition->address + pos) % 65536 || offset + size - pos < 65536 ? SPI_FLASH_SEC_SIZE : 65536;
+		cost += step == 65536 ? flash->block_ms : flash->sector_ms;
+		pos += step;
+	}
+
+	pthread_mutex_lock(&flash_lock);
+	sleep_us(cost * 1000);
+	memset(flash->data + offset, 0xff, size);
+	flash->erases += size / SPI_FLASH_SEC_SIZE;
+	pthread_mutex_unlock(&flash_lock);
+	return ESP_OK;
+}
+
+// NOR flash only programs erased bytes
+static esp_err_t flash_program(size_t offset, const uint8_t *data, size_t size) {
+	struct shim_flash *flash = &shim_ota.flash;
+
+	if (offset + size > flash->size) return ESP_ERR_INVALID_SIZE;
+
+	pthread_mutex_lock(&flash_lock);
+	for (size_t i = 0; i < size; i++) {
+		if (flash->data[offset + i] != 0xff) {
+			flash->bad_writes++;
+			pthread_mutex_unlock(&flash_lock);
+			return ESP_ERR_FLASH_OP_FAIL;
+		}
+	}
+	sleep_us((size + 255) / 256 * flash->page_us);
+	memcpy(flash->data + offset, data, size);
+	pthread_mutex_unlock(&flash_lock);
+	return ESP_OK;
+}
+
+const esp_partition_t *esp_ota_get_boot_partition(void) {
+	return &factory;
+}
+
+const esp_partition_t *esp_ota_get_running_partition(void) {
+	return &factory;
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start) {
+	return &ota_0;
+}
+
+const esp_partition_t *esp_ota_get_last_invalid_partition(void) {
+	return NULL;
+}
+
+esp_err_t esp_ota_get_partition_description(const esp_partition_t *partition, esp_app_desc_t *desc) {
+	if (partition != &factory) return ESP_ERR_NOT_FOUND;
+	memset(desc, 0, sizeof(*desc));
+	strcpy(desc->version, "recovery");
+	return ESP_OK;
+}
+
+// like ESP-IDF 3.3, a known image size erases that many sectors (plus one)
+esp_err_t esp_ota_begin(const esp_partition_t *partition, size_t image_size, esp_ota_handle_t *handle) {
+	esp_err_t err = esp_partition_erase_range(partition, 0, (image_size / SPI_FLASH_SEC_SIZE + 1) * SPI_FLASH_SEC_SIZE);
+	shim_ota.flash.written = 0;
+	*handle = 1;
+	return err;
+}
+
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size) {
+	esp_err_t err;
+	if (!shim_ota.flash.written && size && *(const uint8_t*) data != ESP_IMAGE_HEADER_MAGIC) return ESP_ERR_OTA_VALIDATE_FAILED;
+	err = flash_program(shim_ota.flash.written, data, size);
+	if (err == ESP_OK) shim_ota.flash.written += size;
+	return err;
+}
+
+// stands for esp_image_verify(): header and, when appended, the SHA-256 of what was written
+esp_err_t esp_ota_end(esp_ota_handle_t handle) {
+	struct shim_flash *flash = &shim_ota.flash;
+	esp_image_header_t *header = (esp_image_header_t*) flash->data;
+	mbedtls_sha256_context sha;
+	uint8_t digest[32];
+
+	if (flash->written < sizeof(*header) || header->magic != ESP_IMAGE_HEADER_MAGIC) return ESP_ERR_OTA_VALIDATE_FAILED;
+	if (!header->hash_appended) return ESP_OK;
+	if (flash->written < sizeof(*header) + sizeof(digest)) return ESP_ERR_OTA_VALIDATE_FAILED;
+
+	mbedtls_sha256_init(&sha);
+	mbedtls_sha256_starts_ret(&sha, 0);
+	mbedtls_sha256_update_ret(&sha, flash->data, flash->written - sizeof(digest));
+	mbedtls_sha256_finish_ret(&sha, digest);
+	return memcmp(digest, flash->data + flash->written - sizeof(digest), sizeof(digest)) ? ESP_ERR_OTA_VALIDATE_FAILED : ESP_OK;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition) {
+	if (partition != &ota_0) return ESP_ERR_INVALID_ARG;
+	shim_ota.boot_set = true;
+	shim_ota.boot_set_ms = shim_now_ms();
+	return ESP_OK;
+}
+
+/****************************************************************************************
+ * SHA-256 (FIPS 180-4)
+ */
+static const uint32_t K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR(x, n)	((x) >> (n) | (x) << (32 - (n)))
+
+static void sha256_block(mbedtls_sha256_context *ctx, const uint8_t *p) {
+	uint32_t w[64], s[8], t1, t2;
+
+	for (int i = 0; i < 16; i++) w[i] = p[4*i] << 24 | p[4*i + 1] << 16 | p[4*i + 2] << 8 | p[4*i + 3];
+	for (int i = 16; i < 64; i++) {
+		w[i] = w[i - 16] + (ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ w[i - 15] >> 3) +
+			   w[i - 7] + (ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ w[i - 2] >> 10);
+	}
+
+	memcpy(s, ctx->state, sizeof(s));
+	for (int i = 0; i < 64; i++) {
+		t1 = s[7] + (ROR(s[4], 6) ^ ROR(s[4], 11) ^ ROR(s[4], 25)) + ((s[4] & s[5]) ^ (~s[4] & s[6])) + K[i] + w[i];
+		t2 = (ROR(s[0], 2) ^ ROR(s[0], 13) ^ ROR(s[0], 22)) + ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+		memmove(s + 1, s, 7 * sizeof(*s));
+		s[4] += t1;
+		s[0] = t1 + t2;
+	}
+	for (int i = 0; i < 8; i++) ctx->state[i] += s[i];
+}
+
+void mbedtls_sha256_init(mbedtls_sha256_context *ctx) {
+	memset(ctx, 0, sizeof(*ctx));
+}
+
+void mbedtls_sha256_free(mbedtls_sha256_context *ctx) {
+}
+
+int mbedtls_sha256_starts_ret(mbedtls_sha256_context *ctx, int is224) {
+	static const uint32_t H[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+	memcpy(ctx->state, H, sizeof(H));
+	ctx->count = 0;
+	return 0;
+}
+
+int mbedtls_sha256_update_ret(mbedtls_sha256_context *ctx, const unsigned char *data, size_t len) {
+	while (len) {
+		size_t used = ctx->count % 64, n = 64 - used < len ? 64 - used : len;
+		memcpy(ctx->buf + used, data, n);
+		ctx->count += n;
+		data += n;
+		len -= n;
+		if (ctx->count % 64 == 0) sha256_block(ctx, ctx->buf);
+	}
+	return 0;
+}
+
+int mbedtls_sha256_finish_ret(mbedtls_sha256_context *ctx, unsigned char digest[32]) {
+	uint64_t bits = ctx->count * 8;
+	uint8_t pad[72] = { 0x80 };
+	size_t n = (ctx->count % 64 < 56 ? 56 : 120) - ctx->count % 64;
+
+	for (int i = 0; i < 8; i++) pad[n + i] = bits >> (56 - 8 * i);
+	mbedtls_sha256_update_ret(ctx, pad, n + 8);
+	for (int i = 0; i < 32; i++) digest[i] = ctx->state[i / 4] >> (24 - 8 * (i % 4));
+	return 0;
+}
+
+/****************************************************************************************
+ * config, cmd_system and wifi_manager, defaults registered by esp_app_main.c
+ */
+void *config_alloc_get(int type, const char *key) {
+	char value[16];
+	if (strcmp(key, "ota_erase_blk")) return NULL;
+	snprintf(value, sizeof(value), "%u", OTA_FLASH_ERASE_BLOCK);
+	return strdup(value);
+}
+
+esp_err_t config_set_value(int type, const char *key, const void *value) {
+	return ESP_OK;
+}
+
+bool wait_for_commit(void) {
+	return true;
+}
+
+const char *get_certificate(void) {
+	return NULL;
+}
+
+esp_err_t guided_factory(void) {
+	return ESP_OK;
+}
+
+void wifi_manager_refresh_ota_json(void) {
+}
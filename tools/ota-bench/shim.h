@@ -0,0 +1,232 @@
+/*
+ *  Squeezelite for esp32 - ESP-IDF/FreeRTOS shim of squeezelite-ota.c (host)
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ *  Every ESP-IDF header included by squeezelite-ota.c is replaced by this one (see
+ *  Makefile). Tasks map to pthreads, queues and notifications to pthread ones, the HTTP
+ *  client to BSD sockets and flash to a RAM mock that only programs erased sectors and
+ *  takes as long as a typical SPI NOR chip would.
+ */
+
+#pragma once
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <pthread.h>
+
+// ESP-IDF
+typedef int esp_err_t;
+
+#define ESP_OK						0
+#define ESP_FAIL					-1
+#define ESP_ERR_NO_MEM				0x101
+#define ESP_ERR_INVALID_ARG			0x102
+#define ESP_ERR_INVALID_SIZE		0x104
+#define ESP_ERR_NOT_FOUND			0x105
+#define ESP_ERR_FLASH_OP_FAIL		0x6001
+#define ESP_ERR_IMAGE_INVALID		0x2002
+#define ESP_ERR_OTA_VALIDATE_FAILED	0x1503
+#define ESP_TASK_MAIN_PRIO			1
+#define RECOVERY_APPLICATION		1
+#define NVS_TYPE_STR				0
+#define MALLOC_CAP_INTERNAL			(1 << 11)
+#define MALLOC_CAP_8BIT				(1 << 2)
+#define MALLOC_CAP_SPIRAM			(1 << 10)
+#define SPI_FLASH_SEC_SIZE			4096
+
+#define ESP_LOGE(tag, ...)			shim_log('E', tag, __VA_ARGS__)
+#define ESP_LOGW(tag, ...)			shim_log('W', tag, __VA_ARGS__)
+#define ESP_LOGI(tag, ...)			shim_log('I', tag, __VA_ARGS__)
+#define ESP_LOGD(tag, ...)			shim_log('D', tag, __VA_ARGS__)
+
+extern int shim_verbose;
+void shim_log(char level, const char *tag, const char *fmt, ...);
+const char *esp_err_to_name(esp_err_t err);
+void esp_restart(void);
+void *heap_caps_malloc(size_t size, uint32_t caps);
+size_t heap_caps_get_free_size(uint32_t caps);
+size_t heap_caps_get_minimum_free_size(uint32_t caps);
+
+// FreeRTOS
+typedef struct task *TaskHandle_t;
+typedef struct queue *QueueHandle_t;
+typedef int TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdTRUE					1
+#define pdFALSE					0
+#define pdPASS					1
+#define portMAX_DELAY			-1
+#define portTICK_PERIOD_MS		1
+#define taskYIELD()				sched_yield()
+
+int sched_yield(void);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_size, void *param, UBaseType_t prio, TaskHandle_t *task, BaseType_t core);
+void vTaskDelete(TaskHandle_t task) __attribute__((noreturn));
+void vTaskDelay(TickType_t ticks);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks);
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t size);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks);
+void vQueueDelete(QueueHandle_t queue);
+
+// esp_http_client
+typedef struct http_client *esp_http_client_handle_t;
+
+typedef enum {
+	HTTP_EVENT_ERROR, HTTP_EVENT_ON_CONNECTED, HTTP_EVENT_HEADER_SENT, HTTP_EVENT_ON_HEADER,
+	HTTP_EVENT_ON_DATA, HTTP_EVENT_ON_FINISH, HTTP_EVENT_DISCONNECTED,
+} esp_http_client_event_id_t;
+
+typedef struct {
+	esp_http_client_event_id_t event_id;
+	esp_http_client_handle_t client;
+	void *data;
+	int data_len;
+	void *user_data;
+	char *header_key;
+	char *header_value;
+} esp_http_client_event_t;
+
+typedef struct {
+	const char *url;
+	const char *cert_pem;
+	esp_err_t (*event_handler)(esp_http_client_event_t *evt);
+	int buffer_size;
+	bool disable_auto_redirect;
+	bool skip_cert_common_name_check;
+	int max_redirection_count;
+} esp_http_client_config_t;
+
+enum { HttpStatus_MovedPermanently = 301, HttpStatus_Found = 302, HttpStatus_Unauthorized = 401 };
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config);
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len);
+int esp_http_client_fetch_headers(esp_http_client_handle_t client);
+int esp_http_client_get_status_code(esp_http_client_handle_t client);
+int esp_http_client_read(esp_http_client_handle_t client, char *buffer, int len);
+esp_err_t esp_http_client_set_redirection(esp_http_client_handle_t client);
+void esp_http_client_add_auth(esp_http_client_handle_t client);
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client);
+
+// partitions, OTA and image format
+typedef enum { ESP_PARTITION_TYPE_APP = 0 } esp_partition_type_t;
+typedef enum { ESP_PARTITION_SUBTYPE_APP_FACTORY = 0, ESP_PARTITION_SUBTYPE_APP_OTA_0 = 0x10 } esp_partition_subtype_t;
+typedef struct partition_iterator *esp_partition_iterator_t;
+typedef uint32_t esp_ota_handle_t;
+
+typedef struct {
+	esp_partition_type_t type;
+	esp_partition_subtype_t subtype;
+	uint32_t address;
+	uint32_t size;
+	char label[17];
+	bool encrypted;
+} esp_partition_t;
+
+typedef struct {
+	uint8_t magic;
+	uint8_t segment_count;
+	uint8_t spi_mode;
+	uint8_t spi_speed_size;
+	uint32_t entry_addr;
+	uint8_t wp_pin;
+	uint8_t spi_pin_drv[3];
+	uint16_t chip_id;
+	uint8_t min_chip_rev;
+	uint8_t reserved[8];
+	uint8_t hash_appended;
+} __attribute__((packed)) esp_image_header_t;
+
+typedef struct {
+	uint32_t load_addr;
+	uint32_t data_len;
+} esp_image_segment_header_t;
+
+typedef struct {
+	uint32_t magic_word;
+	uint32_t secure_version;
+	uint32_t reserv1[2];
+	char version[32];
+	char project_name[32];
+	char time[16];
+	char date[16];
+	char idf_ver[32];
+	uint8_t app_elf_sha256[32];
+	uint32_t reserv2[20];
+} esp_app_desc_t;
+
+#define ESP_IMAGE_HEADER_MAGIC		0xE9
+
+esp_partition_iterator_t esp_partition_find(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label);
+const esp_partition_t *esp_partition_get(esp_partition_iterator_t it);
+void esp_partition_iterator_release(esp_partition_iterator_t it);
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size);
+const esp_partition_t *esp_ota_get_boot_partition(void);
+const esp_partition_t *esp_ota_get_running_partition(void);
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start);
+const esp_partition_t *esp_ota_get_last_invalid_partition(void);
+esp_err_t esp_ota_get_partition_description(const esp_partition_t *partition, esp_app_desc_t *desc);
+esp_err_t esp_ota_begin(const esp_partition_t *partition, size_t image_size, esp_ota_handle_t *handle);
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size);
+esp_err_t esp_ota_end(esp_ota_handle_t handle);
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition);
+
+// mbedtls
+typedef struct {
+	uint32_t state[8];
+	uint64_t count;
+	uint8_t buf[64];
+} mbedtls_sha256_context;
+
+void mbedtls_sha256_init(mbedtls_sha256_context *ctx);
+void mbedtls_sha256_free(mbedtls_sha256_context *ctx);
+int mbedtls_sha256_starts_ret(mbedtls_sha256_context *ctx, int is224);
+int mbedtls_sha256_update_ret(mbedtls_sha256_context *ctx, const unsigned char *data, size_t len);
+int mbedtls_sha256_finish_ret(mbedtls_sha256_context *ctx, unsigned char digest[32]);
+
+// config, cmd_system, wifi_manager
+void *config_alloc_get(int type, const char *key);
+esp_err_t config_set_value(int type, const char *key, const void *value);
+bool wait_for_commit(void);
+const char *get_certificate(void);
+esp_err_t guided_factory(void);
+
+// squeezelite-ota.c, not exported by its header
+esp_err_t process_recovery_ota(const char *bin_url);
+
+/*
+ * Flash mock and OTA outcome, for the harness. Costs are per operation, an erase
+ * of a 64 kB aligned block costs block_ms, any other 4 kB sector sector_ms.
+ * While an erase or a write runs, the cache is disabled on target and neither
+ * core runs from flash: esp_http_client_read() waits for it too.
+ */
+struct shim_flash {
+	uint8_t *data;
+	uint32_t size;
+	uint32_t block_ms, sector_ms, page_us;	// 64 kB erase, 4 kB erase, 256 B program
+	uint32_t erases, bad_writes;	// sectors erased, programs of non-erased flash
+	uint32_t written;				// by esp_ota_write()
+};
+
+struct shim_ota {
+	struct shim_flash flash;
+	bool restarted, boot_set;
+	double start_ms, boot_set_ms;
+};
+
+extern struct shim_ota shim_ota;
+void shim_ota_reset(uint32_t block_ms, uint32_t sector_ms, uint32_t page_us);
+void shim_ota_wait(void);
+double shim_now_ms(void);
@@ -0,0 +1,111 @@
+/*
+ *  Squeezelite for esp32 - output packing check (host)
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ *  Runs the 8 bytes frames path of output_i2s.c (components/squeezelite/output_pack.c)
+ *  for every PCM output format: gain, ramp and overlay mix must be done on ISAMPLE_T
+ *  before frames are packed in place. Built by "make" in this directory, exit code is
+ *  the number of failed checks.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include "squeezelite.h"
+
+#define FRAMES		256
+#define RAMP		64
+#define LEVEL		0x40000000
+
+static const struct {
+	output_format format;
+	const char *name;
+	int bytes, bits;
+} formats[] = { { S32_LE, "S32_LE", 8, 32 }, { S24_LE, "S24_LE", 8, 24 }, { S24_3LE, "S24_3LE", 6, 24 }, { S16_LE, "S16_LE", 4, 16 } };
+
+static ISAMPLE_T in[FRAMES * 2], a[FRAMES * 2], b[FRAMES * 2];
+static int fails, mixed;
+
+// logging is done by utils.c on target
+const char *logtime(void) { return ""; }
+
+void logprint(const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+}
+
+/****************************************************************************************
+ * Sample <n> (0 = left of first frame) of packed buffer, scaled back to 32 bits
+ */
+static s32_t unpack(void *buf, int n, int i) {
+	u8_t *p = buf;
+
+	switch (formats[n].format) {
+	case S16_LE: return (s32_t) (((s16_t*) p)[i]) << 16;
+	case S24_LE: return ((s32_t*) p)[i] << 8;
+	case S24_3LE: return (s32_t) ((u32_t) p[i*3] << 8 | (u32_t) p[i*3 + 1] << 16 | (u32_t) p[i*3 + 2] << 24);
+	default: return ((s32_t*) p)[i];
+	}
+}
+
+/****************************************************************************************
+ * Overlay stand-in, must see ISAMPLE_T that have been gained but not packed
+ */
+static void mix(ISAMPLE_T *ptr, frames_t count) {
+	for (int i = 0; i < count * 2; i++) {
+		if (ptr[i] != gain(FIXED_ONE / 2, in[i])) mixed = -1;
+		ptr[i] += LEVEL / 4;
+	}
+	if (!mixed) mixed = count;
+}
+
+static void check(bool ok, int n, const char *what) {
+	if (!ok) fails++;
+	printf("%-8s %-40s %s\n", formats[n].name, what, ok ? "OK" : "FAIL");
+}
+
+int main(void) {
+	for (int i = 0; i < FRAMES * 2; i++) in[i] = (i & 1 ? -1 : 1) * (LEVEL - i * 4099);
+
+	for (int n = 0; n < sizeof(formats) / sizeof(*formats); n++) {
+		bool ok;
+
+		// constant gain is the same whether it is applied before or while packing
+		memcpy(a, in, sizeof(in));
+		_apply_gain_ramp_and_pack(a, FRAMES, 0, 0, 0, FIXED_ONE / 3, FIXED_ONE / 5, NULL, formats[n].format);
+		_scale_and_pack_frames(b, in, FRAMES, FIXED_ONE / 3, FIXED_ONE / 5, formats[n].format);
+		check(!memcmp(a, b, FRAMES * formats[n].bytes), n, "constant gain: bit exact");
+
+		// ramp from silence: envelope grows and ends at full gain
+		memcpy(a, in, sizeof(in));
+		_apply_gain_ramp_and_pack(a, FRAMES, RAMP, 0, 0, FIXED_ONE, FIXED_ONE, NULL, formats[n].format);
+		_scale_and_pack_frames(b, in, FRAMES, FIXED_ONE, FIXED_ONE, formats[n].format);
+		ok = unpack(a, n, 0) == 0 && unpack(a, n, 1) == 0;
+		for (int i = 1; i < RAMP && ok; i++) {
+			s64_t prev = (s64_t) unpack(a, n, 2*i - 2) * LEVEL / (in[2*i - 2] >> 8);
+			s64_t cur = (s64_t) unpack(a, n, 2*i) * LEVEL / (in[2*i] >> 8);
+			ok = cur >= prev && cur > 0 && unpack(a, n, 2*i + 1) <= 0;
+		}
+		check(ok, n, "ramp: monotonic from silence");
+		check(!memcmp((u8_t*) a + RAMP * formats[n].bytes, (u8_t*) b + RAMP * formats[n].bytes, 
+					  (FRAMES - RAMP) * formats[n].bytes), n, "ramp: full gain after ramp");
+
+		// overlay is mixed after gain and before packing
+		mixed = 0;
+		memcpy(a, in, sizeof(in));
+		_apply_gain_ramp_and_pack(a, FRAMES, 0, 0, 0, FIXED_ONE / 2, FIXED_ONE / 2, mix, formats[n].format);
+		ok = mixed == FRAMES;
+		for (int i = 0; i < FRAMES * 2 && ok; i++) {
+			s32_t expected = gain(FIXED_ONE / 2, in[i]) + LEVEL / 4, got = unpack(a, n, i);
+			ok = expected - got < (1 << (32 - formats[n].bits)) && expected - got >= 0;
+		}
+		check(ok, n, "overlay: mixed on ISAMPLE_T");
+	}
+
+	printf("%s\n", fails ? "FAILED" : "PASSED");
+
+	return fails;
+}